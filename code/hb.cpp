@@ -1,6 +1,17 @@
 /*
  * Written by Gyuhyun Lee
  */
+
+#if HB_DETERMINISTIC
+// NOTE(gh) Whether a*b + c gets contracted to fma depends on the compiler(i.e it might only happen in the simd path),
+// and fma is not rounded in between, so the results would be different in the last bit(see StateHash)
+#if HB_LLVM
+#pragma clang fp contract(off)
+#elif HB_MSVC
+#pragma fp_contract(off)
+#endif
+#endif
+
 #include "hb_types.h"
 #include "hb_simd.h"
 #include "hb_intrinsic.h"
@@ -17,6 +28,9 @@
 #include "hb_platform.h"
 #include "hb_debug.h"
 #include "hb_vox.h"
+#include "hb_time_machine.h"
+#include "hb_memory_snapshot.h"
+#include "hb_state_hash.h"
 #include "hb.h"
 
 #include "hb_ray.cpp"
@@ -24,6 +38,8 @@
 #include "hb_mesh_generation.cpp"
 #include "hb_pbd.cpp"
 #include "hb_entity.cpp"
+#include "hb_pbd_fluid.cpp"
+#include "hb_pbd_solver.cpp"
 #include "hb_rigidbody.cpp"
 #include "hb_asset.cpp"
 #include "hb_render.cpp"
@@ -31,12 +47,27 @@
 #include "hb_fluid.cpp"
 #include "hb_obj.cpp"
 #include "hb_vox.cpp"
+#include "hb_time_machine.cpp"
+#include "hb_memory_snapshot.cpp"
+#include "hb_state_hash.cpp"
 
 // TODO(gh) Remove this dependency
 #include <time.h>
 
 internal void 
 output_debug_records(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, v2 p);
+internal void 
+output_pbd_precision_comparison(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                                PBDPrecisionComparison *comparison, v2 top_left_rel_p_px);
+internal void 
+output_pbd_polar_decomposition_benchmark(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                                         PBDPolarDecompositionBenchmark *benchmark, v2 top_left_rel_p_px);
+internal void 
+output_fluid_projection_benchmarks(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                                   FluidProjectionBenchmark *benchmarks, u32 benchmark_count, v2 top_left_rel_p_px);
+internal void 
+output_pbd_substep_stats(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                         PBDSubstepStats *stats, v2 top_left_rel_p_px);
 
 /*
    TODO(gh)
@@ -51,46 +82,80 @@ GAME_UPDATE_AND_RENDER(update_and_render)
     if(!tran_state->is_initialized)
     {
         // NOTE(gh) Should start AFTER the tran state!!
+        // Big chunk of this goes to the time machine(see init_time_machine).
+        // The platform gives us the zeroed pages, and zeroing them again would touch all of the gigabytes at startup. 
+        // (The memory snapshot already has the tran state initialized, so it never gets here)
         tran_state->transient_arena = start_memory_arena((u8 *)platform_memory->transient_memory + sizeof(TranState), 
-                                                        gigabytes(1));
+                                                        platform_memory->transient_memory_size - sizeof(TranState), 
+                                                        false);
 
         {
         PlatformReadFileResult vox_file = platform_api->read_file("../data/3x3x3.vox");
-        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size);
+        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size, &tran_state->transient_arena);
         }
 
         {
         PlatformReadFileResult vox_file = platform_api->read_file("../data/4x4x4.vox");
-        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size);
+        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size, &tran_state->transient_arena);
         }
 
         {
         PlatformReadFileResult vox_file = platform_api->read_file("../data/5x5x5.vox");
-        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size);
+        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size, &tran_state->transient_arena);
         }
 
         {
         PlatformReadFileResult vox_file = platform_api->read_file("../data/6x6x6.vox");
-        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size);
+        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size, &tran_state->transient_arena);
         }
 
         {
         PlatformReadFileResult vox_file = platform_api->read_file("../data/8x8x8.vox");
-        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size);
+        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_vox(vox_file.memory, vox_file.size, &tran_state->transient_arena);
+        }
+
+        {
+        PlatformReadFileResult obj_file = platform_api->read_file("../data/stanford-bunny.obj");
+        tran_state->loaded_voxs[tran_state->loaded_vox_count++] = load_obj_vox(obj_file.memory, obj_file.size, 12, &tran_state->transient_arena, thread_work_queue);
+        }
+
+        for(u32 vox_index = 0;
+                vox_index < tran_state->loaded_vox_count;
+                ++vox_index)
+        {
+            compute_vox_sdf(tran_state->loaded_voxs + vox_index, &tran_state->transient_arena, thread_work_queue);
+            populate_vox_offsets_from_com(tran_state->loaded_voxs + vox_index, &tran_state->transient_arena);
         }
 
         tran_state->game_camera = init_fps_camera(V3(0, -10, 22), 1.0f, 135, 1.0f, 1000.0f);
         tran_state->debug_camera = init_fps_camera(V3(0, 0, 22), 1.0f, 135, 0.1f, 10000.0f);
 
 
-        // 30 seconds worth of frames
-        tran_state->max_saved_game_state_count = round_f32_to_u32(1.0f/platform_input->dt_per_frame) * 15;
-        tran_state->saved_game_states = push_array(&tran_state->transient_arena, GameState, tran_state->max_saved_game_state_count);
-        tran_state->saved_game_state_read_cursor = 0;
-        tran_state->saved_game_state_write_cursor = 0;
-        tran_state->has_entire_buffer_filled_at_least_once = false;
+        // NOTE(gh) Frames are stored as the deltas(see TimeMachine), so this is usually far more than enough
+        // to hold desired_time_machine_seconds worth of frames.
+        init_time_machine(&tran_state->time_machine, &tran_state->transient_arena, sizeof(GameState),
+                          round_f32_to_u32(1.0f/platform_input->dt_per_frame) * desired_time_machine_seconds,
+                          megabytes(512));
+#if HB_STREAM_TIME_MACHINE
+        // NOTE(gh) Named after the time that the game started, so that we don't overwrite the stream from the last run
+        char stream_file_name[64];
+        time_t start_time = time(0);
+        strftime(stream_file_name, array_count(stream_file_name), "hb_time_machine_%Y%m%d_%H%M%S.hbtm", localtime(&start_time));
+
+        // NOTE(gh) An hour worth of frames, and the payload that is usually more than enough for that
+        start_time_machine_stream(&tran_state->time_machine, platform_api, stream_file_name,
+                                  round_f32_to_u32(1.0f/platform_input->dt_per_frame) * 60 * 60, gigabytes(1),
+                                  platform_input->dt_per_frame);
+#endif
+#if HB_DETERMINISTIC
+        // NOTE(gh) Same as the time machine stream
+        start_state_hash_log(&tran_state->state_hash_log, platform_api, 
+                             round_f32_to_u32(1.0f/platform_input->dt_per_frame) * 60 * 60);
+#endif
 
         tran_state->max_pbd_substep_count = 16;
+        tran_state->min_pbd_substep_count = 2;
+        tran_state->pbd_precision_mode = PBDPrecisionMode_f64;
         tran_state->remaining_pbd_substep_count = tran_state->max_pbd_substep_count*50*60;
         tran_state->is_simulating_in_realtime = true;
 
@@ -99,6 +164,12 @@ GAME_UPDATE_AND_RENDER(update_and_render)
         tran_state->is_initialized = true;
     }
 
+    if(platform_memory->is_restored_from_memory_snapshot)
+    {
+        restore_from_memory_snapshot(tran_state, gpu_work_queue);
+        platform_memory->is_restored_from_memory_snapshot = false;
+    }
+
     GameState *game_state = (GameState *)platform_memory->permanent_memory;
 
     if(!game_state->is_initialized)
@@ -142,7 +213,17 @@ GAME_UPDATE_AND_RENDER(update_and_render)
 #endif
         game_state->random_series = start_random_series(12312312);
 
-        add_floor_entity(game_state, V3(), V2(1000, 1000), V3(1.0f, 1.0f, 1.0f), 1, 1, 0);
+        {
+            Entity *floor_entity = add_floor_entity(game_state, V3(), V2(1000, 1000), V3(1.0f, 1.0f, 1.0f), 1, 1, 0);
+
+            // NOTE(gh) The floor is also the only environment collider for now, 
+            // built from the same mesh that we render
+            MeshAsset *floor_mesh = get_mesh_asset(&tran_state->assets, 0, AssetTag_FloorMesh);
+            add_environment_collider(&game_state->environment, &tran_state->transient_arena,
+                                     (VertexPN *)floor_mesh->vertex_buffer.memory, 
+                                     (u32 *)floor_mesh->index_buffer.memory, floor_mesh->index_count,
+                                     floor_entity->generic_entity_info.position, floor_entity->generic_entity_info.dim);
+        }
 
 #if 0
         {
@@ -206,8 +287,41 @@ GAME_UPDATE_AND_RENDER(update_and_render)
                             EntityFlag_Movable|EntityFlag_Collides|EntityFlag_Linear);
         }
 #endif
+#if 0
+        {
+            v3 color = V3(random_between_0_1(&game_state->random_series), 
+                           random_between_0_1(&game_state->random_series),
+                           random_between_0_1(&game_state->random_series));
+            add_pbd_vox_entity(game_state, 
+                             tran_state->loaded_voxs + 5,
+                            V3d(-6, -6, 3), V3d(0, 0, 0),
+                            0.8f, 1.0f/(random_between(&game_state->random_series, 10, 50)), color, 
+                            EntityFlag_Movable|EntityFlag_Collides|EntityFlag_RigidBody);
+        }
+#endif
 
 
+#if 0
+        {
+            v3 color = V3(random_between_0_1(&game_state->random_series), 
+                           random_between_0_1(&game_state->random_series),
+                           random_between_0_1(&game_state->random_series));
+            add_pbd_cloth_entity(game_state, 
+                                V3d(-4, -4, 6), 16, 16,
+                                0.0001f, 1.0f/10.0f, color, 
+                                EntityFlag_Movable|EntityFlag_Collides);
+        }
+#endif
+
+#if 0
+        {
+            add_pbd_fluid_block_entity(game_state, 
+                                       V3d(-2, -2, 0.3), 16, 16, 12, V3d(0, 0, 0),
+                                       1.0f/1000.0f, V3(0.2f, 0.4f, 0.9f), 
+                                       EntityFlag_Movable|EntityFlag_Collides);
+        }
+#endif
+
 #if 0
         // TODO(gh) This means we have one vector per every 10m, which is not ideal.
         i32 fluid_cell_count_x = 16;
@@ -217,14 +331,53 @@ GAME_UPDATE_AND_RENDER(update_and_render)
         v3 fluid_cell_left_bottom_p = V3(-fluid_cell_dim*fluid_cell_count_x/2, -fluid_cell_dim*fluid_cell_count_y/2, 0);
 
 
-        initialize_fluid_cube_mac(&game_state->fluid_cube_mac, &game_state->transient_arena, gpu_work_queue,
+        initialize_fluid_cube_mac(&tran_state->fluid_cube_mac, &tran_state->transient_arena, gpu_work_queue,
                                     fluid_cell_left_bottom_p, V3i(fluid_cell_count_x, fluid_cell_count_y, fluid_cell_count_z), 
                                     fluid_cell_dim);
 #endif
 
+#if HB_DEBUG
+#if HB_PBD_PRECISION_COMPARISON
+        // NOTE(gh) See how far the f32 path drifts away from the f64 reference 
+        // after a few seconds with the current sub step count
+        debug_compare_pbd_precision(&tran_state->pbd_precision_comparison, game_state, 
+                                    &tran_state->transient_arena, thread_work_queue,
+                                    platform_input->dt_per_frame, tran_state->max_pbd_substep_count,
+                                    5*round_f32_to_u32(1.0f/platform_input->dt_per_frame));
+#endif
+
+#if HB_POLAR_DECOMPOSITION_BENCHMARK
+        // NOTE(gh) 500 is around where the scenes with a lot of small vox bodies would be at
+        debug_benchmark_polar_decomposition(&tran_state->pbd_polar_decomposition_benchmark, 
+                                            &tran_state->transient_arena, 500);
+#endif
+
+#if HB_FLUID_BENCHMARK
+        // NOTE(gh) Off by default, 128^3 alone takes seconds
+        for(u32 benchmark_index = 0;
+                benchmark_index < array_count(tran_state->fluid_projection_benchmarks);
+                ++benchmark_index)
+        {
+            debug_benchmark_fluid_projection(tran_state->fluid_projection_benchmarks + benchmark_index, 
+                                             &tran_state->transient_arena, thread_work_queue, 
+                                             (benchmark_index < 4) ? FluidPressureSolverType_Multigrid : FluidPressureSolverType_PCG,
+                                             16 << (benchmark_index % 4), platform_input->dt_per_frame);
+        }
+#endif
+#endif
+
+        // NOTE(gh) Environment lives outside of the game state, so the replay needs its own copy
+        write_time_machine_stream_environment(&tran_state->time_machine, &game_state->environment);
+
         game_state->is_initialized = true;
     }
 
+    // NOTE(gh) Next launch will start from here(see MemorySnapshot)
+    if(is_key_pressed(platform_input, PlatformKeyID_SaveMemorySnapshot))
+    {
+        save_memory_snapshot(platform_api, platform_memory, tran_state);
+    }
+
     u64 game_state_size = sizeof(*game_state);
     u64 tran_state_size = sizeof(*tran_state);
     u64 entity_size = sizeof(game_state->entities);
@@ -298,12 +451,10 @@ GAME_UPDATE_AND_RENDER(update_and_render)
     // depending on whether the game is being simulated or not...
     if(tran_state->is_simulating_in_realtime)
     {
-        tran_state->saved_game_states[tran_state->saved_game_state_write_cursor++] = *game_state;
-        if(tran_state->saved_game_state_write_cursor >= tran_state->max_saved_game_state_count)
-        {
-            tran_state->saved_game_state_write_cursor = 0;
-            tran_state->has_entire_buffer_filled_at_least_once = true;
-        }
+#if HB_DETERMINISTIC
+        log_state_hash(&tran_state->state_hash_log, hash_game_state(game_state, &tran_state->fluid_cube_mac));
+#endif
+        record_time_machine_frame(&tran_state->time_machine, game_state, thread_work_queue);
         tran_state->remaining_pbd_substep_count = tran_state->max_pbd_substep_count;
 
         if(is_key_pressed(platform_input, PlatformKeyID_Shoot))
@@ -317,7 +468,7 @@ GAME_UPDATE_AND_RENDER(update_and_render)
         {
             // Pause the simulation
 
-            tran_state->saved_game_state_read_cursor = tran_state->saved_game_state_write_cursor - 1;
+            tran_state->time_machine.read_cursor = tran_state->time_machine.frame_count - 1;
             tran_state->remaining_pbd_substep_count = 0;
             tran_state->is_simulating_in_realtime = false;
         }
@@ -332,51 +483,37 @@ GAME_UPDATE_AND_RENDER(update_and_render)
             // TODO(gh) This will get set in next frame anyway, so might be an overkill
             // to initialize it here once more
             tran_state->remaining_pbd_substep_count = tran_state->max_pbd_substep_count;
-            // NOTE(gh) We reset the write & read cursor, so that no weird time overlapping happens 
-            tran_state->saved_game_state_write_cursor = 0;
-            tran_state->saved_game_state_read_cursor = 0;
-            tran_state->has_entire_buffer_filled_at_least_once = false;
+            // NOTE(gh) We throw away the recorded frames, so that no weird time overlapping happens 
+            reset_time_machine(&tran_state->time_machine);
             tran_state->is_simulating_in_realtime = true;
         }
 
         if(is_key_down(platform_input, PlatformKeyID_FallbackFrame))
         {
-            if(tran_state->has_entire_buffer_filled_at_least_once)
+            TimeMachine *time_machine = &tran_state->time_machine;
+            if(time_machine->frame_count > 0)
             {
-                if(tran_state->saved_game_state_read_cursor >= tran_state->max_saved_game_state_count)
+                if(time_machine->read_cursor >= time_machine->frame_count)
                 {
-                    tran_state->saved_game_state_read_cursor = tran_state->max_saved_game_state_count-1;
+                    time_machine->read_cursor = time_machine->frame_count-1;
                 }
-            }
-            else
-            {
-                if(tran_state->saved_game_state_read_cursor >= tran_state->saved_game_state_write_cursor)
-                {
-                    tran_state->saved_game_state_read_cursor = tran_state->saved_game_state_write_cursor-1;
-                }
-            }
 
-            *game_state = tran_state->saved_game_states[tran_state->saved_game_state_read_cursor--];
+                load_time_machine_frame(time_machine, time_machine->read_cursor--, game_state);
+            }
         }
 
         if(is_key_down(platform_input, PlatformKeyID_AdvanceFrame))
         {
-            if(tran_state->has_entire_buffer_filled_at_least_once)
-            {
-                if(tran_state->saved_game_state_read_cursor >= tran_state->max_saved_game_state_count)
-                {
-                    tran_state->saved_game_state_read_cursor = 0;
-                }
-            }
-            else
+            TimeMachine *time_machine = &tran_state->time_machine;
+            if(time_machine->frame_count > 0)
             {
-                if(tran_state->saved_game_state_read_cursor >= tran_state->saved_game_state_write_cursor)
+                if(time_machine->read_cursor >= time_machine->frame_count)
                 {
-                    tran_state->saved_game_state_read_cursor = 0;
+                    time_machine->read_cursor = 0;
                 }
-            }
 
-            *game_state = tran_state->saved_game_states[tran_state->saved_game_state_read_cursor++];
+                load_time_machine_frame(time_machine, time_machine->read_cursor++, game_state);
+            }
         }
 
         if(is_key_down(platform_input, PlatformKeyID_AdvanceSubstep))
@@ -396,12 +533,17 @@ GAME_UPDATE_AND_RENDER(update_and_render)
        Problem 1. Collision handling
        Dividing the time step can possibly mean the increased amount of collision detection per frame.
        We can negate this by doing the collision handling once at the start and hope for the best.
+       The collision candidates are now generated once per frame, with each particle expanded by
+       the distance it can travel in this frame(see compute_speculative_margins).
 
        Problem 2. Precision ('Solved' using the double precision)
        In XPBD, a lot of the equations include square(sub_step), which means that f32 might not be
        sufficient for calculation. For example, if the sub step gets higher than 100, the gravity will stop
        working due to lost precision. We can limit the number of sub steps(15~20), or use double, which 
        if fine for the CPU(not considering the cache), but bad for the GPU.
+       The solver is templated on the scalar type, so we can pick the precision with 
+       tran_state->pbd_precision_mode. debug_compare_pbd_precision(HB_PBD_PRECISION_COMPARISON) shows how far 
+       the f32 path drifts away from the f64 reference with the current sub step count.
 
        All PBD starts with the linearization using the taylor expansion(gradient == partial differtiation).
        C(p + dp) (approx)= C(p) + gradient(C) * dp = 0 ...eq(1)
@@ -425,406 +567,34 @@ GAME_UPDATE_AND_RENDER(update_and_render)
        (What about the angular momentum?)
     */
 
-    // TODO(gh) Need to think about how many sub step we need!
     f64 sub_dt = (f64)platform_input->dt_per_frame/(f64)tran_state->max_pbd_substep_count;
-    f64 sub_dt_square = square(sub_dt);
-    for(u32 i = 0;
-        (i < tran_state->max_pbd_substep_count) && (tran_state->remaining_pbd_substep_count-- > 0);
-        ++i)
+    u32 pbd_substep_count = 0;
+    if(tran_state->is_simulating_in_realtime)
     {
-        u32 max_environment_constraint_count = 2048;
-        TempMemory environment_constraint_memory = 
-            start_temp_memory(&tran_state->transient_arena, 
-                    sizeof(EnvironmentConstraint)*max_environment_constraint_count);
-        EnvironmentConstraint *environment_constraints = 
-            push_array(&environment_constraint_memory, EnvironmentConstraint, max_environment_constraint_count);
-        u32 environment_constraint_count = 0;
-
-        // NOTE(gh) Advance the positions of all the particles,
-        // and generate environment constraint, since it is independent from other particles
-        for(u32 entity_index = 0;
-                entity_index < game_state->entity_count;
-                ++entity_index)
-        {
-            Entity *entity = game_state->entities + entity_index;
-            PBDParticleGroup *group = &entity->particle_group;
-            if(group->count)
-            {
-                // Pre solve
-                for(u32 particle_index = 0;
-                        particle_index < group->count;
-                        ++particle_index)
-                {
-                    PBDParticle *particle = group->particles + particle_index;
-                    if(particle->inv_mass > 0.0f)
-                    {
-                        // TODO(gh) For damping, use the formula from XPBD which involves modified lagrange multiplier
-                        particle->prev_p = particle->p;
-
-                        // NOTE(gh) We no longer modify the velocity with external forces,
-                        // but directly modify the position with second order
-                        particle->p += sub_dt * particle->v + sub_dt_square*V3d(0, 0, -9.8);
-
-                        if(particle->p.z < particle->r)
-                        {
-                            EnvironmentConstraint *c = environment_constraints + environment_constraint_count++;
-                            c->particle = particle;
-                            c->n = V3d(0, 0, 1);
-                            c->d = 0;
-                        }
-                    }
-                }
-            }
-        }
-
-        u32 max_collision_constraint_count = 2048;
-        TempMemory collision_constraint_memory = 
-            start_temp_memory(&tran_state->transient_arena, 
-                    sizeof(CollisionConstraint)*max_collision_constraint_count);
-        CollisionConstraint *collision_constraints = 
-            push_array(&collision_constraint_memory, CollisionConstraint, max_collision_constraint_count);
-        u32 collision_constraint_count = 0;
-
-        // NOTE(gh) Generate collision constraints
-        for(u32 entity_index = 0;
-                entity_index < game_state->entity_count;
-                ++entity_index)
-        {
-            Entity *entity = game_state->entities + entity_index;
-            PBDParticleGroup *group = &entity->particle_group;
-            if(group->count)
-            {
-                for(u32 test_entity_index = 0;
-                        test_entity_index < game_state->entity_count;
-                        ++test_entity_index)
-                {
-                    Entity *test_entity = game_state->entities + test_entity_index;
-                    if(is_entity_flag_set(test_entity, EntityFlag_Collides) &&
-                       is_entity_flag_set(test_entity, EntityFlag_Movable))
-                    {
-                        PBDParticleGroup *test_group = &test_entity->particle_group;
-                        if(test_entity > entity && test_group->count)
-                        {
-                            for(u32 particle_index = 0;
-                                    particle_index < group->count;
-                                    ++particle_index)
-                            {
-                                PBDParticle *particle = group->particles + particle_index;
-                                for(u32 test_particle_index = 0;
-                                        test_particle_index < test_group->count;
-                                        ++test_particle_index)
-                                {
-                                    PBDParticle *test_particle = test_group->particles + test_particle_index;
-
-                                    if(particle->inv_mass + test_particle->inv_mass != 0.0f)
-                                    {
-                                        f64 distance_between = length(particle->p - test_particle->p);
-                                        if(distance_between < particle->r + test_particle->r)
-                                        {
-                                            CollisionConstraint *c = collision_constraints + collision_constraint_count++;
-                                            c->particle0 = particle;
-                                            c->particle1 = test_particle;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        u32 pre_stabilization_iter_count = 2;
-        for(u32 iter = 0;
-                iter < pre_stabilization_iter_count;
-                ++iter)
-        {
-            // Pre-stabilize environment constraints
-            for(u32 constraint_index = 0;
-                    constraint_index < environment_constraint_count;
-                    ++constraint_index)
-            {
-                EnvironmentConstraint *c = environment_constraints + constraint_index;
-                EnvironmentSolution solution = {};
-                solve_environment_constraint(&solution, c, &c->particle->prev_p, sub_dt);
-
-                c->particle->p += solution.offset;
-                c->particle->prev_p += solution.offset;
-            }
-
-            // Pre-stabilize collision constraints
-            for(u32 constraint_index = 0;
-                    constraint_index < collision_constraint_count;
-                    ++constraint_index)
-            {
-                CollisionConstraint *c = collision_constraints + constraint_index;
-
-                CollisionSolution solution = {};
-                solve_collision_constraint(&solution, c,
-                                           &c->particle0->prev_p, &c->particle1->prev_p, sub_dt);
-
-                c->particle0->p += solution.offset0;
-                c->particle0->prev_p += solution.offset0;
-
-                c->particle1->p += solution.offset1;
-                c->particle1->prev_p += solution.offset1;
-            }
-        }
-
-        /*
-           TODO(gh) Find out in what precise order we should solve the constraints,
-           especially with the environment and collision
-           Solve every constraints, in specific order.
-           environment -> collision -> distance -> shape matching
-           */
-
-        // Solve environment constraints
-        for(u32 constraint_index = 0;
-                constraint_index < environment_constraint_count;
-                ++constraint_index)
-        {
-            EnvironmentConstraint *c = environment_constraints + constraint_index;
-            EnvironmentSolution solution = {};
-            solve_environment_constraint(&solution, c, &c->particle->p, sub_dt);
-
-           c->particle->p += solution.offset;
-        }
-
-        // Solve collision constraints & friction
-        for(u32 constraint_index = 0;
-                constraint_index < collision_constraint_count;
-                ++constraint_index)
-        {
-            CollisionConstraint *c = collision_constraints + constraint_index;
-
-            CollisionSolution solution = {};
-            solve_collision_constraint(&solution, c,
-                                       &c->particle0->p, &c->particle1->p, sub_dt);
-
-            c->particle0->p += solution.offset0;
-            c->particle1->p += solution.offset1;
-
-            // TODO(gh) Friction seems busted...,
-            // come back when we have SDF
-#if 0
-            if(solution.collided)
-            {
-                v3d d = (c->particle0->p - c->particle0->prev_p) - (c->particle1->p - c->particle1->prev_p);
-
-                v3d tangential_displacement = d - dot(d, solution.contact_normal) * solution.contact_normal;
-                f64 length_tangential_displacement = length(tangential_displacement);
-
-                f64 static_coeff = 0.7;
-                f64 kinetic_coeff = 0.4;
-                v3d offset = V3d();
-                if(length_tangential_displacement < static_coeff)
-                {
-                    offset =  tangential_displacement;
-                }
-                else
-                {
-                    offset = minimum(kinetic_coeff*solution.penetration_depth / length_tangential_displacement, 1.0) * 
-                             tangential_displacement;
-                }
-
-                offset *= (c->particle0->inv_mass/(c->particle0->inv_mass + c->particle1->inv_mass));
-                c->particle0->p += offset;
-                c->particle1->p += (c->particle1->inv_mass/(c->particle0->inv_mass + c->particle1->inv_mass)) * (-offset);
-            }
-#endif
-
-        }
-
-
-#if 0
-        // NOTE(gh) Solve distance constraint
-        for(u32 entity_index = 0;
-                entity_index < game_state->entity_countddddddddf;
-                ++entity_index)
-        {
-            Entity *entity = game_state->entities + entity_index;
-            PBDParticleGroup *group = &entity->particle_group;
-
-            // Solve distance constraint, only used for cloth or chains
-            for(u32 constraint_index = 0;
-                    constraint_index < group->distance_constraint_count;
-                    ++constraint_index)
-            {
-                DistanceConstraint *c = group->distance_constraints + constraint_index;
-                PBDParticle *particle0 = group->particles + c->index0;
-                PBDParticle *particle1 = group->particles + c->index1;
-
-                if(particle0->inv_mass + particle1->inv_mass != 0.0f)
-                {
-                    v3d delta = particle0->p - particle1->p;
-                    f64 delta_length = length(delta);
-
-                    f64 C = delta_length - c->rest_length;
-
-                    if(C < 0.0)
-                    {
-                        f64 stiffness_epsilon = (f64)group->inv_distance_stiffness/sub_dt_square;
-                        solve_distance_constraint(particle0, particle1, delta, C, stiffness_epsilon);
-                    }
-                }
-            }
-        }
-#endif
-    
-#if 1
-        /*
-           NOTE(gh) Solve shape matching constraints.
-           http://www.beosil.com/download/MeshlessDeformations_SIG05.pdf
-
-           The basic idea behind this is about finding a 'rotation matrix' that 
-           when applied each of the initial offset from the COM, produces the 'goal position'
-           that would match the shape.
-
-           This _must_ be the last step, especially for the rigid bodies.
-
-           1. Rigid bodies
-           m3x3d A = sum((xi - com) * transpose(ri)),
-           where xi is the position, and ri is the offset from the COM when resting.
-           The rotational part, R, can be retrieved using the polar decomposition,
-           which is explained in 
-           https://matthias-research.github.io/pages/publications/stablePolarDecomp.pdf
-
-           2. Linear deformation
-           Similar to rigid bodies, but support stretching.
-
-           3. Quadratic deformation
-
-        */
-        // TODO/IMPORTANT(gh) Make sure the polar decomposition math checks out!
-        for(u32 entity_index = 0;
-                entity_index < game_state->entity_count;
-                ++entity_index)
-        {
-            Entity *entity = game_state->entities + entity_index;
-            PBDParticleGroup *group = &entity->particle_group;
-
-            if(is_entity_flag_set(entity, EntityFlag_RigidBody))
-            {
-                m3x3d A = get_shape_matching_rigid_body_deformation_matrix(group);
-
-                group->shape_match_quat = 
-                    extract_rotation_from_polar_decomposition(&A, &group->shape_match_quat, 32);
-                m3x3d shape_matching_matrix = 
-                    orientation_quatd_to_m3x3d(group->shape_match_quat);
-
-                v3d com = get_com_of_particle_group(group);
-                // Apply the shape matching rotation
-                for(u32 particle_index = 0;
-                        particle_index < group->count;
-                        ++particle_index)
-                {
-                    PBDParticle *particle = group->particles + particle_index;
-                    particle->p = shape_matching_matrix*particle->initial_offset_from_com + com;
-                }
-            }
-            else if(is_entity_flag_set(entity, EntityFlag_Linear))
-            {
-                m3x3d shape_matching_matrix = 
-                    get_shape_matching_linear_deformation_rotation_matrix(group);
-
-                v3d com = get_com_of_particle_group(group);
-                for(u32 particle_index = 0;
-                        particle_index < group->count;
-                        ++particle_index)
-                {
-                    PBDParticle *particle = group->particles + particle_index;
-
-                    // NOTE(gh) This is also from the shape-matching paper
-                    f64 alpha = sub_dt_square*group->linear_deformation_c * particle->inv_mass;
-                    particle->p += alpha*(shape_matching_matrix*particle->initial_offset_from_com + com - particle->p);
-                }
-            }
-            else if(is_entity_flag_set(entity, EntityFlag_Quadratic))
-            {
-                v3d com = get_com_of_particle_group(group);
-                m3x9d quadratic_Apq = {};
-                for(u32 particle_index = 0;
-                        particle_index < group->count;
-                        ++particle_index)
-                {
-                    PBDParticle *particle = group->particles + particle_index;
-
-                    v3d offset = particle->p - com;
-                    v9d q = get_quadratic_deformation_q(particle->initial_offset_from_com);
-
-                    f64 particle_mass = 1.0/particle->inv_mass;
-
-                    quadratic_Apq.rows[0] += particle_mass*offset.x * q;
-                    quadratic_Apq.rows[1] += particle_mass*offset.y * q;
-                    quadratic_Apq.rows[2] += particle_mass*offset.z * q;
-                }
-
-                m3x9d quadratic_A = quadratic_Apq*group->quadratic_inv_Aqq;
-
-                // NOTE(gh) Quadratic deformation is done on top of 
-                // linea deformation, so we need to caculate linear deformation first.
-                // quadratric_R = [R 0 0], which results in 3x9 matrix
-                m3x3d R = 
-                    get_shape_matching_linear_deformation_rotation_matrix(group);
-                m3x9d quadratric_R = {};
-                quadratric_R.rows[0] = V9d(R.e[0][0], R.e[0][1], R.e[0][2],
-                                            0, 0, 0, 0, 0, 0);
-                quadratric_R.rows[1] = V9d(R.e[1][0], R.e[1][1], R.e[1][2],
-                                            0, 0, 0, 0, 0, 0);
-                quadratric_R.rows[2] = V9d(R.e[2][0], R.e[2][1], R.e[2][2],
-                                            0, 0, 0, 0, 0, 0);
-
-                f64 quadratic_coefficient = 0.5;
-                m3x9d shape_match_rotation_matrix = quadratic_coefficient*quadratic_A + 
-                                                    (1-quadratic_coefficient)*quadratric_R;
-
-                for(u32 particle_index = 0;
-                        particle_index < group->count;
-                        ++particle_index)
-                {
-                    PBDParticle *particle = group->particles + particle_index;
-
-                    v9d q = get_quadratic_deformation_q(particle->initial_offset_from_com);
-
-                    particle->p = shape_match_rotation_matrix*q + com;
-                }
-            }
-        }
-#endif
-
-        // Post solve
-        for(u32 entity_index = 0;
-                entity_index < game_state->entity_count;
-                ++entity_index)
-        {
-            Entity *entity = game_state->entities + entity_index;
-            PBDParticleGroup *group = &entity->particle_group;
-
-            for(u32 particle_index = 0;
-                    particle_index < group->count;
-                    ++particle_index)
-            {
-                PBDParticle *particle = group->particles + particle_index;
-
-                if(particle->inv_mass != 0.0f)
-                {
-                    v3d delta = (particle->p - particle->prev_p);
-                    f64 sleep_epsilon = 0.00000001;
-                    if(length(delta) > sleep_epsilon)
-                    {
-                        particle->v = delta / sub_dt;
-                    }
-                    else
-                    {
-                        // Particle sleeping
-                        particle->p = particle->prev_p;
-                    }
-                }
-            }
-        }
+        // NOTE(gh) In the time machine, the substep stays fixed so that we can step through the substeps one by one
+        pbd_substep_count = get_pbd_substep_count(game_state, (f64)platform_input->dt_per_frame, 
+                                                  tran_state->min_pbd_substep_count, tran_state->max_pbd_substep_count,
+                                                  &tran_state->pbd_substep_stats);
+        sub_dt = (f64)platform_input->dt_per_frame/(f64)pbd_substep_count;
+        tran_state->remaining_pbd_substep_count = 0;
+    }
+    else if(tran_state->remaining_pbd_substep_count > 0)
+    {
+        pbd_substep_count = minimum((u32)tran_state->remaining_pbd_substep_count, tran_state->max_pbd_substep_count);
+        tran_state->remaining_pbd_substep_count -= pbd_substep_count;
+    }
+    f64 pbd_residual_error = simulate_pbd(game_state, &tran_state->transient_arena, thread_work_queue, 
+                                          tran_state->pbd_precision_mode, sub_dt, pbd_substep_count);
+    if(tran_state->is_simulating_in_realtime)
+    {
+        record_pbd_substep_stats(&tran_state->pbd_substep_stats, pbd_substep_count, pbd_residual_error);
+    }
 
-        end_temp_memory(&collision_constraint_memory);
-        end_temp_memory(&environment_constraint_memory);
+    // NOTE(gh) Only initialized when the fluid scene is turned on
+    if(tran_state->fluid_cube_mac.total_center_count && tran_state->is_simulating_in_realtime)
+    {
+        update_fluid_cube_mac(&tran_state->fluid_cube_mac, &tran_state->transient_arena, thread_work_queue, 
+                              platform_input->dt_per_frame);
     }
 
     // NOTE(gh) Frustum cull the grids
@@ -898,30 +668,6 @@ GAME_UPDATE_AND_RENDER(update_and_render)
                     0, 0, 0, V3(), false);
     }
 
-#if 0
-    // NOTE(gh) Render all saved game states, especially the particles
-    if(!tran_state->is_simulating_in_realtime)
-    {
-        u32 one_past_last_index = 0;
-        if(tran_state->has_entire_buffer_filled_at_least_once)
-        {
-            one_past_last_index = tran_state->max_saved_game_state_count;
-        }
-        else
-        {
-            one_past_last_index = tran_state->saved_game_state_write_cursor;
-        }
-
-        // TODO(gh) This doesn't care about the 'order' now,
-        // but we wanna differentiate the color based on the order later!!
-        for(u32 game_state_index = 0;
-                game_state_index < 5;
-                ++game_state_index)
-        {
-            render_all_entities(platform_render_push_buffer, tran_state->saved_game_states + game_state_index, &tran_state->assets);
-        }
-    }
-#endif
     render_all_entities(platform_render_push_buffer, game_state, &tran_state->assets, true, true);
 
     if(debug_platform_render_push_buffer)
@@ -1016,11 +762,56 @@ GAME_UPDATE_AND_RENDER(update_and_render)
 
         // TODO(gh) This prevents us from timing the game update and render loop itself 
         output_debug_records(debug_platform_render_push_buffer, &tran_state->assets, V2(0, 0));
+
+#if HB_DEBUG
+        if(tran_state->pbd_precision_comparison.frame_count)
+        {
+            output_pbd_precision_comparison(debug_platform_render_push_buffer, &tran_state->assets, 
+                                            &tran_state->pbd_precision_comparison, 
+                                            V2(0.5f*debug_platform_render_push_buffer->window_width, 0));
+        }
+        if(tran_state->pbd_polar_decomposition_benchmark.group_count)
+        {
+            output_pbd_polar_decomposition_benchmark(debug_platform_render_push_buffer, &tran_state->assets, 
+                                                     &tran_state->pbd_polar_decomposition_benchmark, 
+                                                     V2(0.5f*debug_platform_render_push_buffer->window_width, 
+                                                        0.25f*debug_platform_render_push_buffer->window_height));
+        }
+        if(tran_state->fluid_projection_benchmarks[0].cell_count_per_axis)
+        {
+            output_fluid_projection_benchmarks(debug_platform_render_push_buffer, &tran_state->assets, 
+                                               tran_state->fluid_projection_benchmarks, 
+                                               array_count(tran_state->fluid_projection_benchmarks),
+                                               V2(0.5f*debug_platform_render_push_buffer->window_width, 
+                                                  0.75f*debug_platform_render_push_buffer->window_height));
+        }
+#endif
+        if(tran_state->pbd_substep_stats.recorded_count)
+        {
+            output_pbd_substep_stats(debug_platform_render_push_buffer, &tran_state->assets, 
+                                     &tran_state->pbd_substep_stats, 
+                                     V2(0.5f*debug_platform_render_push_buffer->window_width, 
+                                        0.5f*debug_platform_render_push_buffer->window_height));
+        }
     }
     
     thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
 }
 
+extern "C"
+GAME_SHUTDOWN(shutdown_game)
+{
+    TranState *tran_state = (TranState *)platform_memory->transient_memory;
+    if(tran_state->is_initialized)
+    {
+        // NOTE(gh) Otherwise the files stay at the full size that we mapped
+        end_time_machine_stream(&tran_state->time_machine);
+#if HB_DETERMINISTIC
+        end_state_hash_log(&tran_state->state_hash_log);
+#endif
+    }
+}
+
 // TODO(gh) we can use this function to make the p relative to bottom_left!
 internal void
 debug_reset_text_to_top_left(v2 *p)
@@ -1114,7 +905,9 @@ output_debug_records(PlatformRenderPushBuffer *platform_render_push_buffer, Game
             ++record_index)
     {
         DebugRecord *record = game_debug_records + record_index;
-        if(record->function)
+        // NOTE(gh) The record can have 0 hit count if the block didn't run this frame
+        // (i.e the other precision mode of the pbd solver)
+        if(record->function && (record->hit_count_cycle_count >> 32))
         {
             const char *function = record->function;
             const char *file = record->file;
@@ -1125,8 +918,16 @@ output_debug_records(PlatformRenderPushBuffer *platform_render_push_buffer, Game
             total_cycle_count += cycle_count;
 
             char buffer[512] = {};
-            snprintf(buffer, array_count(buffer),
-                    "%s(%s(%u)): %ucy, %uh, %ucy/h ", function, file, line, cycle_count, hit_count, cycle_count/hit_count);
+            if(record->value_name)
+            {
+                snprintf(buffer, array_count(buffer),
+                        "%s(%s(%u)): %s = %g, %uh ", function, file, line, record->value_name, record->value, hit_count);
+            }
+            else
+            {
+                snprintf(buffer, array_count(buffer),
+                        "%s(%s(%u)): %ucy, %uh, %ucy/h ", function, file, line, cycle_count, hit_count, cycle_count/hit_count);
+            }
 
             // TODO(gh) Do we wanna keep this scale value?
             f32 scale = 0.5f;
@@ -1152,5 +953,103 @@ output_debug_records(PlatformRenderPushBuffer *platform_render_push_buffer, Game
 #endif
 }
 
+internal void
+output_pbd_precision_comparison(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                                PBDPrecisionComparison *comparison, v2 top_left_rel_p_px)
+{
+    FontAsset *font_asset = &assets->debug_font_asset;
+    f32 scale = 0.5f;
+
+    char buffer[512] = {};
+    snprintf(buffer, array_count(buffer),
+            "pbd f32 vs f64 after %u frames - max drift : %.6f, average drift : %.6f", 
+            comparison->frame_count, comparison->max_drift, comparison->final_average_drift);
+    debug_text_line(platform_render_push_buffer, font_asset, buffer, top_left_rel_p_px, scale);
+    debug_newline(&top_left_rel_p_px, scale, font_asset);
+
+    snprintf(buffer, array_count(buffer),
+            "pbd f64 : %llucy, f32 : %llucy", 
+            comparison->f64_cycle_count, comparison->f32_cycle_count);
+    debug_text_line(platform_render_push_buffer, font_asset, buffer, top_left_rel_p_px, scale);
+}
+
+internal void
+output_pbd_polar_decomposition_benchmark(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                                         PBDPolarDecompositionBenchmark *benchmark, v2 top_left_rel_p_px)
+{
+    FontAsset *font_asset = &assets->debug_font_asset;
+    f32 scale = 0.5f;
+
+    char buffer[512] = {};
+    snprintf(buffer, array_count(buffer),
+            "polar decomposition x %u - scalar : %llucy, batch : %llucy", 
+            benchmark->group_count, benchmark->scalar_cycle_count, benchmark->batch_cycle_count);
+    debug_text_line(platform_render_push_buffer, font_asset, buffer, top_left_rel_p_px, scale);
+    debug_newline(&top_left_rel_p_px, scale, font_asset);
+
+    snprintf(buffer, array_count(buffer),
+            "max error - scalar : %.8frad, batch : %.8frad", 
+            benchmark->scalar_max_error, benchmark->batch_max_error);
+    debug_text_line(platform_render_push_buffer, font_asset, buffer, top_left_rel_p_px, scale);
+}
 
+internal void
+output_fluid_projection_benchmarks(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                                   FluidProjectionBenchmark *benchmarks, u32 benchmark_count, v2 top_left_rel_p_px)
+{
+    FontAsset *font_asset = &assets->debug_font_asset;
+    f32 scale = 0.5f;
 
+    char buffer[512] = {};
+    for(u32 benchmark_index = 0;
+            benchmark_index < benchmark_count;
+            ++benchmark_index)
+    {
+        FluidProjectionBenchmark *benchmark = benchmarks + benchmark_index;
+        u32 cell_count = benchmark->cell_count_per_axis*benchmark->cell_count_per_axis*benchmark->cell_count_per_axis;
+        snprintf(buffer, array_count(buffer),
+                "fluid projection(%s) %u^3 : %llucy(%.1fcy per cell), %u iterations(residual : %.6f), max divergence : %.4f -> %.4f, warm : %llucy(%u iterations)", 
+                (benchmark->solver_type == FluidPressureSolverType_Multigrid) ? "multigrid" : "pcg",
+                benchmark->cell_count_per_axis, benchmark->cycle_count, (f64)benchmark->cycle_count/cell_count,
+                benchmark->iteration_count, benchmark->relative_residual,
+                benchmark->max_divergence_before, benchmark->max_divergence_after,
+                benchmark->warm_cycle_count, benchmark->warm_iteration_count);
+        debug_text_line(platform_render_push_buffer, font_asset, buffer, top_left_rel_p_px, scale);
+        debug_newline(&top_left_rel_p_px, scale, font_asset);
+    }
+}
+
+internal void
+output_pbd_substep_stats(PlatformRenderPushBuffer *platform_render_push_buffer, GameAssets *assets, 
+                         PBDSubstepStats *stats, v2 top_left_rel_p_px)
+{
+    FontAsset *font_asset = &assets->debug_font_asset;
+    f32 scale = 0.5f;
+
+    u32 min_substep_count = u32_max;
+    u32 max_substep_count = 0;
+    u32 total_substep_count = 0;
+    f32 max_residual_error = 0;
+    for(u32 i = 0;
+            i < stats->recorded_count;
+            ++i)
+    {
+        min_substep_count = minimum(min_substep_count, stats->substep_counts[i]);
+        max_substep_count = maximum(max_substep_count, stats->substep_counts[i]);
+        total_substep_count += stats->substep_counts[i];
+        max_residual_error = maximum(max_residual_error, stats->residual_errors[i]);
+    }
+
+    char buffer[512] = {};
+    snprintf(buffer, array_count(buffer),
+            "pbd substeps : %u (contact travel : %.3fr, residual : %.4fr)", 
+            stats->last_substep_count, stats->last_max_travel, stats->last_residual_error);
+    debug_text_line(platform_render_push_buffer, font_asset, buffer, top_left_rel_p_px, scale);
+    debug_newline(&top_left_rel_p_px, scale, font_asset);
+
+    snprintf(buffer, array_count(buffer),
+            "last %u frames - min : %u, max : %u, average : %.2f, max residual : %.4fr", 
+            stats->recorded_count, min_substep_count, max_substep_count, 
+            (f32)total_substep_count/(f32)stats->recorded_count, max_residual_error);
+    debug_text_line(platform_render_push_buffer, font_asset, buffer, top_left_rel_p_px, scale);
+}
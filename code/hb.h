@@ -22,9 +22,16 @@ struct GameState
     RandomSeries random_series;
 
     PBDParticlePool particle_pool;
+    PBDConstraintPool constraint_pool;
+    PBDEnvironment environment;
+
+    // NOTE(gh) Entity indices sorted by the min x of their bounds, used by the sort and sweep broadphase.
+    // Kept across the frames so that the insertion sort only has to fix up a handful of entities.
+    u32 broadphase_order[512];
+    u32 broadphase_order_count;
 };
 
-#define desired_time_machine_seconds 30
+#define desired_time_machine_seconds 300
 
 // NOTE(gh) Things we don't need to preserve
 struct TranState
@@ -34,10 +41,17 @@ struct TranState
     b32 is_simulating_in_realtime;
 
     u32 max_pbd_substep_count;
+    u32 min_pbd_substep_count; // In realtime, substep count is picked between min and max(see get_pbd_substep_count)
     // NOTE(gh) In realtime, this would be like max_pbd_substep_count in maximum.
     // In time machine, this will be 1 and be replenished when the user presses the key or something.
     i32 remaining_pbd_substep_count;
 
+    PBDPrecisionMode pbd_precision_mode;
+    PBDPrecisionComparison pbd_precision_comparison;
+    PBDPolarDecompositionBenchmark pbd_polar_decomposition_benchmark;
+    FluidProjectionBenchmark fluid_projection_benchmarks[8]; // 16^3, 32^3, 64^3, 128^3 for each pressure solver
+    PBDSubstepStats pbd_substep_stats;
+
     GrassGrid *grass_grids;
     u32 grass_grid_count_x;
     u32 grass_grid_count_y;
@@ -55,14 +69,13 @@ struct TranState
 
     GameAssets assets;
 
-    // TODO(gh) Would it be possible to collapse the 'active' game state
-    // and all these save files by just having a pointer that moves one by one 
-    // like write cursor
-    GameState *saved_game_states;
-    u32 max_saved_game_state_count;
-    u32 saved_game_state_read_cursor; // Will be starting from the write cursor, and decrement by 1
-    u32 saved_game_state_write_cursor; // When the time machine starts, we will going to start the read cursor from the write cursor
-    b32 has_entire_buffer_filled_at_least_once; // whether the entire buffer has ben fulled at least once, and the write cursor has wrapped
+    TimeMachine time_machine;
+
+    MemorySnapshot memory_snapshot;
+
+    StateHashLog state_hash_log; // Only used in the deterministic mode
+
+    FluidCubeMAC fluid_cube_mac; // total_center_count is 0 unless the fluid scene is turned on
 };
 
 #endif
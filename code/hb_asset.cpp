@@ -16,35 +16,54 @@ flush_gpu_visible_buffer(GPUVisibleBuffer *buffer)
 #endif
 }
 
-internal TextureAsset2D
-load_texture_asset(ThreadWorkQueue *gpu_work_queue, void *source, i32 width, i32 height, i32 bytes_per_pixel)
+// NOTE(gh) Allocates the texture in GPU and fills it with the bitmap that the texture is holding
+internal void
+upload_texture_asset(ThreadWorkQueue *gpu_work_queue, TextureAsset2D *texture)
 {
-    TextureAsset2D result = {};
-
-    assert(source);
+    assert(texture->bitmap);
 
     // Allocate the space in GPU and get the handle
     ThreadAllocateTexture2DData allocate_texture2D_data = {};
-    allocate_texture2D_data.handle_to_populate = &result.handle;
-    allocate_texture2D_data.width = width;
-    allocate_texture2D_data.height = height;
-    allocate_texture2D_data.bytes_per_pixel = bytes_per_pixel;
+    allocate_texture2D_data.handle_to_populate = &texture->handle;
+    allocate_texture2D_data.width = texture->width;
+    allocate_texture2D_data.height = texture->height;
+    allocate_texture2D_data.bytes_per_pixel = texture->bytes_per_pixel;
 
     // Load the file into texture
     gpu_work_queue->add_thread_work_queue_item(gpu_work_queue, 0, GPUWorkType_AllocateTexture2D, &allocate_texture2D_data);
     gpu_work_queue->complete_all_thread_work_queue_items(gpu_work_queue, false);
 
     ThreadWriteEntireTexture2D write_entire_texture2D_data = {};
-    write_entire_texture2D_data.handle = result.handle;
-    write_entire_texture2D_data.source = source;
-    write_entire_texture2D_data.width = width;
-    write_entire_texture2D_data.height = height;
-    write_entire_texture2D_data.bytes_per_pixel = bytes_per_pixel;
+    write_entire_texture2D_data.handle = texture->handle;
+    write_entire_texture2D_data.source = texture->bitmap;
+    write_entire_texture2D_data.width = texture->width;
+    write_entire_texture2D_data.height = texture->height;
+    write_entire_texture2D_data.bytes_per_pixel = texture->bytes_per_pixel;
 
     gpu_work_queue->add_thread_work_queue_item(gpu_work_queue, 0, GPUWorkType_WriteEntireTexture2D, &write_entire_texture2D_data);
     gpu_work_queue->complete_all_thread_work_queue_items(gpu_work_queue, false);
 
-    assert(result.handle);
+    assert(texture->handle);
+}
+
+internal TextureAsset2D
+load_texture_asset(ThreadWorkQueue *gpu_work_queue, MemoryArena *arena, void *source, i32 width, i32 height, i32 bytes_per_pixel)
+{
+    TextureAsset2D result = {};
+
+    assert(source);
+
+    // NOTE(gh) Keep our own copy of the bitmap, so that the texture can be uploaded again
+    // (i.e after the game was restored from the memory snapshot)
+    u64 bitmap_size = (u64)width*height*bytes_per_pixel;
+    result.bitmap = push_size(arena, bitmap_size);
+    memcpy(result.bitmap, source, bitmap_size);
+
+    result.width = width;
+    result.height = height;
+    result.bytes_per_pixel = bytes_per_pixel;
+
+    upload_texture_asset(gpu_work_queue, &result);
 
     return result;
 }
@@ -61,6 +80,8 @@ get_gpu_visible_buffer(ThreadWorkQueue *gpu_work_queue, u64 size)
     gpu_work_queue->add_thread_work_queue_item(gpu_work_queue, 0, GPUWorkType_AllocateBuffer, &allocate_buffer_data);
     gpu_work_queue->complete_all_thread_work_queue_items(gpu_work_queue, false);
 
+    result.size = size;
+
     return result;
 }
 
@@ -136,8 +157,9 @@ get_mesh_asset(GameAssets *asset, u32 *mesh_assetID, AssetTag tag)
 }
 
 internal void
-begin_load_font(LoadFontInfo *load_font_info, FontAsset *font_asset, const char *file_path, PlatformAPI *platform_api, u32 max_glyph_count, f32 desired_font_height_px)
+begin_load_font(LoadFontInfo *load_font_info, FontAsset *font_asset, const char *file_path, PlatformAPI *platform_api, MemoryArena *arena, u32 max_glyph_count, f32 desired_font_height_px)
 {
+    load_font_info->arena = arena;
     load_font_info->font_asset = font_asset;
     load_font_info->font_asset->max_glyph_count = max_glyph_count;
 
@@ -156,13 +178,12 @@ begin_load_font(LoadFontInfo *load_font_info, FontAsset *font_asset, const char
     font_asset->descent_from_baseline = -1.0f*load_font_info->font_scale * descent; // stb library gives us negative value, but we want positive value for this
     font_asset->line_gap = load_font_info->font_scale*line_gap;
 
-    // TODO(gh) We should get rid of these mallocs, for sure.
-    u32 codepoint_to_glyphID_table_size = sizeof(u32) * MAX_UNICODE_CODEPOINT;
-    font_asset->codepoint_to_glyphID_table = (u16 *)malloc(sizeof(u16) * MAX_UNICODE_CODEPOINT);
+    u32 codepoint_to_glyphID_table_size = sizeof(u16) * MAX_UNICODE_CODEPOINT;
+    font_asset->codepoint_to_glyphID_table = push_array(arena, u16, MAX_UNICODE_CODEPOINT);
     zero_memory(font_asset->codepoint_to_glyphID_table, codepoint_to_glyphID_table_size);
 
-    font_asset->glyph_assets = (GlyphAsset *)malloc(sizeof(GlyphAsset) * max_glyph_count);
-    font_asset->kerning_advances = (f32 *)malloc(sizeof(f32) * max_glyph_count * max_glyph_count);
+    font_asset->glyph_assets = push_array(arena, GlyphAsset, max_glyph_count);
+    font_asset->kerning_advances = push_array(arena, f32, (max_glyph_count * max_glyph_count));
 }
 
 #if 1 
@@ -222,7 +243,7 @@ add_glyph_asset(LoadFontInfo *load_font_info, ThreadWorkQueue *gpu_work_queue, u
 
     if(bitmap)
     {
-        glyph_asset->texture = load_texture_asset(gpu_work_queue, bitmap, width, height, 1);
+        glyph_asset->texture = load_texture_asset(gpu_work_queue, load_font_info->arena, bitmap, width, height, 1);
         stbtt_FreeBitmap(bitmap, 0);
     }
 }
@@ -238,7 +259,7 @@ load_game_assets(GameAssets *assets, MemoryArena *arena, PlatformAPI *platform_a
     LoadFontInfo load_font_info = {};
 
     begin_load_font(&load_font_info, &assets->debug_font_asset, 
-                    "/System/Library/Fonts/Supplemental/applemyungjo.ttf", platform_api, 
+                    "/System/Library/Fonts/Supplemental/applemyungjo.ttf", platform_api, arena,
                     max_glyph_count, 128.0f);
     {
         // space works just like other glyphs, but without any texture
@@ -22,10 +22,10 @@ struct TextureAsset2D
 {
     void *handle; // handle to the texture in GPU
 
-    // TODO(gh) Also keep the bitmap memory 
-    // so that we can re-load the texture when the
-    // asset gets unloaded from the GPU, or keep the offset
-    // to the pakced asset file?
+    // NOTE(gh) Copy of the bitmap that we uploaded, so that we can re-load the texture 
+    // when the handle is not valid anymore(see upload_texture_asset).
+    // TODO(gh) Keep the offset to the packed asset file instead?
+    void *bitmap;
     i32 width;
     i32 height;
     i32 bytes_per_pixel;
@@ -93,6 +93,7 @@ struct LoadFontInfo
     void *device;
 
     FontAsset *font_asset;
+    struct MemoryArena *arena; // where the tables & glyph bitmaps go
 
     u16 populated_glyph_count;
 
@@ -10,6 +10,10 @@ struct DebugRecord
     // NOTE(gh) (hit_count << 32) | (cycle_count), we can decrease the size of hit_count for more cycle_count
     // This helps us to use only one atomic operation to modify this value
     volatile u64 hit_count_cycle_count;
+
+    // NOTE(gh) Only for the records from DEBUG_VALUE, which don't have any cycle count
+    const char *value_name;
+    f64 value;
 };
 
 #if HB_DEBUG
@@ -18,9 +22,13 @@ struct DebugRecord
 #define __TIMED_BLOCK(line, ...) TimedBlock timed_block_##line(__COUNTER__, __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__);
 #define _TIMED_BLOCK(line, ...) __TIMED_BLOCK(line, ##__VA_ARGS__)
 #define TIMED_BLOCK(...) _TIMED_BLOCK(__LINE__, ##__VA_ARGS__)
+// NOTE(gh) Shows the last value that was recorded in this frame(i.e iteration count of a solver) 
+// next to the timed blocks, with how many times it was recorded
+#define DEBUG_VALUE(name, value) record_debug_value(__COUNTER__, __FILE__, __FUNCTION__, __LINE__, name, (f64)(value));
 #else
 
 #define TIMED_BLOCK(...) 
+#define DEBUG_VALUE(...) 
 #endif
 
 // NOTE(gh) Pre-declaration, makefile or build batch file has pre-declared name for each translation unit
@@ -28,6 +36,19 @@ struct DebugRecord
 // so that any file that is compiled seperately can have debug record array with different names
 extern DebugRecord debug_records[];
 
+inline void
+record_debug_value(int ID, const char *file, const char *function, int line, const char *name, f64 value)
+{
+    DebugRecord *record = debug_records + ID;
+    record->file = file;
+    record->function = function;
+    record->line = line;
+    record->value_name = name;
+    record->value = value;
+
+    atomic_add_64(&record->hit_count_cycle_count, (u64)1 << 32);
+}
+
 struct TimedBlock
 {
     u64 start_cycle_count;
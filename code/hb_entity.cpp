@@ -110,8 +110,9 @@ add_floor_entity(GameState *game_state, v3 center, v2 dim, v3 color, u32 x_quad_
     return result;
 }
 
+// NOTE(gh) Should be called between start_constraint_allocation_from_pool and end_constraint_allocation_from_pool
 internal void
-add_distance_constraint(PBDParticleGroup *group, u32 index0, u32 index1)
+add_distance_constraint(PBDConstraintPool *pool, PBDParticleGroup *group, u32 index0, u32 index1)
 {
     // TODO(gh) First, search through the constraints to see if there is a duplicate.
     // This is a very slow operation that scales horribly, so might be better if we 
@@ -132,6 +133,7 @@ add_distance_constraint(PBDParticleGroup *group, u32 index0, u32 index1)
 
     if(should_add_new_constraint)
     {
+        assert(pool->distance_constraint_count + group->distance_constraint_count < array_count(pool->distance_constraints));
         DistanceConstraint *c = group->distance_constraints + group->distance_constraint_count++;
 
         c->index0 = index0;
@@ -142,7 +144,7 @@ add_distance_constraint(PBDParticleGroup *group, u32 index0, u32 index1)
 }
 
 internal void
-add_volume_constraint(PBDParticleGroup *group, 
+add_volume_constraint(PBDConstraintPool *pool, PBDParticleGroup *group, 
                      u32 top, u32 bottom0, u32 bottom1, u32 bottom2)
 {
     PBDParticle *particle0 = group->particles + top;
@@ -150,6 +152,7 @@ add_volume_constraint(PBDParticleGroup *group,
     PBDParticle *particle2 = group->particles + bottom1;
     PBDParticle *particle3 = group->particles + bottom2;
 
+    assert(pool->volume_constraint_count + group->volume_constraint_count < array_count(pool->volume_constraints));
     VolumeConstraint *c = group->volume_constraints + group->volume_constraint_count++;
     c->index0 = top;
     c->index1 = bottom0;
@@ -250,6 +253,75 @@ populate_pbd_shape_matching_info(Entity *entity,
     }
 }
 
+// NOTE(gh) Done when the vox is loaded, so that the offsets live in the same arena as the vox itself
+internal void
+populate_vox_offsets_from_com(LoadedVOXResult *loaded_vox, MemoryArena *arena)
+{
+    v3d com = V3d();
+    for(u32 voxel_index = 0;
+            voxel_index < loaded_vox->voxel_count;
+            ++voxel_index)
+    {
+        com += V3d(loaded_vox->xs[voxel_index], loaded_vox->ys[voxel_index], loaded_vox->zs[voxel_index]);
+    }
+    com /= (f64)loaded_vox->voxel_count;
+
+    loaded_vox->offsets_from_com = push_array(arena, v3d, loaded_vox->voxel_count);
+    for(u32 voxel_index = 0;
+            voxel_index < loaded_vox->voxel_count;
+            ++voxel_index)
+    {
+        v3d voxel = V3d(loaded_vox->xs[voxel_index], loaded_vox->ys[voxel_index], loaded_vox->zs[voxel_index]);
+        loaded_vox->offsets_from_com[voxel_index] = 2.0*particle_radius*(voxel - com);
+    }
+}
+
+internal void
+populate_vox_shape_matching_cache(LoadedVOXResult *loaded_vox, u32 flags)
+{
+    assert(loaded_vox->offsets_from_com);
+
+    if(!loaded_vox->is_linear_inv_Aqq_valid && 
+        (flags & (EntityFlag_Linear|EntityFlag_Quadratic)))
+    {
+        // NOTE(gh) Same as populate_pbd_shape_matching_info, with the mass of 1
+        m3x3d Aqq = M3x3d();
+        for(u32 voxel_index = 0;
+                voxel_index < loaded_vox->voxel_count;
+                ++voxel_index)
+        {
+            v3d q = loaded_vox->offsets_from_com[voxel_index];
+            Aqq.rows[0] += q.x * q;
+            Aqq.rows[1] += q.y * q;
+            Aqq.rows[2] += q.z * q;
+        }
+
+        assert(is_inversable(Aqq) && is_symmetric(Aqq));
+        loaded_vox->unit_mass_linear_inv_Aqq = inverse(Aqq);
+        loaded_vox->is_linear_inv_Aqq_valid = true;
+    }
+
+    if(!loaded_vox->is_quadratic_inv_Aqq_valid && 
+        (flags & EntityFlag_Quadratic))
+    {
+        m9x9d quadratic_Aqq = {};
+        for(u32 voxel_index = 0;
+                voxel_index < loaded_vox->voxel_count;
+                ++voxel_index)
+        {
+            v9d q = get_quadratic_deformation_q(loaded_vox->offsets_from_com[voxel_index]);
+            for(u32 row = 0;
+                    row < 9;
+                    ++row)
+            {
+                quadratic_Aqq.rows[row] += q.e[row] * q;
+            }
+        }
+
+        loaded_vox->unit_mass_quadratic_inv_Aqq = inverse(quadratic_Aqq);
+        loaded_vox->is_quadratic_inv_Aqq_valid = true;
+    }
+}
 
 // TODO(gh) Later, we would want this is voxelize any mesh
 // we throw in
@@ -301,6 +373,11 @@ add_pbd_cube_entity(GameState *game_state,
                                      group,
                                      linear_deformation_c);
 
+    if(is_entity_flag_set(result, EntityFlag_RigidBody))
+    {
+        initialize_rigid_body(group);
+    }
+
     return result;
 }
 
@@ -331,13 +408,44 @@ add_pbd_vox_entity(GameState *game_state,
                                         p, v,
                                         particle_radius,
                                         inv_particle_mass);
+
+            if(loaded_vox->sdf_values)
+            {
+                PBDParticle *particle = game_state->particle_pool.particles + game_state->particle_pool.count - 1;
+                particle->sdf = 2.0f*particle_radius*loaded_vox->sdf_values[voxel_index];
+                particle->sdf_normal = loaded_vox->sdf_normals[voxel_index];
+            }
         }
     }
     end_particle_allocation_from_pool(&game_state->particle_pool, group);
-    
-    populate_pbd_shape_matching_info(result, 
-                                     group,
-                                     linear_deformation_c);
+
+    // NOTE(gh) Instead of populate_pbd_shape_matching_info, 
+    // reuse the info that was computed for the previous instances of the same vox
+    populate_vox_shape_matching_cache(loaded_vox, flags);
+    group->linear_deformation_c = linear_deformation_c;
+    for(u32 particle_index = 0;
+            particle_index < group->count;
+            ++particle_index)
+    {
+        group->particles[particle_index].initial_offset_from_com = loaded_vox->offsets_from_com[particle_index];
+    }
+
+    if(is_entity_flag_set(result, EntityFlag_Quadratic) || 
+        is_entity_flag_set(result, EntityFlag_Linear))
+    {
+        group->linear_inv_Aqq = (f64)inv_particle_mass*loaded_vox->unit_mass_linear_inv_Aqq;
+
+        if(is_entity_flag_set(result, EntityFlag_Quadratic))
+        {
+            group->quadratic_inv_Aqq = loaded_vox->unit_mass_quadratic_inv_Aqq;
+            group->quadratic_inv_Aqq *= (f64)inv_particle_mass;
+        }
+    }
+
+    if(is_entity_flag_set(result, EntityFlag_RigidBody))
+    {
+        initialize_rigid_body(group);
+    }
 
     return result;
 }
@@ -378,6 +486,118 @@ add_pbd_single_particle_entity(GameState *game_state,
     return result;
 }
 
+// NOTE(gh) Block of fluid particles laid out with the rest spacing, 
+// so that the block starts at the rest density(see get_fluid_rest_density)
+internal Entity *
+add_pbd_fluid_block_entity(GameState *game_state, 
+                           v3d left_bottom_corner, u32 particle_count_x, u32 particle_count_y, u32 particle_count_z,
+                           v3d v, f32 inv_mass, v3 color, u32 flags)
+{
+    Entity *result = add_entity(game_state, EntityType_PBD, flags|EntityFlag_Fluid);
+    result->color = color;
+
+    f32 inv_particle_mass = particle_count_x * particle_count_y * particle_count_z * inv_mass;
+
+    PBDParticleGroup *group = &result->particle_group;
+    start_particle_allocation_from_pool(&game_state->particle_pool, group);
+    {
+        for(u32 z = 0;
+                z < particle_count_z;
+                ++z)
+        {
+            for(u32 y = 0;
+                    y < particle_count_y;
+                    ++y)
+            {
+                for(u32 x = 0;
+                        x < particle_count_x;
+                        ++x)
+                {
+                    v3d p = left_bottom_corner + 2.0*particle_radius*V3d(x, y, z);
+                    allocate_particle_from_pool(&game_state->particle_pool,
+                                                p, v,
+                                                particle_radius,
+                                                inv_particle_mass);
+                }
+            }
+        }
+    }
+    end_particle_allocation_from_pool(&game_state->particle_pool, group);
+
+    return result;
+}
+
+// NOTE(gh) Cloth lying on the xy plane, held by the two corners with the highest y.
+// Particles are connected to their neighbors & diagonal neighbors with the distance constraints.
+internal Entity *
+add_pbd_cloth_entity(GameState *game_state, 
+                     v3d left_bottom_corner, u32 particle_count_x, u32 particle_count_y,
+                     f32 inv_edge_stiffness, f32 inv_mass, v3 color, u32 flags)
+{
+    Entity *result = add_entity(game_state, EntityType_PBD, flags);
+    result->color = color;
+
+    f32 inv_particle_mass = particle_count_x * particle_count_y * inv_mass;
+
+    PBDParticleGroup *group = &result->particle_group;
+    start_particle_allocation_from_pool(&game_state->particle_pool, group);
+    {
+        for(u32 y = 0;
+                y < particle_count_y;
+                ++y)
+        {
+            for(u32 x = 0;
+                    x < particle_count_x;
+                    ++x)
+            {
+                b32 is_pinned = (y == particle_count_y - 1) && (x == 0 || x == particle_count_x - 1);
+
+                v3d p = left_bottom_corner + 2.0*particle_radius*V3d(x, y, 0);
+                allocate_particle_from_pool(&game_state->particle_pool,
+                                            p, V3d(),
+                                            particle_radius,
+                                            is_pinned ? 0.0f : inv_particle_mass);
+            }
+        }
+    }
+    end_particle_allocation_from_pool(&game_state->particle_pool, group);
+
+    start_constraint_allocation_from_pool(&game_state->constraint_pool, group);
+    {
+        for(u32 y = 0;
+                y < particle_count_y;
+                ++y)
+        {
+            for(u32 x = 0;
+                    x < particle_count_x;
+                    ++x)
+            {
+                u32 index = y*particle_count_x + x;
+                if(x + 1 < particle_count_x)
+                {
+                    add_distance_constraint(&game_state->constraint_pool, group, index, index + 1);
+                }
+
+                if(y + 1 < particle_count_y)
+                {
+                    add_distance_constraint(&game_state->constraint_pool, group, index, index + particle_count_x);
+
+                    if(x + 1 < particle_count_x)
+                    {
+                        add_distance_constraint(&game_state->constraint_pool, group, index, index + particle_count_x + 1);
+                        add_distance_constraint(&game_state->constraint_pool, group, index + 1, index + particle_count_x);
+                    }
+                }
+            }
+        }
+    }
+    end_constraint_allocation_from_pool(&game_state->constraint_pool, group);
+
+    group->inv_distance_stiffness = inv_edge_stiffness;
+
+    return result;
+}
+
 
 
 
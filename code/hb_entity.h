@@ -27,6 +27,8 @@ enum EntityFlag
     EntityFlag_RigidBody = (1<<3),
     EntityFlag_Linear = (1<<4),
     EntityFlag_Quadratic = (1<<5),
+    // NOTE(gh) Particles are held together by the density constraint instead of the shape matching
+    EntityFlag_Fluid = (1<<6),
 };
 
 // TODO(gh) For some entities such as rigid body or pbd based entities
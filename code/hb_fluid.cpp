@@ -618,54 +618,6 @@ validate_divergence(f32 *x, f32 *y, f32 *z, v3u cell_count, f32 cell_dim)
 
 
 
-
-internal void
-initialize_fluid_cube_mac(FluidCubeMAC *cube, MemoryArena *arena, ThreadWorkQueue *gpu_work_queue, 
-                        v3 left_bottom_p, v3i cell_count, f32 cell_dim)
-{
-    cube->min = left_bottom_p;
-    cube->max = cube->min + cell_dim*V3(cell_count.x, cell_count.y, cell_count.z);
-
-    cube->cell_count = cell_count;
-    cube->cell_dim = cell_dim;
-
-    cube->total_x_count = (cell_count.x+1)*cell_count.y*cell_count.z;
-    cube->total_y_count = cell_count.x*(cell_count.y+1)*cell_count.z;
-    cube->total_z_count = cell_count.x*cell_count.y*(cell_count.z+1);
-    cube->total_center_count = cell_count.x*cell_count.y*cell_count.z;
-
-    cube->v_x = get_gpu_visible_buffer(gpu_work_queue, sizeof(f32)*2*cube->total_x_count);
-    cube->v_y = get_gpu_visible_buffer(gpu_work_queue, sizeof(f32)*2*cube->total_y_count);
-    cube->v_z = get_gpu_visible_buffer(gpu_work_queue, sizeof(f32)*2*cube->total_z_count);
-    zero_memory(cube->v_x.memory, sizeof(f32)*2*cube->total_x_count);
-    zero_memory(cube->v_y.memory, sizeof(f32)*2*cube->total_y_count);
-    zero_memory(cube->v_z.memory, sizeof(f32)*2*cube->total_z_count);
-    flush_gpu_visible_buffer(&cube->v_x);
-    flush_gpu_visible_buffer(&cube->v_y);
-    flush_gpu_visible_buffer(&cube->v_z);
-
-    cube->pressure_x = push_array(arena, f32, cube->total_center_count);
-    cube->pressure_y = push_array(arena, f32, cube->total_center_count);
-    cube->pressure_z = push_array(arena, f32, cube->total_center_count);
-
-    cube->temp_buffer_x = push_array(arena, f32, cube->total_center_count);
-    cube->temp_buffer_y = push_array(arena, f32, cube->total_center_count);
-    cube->temp_buffer_z = push_array(arena, f32, cube->total_center_count);
-
-    cube->densities = push_array(arena, f32, 2*cube->total_center_count);
-
-    zero_memory(cube->densities, sizeof(f32)*2*cube->total_center_count);
-
-    cube->v_x_dest = (f32 *)cube->v_x.memory;
-    cube->v_x_source = (f32 *)cube->v_x_dest + cube->total_x_count;
-    cube->v_y_dest = (f32 *)cube->v_y.memory;
-    cube->v_y_source = (f32 *)cube->v_y_dest + cube->total_y_count;
-    cube->v_z_dest = (f32 *)cube->v_z.memory;
-    cube->v_z_source = (f32 *)cube->v_z_dest + cube->total_z_count;
-
-    cube->density_dest = cube->densities;
-    cube->density_source = cube->densities + cube->total_center_count;
-}
 
 struct MACID
 {
@@ -812,71 +764,1182 @@ overwrite_input_to_center(f32 *dest, f32 value, i32 x, i32 y, i32 z, v3i cell_co
 }
 
 internal void
-update_with_input(f32 *dest, f32 *source, f32 *input, u32 total_count, f32 dt)
+update_with_input(f32 *dest, f32 *source, f32 *input, u32 total_count, f32 dt)
+{
+    // NOTE(gh) input is guaranteed to be as large as source and dest
+    for(u32 i = 0;
+            i < total_count;
+            ++i)
+    {
+        dest[i] = source[i] + dt*input[i];
+    }
+}
+
+/*
+   NOTE(gh) Every grid of the pressure solve(pressures, rhs, residuals...) has one layer of ghost cells around it,
+   so the count is (x+2)*(y+2)*(z+2). The ghost cells are filled by a separate pass before the stencils read them,
+   which lets the stencils go through the whole row without checking where the walls are.
+   The velocities don't need this, because the faces on the walls are already inside the MAC grid.
+*/
+inline i32
+get_padded_index(i32 x, i32 y, i32 z, v3i cell_count)
+{
+    i32 result = ((z+1)*(cell_count.y+2) + (y+1))*(cell_count.x+2) + (x+1);
+    return result;
+}
+
+inline u32
+get_padded_count(v3i cell_count)
+{
+    u32 result = (cell_count.x+2)*(cell_count.y+2)*(cell_count.z+2);
+    return result;
+}
+
+// NOTE(gh) The ghost cell gets the pressure of the cell next to it, so there's no pressure gradient across the wall.
+// With this, 6*P - (sum of the neighboring P) of the cell becomes (neighbor count)*P - (sum of the fluid neighbors),
+// where the neighbor count is 6 minus the number of walls that the cell is touching.
+// Edges and corners are also filled, because the prolongation reads them.
+internal void
+set_pressure_ghost_cells(f32 *p, v3i cell_count)
+{
+    i32 stride_y = cell_count.x+2;
+    i32 stride_z = stride_y*(cell_count.y+2);
+    for(i32 z = 0;
+            z < cell_count.z;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 ID = get_padded_index(0, y, z, cell_count);
+            p[ID - 1] = p[ID];
+            p[ID + cell_count.x] = p[ID + cell_count.x - 1];
+        }
+    }
+
+    for(i32 z = 0;
+            z < cell_count.z;
+            ++z)
+    {
+        for(i32 x = -1;
+                x <= cell_count.x;
+                ++x)
+        {
+            i32 ID = get_padded_index(x, 0, z, cell_count);
+            p[ID - stride_y] = p[ID];
+            p[ID + cell_count.y*stride_y] = p[ID + (cell_count.y-1)*stride_y];
+        }
+    }
+
+    for(i32 y = -1;
+            y <= cell_count.y;
+            ++y)
+    {
+        for(i32 x = -1;
+                x <= cell_count.x;
+                ++x)
+        {
+            i32 ID = get_padded_index(x, y, 0, cell_count);
+            p[ID - stride_z] = p[ID];
+            p[ID + cell_count.z*stride_z] = p[ID + (cell_count.z-1)*stride_z];
+        }
+    }
+}
+
+// NOTE(gh) Faces on the solid walls get the velocity of the wall.
+// TODO(gh) For now, we assume the solid wall is not moving 
+// later, we need to change this with the velocity of solid wall based on x, y, z direction
+internal void
+set_velocity_boundary_condition(f32 *v_x, f32 *v_y, f32 *v_z, v3i cell_count)
+{
+    for(i32 z = 0;
+            z < cell_count.z;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            v_x[get_mac_index_x(0, y, z, cell_count).ID0] = 0;
+            v_x[get_mac_index_x(cell_count.x-1, y, z, cell_count).ID1] = 0;
+        }
+    }
+
+    for(i32 z = 0;
+            z < cell_count.z;
+            ++z)
+    {
+        for(i32 x = 0;
+                x < cell_count.x;
+                ++x)
+        {
+            v_y[get_mac_index_y(x, 0, z, cell_count).ID0] = 0;
+            v_y[get_mac_index_y(x, cell_count.y-1, z, cell_count).ID1] = 0;
+        }
+    }
+
+    for(i32 y = 0;
+            y < cell_count.y;
+            ++y)
+    {
+        for(i32 x = 0;
+                x < cell_count.x;
+                ++x)
+        {
+            v_z[get_mac_index_z(x, y, 0, cell_count).ID0] = 0;
+            v_z[get_mac_index_z(x, y, cell_count.z-1, cell_count).ID1] = 0;
+        }
+    }
+}
+
+// NOTE(gh) Below this, waking up the threads costs more than the work itself.
+// This also keeps the coarse levels of the multigrid & the small cubes on the calling thread.
+#define fluid_slab_job_min_cell_count 8192
+#define fluid_max_slab_job_count 64
+
+internal
+THREAD_WORK_CALLBACK(thread_fluid_slab_callback)
+{
+    FluidSlabJob *job = (FluidSlabJob *)data;
+    job->kernel(job);
+}
+
+/*
+   NOTE(gh) Divides [0, slab_count) into the jobs and runs the kernel for each of them through the thread work queue,
+   and returns the sum of the jobs. cell_count_per_slab is used to decide how many jobs are worth it.
+   The division only depends on the counts, so the sums are the same whether the queue is 0(run everything here) or not.
+*/
+internal f64
+run_fluid_slab_jobs(ThreadWorkQueue *thread_work_queue, FluidSlabKernel *kernel, void *data,
+                    i32 slab_count, i32 cell_count_per_slab)
+{
+    i32 job_count = (slab_count*cell_count_per_slab)/fluid_slab_job_min_cell_count;
+    job_count = clamp(1, job_count, minimum(slab_count, fluid_max_slab_job_count));
+
+    FluidSlabJob jobs[fluid_max_slab_job_count];
+    for(i32 job_index = 0;
+            job_index < job_count;
+            ++job_index)
+    {
+        FluidSlabJob *job = jobs + job_index;
+        job->kernel = kernel;
+        job->data = data;
+        job->first = (slab_count*job_index)/job_count;
+        job->one_past_last = (slab_count*(job_index + 1))/job_count;
+        job->sum = 0;
+    }
+
+    if(thread_work_queue && job_count > 1)
+    {
+        for(i32 job_index = 0;
+                job_index < job_count;
+                ++job_index)
+        {
+            thread_work_queue->add_thread_work_queue_item(thread_work_queue, thread_fluid_slab_callback, 0,
+                                                          (void *)(jobs + job_index));
+        }
+        thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
+    }
+    else
+    {
+        for(i32 job_index = 0;
+                job_index < job_count;
+                ++job_index)
+        {
+            kernel(jobs + job_index);
+        }
+    }
+
+    f64 result = 0;
+    for(i32 job_index = 0;
+            job_index < job_count;
+            ++job_index)
+    {
+        result += jobs[job_index].sum;
+    }
+
+    return result;
+}
+
+// NOTE(gh) As we know that divergence should be 0, we can express it in mac grid.
+// Then, we can express each u or v with u(zero-div)= u(yes-div) - (density/dt)*gradient(P)
+// This works even if the cell was occupied by a solid wall, because we can think
+// of a solid wall having a 'ghost' pressure.
+// The result looks like : P = ((-cell_dim*density/dt)*Divergence(u(yes-div)) + all of neighboring P)/6
+// The faces on the walls should already have the wall velocity(see set_velocity_boundary_condition).
+internal
+FLUID_SLAB_KERNEL(build_pressure_rhs)
+{
+    FluidProjectionSlabData *d = (FluidProjectionSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+
+    // NOTE(gh) simplified version of -(cell_dim*cell_dim*density/dt) * divergence;
+    f32 a = -(d->cell_dim*d->density/d->dt);
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                MACID macID_x = get_mac_index_x(x, y, z, cell_count);
+                MACID macID_y = get_mac_index_y(x, y, z, cell_count);
+                MACID macID_z = get_mac_index_z(x, y, z, cell_count);
+
+                d->rhs[row + x] = a*(d->v_x[macID_x.ID1]-d->v_x[macID_x.ID0]+
+                                     d->v_y[macID_y.ID1]-d->v_y[macID_y.ID0]+
+                                     d->v_z[macID_z.ID1]-d->v_z[macID_z.ID0]);
+            }
+        }
+    }
+}
+
+internal u32
+get_pressure_multigrid_level_count(v3i cell_count)
+{
+    u32 result = 1;
+    // NOTE(gh) Keep halving while every axis can be halved & the coarser level still has 2 cells per axis
+    while(result < pressure_multigrid_max_level_count &&
+          (cell_count.x % 2) == 0 && (cell_count.y % 2) == 0 && (cell_count.z % 2) == 0 &&
+          cell_count.x >= 4 && cell_count.y >= 4 && cell_count.z >= 4)
+    {
+        cell_count.x /= 2;
+        cell_count.y /= 2;
+        cell_count.z /= 2;
+        result++;
+    }
+
+    return result;
+}
+
+// NOTE(gh) Doesn't include the pressures & rhs of level 0, which are provided by the user
+internal size_t
+get_pressure_multigrid_memory_size(v3i cell_count)
+{
+    size_t result = 0;
+    u32 level_count = get_pressure_multigrid_level_count(cell_count);
+    for(u32 level_index = 0;
+            level_index < level_count;
+            ++level_index)
+    {
+        size_t level_cell_count = get_padded_count(cell_count);
+        result += sizeof(f32)*((level_index == 0) ? level_cell_count : 3*level_cell_count);
+
+        cell_count.x /= 2;
+        cell_count.y /= 2;
+        cell_count.z /= 2;
+    }
+
+    return result;
+}
+
+internal void
+initialize_pressure_multigrid(PressureMultigrid *multigrid, MemoryArena *arena, v3i cell_count, f32 *pressures, f32 *rhs)
+{
+    zero_memory(multigrid, sizeof(*multigrid));
+
+    multigrid->level_count = get_pressure_multigrid_level_count(cell_count);
+    multigrid->max_v_cycle_count = 16;
+    multigrid->tolerance = 0.0001f;
+
+    for(u32 level_index = 0;
+            level_index < multigrid->level_count;
+            ++level_index)
+    {
+        PressureMultigridLevel *level = multigrid->levels + level_index;
+        level->cell_count = cell_count;
+
+        u32 level_cell_count = get_padded_count(cell_count);
+        if(level_index == 0)
+        {
+            level->pressures = pressures;
+            level->rhs = rhs;
+        }
+        else
+        {
+            level->pressures = push_array(arena, f32, level_cell_count);
+            level->rhs = push_array(arena, f32, level_cell_count);
+            zero_memory(level->pressures, sizeof(f32)*level_cell_count);
+            zero_memory(level->rhs, sizeof(f32)*level_cell_count);
+        }
+        level->residuals = push_array(arena, f32, level_cell_count);
+        zero_memory(level->residuals, sizeof(f32)*level_cell_count);
+
+        cell_count.x /= 2;
+        cell_count.y /= 2;
+        cell_count.z /= 2;
+    }
+}
+
+// NOTE(gh) Updates the cells of one color inside the slab
+internal
+FLUID_SLAB_KERNEL(smooth_pressure_red_black_slab)
+{
+    PressureSlabData *d = (PressureSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+    i32 stride_y = cell_count.x+2;
+    i32 stride_z = stride_y*(cell_count.y+2);
+
+    f32 *p = d->pressures;
+    f32 *rhs = d->rhs;
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = (d->color + y + z) & 1;
+                    x < cell_count.x;
+                    x += 2)
+            {
+                i32 ID = row + x;
+                p[ID] = (1.0f/6.0f)*(rhs[ID] +
+                                     p[ID - 1] + p[ID + 1] +
+                                     p[ID - stride_y] + p[ID + stride_y] +
+                                     p[ID - stride_z] + p[ID + stride_z]);
+            }
+        }
+    }
+}
+
+// NOTE(gh) Gauss-Seidel that updates all the 'red'((x+y+z) is even) cells first and the 'black' cells later.
+// Every neighbor of a red cell is black(and vice versa), so the result doesn't depend on the order inside the same color,
+// which also means that the slabs of the same color can be updated at the same time.
+internal void
+smooth_pressure_red_black(PressureMultigridLevel *level, ThreadWorkQueue *thread_work_queue, u32 sweep_count)
+{
+    v3i cell_count = level->cell_count;
+
+    PressureSlabData data = {};
+    data.cell_count = cell_count;
+    data.pressures = level->pressures;
+    data.rhs = level->rhs;
+    for(u32 sweep = 0;
+            sweep < sweep_count;
+            ++sweep)
+    {
+        // NOTE(gh) The ghost cell is only read by the cell next to it, which has the same color.
+        // So filling them once per sweep is enough to give every cell the pressure that it had before the update.
+        set_pressure_ghost_cells(level->pressures, cell_count);
+        for(i32 color = 0;
+                color < 2;
+                ++color)
+        {
+            data.color = color;
+            run_fluid_slab_jobs(thread_work_queue, smooth_pressure_red_black_slab, &data,
+                                cell_count.z, cell_count.x*cell_count.y);
+        }
+    }
+}
+
+internal
+FLUID_SLAB_KERNEL(compute_pressure_residual_slab)
+{
+    PressureSlabData *d = (PressureSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+    i32 stride_y = cell_count.x+2;
+    i32 stride_z = stride_y*(cell_count.y+2);
+
+    f32 *p = d->pressures;
+    f64 sum = 0;
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                i32 ID = row + x;
+                f32 residual = d->rhs[ID] - (6.0f*p[ID] -
+                                             (p[ID - 1] + p[ID + 1] +
+                                              p[ID - stride_y] + p[ID + stride_y] +
+                                              p[ID - stride_z] + p[ID + stride_z]));
+                d->result[ID] = residual;
+
+                sum += (f64)residual*(f64)residual;
+            }
+        }
+    }
+
+    job->sum = sum;
+}
+
+// NOTE(gh) Returns the squared length of the residual
+internal f64
+compute_pressure_residual(PressureMultigridLevel *level, ThreadWorkQueue *thread_work_queue)
+{
+    v3i cell_count = level->cell_count;
+    set_pressure_ghost_cells(level->pressures, cell_count);
+
+    PressureSlabData data = {};
+    data.cell_count = cell_count;
+    data.pressures = level->pressures;
+    data.rhs = level->rhs;
+    data.result = level->residuals;
+    f64 result = run_fluid_slab_jobs(thread_work_queue, compute_pressure_residual_slab, &data,
+                                     cell_count.z, cell_count.x*cell_count.y);
+
+    return result;
+}
+
+// NOTE(gh) The poisson equation is multiplied by cell_dim^2 on both sides,
+// so the rhs of the coarse level(which has twice the cell_dim) is 4 times the average of the fine residuals.
+// The slabs are the coarse slices, each of them reading two fine slices.
+internal
+FLUID_SLAB_KERNEL(restrict_pressure_residual)
+{
+    PressureSlabData *d = (PressureSlabData *)job->data;
+    PressureMultigridLevel *coarse = d->coarse;
+    v3i cell_count = coarse->cell_count;
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                f32 sum = 0;
+                for(i32 child_z = 0;
+                        child_z < 2;
+                        ++child_z)
+                {
+                    for(i32 child_y = 0;
+                            child_y < 2;
+                            ++child_y)
+                    {
+                        i32 child_ID = get_padded_index(2*x, 2*y + child_y, 2*z + child_z, d->cell_count);
+                        sum += d->result[child_ID] + d->result[child_ID + 1];
+                    }
+                }
+
+                coarse->rhs[row + x] = 0.5f*sum;
+                coarse->pressures[row + x] = 0;
+            }
+        }
+    }
+}
+
+// NOTE(gh) Trilinear interpolation of the coarse correction. The fine cell center is 1/4 of the coarse cell_dim
+// away from the center of the coarse cell that it's in, so it's 3/4 of that cell & 1/4 of the neighbor
+// that is on the same side(which is the ghost cell that has the same value, if the neighbor is a solid wall).
+// The slabs are the fine slices.
+internal
+FLUID_SLAB_KERNEL(prolongate_pressure_correction)
+{
+    PressureSlabData *d = (PressureSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+    v3i coarse_cell_count = d->coarse->cell_count;
+
+    f32 *p = d->coarse->pressures;
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        i32 z0 = z/2;
+        i32 z1 = z0 - 1 + 2*(z & 1);
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 y0 = y/2;
+            i32 y1 = y0 - 1 + 2*(y & 1);
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                i32 x0 = x/2;
+                i32 x1 = x0 - 1 + 2*(x & 1);
+
+                f32 correction =
+                    0.75f*(0.75f*(0.75f*p[get_padded_index(x0, y0, z0, coarse_cell_count)] + 0.25f*p[get_padded_index(x1, y0, z0, coarse_cell_count)]) +
+                           0.25f*(0.75f*p[get_padded_index(x0, y1, z0, coarse_cell_count)] + 0.25f*p[get_padded_index(x1, y1, z0, coarse_cell_count)])) +
+                    0.25f*(0.75f*(0.75f*p[get_padded_index(x0, y0, z1, coarse_cell_count)] + 0.25f*p[get_padded_index(x1, y0, z1, coarse_cell_count)]) +
+                           0.25f*(0.75f*p[get_padded_index(x0, y1, z1, coarse_cell_count)] + 0.25f*p[get_padded_index(x1, y1, z1, coarse_cell_count)]));
+
+                d->pressures[row + x] += correction;
+            }
+        }
+    }
+}
+
+internal void
+pressure_v_cycle(PressureMultigrid *multigrid, ThreadWorkQueue *thread_work_queue, u32 level_index)
+{
+    PressureMultigridLevel *level = multigrid->levels + level_index;
+    if(level_index == multigrid->level_count-1)
+    {
+        // NOTE(gh) Coarsest level has only a few cells, so we can just smooth it until it's solved
+        smooth_pressure_red_black(level, thread_work_queue, 32);
+    }
+    else
+    {
+        PressureMultigridLevel *coarse = multigrid->levels + level_index + 1;
+        v3i cell_count = level->cell_count;
+
+        PressureSlabData data = {};
+        data.cell_count = cell_count;
+        data.pressures = level->pressures;
+        data.result = level->residuals;
+        data.coarse = coarse;
+
+        smooth_pressure_red_black(level, thread_work_queue, 2);
+        compute_pressure_residual(level, thread_work_queue);
+        run_fluid_slab_jobs(thread_work_queue, restrict_pressure_residual, &data,
+                            coarse->cell_count.z, 2*cell_count.x*cell_count.y);
+
+        pressure_v_cycle(multigrid, thread_work_queue, level_index + 1);
+
+        set_pressure_ghost_cells(coarse->pressures, coarse->cell_count);
+        run_fluid_slab_jobs(thread_work_queue, prolongate_pressure_correction, &data,
+                            cell_count.z, cell_count.x*cell_count.y);
+        smooth_pressure_red_black(level, thread_work_queue, 2);
+    }
+}
+
+/*
+   NOTE(gh) Solves the pressure of level 0, starting from whatever is inside the pressure buffer.
+   rhs_length_square is |rhs|^2, see solve_fluid_pressure.
+*/
+internal void
+solve_pressure_multigrid(PressureMultigrid *multigrid, ThreadWorkQueue *thread_work_queue, f64 rhs_length_square)
+{
+    TIMED_BLOCK();
+
+    PressureMultigridLevel *level = multigrid->levels + 0;
+
+    multigrid->v_cycle_count = 0;
+    multigrid->relative_residual = 0;
+    if(rhs_length_square > 0)
+    {
+        f64 tolerance_square = (f64)multigrid->tolerance*(f64)multigrid->tolerance*rhs_length_square;
+        f64 residual_length_square = compute_pressure_residual(level, thread_work_queue);
+        while(residual_length_square > tolerance_square &&
+              multigrid->v_cycle_count < multigrid->max_v_cycle_count)
+        {
+            pressure_v_cycle(multigrid, thread_work_queue, 0);
+            f64 previous_residual_length_square = residual_length_square;
+            residual_length_square = compute_pressure_residual(level, thread_work_queue);
+            multigrid->v_cycle_count++;
+
+            // NOTE(gh) Each V-cycle normally cuts the residual by ~10x, no matter how big the grid is.
+            // If it doesn't, we hit the precision of f32(the bigger the grid, the sooner),
+            // and the next V-cycles will not make it any better.
+            if(residual_length_square > 0.25*previous_residual_length_square)
+            {
+                break;
+            }
+        }
+
+        multigrid->relative_residual = (f32)sqrt(residual_length_square/rhs_length_square);
+    }
+
+    DEBUG_VALUE("v-cycles", multigrid->v_cycle_count);
+    DEBUG_VALUE("relative residual", multigrid->relative_residual);
+}
+
+internal size_t
+get_pressure_pcg_memory_size(v3i cell_count)
+{
+    size_t result = 4*sizeof(f32)*get_padded_count(cell_count);
+    return result;
+}
+
+// NOTE(gh) Modified incomplete cholesky from Fluid Simulation for Computer Graphics by Robert Bridson.
+// The off-diagonals are -1 for every neighbor that is not a solid wall, 
+// and the ghost cells of the preconditioner stay 0 so that the walls drop out of the sweeps.
+internal void
+build_mic0_preconditioner(f32 *preconditioner, v3i cell_count)
+{
+    f32 tau = 0.97f; // how much of the dropped fill-in goes back into the diagonal
+    f32 sigma = 0.25f; // safety, for the diagonals that become too small
+
+    i32 stride_y = cell_count.x+2;
+    i32 stride_z = stride_y*(cell_count.y+2);
+    for(i32 z = 0;
+            z < cell_count.z;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                i32 ID = get_padded_index(x, y, z, cell_count);
+
+                // NOTE(gh) 1 if there's a neighbor in + direction, which makes A(+) of that axis -1
+                f32 has_x1 = (x < cell_count.x-1) ? 1.0f : 0.0f;
+                f32 has_y1 = (y < cell_count.y-1) ? 1.0f : 0.0f;
+                f32 has_z1 = (z < cell_count.z-1) ? 1.0f : 0.0f;
+                f32 diagonal = has_x1 + has_y1 + has_z1 + 
+                               ((x > 0) ? 1.0f : 0.0f) + ((y > 0) ? 1.0f : 0.0f) + ((z > 0) ? 1.0f : 0.0f);
+
+                f32 p_x = preconditioner[ID - 1];
+                f32 p_y = preconditioner[ID - stride_y];
+                f32 p_z = preconditioner[ID - stride_z];
+                f32 e = diagonal - 
+                        p_x*p_x*(1.0f + tau*(has_y1 + has_z1)) - 
+                        p_y*p_y*(1.0f + tau*(has_x1 + has_z1)) - 
+                        p_z*p_z*(1.0f + tau*(has_x1 + has_y1));
+
+                if(e < sigma*diagonal)
+                {
+                    e = diagonal;
+                }
+
+                preconditioner[ID] = 1.0f/sqrtf(e);
+            }
+        }
+    }
+}
+
+internal void
+initialize_pressure_pcg(PressurePCG *pcg, MemoryArena *arena, v3i cell_count)
+{
+    zero_memory(pcg, sizeof(*pcg));
+
+    u32 padded_count = get_padded_count(cell_count);
+    pcg->residuals = push_array(arena, f32, padded_count);
+    pcg->z = push_array(arena, f32, padded_count);
+    pcg->search = push_array(arena, f32, padded_count);
+    pcg->preconditioner = push_array(arena, f32, padded_count);
+    zero_memory(pcg->residuals, 4*sizeof(f32)*padded_count);
+
+    pcg->max_iteration_count = 256;
+    pcg->tolerance = 0.0001f;
+
+    build_mic0_preconditioner(pcg->preconditioner, cell_count);
+}
+
+internal
+FLUID_SLAB_KERNEL(apply_pressure_operator_slab)
+{
+    PressureSlabData *d = (PressureSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+    i32 stride_y = cell_count.x+2;
+    i32 stride_z = stride_y*(cell_count.y+2);
+
+    f32 *p = d->pressures;
+    f32 *result = d->result;
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                i32 ID = row + x;
+                result[ID] = 6.0f*p[ID] - 
+                             (p[ID - 1] + p[ID + 1] + 
+                              p[ID - stride_y] + p[ID + stride_y] + 
+                              p[ID - stride_z] + p[ID + stride_z]);
+            }
+        }
+    }
+}
+
+// NOTE(gh) result = A*p, only the interior cells of the result are written
+internal void
+apply_pressure_operator(f32 *result, f32 *p, v3i cell_count, ThreadWorkQueue *thread_work_queue)
+{
+    set_pressure_ghost_cells(p, cell_count);
+
+    PressureSlabData data = {};
+    data.cell_count = cell_count;
+    data.pressures = p;
+    data.result = result;
+    run_fluid_slab_jobs(thread_work_queue, apply_pressure_operator_slab, &data,
+                        cell_count.z, cell_count.x*cell_count.y);
+}
+
+// NOTE(gh) result = M^-1 * r, where M = LL^T. Solves L*q = r first and then L^T*result = q,
+// and q is kept inside the result. Each cell depends on the cells that were solved right before it,
+// so unlike the other stencils, this can't be divided into the slabs.
+// Both the preconditioner and the result have 0 inside the ghost cells, so the walls don't need any branch.
+internal void
+apply_mic0_preconditioner(f32 *result, f32 *r, f32 *preconditioner, v3i cell_count)
+{
+    i32 stride_y = cell_count.x+2;
+    i32 stride_z = stride_y*(cell_count.y+2);
+    for(i32 z = 0;
+            z < cell_count.z;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                i32 ID = row + x;
+                f32 t = r[ID] + 
+                        preconditioner[ID - 1]*result[ID - 1] + 
+                        preconditioner[ID - stride_y]*result[ID - stride_y] + 
+                        preconditioner[ID - stride_z]*result[ID - stride_z];
+                result[ID] = t*preconditioner[ID];
+            }
+        }
+    }
+
+    for(i32 z = cell_count.z-1;
+            z >= 0;
+            --z)
+    {
+        for(i32 y = cell_count.y-1;
+                y >= 0;
+                --y)
+        {
+            i32 row = get_padded_index(0, y, z, cell_count);
+            for(i32 x = cell_count.x-1;
+                    x >= 0;
+                    --x)
+            {
+                i32 ID = row + x;
+                f32 t = result[ID + 1] + result[ID + stride_y] + result[ID + stride_z];
+                result[ID] = (result[ID] + preconditioner[ID]*t)*preconditioner[ID];
+            }
+        }
+    }
+}
+
+internal f64
+dot_f32_arrays(f32 *a, f32 *b, u32 count)
+{
+    f64 result = 0;
+    for(u32 i = 0;
+            i < count;
+            ++i)
+    {
+        result += (f64)a[i]*(f64)b[i];
+    }
+
+    return result;
+}
+
+// NOTE(gh) Same as solve_pressure_multigrid, the solve starts from whatever is inside the pressure buffer
+internal void
+solve_pressure_pcg(PressurePCG *pcg, ThreadWorkQueue *thread_work_queue, 
+                   f32 *pressures, f32 *rhs, v3i cell_count, f64 rhs_length_square)
+{
+    TIMED_BLOCK();
+
+    // NOTE(gh) The ghost cells of r, z & rhs are always 0, so the vector operations can go through the whole padded array.
+    // Ghost cells of the search direction & the pressure are not, but they are filled again before being read.
+    u32 total_cell_count = get_padded_count(cell_count);
+
+    pcg->iteration_count = 0;
+    pcg->relative_residual = 0;
+    if(rhs_length_square > 0)
+    {
+        f32 *r = pcg->residuals;
+        f32 *z = pcg->z;
+        f32 *s = pcg->search;
+
+        // NOTE(gh) r = rhs - A*p
+        apply_pressure_operator(z, pressures, cell_count, thread_work_queue);
+        for(u32 i = 0;
+                i < total_cell_count;
+                ++i)
+        {
+            r[i] = rhs[i] - z[i];
+        }
+
+        f64 tolerance_square = (f64)pcg->tolerance*(f64)pcg->tolerance*rhs_length_square;
+        f64 residual_length_square = dot_f32_arrays(r, r, total_cell_count);
+        if(residual_length_square > tolerance_square)
+        {
+            apply_mic0_preconditioner(z, r, pcg->preconditioner, cell_count);
+            memcpy(s, z, sizeof(f32)*total_cell_count);
+            f64 rho = dot_f32_arrays(z, r, total_cell_count);
+
+            while(pcg->iteration_count < pcg->max_iteration_count)
+            {
+                apply_pressure_operator(z, s, cell_count, thread_work_queue);
+                f64 z_dot_s = dot_f32_arrays(z, s, total_cell_count);
+                if(z_dot_s <= 0)
+                {
+                    // NOTE(gh) Search direction is already in the null space(or we ran out of the precision)
+                    break;
+                }
+                f32 alpha = (f32)(rho/z_dot_s);
+
+                for(u32 i = 0;
+                        i < total_cell_count;
+                        ++i)
+                {
+                    pressures[i] += alpha*s[i];
+                    r[i] -= alpha*z[i];
+                }
+                pcg->iteration_count++;
+
+                residual_length_square = dot_f32_arrays(r, r, total_cell_count);
+                if(residual_length_square <= tolerance_square)
+                {
+                    break;
+                }
+
+                apply_mic0_preconditioner(z, r, pcg->preconditioner, cell_count);
+                f64 new_rho = dot_f32_arrays(z, r, total_cell_count);
+                f32 beta = (f32)(new_rho/rho);
+                rho = new_rho;
+
+                for(u32 i = 0;
+                        i < total_cell_count;
+                        ++i)
+                {
+                    s[i] = z[i] + beta*s[i];
+                }
+            }
+        }
+
+        pcg->relative_residual = (f32)sqrt(residual_length_square/rhs_length_square);
+    }
+
+    DEBUG_VALUE("iterations", pcg->iteration_count);
+    DEBUG_VALUE("relative residual", pcg->relative_residual);
+}
+
+internal size_t
+get_fluid_pressure_solver_memory_size(v3i cell_count, FluidPressureSolverType type)
+{
+    size_t result = 2*sizeof(f32)*get_padded_count(cell_count);
+    switch(type)
+    {
+        case FluidPressureSolverType_Multigrid:
+        {
+            result += get_pressure_multigrid_memory_size(cell_count);
+        }break;
+
+        case FluidPressureSolverType_PCG:
+        {
+            result += get_pressure_pcg_memory_size(cell_count);
+        }break;
+    }
+
+    return result;
+}
+
+internal void
+initialize_fluid_pressure_solver(FluidPressureSolver *solver, MemoryArena *arena, v3i cell_count, FluidPressureSolverType type)
+{
+    zero_memory(solver, sizeof(*solver));
+
+    solver->type = type;
+    solver->cell_count = cell_count;
+
+    u32 padded_count = get_padded_count(cell_count);
+    solver->pressures = push_array(arena, f32, padded_count);
+    solver->rhs = push_array(arena, f32, padded_count);
+    zero_memory(solver->pressures, sizeof(f32)*padded_count);
+    zero_memory(solver->rhs, sizeof(f32)*padded_count);
+
+    switch(type)
+    {
+        case FluidPressureSolverType_Multigrid:
+        {
+            initialize_pressure_multigrid(&solver->multigrid, arena, cell_count, solver->pressures, solver->rhs);
+        }break;
+
+        case FluidPressureSolverType_PCG:
+        {
+            initialize_pressure_pcg(&solver->pcg, arena, cell_count);
+        }break;
+    }
+}
+
+internal
+FLUID_SLAB_KERNEL(sum_pressure_rhs)
+{
+    PressureSlabData *d = (PressureSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+
+    f64 sum = 0;
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            f32 *rhs = d->rhs + get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                sum += rhs[x];
+            }
+        }
+    }
+
+    job->sum = sum;
+}
+
+// NOTE(gh) Also sums up |rhs|^2
+internal
+FLUID_SLAB_KERNEL(remove_pressure_rhs_mean)
+{
+    PressureSlabData *d = (PressureSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+
+    f64 length_square = 0;
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            f32 *rhs = d->rhs + get_padded_index(0, y, z, cell_count);
+            for(i32 x = 0;
+                    x < cell_count.x;
+                    ++x)
+            {
+                rhs[x] -= d->rhs_mean;
+                length_square += (f64)rhs[x]*(f64)rhs[x];
+            }
+        }
+    }
+
+    job->sum = length_square;
+}
+
+/*
+   NOTE(gh) The solid walls are all around the cube, so the pressure is only defined up to a constant
+   and the equation has a solution only if the rhs sums up to 0.
+   build_pressure_rhs already does that, but the sum is removed here again to get rid of the floating point error.
+
+   Returns false when the rhs is 0(i.e the velocity is already divergence free), 
+   in which case the pressure is 0 and there's nothing to subtract.
+*/
+internal b32
+solve_fluid_pressure(FluidPressureSolver *solver, ThreadWorkQueue *thread_work_queue)
+{
+    v3i cell_count = solver->cell_count;
+    u32 total_cell_count = cell_count.x*cell_count.y*cell_count.z;
+
+    PressureSlabData data = {};
+    data.cell_count = cell_count;
+    data.rhs = solver->rhs;
+
+    f64 rhs_sum = run_fluid_slab_jobs(thread_work_queue, sum_pressure_rhs, &data,
+                                      cell_count.z, cell_count.x*cell_count.y);
+    data.rhs_mean = (f32)(rhs_sum/total_cell_count);
+    f64 rhs_length_square = run_fluid_slab_jobs(thread_work_queue, remove_pressure_rhs_mean, &data,
+                                                cell_count.z, cell_count.x*cell_count.y);
+
+    b32 result = (rhs_length_square > 0);
+    if(!result)
+    {
+        // NOTE(gh) Otherwise the warm start pressure of the last frame would be subtracted from the velocity
+        zero_memory(solver->pressures, sizeof(f32)*get_padded_count(cell_count));
+    }
+
+    // NOTE(gh) Both solvers skip the solve and report 0 iteration & 0 residual when the rhs is 0
+    switch(solver->type)
+    {
+        case FluidPressureSolverType_Multigrid:
+        {
+            solve_pressure_multigrid(&solver->multigrid, thread_work_queue, rhs_length_square);
+        }break;
+
+        case FluidPressureSolverType_PCG:
+        {
+            solve_pressure_pcg(&solver->pcg, thread_work_queue, solver->pressures, solver->rhs, solver->cell_count, rhs_length_square);
+        }break;
+    }
+
+    return result;
+}
+
+// NOTE(gh) Do u(n+1) = u(n) - (dt/density)*gradient(P) for all three components.
+// Only the faces between two fluid cells are written, the faces on the walls are left to set_velocity_boundary_condition.
+// Each component goes through its own layout, so that the innermost loop is always contiguous.
+// The z faces of the slab are the ones below each slice(z = 0 is on the wall), so no face is written by two slabs.
+internal
+FLUID_SLAB_KERNEL(subtract_pressure_gradient)
+{
+    FluidProjectionSlabData *d = (FluidProjectionSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+
+    f32 c = (d->dt/(d->density*d->cell_dim));
+    i32 stride_y = cell_count.x+2;
+    i32 stride_z = stride_y*(cell_count.y+2);
+
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            f32 *p = d->pressures + get_padded_index(0, y, z, cell_count);
+            i32 face_row = get_mac_index_x(0, y, z, cell_count).ID0;
+            for(i32 x = 1;
+                    x < cell_count.x;
+                    ++x)
+            {
+                i32 ID = face_row + x;
+                d->dest_x[ID] = d->v_x[ID] - c*(p[x] - p[x - 1]);
+            }
+        }
+    }
+
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        for(i32 x = 0;
+                x < cell_count.x;
+                ++x)
+        {
+            f32 *p = d->pressures + get_padded_index(x, 0, z, cell_count);
+            i32 face_row = get_mac_index_y(x, 0, z, cell_count).ID0;
+            for(i32 y = 1;
+                    y < cell_count.y;
+                    ++y)
+            {
+                i32 ID = face_row + y;
+                d->dest_y[ID] = d->v_y[ID] - c*(p[y*stride_y] - p[(y - 1)*stride_y]);
+            }
+        }
+    }
+
+    for(i32 y = 0;
+            y < cell_count.y;
+            ++y)
+    {
+        for(i32 x = 0;
+                x < cell_count.x;
+                ++x)
+        {
+            f32 *p = d->pressures + get_padded_index(x, y, 0, cell_count);
+            i32 face_row = get_mac_index_z(x, y, 0, cell_count).ID0;
+            for(i32 z = maximum(job->first, 1);
+                    z < job->one_past_last;
+                    ++z)
+            {
+                i32 ID = face_row + z;
+                d->dest_z[ID] = d->v_z[ID] - c*(p[z*stride_z] - p[(z - 1)*stride_z]);
+            }
+        }
+    }
+}
+
+
+// NOTE(gh) N-S mementum equation does have a pressure term (-delP/density),
+// but we don't know the pressure that will satisfy the continuity equation (divergence(u) = 0)
+// So we need to get the pressure, and subtract it from the result of the N-S equation.
+// All three components share the same pressure, so the pressure is solved only once.
+internal void
+project_and_enforce_boundary_condition(f32 *dest_x, f32 *dest_y, f32 *dest_z, f32 *v_x, f32 *v_y, f32 *v_z, 
+                                       FluidPressureSolver *solver, ThreadWorkQueue *thread_work_queue, 
+                                       f32 cell_dim, f32 dt)
 {
-    // NOTE(gh) input is guaranteed to be as large as source and dest
-    for(u32 i = 0;
-            i < total_count;
-            ++i)
+    TIMED_BLOCK();
+    v3i cell_count = solver->cell_count;
+
+    FluidProjectionSlabData data = {};
+    data.cell_count = cell_count;
+    data.cell_dim = cell_dim;
+    // TODO(gh) For now, we will assume that the density is uniform across the board.
+    // Later, we would want to do something else(AKA smoke)
+    data.density = 997; // density of water
+    data.dt = dt;
+    data.dest_x = dest_x;
+    data.dest_y = dest_y;
+    data.dest_z = dest_z;
+    data.v_x = v_x;
+    data.v_y = v_y;
+    data.v_z = v_z;
+    data.rhs = solver->rhs;
+    data.pressures = solver->pressures;
+
+    set_velocity_boundary_condition(v_x, v_y, v_z, cell_count);
+    run_fluid_slab_jobs(thread_work_queue, build_pressure_rhs, &data, cell_count.z, cell_count.x*cell_count.y);
+    // NOTE(gh) The pressure doesn't change much between the frames, so the solve starts from the last pressure
+    if(solve_fluid_pressure(solver, thread_work_queue))
     {
-        dest[i] = source[i] + dt*input[i];
+        run_fluid_slab_jobs(thread_work_queue, subtract_pressure_gradient, &data, cell_count.z, cell_count.x*cell_count.y);
+    }
+    else
+    {
+        memcpy(dest_x, v_x, sizeof(f32)*(cell_count.x+1)*cell_count.y*cell_count.z);
+        memcpy(dest_y, v_y, sizeof(f32)*cell_count.x*(cell_count.y+1)*cell_count.z);
+        memcpy(dest_z, v_z, sizeof(f32)*cell_count.x*cell_count.y*(cell_count.z+1));
     }
+    set_velocity_boundary_condition(dest_x, dest_y, dest_z, cell_count);
 }
 
 internal f32
-get_neighboring_pressure_with_boundary_condition(f32 *pressures, i32 center_x, i32 center_y, i32 center_z, v3i offset, v3i cell_count)
+get_divergence_mac(f32 *v_x, f32 *v_y, f32 *v_z, i32 x, i32 y, i32 z, v3i cell_count, f32 cell_dim)
 {
-    f32 result = 0;
+    MACID macID_x = get_mac_index_x(x, y, z, cell_count);
+    MACID macID_y = get_mac_index_y(x, y, z, cell_count);
+    MACID macID_z = get_mac_index_z(x, y, z, cell_count);
 
-    i32 x = center_x+offset.x;
-    i32 y = center_y+offset.y;
-    i32 z = center_z+offset.z;
+    f32 result = (v_x[macID_x.ID1]-v_x[macID_x.ID0] + 
+                  v_y[macID_y.ID1]-v_y[macID_y.ID0] + 
+                  v_z[macID_z.ID1]-v_z[macID_z.ID0])/cell_dim;
 
-    b32 is_solid_wall = false;
-    if(x < 0 || x >= cell_count.x ||
-        y < 0 || y >= cell_count.y ||
-        z < 0 || z >= cell_count.z)
-    {
-        // TODO(gh) For now, we will assume that the fluid cube is 
-        // covered with solid walls for now(which sets the pressure to the center cell)
-        // but we should also handle free-space case, which will just set the pressure to 0.
-        is_solid_wall = true;
-    }
+    return result;
+}
 
-    if(is_solid_wall)
-    {
-        // Set the pressure to the center P, which effectively negates 1 from the coefficient of center P in the equation
-        // (4 in 2D, 6 in 3D)
-        result = pressures[get_mac_index_center(center_x, center_y, center_z, cell_count)];
-    }
-    else
-    {
-        result = pressures[get_mac_index_center(x, y, z, cell_count)];
-    }
+// NOTE(gh) Sum of the magnitudes of the terms in get_divergence_mac, which bounds the floating point error of it
+internal f32
+get_divergence_magnitude_mac(f32 *v_x, f32 *v_y, f32 *v_z, i32 x, i32 y, i32 z, v3i cell_count, f32 cell_dim)
+{
+    MACID macID_x = get_mac_index_x(x, y, z, cell_count);
+    MACID macID_y = get_mac_index_y(x, y, z, cell_count);
+    MACID macID_z = get_mac_index_z(x, y, z, cell_count);
+
+    f32 result = (abs_f32(v_x[macID_x.ID1]) + abs_f32(v_x[macID_x.ID0]) + 
+                  abs_f32(v_y[macID_y.ID1]) + abs_f32(v_y[macID_y.ID0]) + 
+                  abs_f32(v_z[macID_z.ID1]) + abs_f32(v_z[macID_z.ID0]))/cell_dim;
 
     return result;
 }
 
-// NOTE(gh) N-S mementum equation does have a pressure term (-delP/density),
-// but we don't know the pressure that will satisfy the continuity equation (divergence(u) = 0)
-// So we need to get the pressure, and subtract it from the result of the N-S equation
-internal void
-project_and_enforce_boundary_condition(f32 *dest, f32 *source, f32 *v_x, f32 *v_y, f32 *v_z, 
-                                        f32 *pressures, f32 *temp_buffer,
-                                        v3i cell_count, f32 cell_dim, f32 dt, FluidQuantityType quantity_type)
+internal f32
+get_max_divergence_mac(f32 *v_x, f32 *v_y, f32 *v_z, v3i cell_count, f32 cell_dim)
 {
-    TIMED_BLOCK();
-    // IMPORTANT(gh) : pressures and temp buffer SHOULD be initialized to 0!!! 
-    
-    // TODO(gh) For now, we will assume that the density is uniform across the board.
-    // Later, we would want to do something else(AKA smoke)
-    f32 density = 997; // density of water
-
-    // As we know that divergence should be 0, we can express it in mac grid.
-    // Then, we can express each u or v with u(zero-div)= u(yes-div) - (density/dt)*gradient(P)
-    // This works even if the cell was occupied by a solid wall, because we can think
-    // of a solid wall having a 'ghost' pressure.
-    // The result looks like : P = ((-cell_dim*density/dt)*Divergence(u(yes-div)) + all of neighboring P)/6
+    f32 result = 0;
     for(i32 z = 0;
             z < cell_count.z;
             ++z)
@@ -889,92 +1952,54 @@ project_and_enforce_boundary_condition(f32 *dest, f32 *source, f32 *v_x, f32 *v_
                     x < cell_count.x;
                     ++x)
             {
-                MACID macID_x = get_mac_index_x(x, y, z, cell_count);
-                MACID macID_y = get_mac_index_y(x, y, z, cell_count);
-                MACID macID_z = get_mac_index_z(x, y, z, cell_count);
-
-                // NOTE(gh) This is (-cell_dim*cell_dim*density/dt)*Divergence(u(yes-div)) - (cell_dim*density/dt)*(u - u)(soild-fluid or fluid-solid, depending on where the solid wall was located) 
-                // for each solid wall boundary)
-                f32 a = -(cell_dim*density/dt);
-                // simplified version of -(cell_dim*cell_dim*density/dt) * divergence;
-                f32 rhs = a*(v_x[macID_x.ID1]-v_x[macID_x.ID0]+v_y[macID_y.ID1]-v_y[macID_y.ID0]+v_z[macID_z.ID1]-v_z[macID_z.ID0]); 
-                 
-                // TODO(gh) Set these properly when we have moving object
-                f32 solid_wall_x0 = 0;
-                f32 solid_wall_x1 = 0;
-                f32 solid_wall_y0 = 0;
-                f32 solid_wall_y1 = 0;
-                f32 solid_wall_z0 = 0;
-                f32 solid_wall_z1 = 0;
-                // If the neighboring cell was located at the boundary,
-                // we should set the 'ghost' pressure with the solid wall velocity
-                if(x == 0)
-                {
-                    rhs += a*(v_x[macID_x.ID0] - solid_wall_x0);
-                }
-                else if(x == cell_count.x-1)
-                {
-                    rhs -= a*(v_x[macID_x.ID1] - solid_wall_x1);
-                }
-
-                if(y == 0)
-                {
-                    rhs += a*(v_y[macID_y.ID0] - solid_wall_y0);
-                }
-                else if(y == cell_count.y-1)
-                {
-                    rhs -= a*(v_y[macID_y.ID1] - solid_wall_y1);
-                }
-
-                if(z == 0)
-                {
-                    rhs += a * (v_z[macID_z.ID0] - solid_wall_z0);
-                }
-                else if(z == cell_count.z-1)
-                {
-                    rhs -= a*(v_z[macID_z.ID1] - solid_wall_z1);
-                }
-
-                temp_buffer[get_mac_index_center(x, y, z, cell_count)] = rhs;
+                result = maximum(result, abs_f32(get_divergence_mac(v_x, v_y, v_z, x, y, z, cell_count, cell_dim)));
             }
         }
     }
 
+    return result;
+}
+
+/*
+   NOTE(gh) Same as validate_divergence, but for the MAC grid. Checks the velocities that came out of 
+   project_and_enforce_boundary_condition(dest) against the ones that went in(v).
+   The rhs of the pressure solve is -(density*cell_dim*cell_dim/dt)*divergence of v, and the divergence of dest is 
+   -(dt/(density*cell_dim*cell_dim))*residual. So if the solver got |residual| <= tolerance*|rhs|,
+   |divergence of dest| <= tolerance*|divergence of v| as well.
+
+   That doesn't hold when the divergence of v is tiny compared to v itself, 
+   because dest = v - c*gradient(P) is rounded to f32 per face. 
+   Each face is off by at most ~epsilon*(|v| + |dest|), so the divergence of each cell gets that much of slack.
+*/
+internal void
+validate_divergence_mac(f32 *dest_x, f32 *dest_y, f32 *dest_z, f32 *v_x, f32 *v_y, f32 *v_z, 
+                        FluidPressureSolver *solver, f32 cell_dim)
+{
+    v3i cell_count = solver->cell_count;
 
-    // TODO(gh) We will stick with the basic Jacobi iteration for now, but we might wanna
-    // switch to a better and faster converging algorithm.
-    for(u32 iter = 0;
-            iter < 80;
-            ++iter)
+    f32 tolerance = 0;
+    f32 relative_residual = 0;
+    switch(solver->type)
     {
-        for(i32 z = 0;
-                z < cell_count.z;
-                ++z)
+        case FluidPressureSolverType_Multigrid:
         {
-            for(i32 y = 0;
-                    y < cell_count.y;
-                    ++y)
-            {
-                for(i32 x = 0;
-                        x < cell_count.x;
-                        ++x)
-                {
-                    u32 centerID = get_mac_index_center(x, y, z, cell_count);
-                    pressures[centerID] = 
-                        (1.0f/6.0f)*(temp_buffer[centerID]+
-                                    get_neighboring_pressure_with_boundary_condition(pressures, x, y, z, V3i(1, 0, 0), cell_count) +
-                                    get_neighboring_pressure_with_boundary_condition(pressures, x, y, z, V3i(-1, 0, 0), cell_count) +
-                                    get_neighboring_pressure_with_boundary_condition(pressures, x, y, z, V3i(0, 1, 0), cell_count) +
-                                    get_neighboring_pressure_with_boundary_condition(pressures, x, y, z, V3i(0, -1, 0), cell_count) +
-                                    get_neighboring_pressure_with_boundary_condition(pressures, x, y, z, V3i(0, 0, 1), cell_count) +
-                                    get_neighboring_pressure_with_boundary_condition(pressures, x, y, z, V3i(0, 0, -1), cell_count));
-                }
-            }
-        }
+            tolerance = solver->multigrid.tolerance;
+            relative_residual = solver->multigrid.relative_residual;
+        }break;
+
+        case FluidPressureSolverType_PCG:
+        {
+            tolerance = solver->pcg.tolerance;
+            relative_residual = solver->pcg.relative_residual;
+        }break;
     }
-    
-    // NOTE(gh) Do u(n+1) = u(n) - (dt/density)*divergence(P)
-    f32 c = (dt/(density*cell_dim));
+    // NOTE(gh) The solver can stop before reaching the tolerance(i.e the multigrid hitting the precision of f32),
+    // in which case we can only ask for what it actually got
+    tolerance = maximum(tolerance, relative_residual);
+
+    f64 length_square = 0;
+    f64 dest_length_square = 0;
+    f64 rounding_length_square = 0;
     for(i32 z = 0;
             z < cell_count.z;
             ++z)
@@ -987,317 +2012,284 @@ project_and_enforce_boundary_condition(f32 *dest, f32 *source, f32 *v_x, f32 *v_
                     x < cell_count.x;
                     ++x)
             {
-                f32 center_pressure = pressures[get_mac_index_center(x,y,z,cell_count)];
-                // TODO(gh) For now, we assume the solid wall is not moving 
-                // later, we need to change this with the velocity of solid wall based on x, y, z direction
-                switch(quantity_type)
-                {
-                    case FluidQuantityType_x:
-                    {
-                        MACID macID = get_mac_index_x(x, y, z, cell_count);
-
-                        if(x == cell_count.x-1)
-                        {
-                            // fluid - solid
-                            dest[macID.ID1] = 0;
-                        }
-                        else
-                        {
-                            // We always(and only) set the dest with higher ID, so we need to explicitly set the left boundary
-                            if(x == 0)
-                            {
-                                // solid - fluid
-                                dest[macID.ID0] = 0;
-                            }
-
-                            dest[macID.ID1] = source[macID.ID1] - c*(pressures[get_mac_index_center(x+1,y,z,cell_count)] - center_pressure);
-                        }
-                    }break;
-
-                    case FluidQuantityType_y:
-                    {
-                        MACID macID = get_mac_index_y(x, y, z, cell_count);
-
-                        if(y == cell_count.y-1)
-                        {
-                            /*
-                               solid
-                                 |
-                               fluid
-                            */
-                            dest[macID.ID1] = 0;
-                        }
-                        else
-                        {
-                            if(y == 0)
-                            {
-                                /*
-                                   fluid
-                                   |
-                                   solid
-                                   */
-                                dest[macID.ID0] = 0;
-                            }
-
-                            dest[macID.ID1] = source[macID.ID1] - c*(pressures[get_mac_index_center(x,y+1,z,cell_count)] - center_pressure);
-                        }
-                    }break;
-
-                    case FluidQuantityType_z:
-                    {
-                        MACID macID = get_mac_index_z(x, y, z, cell_count);
-
-                        if(z == cell_count.z-1)
-                        {
-                            /*
-                               solid
-                                 |
-                               fluid
-                            */
-                            dest[macID.ID1] = 0;
-                        }
-                        else
-                        {
-                            if(z == 0)
-                            {
-                                /*
-                                   fluid
-                                   |
-                                   solid
-                                   */
-                                dest[macID.ID0] = 0;
-                            }
-                            dest[macID.ID1] = source[macID.ID1] - c*(pressures[get_mac_index_center(x,y,z+1,cell_count)] - center_pressure);
-                        }
-                    }break;
-                }
+                f64 divergence = get_divergence_mac(v_x, v_y, v_z, x, y, z, cell_count, cell_dim);
+                f64 dest_divergence = get_divergence_mac(dest_x, dest_y, dest_z, x, y, z, cell_count, cell_dim);
+                length_square += divergence*divergence;
+                dest_length_square += dest_divergence*dest_divergence;
+
+                // NOTE(gh) 4x to also cover the rounding of the sum inside get_divergence_mac
+                f64 rounding = 4.0*FLT_EPSILON*((f64)get_divergence_magnitude_mac(v_x, v_y, v_z, x, y, z, cell_count, cell_dim) + 
+                                                (f64)get_divergence_magnitude_mac(dest_x, dest_y, dest_z, x, y, z, cell_count, cell_dim));
+                rounding_length_square += rounding*rounding;
             }
         }
     }
+
+    assert(dest_length_square <= (f64)tolerance*(f64)tolerance*length_square + rounding_length_square);
 }
 
 internal void
-advect(FluidCubeMAC *cube, f32 *dest, f32 *source, f32 *v_x, f32 *v_y, f32 *v_z, f32 dt, FluidQuantityType quantity_type)
+fill_random_velocities(f32 *v, u32 count, RandomSeries *series, f32 scale)
 {
-    TIMED_BLOCK();
-    v3i cell_count = cube->cell_count; 
-    f32 cell_dim = cube->cell_dim; 
+    for(u32 i = 0;
+            i < count;
+            ++i)
+    {
+        v[i] += scale*random_between_minus_1_1(series);
+    }
+}
 
-    // NOTE(gh) right(or top) most boundary to keep the same loop condition is not getting processed
-    // because it will be set by the boundary condition anyway.
-    for(i32 z = 0;
-            z < cell_count.z;
+/*
+   NOTE(gh) Projects a random velocity field inside the cube with cell_count_per_axis^3 cells.
+   The cube is filled the same way for every size, so the results of different sizes can be compared.
+   Then the field is changed a little bit and projected again, which is what the warm start sees every frame.
+*/
+internal void
+debug_benchmark_fluid_projection(FluidProjectionBenchmark *benchmark, MemoryArena *arena, ThreadWorkQueue *thread_work_queue, 
+                                 FluidPressureSolverType solver_type, u32 cell_count_per_axis, f32 dt)
+{
+    v3i cell_count = V3i(cell_count_per_axis, cell_count_per_axis, cell_count_per_axis);
+    f32 cell_dim = 1.0f;
+
+    u32 total_x_count = (cell_count.x+1)*cell_count.y*cell_count.z;
+    u32 total_y_count = cell_count.x*(cell_count.y+1)*cell_count.z;
+    u32 total_z_count = cell_count.x*cell_count.y*(cell_count.z+1);
+
+    size_t solver_memory_size = get_fluid_pressure_solver_memory_size(cell_count, solver_type);
+    TempMemory memory = start_temp_memory(arena, 
+                                          sizeof(f32)*2*(total_x_count + total_y_count + total_z_count) + solver_memory_size);
+    f32 *v_x = push_array(&memory, f32, total_x_count);
+    f32 *v_y = push_array(&memory, f32, total_y_count);
+    f32 *v_z = push_array(&memory, f32, total_z_count);
+    f32 *dest_x = push_array(&memory, f32, total_x_count);
+    f32 *dest_y = push_array(&memory, f32, total_y_count);
+    f32 *dest_z = push_array(&memory, f32, total_z_count);
+
+    MemoryArena solver_arena = start_memory_arena(push_size(&memory, solver_memory_size), solver_memory_size, false);
+    FluidPressureSolver solver;
+    initialize_fluid_pressure_solver(&solver, &solver_arena, cell_count, solver_type);
+
+    RandomSeries series = start_random_series(1234);
+    fill_random_velocities(v_x, total_x_count, &series, 1.0f);
+    fill_random_velocities(v_y, total_y_count, &series, 1.0f);
+    fill_random_velocities(v_z, total_z_count, &series, 1.0f);
+
+    *benchmark = {};
+    benchmark->solver_type = solver_type;
+    benchmark->cell_count_per_axis = cell_count_per_axis;
+    benchmark->max_divergence_before = get_max_divergence_mac(v_x, v_y, v_z, cell_count, cell_dim);
+
+    u64 start_cycle_count = rdtsc();
+    project_and_enforce_boundary_condition(dest_x, dest_y, dest_z, v_x, v_y, v_z, 
+                                           &solver, thread_work_queue, cell_dim, dt);
+    benchmark->cycle_count = rdtsc() - start_cycle_count;
+    validate_divergence_mac(dest_x, dest_y, dest_z, v_x, v_y, v_z, &solver, cell_dim);
+
+    benchmark->max_divergence_after = get_max_divergence_mac(dest_x, dest_y, dest_z, cell_count, cell_dim);
+    benchmark->iteration_count = (solver_type == FluidPressureSolverType_Multigrid) ? 
+                                    solver.multigrid.v_cycle_count : solver.pcg.iteration_count;
+    benchmark->relative_residual = (solver_type == FluidPressureSolverType_Multigrid) ? 
+                                    solver.multigrid.relative_residual : solver.pcg.relative_residual;
+
+    fill_random_velocities(v_x, total_x_count, &series, 0.05f);
+    fill_random_velocities(v_y, total_y_count, &series, 0.05f);
+    fill_random_velocities(v_z, total_z_count, &series, 0.05f);
+
+    start_cycle_count = rdtsc();
+    project_and_enforce_boundary_condition(dest_x, dest_y, dest_z, v_x, v_y, v_z, 
+                                           &solver, thread_work_queue, cell_dim, dt);
+    benchmark->warm_cycle_count = rdtsc() - start_cycle_count;
+    validate_divergence_mac(dest_x, dest_y, dest_z, v_x, v_y, v_z, &solver, cell_dim);
+    benchmark->warm_iteration_count = (solver_type == FluidPressureSolverType_Multigrid) ? 
+                                        solver.multigrid.v_cycle_count : solver.pcg.iteration_count;
+
+    end_temp_memory(&memory);
+}
+
+/*
+   NOTE(gh) Velocity at the cell centers, which is the average of the two faces of each axis.
+   Advection reads these for every cell(and 8 times for the trilinear taps, when advecting the velocity itself),
+   so they are computed once per velocity field instead of inside the taps.
+*/
+internal
+FLUID_SLAB_KERNEL(get_mac_center_velocities)
+{
+    FluidAdvectSlabData *d = (FluidAdvectSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+    for(i32 z = job->first;
+            z < job->one_past_last;
             ++z)
     {
         for(i32 y = 0;
                 y < cell_count.y;
                 ++y)
         {
+            i32 row = get_mac_index_center(0, y, z, cell_count);
             for(i32 x = 0;
                     x < cell_count.x;
                     ++x)
             {
-                v3 cell_rel_p = V3(x, y, z);
-                
-                // Adjust p inside the cell depending on the type
-                switch(quantity_type)
-                {
-                    case FluidQuantityType_x:
-                    {
-                        cell_rel_p += V3(0, 0.5f, 0.5f);
-                    }break;
-                    
-                    case FluidQuantityType_y:
-                    {
-                        cell_rel_p += V3(0.5f, 0, 0.5f);
-                    }break;
-
-                    case FluidQuantityType_z:
-                    {
-                        cell_rel_p += V3(0.5f, 0.5f, 0);
-                    }break;
-
-                    case FluidQuantityType_Center:
-                    {
-                        cell_rel_p += V3(0.5f, 0.5f, 0.5f);
-                    }break;
-                }
-
-                MACID macID_x = get_mac_index_x(x, y, z, cell_count);
-                f32 v_x0 = v_x[macID_x.ID0];
-                f32 v_x1 = v_x[macID_x.ID1];
-                MACID macID_y = get_mac_index_y(x, y, z, cell_count);
-                f32 v_y0 = v_y[macID_y.ID0];
-                f32 v_y1 = v_y[macID_y.ID1];
-                MACID macID_z = get_mac_index_z(x, y, z, cell_count);
-                f32 v_z0 = v_z[macID_z.ID0];
-                f32 v_z1 = v_z[macID_z.ID1];
-                    
-                v3 cell_rel_v = {};
-                switch(quantity_type)
-                {
-                    case FluidQuantityType_x:
-                    {
-                        cell_rel_v = V3(v_x0, 0.5f*(v_y0+v_y1), 0.5f*(v_z0+v_z1)) / cell_dim;
-                    }break;
-                    
-                    case FluidQuantityType_y:
-                    {
-                        cell_rel_v = V3(0.5f*(v_x0+v_x1), v_y0, 0.5f*(v_z0+v_z1)) / cell_dim;
-                    }break;
-
-                    case FluidQuantityType_z:
-                    {
-                        cell_rel_v = V3(0.5f*(v_x0+v_x1), 0.5f*(v_y0+v_y1), v_z0) / cell_dim;
-                    }break;
-
-                    case FluidQuantityType_Center:
-                    {
-                        cell_rel_v = V3(0.5f*(v_x0+v_x1), 0.5f*(v_y0+v_y1), 0.5f*(v_z0+v_z1)) / cell_dim;
-                    }break;
-                }
+                d->center_v_x[row + x] = get_mac_center_value_x(d->v_x, x, y, z, cell_count);
+                d->center_v_y[row + x] = get_mac_center_value_y(d->v_y, x, y, z, cell_count);
+                d->center_v_z[row + x] = get_mac_center_value_z(d->v_z, x, y, z, cell_count);
+            }
+        }
+    }
+}
 
-                // NOTE(gh) Because forward euler method is unstable, we use backtracking which guarantees 
-                // the stable result(but might not be accute)
-                // TODO(gh) Use RK3 instead of linear interpolation, but the performance might not be great.
-                v3 backtracked_p = cell_rel_p - dt*cell_rel_v; 
-
-                // TODO(gh) We are always clamping considering that we will be using cell centers for lerp,
-                // but do we wanna clamp it differently based on x, y, z, and scalar?
-                backtracked_p.x = clamp(0.5f, backtracked_p.x, cell_count.x-0.5f);
-                backtracked_p.y = clamp(0.5f, backtracked_p.y, cell_count.y-0.5f);
-                backtracked_p.z = clamp(0.5f, backtracked_p.z, cell_count.z-0.5f);
-
-                // TODO(gh) This might produce slightly wrong value?
-                v3 lerp_p = backtracked_p - V3(0.5f, 0.5f, 0.5f);
-                i32 x0 = (i32)lerp_p.x;
-                i32 x1 = x0 + 1;
-                if(x1 == cell_count.x)
-                {
-                    x0--;
-                    x1--;
-                }
-                f32 xf = clamp(0.0f, lerp_p.x - x0, 1.0f);
+/*
+   NOTE(gh) Semi-lagrangian advection of HB_LANE_WIDTH cells at once, along x.
+   The quantity type is a template parameter, so every switch of the scalar version is resolved at compile time.
+   The lanes always go along x even for v_y & v_z(whose faces are contiguous along their own axis), 
+   because then the center velocities can be loaded without gathering, 
+   and the trilinear taps of the neighboring lanes mostly land on the same cache lines.
 
-                i32 y0 = (i32)lerp_p.y;
-                i32 y1 = y0 + 1;
-                if(y1 == cell_count.y)
-                {
-                    y0--;
-                    y1--;
-                }
-                f32 yf = clamp(0.0f, lerp_p.y - y0, 1.0f);
+   'centers' is the quantity at the cell centers, which is what the taps sample.
+   The face velocity is only read for the component that we are advecting(i.e v_x for FluidQuantityType_x).
 
-                i32 z0 = (i32)lerp_p.z;
-                i32 z1 = z0 + 1;
-                if(z1 == cell_count.z)
-                {
-                    z0--;
-                    z1--;
-                }
-                f32 zf = clamp(0.0f, lerp_p.z - z0, 1.0f);
+   When the cell count is not a multiple of the lane width, the last batch is moved back so that it ends at the last cell.
+   The cells that are processed twice get the same value, because dest is not one of the inputs.
+*/
+template<FluidQuantityType quantity_type>
+internal
+FLUID_SLAB_KERNEL(advect_mac)
+{
+    FluidAdvectSlabData *d = (FluidAdvectSlabData *)job->data;
+    v3i cell_count = d->cell_count;
+    f32 *dest = d->dest;
+    f32 *centers = d->centers;
+    f32 *v_face = d->v_face;
+    assert(cell_count.x >= HB_LANE_WIDTH);
+
+    // NOTE(gh) Where the sample point is inside the cell
+    v3 offset = V3(0.5f, 0.5f, 0.5f);
+    switch(quantity_type)
+    {
+        case FluidQuantityType_x: {offset.x = 0;}break;
+        case FluidQuantityType_y: {offset.y = 0;}break;
+        case FluidQuantityType_z: {offset.z = 0;}break;
+    }
 
-                assert(x0 >= 0 && y0 >= 0 && z0 >= 0 &&
-                        x1 < cell_count.x && y1 < cell_count.y && z1 < cell_count.z);
+    simd_i32 lane_offsets = Simd_i32(0, 1, 2, 3);
+    simd_f32 lane_offsets_f32 = Simd_f32(0.0f, 1.0f, 2.0f, 3.0f);
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 one = Simd_f32(1.0f);
+    simd_f32 half = Simd_f32(0.5f);
+
+    // NOTE(gh) How far the next lane is, inside the layout of v_y & v_z
+    simd_i32 lane_stride_y = lane_offsets*Simd_i32(cell_count.y+1);
+    simd_i32 lane_stride_z = lane_offsets*Simd_i32(cell_count.z+1);
+
+    simd_f32 simd_dt = Simd_f32(d->dt);
+    simd_f32 simd_cell_dim = Simd_f32(d->cell_dim);
+    simd_f32 min_p = Simd_f32(0.5f);
+    simd_f32 max_p_x = Simd_f32(cell_count.x-0.5f);
+    simd_f32 max_p_y = Simd_f32(cell_count.y-0.5f);
+    simd_f32 max_p_z = Simd_f32(cell_count.z-0.5f);
+    simd_i32 max_x0 = Simd_i32(cell_count.x-2);
+    simd_i32 max_y0 = Simd_i32(cell_count.y-2);
+    simd_i32 max_z0 = Simd_i32(cell_count.z-2);
+    simd_i32 center_stride_y = Simd_i32(cell_count.x);
+    simd_i32 center_stride_z = Simd_i32(cell_count.x*cell_count.y);
+
+    for(i32 z = job->first;
+            z < job->one_past_last;
+            ++z)
+    {
+        simd_f32 cell_rel_p_z = Simd_f32(z + offset.z);
+        for(i32 y = 0;
+                y < cell_count.y;
+                ++y)
+        {
+            simd_f32 cell_rel_p_y = Simd_f32(y + offset.y);
+            for(i32 lane_first = 0;
+                    lane_first < cell_count.x;
+                    lane_first += HB_LANE_WIDTH)
+            {
+                i32 x = minimum(lane_first, cell_count.x - HB_LANE_WIDTH);
+                simd_f32 cell_rel_p_x = Simd_f32(x + offset.x) + lane_offsets_f32;
 
-                f32 center000 = flt_max; 
-                f32 center100 = flt_max; 
-                f32 center010 = flt_max; 
-                f32 center110 = flt_max; 
-                f32 center001 = flt_max; 
-                f32 center101 = flt_max; 
-                f32 center011 = flt_max; 
-                f32 center111 = flt_max; 
+                i32 center_ID = get_mac_index_center(x, y, z, cell_count);
+                simd_f32 v_x = Simd_f32(d->center_v_x + center_ID);
+                simd_f32 v_y = Simd_f32(d->center_v_y + center_ID);
+                simd_f32 v_z = Simd_f32(d->center_v_z + center_ID);
 
+                i32 dest_ID = center_ID;
                 switch(quantity_type)
                 {
                     case FluidQuantityType_x:
                     {
-                        center000 = get_mac_center_value_x(source, x0, y0, z0, cell_count); 
-                        center100 = get_mac_center_value_x(source, x1, y0, z0, cell_count); 
-                        center010 = get_mac_center_value_x(source, x0, y1, z0, cell_count); 
-                        center110 = get_mac_center_value_x(source, x1, y1, z0, cell_count); 
-
-                        center001 = get_mac_center_value_x(source, x0, y0, z1, cell_count); 
-                        center101 = get_mac_center_value_x(source, x1, y0, z1, cell_count); 
-                        center011 = get_mac_center_value_x(source, x0, y1, z1, cell_count); 
-                        center111 = get_mac_center_value_x(source, x1, y1, z1, cell_count); 
+                        dest_ID = get_mac_index_x(x, y, z, cell_count).ID0;
+                        v_x = Simd_f32(v_face + dest_ID);
                     }break;
-                    
+
                     case FluidQuantityType_y:
                     {
-                        center000 = get_mac_center_value_y(source, x0, y0, z0, cell_count); 
-                        center100 = get_mac_center_value_y(source, x1, y0, z0, cell_count); 
-                        center010 = get_mac_center_value_y(source, x0, y1, z0, cell_count); 
-                        center110 = get_mac_center_value_y(source, x1, y1, z0, cell_count); 
-
-                        center001 = get_mac_center_value_y(source, x0, y0, z1, cell_count); 
-                        center101 = get_mac_center_value_y(source, x1, y0, z1, cell_count); 
-                        center011 = get_mac_center_value_y(source, x0, y1, z1, cell_count); 
-                        center111 = get_mac_center_value_y(source, x1, y1, z1, cell_count); 
+                        dest_ID = get_mac_index_y(x, y, z, cell_count).ID0;
+                        v_y = gather(v_face, Simd_i32(dest_ID) + lane_stride_y);
                     }break;
 
                     case FluidQuantityType_z:
                     {
-                        center000 = get_mac_center_value_z(source, x0, y0, z0, cell_count); 
-                        center100 = get_mac_center_value_z(source, x1, y0, z0, cell_count); 
-                        center010 = get_mac_center_value_z(source, x0, y1, z0, cell_count); 
-                        center110 = get_mac_center_value_z(source, x1, y1, z0, cell_count); 
-
-                        center001 = get_mac_center_value_z(source, x0, y0, z1, cell_count); 
-                        center101 = get_mac_center_value_z(source, x1, y0, z1, cell_count); 
-                        center011 = get_mac_center_value_z(source, x0, y1, z1, cell_count); 
-                        center111 = get_mac_center_value_z(source, x1, y1, z1, cell_count); 
-                    }break;
-
-                    case FluidQuantityType_Center:
-                    {
-                        center000 = source[get_mac_index_center(x0, y0, z0, cell_count)];
-                        center100 = source[get_mac_index_center(x1, y0, z0, cell_count)];
-                        center010 = source[get_mac_index_center(x0, y1, z0, cell_count)];
-                        center110 = source[get_mac_index_center(x1, y1, z0, cell_count)];
-
-                        center001 = source[get_mac_index_center(x0, y0, z1, cell_count)];
-                        center101 = source[get_mac_index_center(x1, y0, z1, cell_count)];
-                        center011 = source[get_mac_index_center(x0, y1, z1, cell_count)];
-                        center111 = source[get_mac_index_center(x1, y1, z1, cell_count)];
+                        dest_ID = get_mac_index_z(x, y, z, cell_count).ID0;
+                        v_z = gather(v_face, Simd_i32(dest_ID) + lane_stride_z);
                     }break;
                 }
 
-                f32 lerp_value = lerp(
-                                  lerp(lerp(center000, xf, center100), 
-                                  yf, 
-                                  lerp(center010, xf, center110)),
-
-                                  zf,
-
-                                  lerp(lerp(center001, xf, center101), 
-                                  yf, 
-                                  lerp(center011, xf, center111)));
-
+                // NOTE(gh) Same backtracking & clamping as the scalar version
+                simd_f32 lerp_p_x = min(max(cell_rel_p_x - simd_dt*(v_x/simd_cell_dim), min_p), max_p_x) - half;
+                simd_f32 lerp_p_y = min(max(cell_rel_p_y - simd_dt*(v_y/simd_cell_dim), min_p), max_p_y) - half;
+                simd_f32 lerp_p_z = min(max(cell_rel_p_z - simd_dt*(v_z/simd_cell_dim), min_p), max_p_z) - half;
+
+                // NOTE(gh) The last cell uses the same pair as the cell before it, with the fraction of 1
+                simd_i32 x0 = min(convert_i32_from_f32(lerp_p_x), max_x0);
+                simd_i32 y0 = min(convert_i32_from_f32(lerp_p_y), max_y0);
+                simd_i32 z0 = min(convert_i32_from_f32(lerp_p_z), max_z0);
+                simd_f32 xf = min(max(lerp_p_x - convert_f32_from_i32(x0), zero), one);
+                simd_f32 yf = min(max(lerp_p_y - convert_f32_from_i32(y0), zero), one);
+                simd_f32 zf = min(max(lerp_p_z - convert_f32_from_i32(z0), zero), one);
+
+                simd_i32 ID000 = z0*center_stride_z + y0*center_stride_y + x0;
+                simd_i32 ID010 = ID000 + center_stride_y;
+                simd_i32 ID001 = ID000 + center_stride_z;
+                simd_i32 ID011 = ID010 + center_stride_z;
+
+                // NOTE(gh) x1 is always x0 + 1, so both x taps come from one load
+                simd_f32 center000, center100, center010, center110;
+                simd_f32 center001, center101, center011, center111;
+                gather_pairs(centers, ID000, &center000, &center100);
+                gather_pairs(centers, ID010, &center010, &center110);
+                gather_pairs(centers, ID001, &center001, &center101);
+                gather_pairs(centers, ID011, &center011, &center111);
+
+                simd_f32 lerp_value = lerp(
+                                        lerp(lerp(center000, xf, center100), 
+                                        yf, 
+                                        lerp(center010, xf, center110)),
+
+                                        zf,
+
+                                        lerp(lerp(center001, xf, center101), 
+                                        yf, 
+                                        lerp(center011, xf, center111)));
 
                 // NOTE(gh) We will always fill ID0 for x, y, z quantity types. The last ID1 is at the boundary, 
                 // and will be overwrited by the boundary condition anyway.
                 switch(quantity_type)
                 {
-                    case FluidQuantityType_x:
-                    {
-                        dest[get_mac_index_x(x, y, z, cell_count).ID0] = lerp_value;
-                    }break;
-                    
                     case FluidQuantityType_y:
                     {
-                        dest[get_mac_index_y(x, y, z, cell_count).ID0] = lerp_value;
+                        scatter(dest, Simd_i32(dest_ID) + lane_stride_y, lerp_value);
                     }break;
 
                     case FluidQuantityType_z:
                     {
-                        dest[get_mac_index_z(x, y, z, cell_count).ID0] = lerp_value;
+                        scatter(dest, Simd_i32(dest_ID) + lane_stride_z, lerp_value);
                     }break;
 
-                    case FluidQuantityType_Center:
+                    default:
                     {
-                        dest[get_mac_index_center(x, y, z, cell_count)] = lerp_value;
+                        simd_f32_store(dest + dest_ID, lerp_value);
                     }break;
                 }
             }
@@ -1305,64 +2297,116 @@ advect(FluidCubeMAC *cube, f32 *dest, f32 *source, f32 *v_x, f32 *v_y, f32 *v_z,
     }
 }
 
-struct ThreadFluidCubeWorkData
+// NOTE(gh) Advects all three components of the velocity with itself.
+// The center velocities are shared by the three, as both the velocity field & the quantity that we are advecting.
+// Every pass only writes its own slab, but reads the center velocities of the other slabs,
+// so each of them has to finish before the next one starts.
+internal void
+advect_velocities(FluidCubeMAC *cube, MemoryArena *arena, ThreadWorkQueue *thread_work_queue,
+                  f32 *dest_x, f32 *dest_y, f32 *dest_z, f32 *v_x, f32 *v_y, f32 *v_z, f32 dt)
 {
-    FluidCubeMAC *fluid_cube;
-
-    i32 start_x;
-    i32 one_past_end_x;
-
-    i32 start_y;
-    i32 one_past_end_y;
-
-    i32 start_z;
-    i32 one_past_end_z;
-
-    f32 *source;
-    f32 *dest;
-
-    // Only holds how much item is gonna process,
-    // both need to be cleared to 0
-    f32 *pressure;
-    f32 *temp_buffer;
-
-    FluidQuantityType quantity_type;
-
-    f32 dt;
-};
+    TIMED_BLOCK();
+    v3i cell_count = cube->cell_count;
+
+    TempMemory center_memory = start_temp_memory(arena, 3*sizeof(f32)*cube->total_center_count, false);
+    FluidAdvectSlabData data = {};
+    data.cell_count = cell_count;
+    data.cell_dim = cube->cell_dim;
+    data.dt = dt;
+    data.v_x = v_x;
+    data.v_y = v_y;
+    data.v_z = v_z;
+    data.center_v_x = push_array(&center_memory, f32, cube->total_center_count);
+    data.center_v_y = push_array(&center_memory, f32, cube->total_center_count);
+    data.center_v_z = push_array(&center_memory, f32, cube->total_center_count);
+    run_fluid_slab_jobs(thread_work_queue, get_mac_center_velocities, &data, cell_count.z, cell_count.x*cell_count.y);
+
+    data.dest = dest_x;
+    data.centers = data.center_v_x;
+    data.v_face = v_x;
+    run_fluid_slab_jobs(thread_work_queue, advect_mac<FluidQuantityType_x>, &data, cell_count.z, cell_count.x*cell_count.y);
+
+    data.dest = dest_y;
+    data.centers = data.center_v_y;
+    data.v_face = v_y;
+    run_fluid_slab_jobs(thread_work_queue, advect_mac<FluidQuantityType_y>, &data, cell_count.z, cell_count.x*cell_count.y);
+
+    data.dest = dest_z;
+    data.centers = data.center_v_z;
+    data.v_face = v_z;
+    run_fluid_slab_jobs(thread_work_queue, advect_mac<FluidQuantityType_z>, &data, cell_count.z, cell_count.x*cell_count.y);
+
+    end_temp_memory(&center_memory);
+}
 
-internal
-THREAD_WORK_CALLBACK(thread_project_and_enforce_boundary_condition_calllback)
+// NOTE(gh) Advects the quantity that lives in the cell center(density, temperature...)
+internal void
+advect_center_quantity(FluidCubeMAC *cube, MemoryArena *arena, ThreadWorkQueue *thread_work_queue,
+                       f32 *dest, f32 *source, f32 *v_x, f32 *v_y, f32 *v_z, f32 dt)
 {
-    ThreadFluidCubeWorkData *d = (ThreadFluidCubeWorkData *)data;
-    FluidCubeMAC *cube = d->fluid_cube;
-
-    project_and_enforce_boundary_condition(d->dest, d->source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-            d->pressure, d->temp_buffer,
-            cube->cell_count, cube->cell_dim, d->dt, d->quantity_type);
+    TIMED_BLOCK();
+    v3i cell_count = cube->cell_count;
+
+    TempMemory center_memory = start_temp_memory(arena, 3*sizeof(f32)*cube->total_center_count, false);
+    FluidAdvectSlabData data = {};
+    data.cell_count = cell_count;
+    data.cell_dim = cube->cell_dim;
+    data.dt = dt;
+    data.v_x = v_x;
+    data.v_y = v_y;
+    data.v_z = v_z;
+    data.center_v_x = push_array(&center_memory, f32, cube->total_center_count);
+    data.center_v_y = push_array(&center_memory, f32, cube->total_center_count);
+    data.center_v_z = push_array(&center_memory, f32, cube->total_center_count);
+    run_fluid_slab_jobs(thread_work_queue, get_mac_center_velocities, &data, cell_count.z, cell_count.x*cell_count.y);
+
+    data.dest = dest;
+    data.centers = source;
+    run_fluid_slab_jobs(thread_work_queue, advect_mac<FluidQuantityType_Center>, &data, cell_count.z, cell_count.x*cell_count.y);
+
+    end_temp_memory(&center_memory);
 }
 
 internal void
-add_project_and_enforce_boundary_condition_work(ThreadWorkQueue *thread_work_queue, ThreadFluidCubeWorkData *data, 
-                                                FluidCubeMAC *cube, f32 *dest, f32 *source, 
-                                                f32 *pressure, f32 *temp_buffer, FluidQuantityType quantity_type, f32 dt)
+initialize_fluid_cube_mac(FluidCubeMAC *cube, MemoryArena *arena, ThreadWorkQueue *gpu_work_queue, 
+                        v3 left_bottom_p, v3i cell_count, f32 cell_dim)
 {
-    zero_memory(pressure, sizeof(f32)*cube->total_center_count);
-    zero_memory(temp_buffer, sizeof(f32)*cube->total_center_count);
+    cube->min = left_bottom_p;
+    cube->max = cube->min + cell_dim*V3(cell_count.x, cell_count.y, cell_count.z);
+
+    cube->cell_count = cell_count;
+    cube->cell_dim = cell_dim;
+
+    cube->total_x_count = (cell_count.x+1)*cell_count.y*cell_count.z;
+    cube->total_y_count = cell_count.x*(cell_count.y+1)*cell_count.z;
+    cube->total_z_count = cell_count.x*cell_count.y*(cell_count.z+1);
+    cube->total_center_count = cell_count.x*cell_count.y*cell_count.z;
+
+    cube->v_x = get_gpu_visible_buffer(gpu_work_queue, sizeof(f32)*2*cube->total_x_count);
+    cube->v_y = get_gpu_visible_buffer(gpu_work_queue, sizeof(f32)*2*cube->total_y_count);
+    cube->v_z = get_gpu_visible_buffer(gpu_work_queue, sizeof(f32)*2*cube->total_z_count);
+    zero_memory(cube->v_x.memory, sizeof(f32)*2*cube->total_x_count);
+    zero_memory(cube->v_y.memory, sizeof(f32)*2*cube->total_y_count);
+    zero_memory(cube->v_z.memory, sizeof(f32)*2*cube->total_z_count);
+    flush_gpu_visible_buffer(&cube->v_x);
+    flush_gpu_visible_buffer(&cube->v_y);
+    flush_gpu_visible_buffer(&cube->v_z);
 
-    // NOTE(gh) We can't divide this job any more, because the pressure buffer needs neighboring values to be coherent(jacobi iteration)
-    data->fluid_cube = cube;
+    initialize_fluid_pressure_solver(&cube->pressure_solver, arena, cell_count, FluidPressureSolverType_Multigrid);
 
-    data->dest = dest;
-    data->source = source;
+    cube->densities = push_array(arena, f32, 2*cube->total_center_count);
 
-    data->pressure = pressure;
-    data->temp_buffer = temp_buffer; 
+    zero_memory(cube->densities, sizeof(f32)*2*cube->total_center_count);
 
-    data->dt = dt;
-    data->quantity_type = quantity_type;
+    cube->v_x_dest = (f32 *)cube->v_x.memory;
+    cube->v_x_source = (f32 *)cube->v_x_dest + cube->total_x_count;
+    cube->v_y_dest = (f32 *)cube->v_y.memory;
+    cube->v_y_source = (f32 *)cube->v_y_dest + cube->total_y_count;
+    cube->v_z_dest = (f32 *)cube->v_z.memory;
+    cube->v_z_source = (f32 *)cube->v_z_dest + cube->total_z_count;
 
-    thread_work_queue->add_thread_work_queue_item(thread_work_queue, thread_project_and_enforce_boundary_condition_calllback, 0, (void *)data);
+    cube->density_dest = cube->densities;
+    cube->density_source = cube->densities + cube->total_center_count;
 }
 
 internal b32
@@ -1495,78 +2539,34 @@ update_fluid_cube_mac(FluidCubeMAC *cube, MemoryArena *arena, ThreadWorkQueue *t
     swap(cube->v_y_dest, cube->v_y_source);
     swap(cube->v_z_dest, cube->v_z_source);
 
-    TempMemory thread_work_data_temp_memory = 
-        start_temp_memory(arena, 3*sizeof(ThreadFluidCubeWorkData));
-
-    ThreadFluidCubeWorkData *fluid_work_data = 
-        push_array(&thread_work_data_temp_memory, ThreadFluidCubeWorkData, 3);
-
-#if 0
-    project_and_enforce_boundary_condition(cube->v_x_dest, cube->v_x_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-                                            cube->pressure_x, cube->temp_buffer_x,
-                                            cube->cell_count, cube->cell_dim, dt, FluidQuantityType_x);
-
-    project_and_enforce_boundary_condition(cube->v_y_dest, cube->v_y_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-                                            cube->pressure_y, cube->temp_buffer_y,
-                                            cube->cell_count, cube->cell_dim, dt, FluidQuantityType_y);
-
-    project_and_enforce_boundary_condition(cube->v_z_dest, cube->v_z_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-                                            cube->pressure_z, cube->temp_buffer_z,
-                                            cube->cell_count, cube->cell_dim, dt, FluidQuantityType_z);
-#else
-    add_project_and_enforce_boundary_condition_work(thread_work_queue, fluid_work_data + 0, 
-                                                cube, cube->v_x_dest, cube->v_x_source, cube->pressure_x, cube->temp_buffer_x, 
-                                                FluidQuantityType_x, dt);
-    add_project_and_enforce_boundary_condition_work(thread_work_queue, fluid_work_data + 1, 
-                                                cube, cube->v_y_dest, cube->v_y_source, cube->pressure_y, cube->temp_buffer_y, 
-                                                FluidQuantityType_y, dt);
-    add_project_and_enforce_boundary_condition_work(thread_work_queue, fluid_work_data + 2, 
-                                                cube, cube->v_z_dest, cube->v_z_source, cube->pressure_z, cube->temp_buffer_z, 
-                                                FluidQuantityType_z, dt);
-    thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
+    project_and_enforce_boundary_condition(cube->v_x_dest, cube->v_y_dest, cube->v_z_dest, 
+                                           cube->v_x_source, cube->v_y_source, cube->v_z_source, 
+                                           &cube->pressure_solver, thread_work_queue, cube->cell_dim, dt);
+#if HB_SLOW
+    validate_divergence_mac(cube->v_x_dest, cube->v_y_dest, cube->v_z_dest, 
+                            cube->v_x_source, cube->v_y_source, cube->v_z_source, 
+                            &cube->pressure_solver, cube->cell_dim);
 #endif
-    //
 
 #if 1
     swap(cube->v_x_dest, cube->v_x_source);
     swap(cube->v_y_dest, cube->v_y_source);
     swap(cube->v_z_dest, cube->v_z_source);
 
-    advect(cube, cube->v_x_dest, cube->v_x_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-           dt, FluidQuantityType_x);
-    advect(cube, cube->v_y_dest, cube->v_y_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-           dt, FluidQuantityType_y);
-    advect(cube, cube->v_z_dest, cube->v_z_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-           dt, FluidQuantityType_z);
+    advect_velocities(cube, arena, thread_work_queue, cube->v_x_dest, cube->v_y_dest, cube->v_z_dest, 
+                      cube->v_x_source, cube->v_y_source, cube->v_z_source, dt);
     swap(cube->v_x_dest, cube->v_x_source);
     swap(cube->v_y_dest, cube->v_y_source);
     swap(cube->v_z_dest, cube->v_z_source);
 #endif
 
-#if 0
-    project_and_enforce_boundary_condition(cube->v_x_dest, cube->v_x_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-                                            cube->pressure_x, cube->temp_buffer_x,
-                                            cube->cell_count, cube->cell_dim, dt, FluidQuantityType_x);
-
-    project_and_enforce_boundary_condition(cube->v_y_dest, cube->v_y_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-                                            cube->pressure_y, cube->temp_buffer_y,
-                                            cube->cell_count, cube->cell_dim, dt, FluidQuantityType_y);
-
-    project_and_enforce_boundary_condition(cube->v_z_dest, cube->v_z_source, cube->v_x_source, cube->v_y_source, cube->v_z_source, 
-                                            cube->pressure_z, cube->temp_buffer_z,
-                                            cube->cell_count, cube->cell_dim, dt, FluidQuantityType_z);
-
-#else
-    add_project_and_enforce_boundary_condition_work(thread_work_queue, fluid_work_data + 0, 
-                                                cube, cube->v_x_dest, cube->v_x_source, cube->pressure_x, cube->temp_buffer_x, 
-                                                FluidQuantityType_x, dt);
-    add_project_and_enforce_boundary_condition_work(thread_work_queue, fluid_work_data + 1, 
-                                                cube, cube->v_y_dest, cube->v_y_source, cube->pressure_y, cube->temp_buffer_y, 
-                                                FluidQuantityType_y, dt);
-    add_project_and_enforce_boundary_condition_work(thread_work_queue, fluid_work_data + 2, 
-                                                cube, cube->v_z_dest, cube->v_z_source, cube->pressure_z, cube->temp_buffer_z, 
-                                                FluidQuantityType_z, dt);
-    thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
+    project_and_enforce_boundary_condition(cube->v_x_dest, cube->v_y_dest, cube->v_z_dest, 
+                                           cube->v_x_source, cube->v_y_source, cube->v_z_source, 
+                                           &cube->pressure_solver, thread_work_queue, cube->cell_dim, dt);
+#if HB_SLOW
+    validate_divergence_mac(cube->v_x_dest, cube->v_y_dest, cube->v_z_dest, 
+                            cube->v_x_source, cube->v_y_source, cube->v_z_source, 
+                            &cube->pressure_solver, cube->cell_dim);
 #endif
 
     // NOTE(gh) The order of processing quantities is from the paper Real-Time Fluid Dynamics for Games from Jos Stam,
@@ -1602,8 +2602,8 @@ update_fluid_cube_mac(FluidCubeMAC *cube, MemoryArena *arena, ThreadWorkQueue *t
     // TODO(gh) Also, I don't think the total density gets preserved by this advection
 #if 1
     swap(cube->density_dest, cube->density_source);
-    advect(cube, cube->density_dest, cube->density_source, cube->v_x_dest, cube->v_y_dest, cube->v_z_dest, 
-           dt, FluidQuantityType_Center);
+    advect_center_quantity(cube, arena, thread_work_queue, cube->density_dest, cube->density_source, 
+                           cube->v_x_dest, cube->v_y_dest, cube->v_z_dest, dt);
 #endif
 
     f32 total_density = 0;
@@ -1628,7 +2628,6 @@ update_fluid_cube_mac(FluidCubeMAC *cube, MemoryArena *arena, ThreadWorkQueue *t
 
     // printf("Total Density : %.6f\n", total_density);
 
-    end_temp_memory(&thread_work_data_temp_memory);
     t += dt;
 }
 
@@ -48,6 +48,147 @@ enum ElementTypeForBoundary
     ElementTypeForBoundary_Continuous,
 };
 
+#define pressure_multigrid_max_level_count 8
+
+struct PressureMultigridLevel
+{
+    v3i cell_count;
+
+    f32 *pressures;
+    f32 *rhs;
+    f32 *residuals;
+};
+
+/*
+   NOTE(gh) Geometric multigrid for the pressure poisson equation of the MAC grid.
+   Each level has half as many cells per axis as the level before, and level 0 is the grid itself.
+   The pressure lives in the cell center, so a coarse cell covers exactly 2x2x2 fine cells.
+*/
+struct PressureMultigrid
+{
+    PressureMultigridLevel levels[pressure_multigrid_max_level_count];
+    u32 level_count;
+
+    u32 max_v_cycle_count;
+    f32 tolerance; // |residual|/|rhs| that we stop at
+
+    // NOTE(gh) From the last solve
+    u32 v_cycle_count;
+    f32 relative_residual;
+};
+
+/*
+   NOTE(gh) Conjugate gradient for the same equation, preconditioned with MIC(0)(modified incomplete cholesky).
+   The preconditioner only depends on where the solid walls are, so it's built once when the solver is initialized.
+*/
+struct PressurePCG
+{
+    f32 *residuals;
+    f32 *z; // preconditioned residual, also holds A*search
+    f32 *search;
+    f32 *preconditioner;
+
+    u32 max_iteration_count;
+    f32 tolerance; // |residual|/|rhs| that we stop at
+
+    // NOTE(gh) From the last solve
+    u32 iteration_count;
+    f32 relative_residual;
+};
+
+enum FluidPressureSolverType
+{
+    FluidPressureSolverType_Multigrid,
+    FluidPressureSolverType_PCG,
+};
+
+struct FluidPressureSolver
+{
+    FluidPressureSolverType type;
+    v3i cell_count;
+
+    // NOTE(gh) Never cleared between the solves, so each solve is warm started with the pressure of the last one
+    f32 *pressures; // count : (x+2)*(y+2)*(z+2), see get_padded_index
+    f32 *rhs; // count : (x+2)*(y+2)*(z+2), built from the divergence of the velocity that we are projecting
+
+    // NOTE(gh) Only the one that matches the type is initialized
+    PressureMultigrid multigrid; // level 0 uses pressures & rhs
+    PressurePCG pcg;
+};
+
+struct FluidSlabJob;
+#define FLUID_SLAB_KERNEL(name) void name(FluidSlabJob *job)
+typedef FLUID_SLAB_KERNEL(FluidSlabKernel);
+
+/*
+   NOTE(gh) The slices along z([first, one_past_last)) that one thread work item goes through(see run_fluid_slab_jobs).
+   Every kernel only writes the cells inside its own slab, so the jobs don't need any synchronization.
+*/
+struct FluidSlabJob
+{
+    FluidSlabKernel *kernel;
+    void *data; // shared by all the jobs of the same dispatch
+
+    i32 first;
+    i32 one_past_last;
+
+    // NOTE(gh) For the kernels that sum something up(i.e |residual|^2).
+    // These are added in the job order, so the result doesn't depend on which thread finished first.
+    f64 sum;
+};
+
+struct FluidProjectionSlabData
+{
+    v3i cell_count;
+    f32 cell_dim;
+    f32 density;
+    f32 dt;
+
+    f32 *dest_x;
+    f32 *dest_y;
+    f32 *dest_z;
+    f32 *v_x;
+    f32 *v_y;
+    f32 *v_z;
+
+    f32 *rhs;
+    f32 *pressures;
+};
+
+// NOTE(gh) Not every kernel uses all of these, see the kernels that use this
+struct PressureSlabData
+{
+    v3i cell_count;
+
+    f32 *pressures;
+    f32 *rhs;
+    f32 *result; // residual or A*p
+    f32 rhs_mean;
+
+    PressureMultigridLevel *coarse; // for restricting & prolongating
+    i32 color; // 0 : red, 1 : black
+};
+
+struct FluidAdvectSlabData
+{
+    v3i cell_count;
+    f32 cell_dim;
+    f32 dt;
+
+    // NOTE(gh) Face velocities, and the average of them at the cell center(see get_mac_center_velocities)
+    f32 *v_x;
+    f32 *v_y;
+    f32 *v_z;
+    f32 *center_v_x;
+    f32 *center_v_y;
+    f32 *center_v_z;
+
+    // NOTE(gh) Quantity that we are advecting, see advect_mac
+    f32 *dest;
+    f32 *centers;
+    f32 *v_face;
+};
+
 // NOTE(gh) This is fluid cube using MAC grid which is a grid that stores different quantities
 // in different locations. For example, we store pressure in the center of the grid, 
 // while storing velocities on the edge(or center of the face in 3D) of the grid.
@@ -72,12 +213,9 @@ struct FluidCubeMAC
 
     f32 *densities; // count : x*y*z
 
-    f32 *pressure_x; // Used implicitly by the projection
-    f32 *temp_buffer_x; // Used for forward advection
-    f32 *pressure_y; // Used implicitly by the projection
-    f32 *temp_buffer_y; // Used for forward advection
-    f32 *pressure_z; // Used implicitly by the projection
-    f32 *temp_buffer_z; // Used for forward advection
+    // NOTE(gh) All three velocity components are projected with the same pressure, 
+    // so there is only one pressure solve per projection
+    FluidPressureSolver pressure_solver;
 
     f32 *v_x_dest;
     f32 *v_x_source;
@@ -91,6 +229,25 @@ struct FluidCubeMAC
     // We will also not store the viscosity, and depend on numerical diffusion due to forward euler
 };
 
+// NOTE(gh) See debug_benchmark_fluid_projection
+struct FluidProjectionBenchmark
+{
+    FluidPressureSolverType solver_type;
+    u32 cell_count_per_axis;
+
+    u64 cycle_count;
+    u32 iteration_count; // V-cycles for the multigrid
+    f32 relative_residual;
+
+    // NOTE(gh) Solving again after the velocities changed a little bit
+    u64 warm_cycle_count;
+    u32 warm_iteration_count;
+
+    // NOTE(gh) Largest |divergence| among the cells, before and after the projection
+    f32 max_divergence_before;
+    f32 max_divergence_after;
+};
+
 // NOTE(gh) Also used for enforcing boundary
 // i.e if FluidQuantityType_x, pressure will be adjusted with a 'ghost' pressure for the left and right walls
 enum FluidQuantityType
@@ -1561,12 +1561,9 @@ inline b32
 is_symmetric(const m3x3d m)
 {
     b32 result = false;
-    if(compare_with_epsilon_f64(m.e[0][1], 0) &&
-        compare_with_epsilon_f64(m.e[0][2], 0) && 
-        compare_with_epsilon_f64(m.e[1][0], 0) && 
-        compare_with_epsilon_f64(m.e[1][2], 0) && 
-        compare_with_epsilon_f64(m.e[2][0], 0) && 
-        compare_with_epsilon_f64(m.e[2][1], 0))
+    if(compare_with_epsilon_f64(m.e[0][1], m.e[1][0]) &&
+        compare_with_epsilon_f64(m.e[0][2], m.e[2][0]) && 
+        compare_with_epsilon_f64(m.e[1][2], m.e[2][1]))
     {
         result = true;
     }
@@ -1768,6 +1765,24 @@ M9x9d()
     return result;
 }
 
+inline m9x9d&
+operator *=(m9x9d &m, f64 value)
+{
+    for(u32 row = 0;
+            row < 9;
+            ++row)
+    {
+        for(u32 column = 0;
+                column < 9;
+                ++column)
+        {
+            m.e[row][column] *= value;
+        }
+    }
+
+    return m;
+}
+
 // NOTE(gh) When selecting the pivot while getting the inverse matrix,
 // we can't choose the pivot with same row nor column with the previous pivot.
 // For example, in m3x3 matrix, if we previously chose m.e[0][1] as pivot,
@@ -48,7 +48,7 @@ operator *(f64 value, const m3x9d &m)
 {
     m3x9d result = m;
     for(u32 i = 0;
-            i < 9;
+            i < 3;
             ++i)
     {
         result.rows[i] *= value;
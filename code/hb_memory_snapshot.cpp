@@ -0,0 +1,147 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+// NOTE(gh) Returns the number of GPU visible buffers that the game is holding,
+// and fills the entries if there are any
+internal u32
+gather_memory_snapshot_gpu_buffers(TranState *tran_state, MemorySnapshotGPUBuffer *entries)
+{
+    u32 result = 0;
+
+    GameAssets *assets = &tran_state->assets;
+    for(u32 mesh_asset_index = 0;
+            mesh_asset_index < assets->populated_mesh_asset;
+            ++mesh_asset_index)
+    {
+        MeshAsset *mesh_asset = assets->mesh_assets + mesh_asset_index;
+        if(entries)
+        {
+            entries[result].buffer = &mesh_asset->vertex_buffer;
+            entries[result + 1].buffer = &mesh_asset->index_buffer;
+        }
+        result += 2;
+    }
+
+    for(u32 grass_grid_index = 0;
+            grass_grid_index < tran_state->grass_grid_count_x*tran_state->grass_grid_count_y;
+            ++grass_grid_index)
+    {
+        GrassGrid *grid = tran_state->grass_grids + grass_grid_index;
+        if(grid->is_initialized)
+        {
+            if(entries)
+            {
+                entries[result].buffer = &grid->floor_z_buffer;
+                entries[result + 1].buffer = &grid->grass_instance_data_buffer;
+            }
+            result += 2;
+        }
+    }
+
+    return result;
+}
+
+internal void
+end_memory_snapshot_staging(TranState *tran_state)
+{
+    MemorySnapshot *snapshot = &tran_state->memory_snapshot;
+    MemoryArena *arena = &tran_state->transient_arena;
+
+    // NOTE(gh) Whoever pushes to the arena next expects the memory to be zero
+    zero_memory((u8 *)arena->base + snapshot->arena_used_before_staging,
+                arena->used - snapshot->arena_used_before_staging);
+    arena->used = snapshot->arena_used_before_staging;
+
+    snapshot->gpu_buffers = 0;
+    snapshot->gpu_buffer_count = 0;
+}
+
+internal b32
+save_memory_snapshot(PlatformAPI *platform_api, PlatformMemory *platform_memory, TranState *tran_state)
+{
+    b32 result = false;
+    if(platform_api->write_memory_snapshot)
+    {
+        MemorySnapshot *snapshot = &tran_state->memory_snapshot;
+        MemoryArena *arena = &tran_state->transient_arena;
+        assert(arena->temp_memory_count == 0);
+
+        snapshot->arena_used_before_staging = arena->used;
+        snapshot->gpu_buffer_count = gather_memory_snapshot_gpu_buffers(tran_state, 0);
+        if(snapshot->gpu_buffer_count)
+        {
+            snapshot->gpu_buffers = push_array(arena, MemorySnapshotGPUBuffer, snapshot->gpu_buffer_count);
+            gather_memory_snapshot_gpu_buffers(tran_state, snapshot->gpu_buffers);
+
+            for(u32 entry_index = 0;
+                    entry_index < snapshot->gpu_buffer_count;
+                    ++entry_index)
+            {
+                MemorySnapshotGPUBuffer *entry = snapshot->gpu_buffers + entry_index;
+                assert(entry->buffer->size);
+
+                entry->contents = push_size(arena, entry->buffer->size);
+                memcpy(entry->contents, entry->buffer->memory, entry->buffer->size);
+            }
+        }
+
+        platform_memory->permanent_memory_used = sizeof(GameState);
+        platform_memory->transient_memory_used = sizeof(TranState) + arena->used;
+        result = platform_api->write_memory_snapshot(platform_memory);
+
+        end_memory_snapshot_staging(tran_state);
+    }
+
+    return result;
+}
+
+/*
+   NOTE(gh) Called once after the platform mapped the snapshot back in.
+   Everything else is already where it was when the snapshot was written.
+*/
+internal void
+restore_from_memory_snapshot(TranState *tran_state, ThreadWorkQueue *gpu_work_queue)
+{
+    MemorySnapshot *snapshot = &tran_state->memory_snapshot;
+    for(u32 entry_index = 0;
+            entry_index < snapshot->gpu_buffer_count;
+            ++entry_index)
+    {
+        MemorySnapshotGPUBuffer *entry = snapshot->gpu_buffers + entry_index;
+        GPUVisibleBuffer *buffer = entry->buffer;
+
+        u64 used = buffer->used;
+        *buffer = get_gpu_visible_buffer(gpu_work_queue, buffer->size);
+        buffer->used = used;
+
+        memcpy(buffer->memory, entry->contents, buffer->size);
+        flush_gpu_visible_buffer(buffer);
+    }
+
+    FontAsset *font_asset = &tran_state->assets.debug_font_asset;
+    for(u32 glyph_index = 0;
+            glyph_index < font_asset->max_glyph_count;
+            ++glyph_index)
+    {
+        TextureAsset2D *texture = &font_asset->glyph_assets[glyph_index].texture;
+        if(texture->bitmap)
+        {
+            upload_texture_asset(gpu_work_queue, texture);
+        }
+    }
+
+    // NOTE(gh) The stream was mapped by the process that wrote the snapshot,
+    // and is already complete on the disk. Starting a new one here would overwrite it.
+    TimeMachine *time_machine = &tran_state->time_machine;
+    if(time_machine->is_streaming)
+    {
+        time_machine->is_streaming = false;
+        zero_memory(&time_machine->stream, sizeof(time_machine->stream));
+    }
+
+    // NOTE(gh) Same goes for the hash log, the new frames are not logged
+    zero_memory(&tran_state->state_hash_log.file, sizeof(tran_state->state_hash_log.file));
+
+    end_memory_snapshot_staging(tran_state);
+}
@@ -0,0 +1,32 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+#ifndef HB_MEMORY_SNAPSHOT_H
+#define HB_MEMORY_SNAPSHOT_H
+
+/*
+   NOTE(gh) Memory snapshot is the used part of the permanent & transient memory written to a file, 
+   so that the next launch can map it back in and skip loading the voxs, shape matching caches, fonts and meshes.
+   The platform puts the memory at the same address every time, so the pointers inside the memory stay valid.
+
+   GPU resources are the only things that don't survive, so before writing the snapshot
+   we stage the contents of every GPU visible buffer at the end of the transient arena.
+   After the restore, they are allocated again and filled with the staged contents, 
+   and the textures are uploaded again from the bitmaps that the assets are holding.
+*/
+struct MemorySnapshotGPUBuffer
+{
+    GPUVisibleBuffer *buffer;
+    void *contents; // Copy of the buffer, only valid inside the snapshot
+};
+
+struct MemorySnapshot
+{
+    // NOTE(gh) Staged GPU buffers, which go away right after they are written(or restored)
+    MemorySnapshotGPUBuffer *gpu_buffers;
+    u32 gpu_buffer_count;
+    size_t arena_used_before_staging;
+};
+
+#endif
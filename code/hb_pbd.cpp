@@ -20,6 +20,14 @@ end_particle_allocation_from_pool(PBDParticlePool *pool, PBDParticleGroup *group
     assert(group->count > 0);
 }
 
+internal u32
+get_first_particle_index(PBDParticlePool *pool, PBDParticleGroup *group)
+{
+    u32 result = (u32)(group->particles - pool->particles);
+
+    return result;
+}
+
 internal void
 allocate_particle_from_pool(PBDParticlePool *pool, 
                             v3d p, v3d v, f32 r, f32 inv_mass, i32 phase = 0)
@@ -31,6 +39,8 @@ allocate_particle_from_pool(PBDParticlePool *pool,
     particle->v = v;
     particle->r = r;
     particle->inv_mass = inv_mass;
+    particle->sdf = 0.0f;
+    particle->sdf_normal = V3(0, 0, 0);
 
     // Intializing temp variables
     particle->prev_p = V3d(0, 0, 0); 
@@ -38,6 +48,237 @@ allocate_particle_from_pool(PBDParticlePool *pool,
     particle->constraint_hit_count = 0;
 }
 
+internal u32
+get_constraint_particle_indices(DistanceConstraint *c, u32 *indices)
+{
+    indices[0] = c->index0;
+    indices[1] = c->index1;
+
+    return 2;
+}
+
+internal u32
+get_constraint_particle_indices(VolumeConstraint *c, u32 *indices)
+{
+    indices[0] = c->index0;
+    indices[1] = c->index1;
+    indices[2] = c->index2;
+    indices[3] = c->index3;
+
+    return 4;
+}
+
+/*
+   NOTE(gh) Greedy graph coloring, where two constraints are connected when they share a particle.
+   Constraints with the same color can be solved at the same time(i.e in simd lanes) 
+   without any conflict, so that we don't lose the Gauss-Seidel convergence between the colors.
+
+   Each color takes as many constraints as possible from the uncolored ones, 
+   which are swapped to the front. Returns the color count.
+*/
+template<typename Constraint>
+internal u32
+color_constraints(Constraint *constraints, u32 constraint_count, u32 particle_count, u32 *color_ends)
+{
+    // NOTE(gh) color + 1 that used this particle last, so that we don't have to clear this per color
+    u32 particle_color_stamps[array_count(((PBDParticlePool *)0)->particles)] = {};
+    assert(particle_count <= array_count(particle_color_stamps));
+
+    u32 color_count = 0;
+    u32 colored_count = 0;
+    while(colored_count < constraint_count)
+    {
+        assert(color_count < max_pbd_constraint_color_count);
+        u32 stamp = color_count + 1;
+
+        for(u32 constraint_index = colored_count;
+                constraint_index < constraint_count;
+                ++constraint_index)
+        {
+            u32 indices[4];
+            u32 index_count = get_constraint_particle_indices(constraints + constraint_index, indices);
+
+            b32 is_independent = true;
+            for(u32 i = 0;
+                    i < index_count;
+                    ++i)
+            {
+                if(particle_color_stamps[indices[i]] == stamp)
+                {
+                    is_independent = false;
+                    break;
+                }
+            }
+
+            if(is_independent)
+            {
+                for(u32 i = 0;
+                        i < index_count;
+                        ++i)
+                {
+                    particle_color_stamps[indices[i]] = stamp;
+                }
+
+                Constraint temp = constraints[colored_count];
+                constraints[colored_count] = constraints[constraint_index];
+                constraints[constraint_index] = temp;
+                colored_count++;
+            }
+        }
+
+        color_ends[color_count++] = colored_count;
+    }
+
+    return color_count;
+}
+
+internal u32
+get_environment_cell(f64 value, f64 grid_min, f64 cell_dim, u32 cell_count)
+{
+    f64 cell = floor((value - grid_min)/cell_dim);
+    u32 result = (u32)minimum(maximum(cell, 0.0), (f64)(cell_count-1));
+
+    return result;
+}
+
+/*
+   NOTE(gh) Builds a static collider from the indexed VertexPN triangles(i.e generated meshes or the mesh assets),
+   transformed the same way as the renderer does(scale first, and then translate).
+   The size of the cell is decided by the average xy size of the triangles, 
+   so that each triangle only ends up in a handful of cells.
+*/
+internal void
+add_environment_collider(PBDEnvironment *environment, MemoryArena *arena, 
+                         VertexPN *vertices, u32 *indices, u32 index_count, 
+                         v3 translation, v3 scale)
+{
+    assert(environment->collider_count < array_count(environment->colliders));
+    PBDEnvironmentCollider *collider = environment->colliders + environment->collider_count++;
+
+    collider->triangle_count = index_count/3;
+    collider->triangles = push_array(arena, PBDEnvironmentTriangle, collider->triangle_count);
+
+    v2d grid_min = {flt_max, flt_max};
+    v2d grid_max = {-flt_max, -flt_max};
+    f64 total_xy_size = 0;
+    for(u32 triangle_index = 0;
+            triangle_index < collider->triangle_count;
+            ++triangle_index)
+    {
+        PBDEnvironmentTriangle *triangle = collider->triangles + triangle_index;
+        triangle->p0 = V3d(hadamard(scale, vertices[indices[3*triangle_index + 0]].p) + translation);
+        triangle->p1 = V3d(hadamard(scale, vertices[indices[3*triangle_index + 1]].p) + translation);
+        triangle->p2 = V3d(hadamard(scale, vertices[indices[3*triangle_index + 2]].p) + translation);
+        triangle->normal = normalize(cross(triangle->p1 - triangle->p0, triangle->p2 - triangle->p0));
+
+        triangle->min = V3d(minimum(minimum(triangle->p0.x, triangle->p1.x), triangle->p2.x),
+                            minimum(minimum(triangle->p0.y, triangle->p1.y), triangle->p2.y),
+                            minimum(minimum(triangle->p0.z, triangle->p1.z), triangle->p2.z));
+        triangle->max = V3d(maximum(maximum(triangle->p0.x, triangle->p1.x), triangle->p2.x),
+                            maximum(maximum(triangle->p0.y, triangle->p1.y), triangle->p2.y),
+                            maximum(maximum(triangle->p0.z, triangle->p1.z), triangle->p2.z));
+
+        grid_min.x = minimum(grid_min.x, triangle->min.x);
+        grid_min.y = minimum(grid_min.y, triangle->min.y);
+        grid_max.x = maximum(grid_max.x, triangle->max.x);
+        grid_max.y = maximum(grid_max.y, triangle->max.y);
+        total_xy_size += maximum(triangle->max.x - triangle->min.x, triangle->max.y - triangle->min.y);
+    }
+
+    // NOTE(gh) Don't let the huge meshes blow up the cell count
+    u32 max_cell_count_per_axis = 256;
+    collider->cell_dim = maximum(total_xy_size/collider->triangle_count, 
+                                 maximum(grid_max.x - grid_min.x, grid_max.y - grid_min.y)/max_cell_count_per_axis);
+    collider->grid_min_x = grid_min.x;
+    collider->grid_min_y = grid_min.y;
+    collider->cell_count_x = (u32)ceil((grid_max.x - grid_min.x)/collider->cell_dim) + 1;
+    collider->cell_count_y = (u32)ceil((grid_max.y - grid_min.y)/collider->cell_dim) + 1;
+
+    /*
+       NOTE(gh) Counting sort of the triangles into the cells.
+       1. count the triangles of cell i into cell_first_triangle[i+1]
+       2. exclusive prefix sum, so that cell_first_triangle[i+1] becomes the first index of cell i
+       3. fill by incrementing cell_first_triangle[i+1], which ends up at the first index of cell i+1
+    */
+    u32 cell_count = collider->cell_count_x*collider->cell_count_y;
+    collider->cell_first_triangle = push_array(arena, u32, (cell_count+1));
+    zero_memory(collider->cell_first_triangle, sizeof(u32)*(cell_count+1));
+    for(u32 pass = 0;
+            pass < 2;
+            ++pass)
+    {
+        for(u32 triangle_index = 0;
+                triangle_index < collider->triangle_count;
+                ++triangle_index)
+        {
+            PBDEnvironmentTriangle *triangle = collider->triangles + triangle_index;
+            u32 min_x = get_environment_cell(triangle->min.x, collider->grid_min_x, collider->cell_dim, collider->cell_count_x);
+            u32 min_y = get_environment_cell(triangle->min.y, collider->grid_min_y, collider->cell_dim, collider->cell_count_y);
+            u32 max_x = get_environment_cell(triangle->max.x, collider->grid_min_x, collider->cell_dim, collider->cell_count_x);
+            u32 max_y = get_environment_cell(triangle->max.y, collider->grid_min_y, collider->cell_dim, collider->cell_count_y);
+            for(u32 y = min_y;
+                    y <= max_y;
+                    ++y)
+            {
+                for(u32 x = min_x;
+                        x <= max_x;
+                        ++x)
+                {
+                    u32 cell_index = y*collider->cell_count_x + x;
+                    if(pass == 0)
+                    {
+                        collider->cell_first_triangle[cell_index+1]++;
+                    }
+                    else
+                    {
+                        collider->cell_triangle_indices[collider->cell_first_triangle[cell_index+1]++] = triangle_index;
+                    }
+                }
+            }
+        }
+
+        if(pass == 0)
+        {
+            u32 total_index_count = 0;
+            for(u32 cell_index = 0;
+                    cell_index < cell_count;
+                    ++cell_index)
+            {
+                u32 count = collider->cell_first_triangle[cell_index+1];
+                collider->cell_first_triangle[cell_index+1] = total_index_count;
+                total_index_count += count;
+            }
+            collider->cell_triangle_indices = push_array(arena, u32, total_index_count);
+        }
+    }
+}
+
+// NOTE(gh) Should be called after the particle allocation of the group
+internal void
+start_constraint_allocation_from_pool(PBDConstraintPool *pool, PBDParticleGroup *group)
+{
+    group->distance_constraints = pool->distance_constraints + pool->distance_constraint_count;
+    group->distance_constraint_count = 0;
+    group->volume_constraints = pool->volume_constraints + pool->volume_constraint_count;
+    group->volume_constraint_count = 0;
+}
+
+internal void
+end_constraint_allocation_from_pool(PBDConstraintPool *pool, PBDParticleGroup *group)
+{
+    pool->distance_constraint_count += group->distance_constraint_count;
+    pool->volume_constraint_count += group->volume_constraint_count;
+    assert(pool->distance_constraint_count <= array_count(pool->distance_constraints));
+    assert(pool->volume_constraint_count <= array_count(pool->volume_constraints));
+
+    group->distance_color_count = 
+        color_constraints(group->distance_constraints, group->distance_constraint_count, 
+                          group->count, group->distance_color_ends);
+    group->volume_color_count = 
+        color_constraints(group->volume_constraints, group->volume_constraint_count, 
+                          group->count, group->volume_color_ends);
+}
+
 // TODO(gh) Is there any way to get the COM without any division,
 // maybe cleverly using the inverse mass?
 /*
@@ -66,150 +307,1556 @@ get_com_of_particle_group(PBDParticleGroup *group)
     return result;
 }
 
+/*
+   NOTE(gh) Rigid body fast path.
+   EntityFlag_RigidBody groups that are not touching anything are simulated as a single 6-DOF body
+   instead of the particles, so flying bodies cost the same regardless of how many voxels they have.
+   The particles are only brought up to date when the body starts touching something,
+   or when someone needs to read them(i.e the renderer).
+
+   I = sum(mi*(dot(ri, ri)*E - ri*transpose(ri))), where ri is the initial offset from the com.
+   This has to happen after the particle allocation and the initial offsets are done!!!
+*/
+internal void
+initialize_rigid_body(PBDParticleGroup *group)
+{
+    group->rigid_body_inv_mass = 0;
+
+    f64 total_mass = 0;
+    v3d momentum = V3d();
+    m3x3d inertia = M3x3d();
+    f64 radius = 0;
+    for(u32 particle_index = 0;
+            particle_index < group->count;
+            ++particle_index)
+    {
+        PBDParticle *particle = group->particles + particle_index;
+        if(particle->inv_mass == 0)
+        {
+            // NOTE(gh) Pinned particles can't be moved by the body
+            return;
+        }
+
+        f64 mass = 1.0/particle->inv_mass;
+        v3d r = particle->initial_offset_from_com;
+        f64 r_square = dot(r, r);
+
+        total_mass += mass;
+        momentum += mass*particle->v;
+        inertia.rows[0] += mass*(r_square*V3d(1, 0, 0) - r.x*r);
+        inertia.rows[1] += mass*(r_square*V3d(0, 1, 0) - r.y*r);
+        inertia.rows[2] += mass*(r_square*V3d(0, 0, 1) - r.z*r);
+        radius = maximum(radius, length(r) + particle->r);
+    }
+
+    // NOTE(gh) Single particle or the particles in a line, which don't have a well defined rotation
+    if(is_inversable(inertia))
+    {
+        group->rigid_body_p = get_com_of_particle_group(group);
+        group->rigid_body_v = momentum/total_mass;
+        group->rigid_body_w = V3d();
+        group->rigid_body_inv_mass = 1.0/total_mass;
+        group->rigid_body_inertia = inertia;
+        group->rigid_body_inv_inertia = inverse(inertia);
+        group->rigid_body_radius = radius;
+    }
+}
+
+internal b32
+has_rigid_body(PBDParticleGroup *group)
+{
+    b32 result = (group->rigid_body_inv_mass != 0);
+
+    return result;
+}
+
+internal void
+materialize_rigid_body_particles(PBDParticleGroup *group)
+{
+    if(group->are_particles_stale)
+    {
+        m3x3d rotation = orientation_quatd_to_m3x3d(group->shape_match_quat);
+        for(u32 particle_index = 0;
+                particle_index < group->count;
+                ++particle_index)
+        {
+            PBDParticle *particle = group->particles + particle_index;
+            v3d offset = rotation*particle->initial_offset_from_com;
+
+            particle->p = group->rigid_body_p + offset;
+            particle->prev_p = particle->p;
+            particle->v = group->rigid_body_v + cross(group->rigid_body_w, offset);
+        }
+
+        group->are_particles_stale = false;
+    }
+}
+
+// NOTE(gh) World angular velocity of the free body with the given orientation, w = R*inv(I)*transpose(R)*L
+internal v3d
+get_rigid_body_angular_velocity(PBDParticleGroup *group, quatd orientation, v3d angular_momentum)
+{
+    m3x3d rotation = orientation_quatd_to_m3x3d(orientation);
+    v3d result = rotation*(group->rigid_body_inv_inertia*(transpose(rotation)*angular_momentum));
+
+    return result;
+}
+
+/*
+   NOTE(gh) Same integration as the particles(gravity folded into the position).
+   Nothing applies torque to the free body, so what stays the same is the world angular momentum L, not the angular velocity.
+   (They are only the same when the inertia is the same for every axis, otherwise the body tumbles)
+   The orientation is advanced with the angular velocity at the half step(which also comes from L),
+   because advancing it with the angular velocity at the start keeps adding energy to the tumbling body.
+*/
+internal void
+integrate_rigid_body(PBDParticleGroup *group, f64 sub_dt)
+{
+    group->rigid_body_v.z += -9.8*sub_dt;
+    group->rigid_body_p += sub_dt*group->rigid_body_v;
+
+    quatd q = group->shape_match_quat;
+    m3x3d rotation = orientation_quatd_to_m3x3d(q);
+    v3d angular_momentum = rotation*(group->rigid_body_inertia*(transpose(rotation)*group->rigid_body_w));
+
+    quatd half_q = normalize(q + (0.25*sub_dt)*(Quatd(0, group->rigid_body_w)*q));
+    v3d half_w = get_rigid_body_angular_velocity(group, half_q, angular_momentum);
+    group->shape_match_quat = normalize(q + (0.5*sub_dt)*(Quatd(0, half_w)*q));
+
+    group->rigid_body_w = get_rigid_body_angular_velocity(group, group->shape_match_quat, angular_momentum);
+
+    group->are_particles_stale = true;
+}
+
+// NOTE(gh) Pulls the body state out of the particles after they were solved,
+// the orientation is already in shape_match_quat thanks to the rigid shape matching.
+internal void
+update_rigid_body_from_particles(PBDParticleGroup *group)
+{
+    f64 total_mass = 1.0/group->rigid_body_inv_mass;
+    v3d com = get_com_of_particle_group(group);
+    v3d momentum = V3d();
+    v3d angular_momentum = V3d();
+    for(u32 particle_index = 0;
+            particle_index < group->count;
+            ++particle_index)
+    {
+        PBDParticle *particle = group->particles + particle_index;
+        f64 mass = 1.0/particle->inv_mass;
+
+        momentum += mass*particle->v;
+        angular_momentum += mass*cross(particle->p - com, particle->v);
+    }
+
+    m3x3d rotation = orientation_quatd_to_m3x3d(group->shape_match_quat);
+    m3x3d world_inv_inertia = rotation*group->rigid_body_inv_inertia*transpose(rotation);
+
+    group->rigid_body_p = com;
+    group->rigid_body_v = momentum/total_mass;
+    group->rigid_body_w = world_inv_inertia*angular_momentum;
+}
+
+internal f64
+get_rigid_body_kinetic_energy(PBDParticleGroup *group)
+{
+    m3x3d rotation = orientation_quatd_to_m3x3d(group->shape_match_quat);
+    v3d body_w = transpose(rotation)*group->rigid_body_w;
+
+    f64 result = 0.5*length_square(group->rigid_body_v)/group->rigid_body_inv_mass +
+                 0.5*dot(body_w, group->rigid_body_inertia*body_w);
+
+    return result;
+}
+
 #define collision_epsilon -1.0e-6
+#define pbd_static_friction 0.5
+#define pbd_kinetic_friction 0.3
 
-struct CollisionSolution
+/*
+   NOTE(gh) Constraint kernels that the substep solver uses.
+   These are templated on the scalar type(f64 for the reference path, f32 for the simd path), 
+   and the f32 versions of the hot loops are overloaded below with HB_LANE_WIDTH wide versions.
+*/
+
+// NOTE(gh) Environment constraints are independent from each other, 
+// so the order doesn't matter.
+// If pre_stabilize is true, the constraint is solved using prev_p and the offset is applied to both p and prev_p.
+template<typename real>
+internal void
+solve_environment_constraints(PBDSolverParticles<real> *particles, u32 first, u32 count, b32 pre_stabilize)
 {
-    b32 collided;
-    v3d offset0;
-    v3d offset1;
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        if(particles->environment_mask[particle_index])
+        {
+            real inv_mass = particles->inv_mass[particle_index];
+            real nx = particles->environment_nx[particle_index];
+            real ny = particles->environment_ny[particle_index];
+            real nz = particles->environment_nz[particle_index];
+
+            real x = particles->px[particle_index];
+            real y = particles->py[particle_index];
+            real z = particles->pz[particle_index];
+            if(pre_stabilize)
+            {
+                x = particles->prev_px[particle_index];
+                y = particles->prev_py[particle_index];
+                z = particles->prev_pz[particle_index];
+            }
+
+            real d = nx*x + ny*y + nz*z;
+            real C = d - particles->environment_d[particle_index] - particles->r[particle_index];
+            if(C < collision_epsilon)
+            {
+                // TODO(gh) inv_stiffness * square(sub_dt) should be added to the denominator
+                // when we have compliant environment constraints
+                real lagrange_multiplier = -C / inv_mass;
+
+                // NOTE(gh) delta(xi) = lagrange_multiplier*inv_mass*gradient(xi);
+                real offset_x = lagrange_multiplier*inv_mass*nx;
+                real offset_y = lagrange_multiplier*inv_mass*ny;
+                real offset_z = lagrange_multiplier*inv_mass*nz;
+
+                particles->px[particle_index] += offset_x;
+                particles->py[particle_index] += offset_y;
+                particles->pz[particle_index] += offset_z;
+                if(pre_stabilize)
+                {
+                    particles->prev_px[particle_index] += offset_x;
+                    particles->prev_py[particle_index] += offset_y;
+                    particles->prev_pz[particle_index] += offset_z;
+                }
+                else
+                {
+                    // NOTE(gh) Friction against the environment, which has infinite mass(see FrictionConstraint)
+                    real d_x = particles->px[particle_index] - particles->prev_px[particle_index];
+                    real d_y = particles->py[particle_index] - particles->prev_py[particle_index];
+                    real d_z = particles->pz[particle_index] - particles->prev_pz[particle_index];
+                    real d_normal = d_x*nx + d_y*ny + d_z*nz;
 
-    v3d contact_normal;
-    f64 penetration_depth;
-};
+                    real tangent_x = d_x - d_normal*nx;
+                    real tangent_y = d_y - d_normal*ny;
+                    real tangent_z = d_z - d_normal*nz;
+                    real tangent_length = sqrt(tangent_x*tangent_x + tangent_y*tangent_y + tangent_z*tangent_z);
+                    if(tangent_length > 0)
+                    {
+                        real scale = 1;
+                        if(tangent_length >= (real)pbd_static_friction*(-C))
+                        {
+                            scale = minimum((real)pbd_kinetic_friction*(-C)/tangent_length, (real)1);
+                        }
 
-// stiffness_epsilon = inv_stiffness/square(sub_dt);
+                        particles->px[particle_index] -= scale*tangent_x;
+                        particles->py[particle_index] -= scale*tangent_y;
+                        particles->pz[particle_index] -= scale*tangent_z;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// NOTE(gh) Particles of the sdf bodies that are below the surface layer.
+// The surface particles have the sdf of -r, and the next layer has -3r.
+template<typename real>
+internal b32
+is_interior_particle(PBDSolverParticles<real> *particles, u32 index)
+{
+    b32 result = (particles->sdf[index] < (real)-1.5*particles->r[index]);
+
+    return result;
+}
+
+/*
+   NOTE(gh) Friction between two particles(see FrictionConstraint),
+   where normal is the contact normal and penetration is the depth that was resolved by the contact.
+*/
+template<typename real>
 internal void
-solve_collision_constraint(CollisionSolution *solution,
-                            CollisionConstraint *c,
-                            v3d *p0, v3d *p1, f64 sub_dt) 
+solve_particle_friction(PBDSolverParticles<real> *particles, u32 i0, u32 i1, 
+                        real normal_x, real normal_y, real normal_z, real penetration)
 {
-    PBDParticle *particle0 = c->particle0;
-    PBDParticle *particle1 = c->particle1;
+    real inv_mass0 = particles->inv_mass[i0];
+    real inv_mass1 = particles->inv_mass[i1];
+
+    real d_x = (particles->px[i0] - particles->prev_px[i0]) - (particles->px[i1] - particles->prev_px[i1]);
+    real d_y = (particles->py[i0] - particles->prev_py[i0]) - (particles->py[i1] - particles->prev_py[i1]);
+    real d_z = (particles->pz[i0] - particles->prev_pz[i0]) - (particles->pz[i1] - particles->prev_pz[i1]);
+    real d_normal = d_x*normal_x + d_y*normal_y + d_z*normal_z;
+
+    real tangent_x = d_x - d_normal*normal_x;
+    real tangent_y = d_y - d_normal*normal_y;
+    real tangent_z = d_z - d_normal*normal_z;
+    real tangent_length = sqrt(tangent_x*tangent_x + tangent_y*tangent_y + tangent_z*tangent_z);
+
+    if(tangent_length > 0)
+    {
+        real scale = 1;
+        if(tangent_length >= (real)pbd_static_friction*penetration)
+        {
+            scale = minimum((real)pbd_kinetic_friction*penetration/tangent_length, (real)1);
+        }
+
+        real scale0 = -scale*inv_mass0/(inv_mass0 + inv_mass1);
+        real scale1 = scale*inv_mass1/(inv_mass0 + inv_mass1);
+        particles->px[i0] += scale0*tangent_x;
+        particles->py[i0] += scale0*tangent_y;
+        particles->pz[i0] += scale0*tangent_z;
+        particles->px[i1] += scale1*tangent_x;
+        particles->py[i1] += scale1*tangent_y;
+        particles->pz[i1] += scale1*tangent_z;
+    }
+}
+
+/*
+   NOTE(gh) Speculative contact between two particles that were not overlapping at the start of the substep.
+   The relative position d(t) = d0 + t*(d1 - d0) is swept along p - prev_p, 
+   and if |d(t)| hits r0 + r1 for t in [0, 1], the contact normal at the time of impact is returned.
+   Solving C = dot(n, d1) - (r0 + r1) along that normal keeps the fast particles 
+   from passing through each other within a single substep.
+*/
+template<typename real>
+internal b32
+get_speculative_contact_normal(PBDSolverParticles<real> *particles, u32 i0, u32 i1, real rest_length,
+                               real *normal_x, real *normal_y, real *normal_z)
+{
+    b32 result = false;
+
+    real start_x = particles->prev_px[i0] - particles->prev_px[i1];
+    real start_y = particles->prev_py[i0] - particles->prev_py[i1];
+    real start_z = particles->prev_pz[i0] - particles->prev_pz[i1];
+    real move_x = (particles->px[i0] - particles->px[i1]) - start_x;
+    real move_y = (particles->py[i0] - particles->py[i1]) - start_y;
+    real move_z = (particles->pz[i0] - particles->pz[i1]) - start_z;
+
+    // NOTE(gh) |d0 + t*m|^2 = R^2 -> a*t^2 + b*t + c = 0
+    real a = move_x*move_x + move_y*move_y + move_z*move_z;
+    real b = 2*(start_x*move_x + start_y*move_y + start_z*move_z);
+    real c = start_x*start_x + start_y*start_y + start_z*start_z - rest_length*rest_length;
+    real discriminant = b*b - 4*a*c;
+
+    // NOTE(gh) Only when they were apart and getting closer
+    if(c > 0 && b < 0 && discriminant >= 0)
+    {
+        real t = (-b - sqrt(discriminant))/(2*a);
+        if(t <= 1)
+        {
+            real inv_length = 1/rest_length;
+            *normal_x = (start_x + t*move_x)*inv_length;
+            *normal_y = (start_y + t*move_y)*inv_length;
+            *normal_z = (start_z + t*move_z)*inv_length;
+            result = true;
+        }
+    }
+
+    return result;
+}
+
+/*
+   NOTE(gh) Collision constraints are solved in Gauss-Seidel fashion,
+   which means that these cannot be vectorized naively.
 
-    f64 inv_stiffness = 0.0;
-    // TODO(gh) Since this constraint is only generated when 
-    // at least one of them as finite mass anyway, maybe there's no reason
-    // for this checking?
-    if(particle0->inv_mass + particle1->inv_mass != 0.0f)
+   When one of the particles belongs to the body with the sdf, the contact normal comes from the sdf
+   of the particle that is closer to its surface, which is more accurate.
+   - If that particle is inside the surface layer, the particle-particle normal is used,
+     but it's reflected when it points into the body(so that the particles don't get pushed through the body).
+   - If the particle is deeper than that, the sdf gradient itself is the normal.
+   http://mmacklin.com/uppfrta_preprint.pdf
+*/
+template<typename real>
+internal void
+solve_collision_constraints(PBDSolverParticles<real> *particles, 
+                            CollisionConstraint *constraints, u32 constraint_count, b32 pre_stabilize)
+{
+    for(u32 constraint_index = 0;
+            constraint_index < constraint_count;
+            ++constraint_index)
     {
-        v3d delta = *p0 - *p1;
-        f64 delta_length = length(delta);
+        CollisionConstraint *c = constraints + constraint_index;
+        u32 i0 = c->index0;
+        u32 i1 = c->index1;
 
-        f64 rest_length = (f64)(particle0->r + particle1->r);
-        f64 C = delta_length - rest_length;
-        if(C < collision_epsilon)
+        real inv_mass0 = particles->inv_mass[i0];
+        real inv_mass1 = particles->inv_mass[i1];
+
+        // TODO(gh) Since this constraint is only generated when 
+        // at least one of them as finite mass anyway, maybe there's no reason
+        // for this checking?
+        if(inv_mass0 + inv_mass1 != 0)
         {
+            real *x0 = particles->px; 
+            real *y0 = particles->py; 
+            real *z0 = particles->pz; 
+            if(pre_stabilize)
+            {
+                x0 = particles->prev_px; 
+                y0 = particles->prev_py; 
+                z0 = particles->prev_pz; 
+            }
+
+            real delta_x = x0[i0] - x0[i1];
+            real delta_y = y0[i0] - y0[i1];
+            real delta_z = z0[i0] - z0[i1];
+            real delta_length = sqrt(delta_x*delta_x + delta_y*delta_y + delta_z*delta_z);
+
+            real rest_length = particles->r[i0] + particles->r[i1];
+            real C = delta_length - rest_length;
+
             // Gradient of the constraint for each particles that were invovled in the constraint
-            // So this is actually gradient(C(xi))
-            v3d gradient0 = normalize(delta);
-            v3d gradient1 = -gradient0;
+            // So this is actually gradient(C(xi)), and gradient1 = -gradient0
+            real gradient_x = 0;
+            real gradient_y = 0;
+            real gradient_z = 0;
+            b32 is_speculative = false;
+            if(C >= collision_epsilon && !pre_stabilize)
+            {
+                is_speculative = get_speculative_contact_normal(particles, i0, i1, rest_length, 
+                                                                &gradient_x, &gradient_y, &gradient_z);
+                if(is_speculative)
+                {
+                    C = gradient_x*delta_x + gradient_y*delta_y + gradient_z*delta_z - rest_length;
+                }
+            }
+
+            if(C < collision_epsilon && (delta_length > 0 || is_speculative))
+            {
+                if(!is_speculative)
+                {
+                    gradient_x = delta_x/delta_length;
+                    gradient_y = delta_y/delta_length;
+                    gradient_z = delta_z/delta_length;
+                }
 
-            f64 lagrange_multiplier = 
-                -C / (particle0->inv_mass + particle1->inv_mass + inv_stiffness * square(sub_dt));
+                real sdf0 = particles->sdf[i0];
+                real sdf1 = particles->sdf[i1];
+                if(!is_speculative && (sdf0 != 0 || sdf1 != 0))
+                {
+                    // NOTE(gh) sdf normal is the outward normal of the body, 
+                    // so flip it when it's from particle 0 to make it push particle 0 away from particle 1
+                    b32 use_sdf0 = (sdf0 != 0) && (sdf1 == 0 || sdf0 >= sdf1);
+                    u32 sdf_index = use_sdf0 ? i0 : i1;
+                    real sign = use_sdf0 ? (real)-1 : (real)1;
+                    real normal_x = sign*particles->sdf_nx[sdf_index];
+                    real normal_y = sign*particles->sdf_ny[sdf_index];
+                    real normal_z = sign*particles->sdf_nz[sdf_index];
 
-            // NOTE(gh) delta(xi) = lagrange_multiplier*inv_mass*gradient(xi);
-            // inv_mass of the particles are involved
-            // so that the linear momentum is conserved(otherwise, it might produce the 'ghost force')
-            solution->collided = true;
-            solution->offset0 = lagrange_multiplier*(f64)particle0->inv_mass*gradient0;
-            solution->offset1 = lagrange_multiplier*(f64)particle1->inv_mass*gradient1;
+                    if(is_interior_particle(particles, sdf_index))
+                    {
+                        gradient_x = normal_x;
+                        gradient_y = normal_y;
+                        gradient_z = normal_z;
+                    }
+                    else
+                    {
+                        real d = gradient_x*normal_x + gradient_y*normal_y + gradient_z*normal_z;
+                        if(d < 0)
+                        {
+                            gradient_x -= 2*d*normal_x;
+                            gradient_y -= 2*d*normal_y;
+                            gradient_z -= 2*d*normal_z;
+                        }
+                    }
+                }
 
-            solution->contact_normal = gradient0;
-            // TODO(gh) C or -C
-            solution->penetration_depth = abs_f64(C);
+                real lagrange_multiplier = -C / (inv_mass0 + inv_mass1);
+
+                // NOTE(gh) delta(xi) = lagrange_multiplier*inv_mass*gradient(xi);
+                // inv_mass of the particles are involved
+                // so that the linear momentum is conserved(otherwise, it might produce the 'ghost force')
+                real offset0_x = lagrange_multiplier*inv_mass0*gradient_x;
+                real offset0_y = lagrange_multiplier*inv_mass0*gradient_y;
+                real offset0_z = lagrange_multiplier*inv_mass0*gradient_z;
+                real offset1_x = lagrange_multiplier*inv_mass1*(-gradient_x);
+                real offset1_y = lagrange_multiplier*inv_mass1*(-gradient_y);
+                real offset1_z = lagrange_multiplier*inv_mass1*(-gradient_z);
+
+                particles->px[i0] += offset0_x;
+                particles->py[i0] += offset0_y;
+                particles->pz[i0] += offset0_z;
+                particles->px[i1] += offset1_x;
+                particles->py[i1] += offset1_y;
+                particles->pz[i1] += offset1_z;
+                if(pre_stabilize)
+                {
+                    particles->prev_px[i0] += offset0_x;
+                    particles->prev_py[i0] += offset0_y;
+                    particles->prev_pz[i0] += offset0_z;
+                    particles->prev_px[i1] += offset1_x;
+                    particles->prev_py[i1] += offset1_y;
+                    particles->prev_pz[i1] += offset1_z;
+                }
+                else
+                {
+                    solve_particle_friction(particles, i0, i1, gradient_x, gradient_y, gradient_z, -C);
+                }
+            }
         }
     }
 }
 
-struct EnvironmentSolution
+// NOTE(gh) XPBD distance constraints of one group(see DistanceConstraint).
+// The constraints are sorted by their colors, so solving them in order gives the same result 
+// as solving each color in parallel.
+template<typename real>
+internal void
+solve_distance_constraints(PBDSolverParticles<real> *particles, u32 first, PBDParticleGroup *group, f64 sub_dt)
 {
-    v3d offset;
-};
+    real alpha = (real)(group->inv_distance_stiffness/square(sub_dt));
+    for(u32 constraint_index = 0;
+            constraint_index < group->distance_constraint_count;
+            ++constraint_index)
+    {
+        DistanceConstraint *c = group->distance_constraints + constraint_index;
+        u32 i0 = first + c->index0;
+        u32 i1 = first + c->index1;
+
+        real inv_mass0 = particles->inv_mass[i0];
+        real inv_mass1 = particles->inv_mass[i1];
+
+        real delta_x = particles->px[i0] - particles->px[i1];
+        real delta_y = particles->py[i0] - particles->py[i1];
+        real delta_z = particles->pz[i0] - particles->pz[i1];
+        real delta_length = sqrt(delta_x*delta_x + delta_y*delta_y + delta_z*delta_z);
+
+        if(inv_mass0 + inv_mass1 != 0 && delta_length != 0)
+        {
+            real C = delta_length - (real)c->rest_length;
 
+            real gradient_x = delta_x/delta_length;
+            real gradient_y = delta_y/delta_length;
+            real gradient_z = delta_z/delta_length;
+
+            real lagrange_multiplier = -C / (inv_mass0 + inv_mass1 + alpha);
+
+            particles->px[i0] += lagrange_multiplier*inv_mass0*gradient_x;
+            particles->py[i0] += lagrange_multiplier*inv_mass0*gradient_y;
+            particles->pz[i0] += lagrange_multiplier*inv_mass0*gradient_z;
+            particles->px[i1] -= lagrange_multiplier*inv_mass1*gradient_x;
+            particles->py[i1] -= lagrange_multiplier*inv_mass1*gradient_y;
+            particles->pz[i1] -= lagrange_multiplier*inv_mass1*gradient_z;
+        }
+    }
+}
+
+// NOTE(gh) XPBD volume constraints of one group(see VolumeConstraint), 
+// C = volume - rest_volume
+template<typename real>
 internal void
-solve_environment_constraint(EnvironmentSolution *solution,
-                             EnvironmentConstraint *c,
-                             v3d *p, f64 sub_dt)
+solve_volume_constraints(PBDSolverParticles<real> *particles, u32 first, PBDParticleGroup *group, f64 sub_dt)
 {
-    f64 inv_stiffness = 0;
-    // TODO(gh) Since this constraint is only generated when 
-    // the particle has finite mass anyway, maybe there's no reason
-    // for this checking?
-    if(c->particle->inv_mass != 0.0f)
+    real alpha = (real)(group->inv_volume_stiffness/square(sub_dt));
+    for(u32 constraint_index = 0;
+            constraint_index < group->volume_constraint_count;
+            ++constraint_index)
     {
-        f64 d = dot(c->n, *p);
-        f64 C = d - c->d - c->particle->r;
-        if(C < collision_epsilon)
+        VolumeConstraint *c = group->volume_constraints + constraint_index;
+        u32 indices[4] = {first + c->index0, first + c->index1, first + c->index2, first + c->index3};
+
+        real x[4][3];
+        real inv_mass[4];
+        for(u32 i = 0;
+                i < 4;
+                ++i)
         {
-            f64 lagrange_multiplier = -C / (c->particle->inv_mass + inv_stiffness * square(sub_dt));
+            x[i][0] = particles->px[indices[i]];
+            x[i][1] = particles->py[indices[i]];
+            x[i][2] = particles->pz[indices[i]];
+            inv_mass[i] = particles->inv_mass[indices[i]];
+        }
+
+        // NOTE(gh) gradient(xi) = (xa - xb) x (xc - xb)/6, 
+        // {a, b, c} = {2, 1, 3}, {0, 2, 3}, {3, 1, 0}, {1, 2, 0}
+        u32 abc[4][3] = {{2, 1, 3}, {0, 2, 3}, {3, 1, 0}, {1, 2, 0}};
+        real gradients[4][3];
+        real denominator = alpha;
+        for(u32 i = 0;
+                i < 4;
+                ++i)
+        {
+            real *a = x[abc[i][0]];
+            real *b = x[abc[i][1]];
+            real *c = x[abc[i][2]];
+            real u[3] = {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+            real v[3] = {c[0] - b[0], c[1] - b[1], c[2] - b[2]};
+            gradients[i][0] = (u[1]*v[2] - u[2]*v[1])/6;
+            gradients[i][1] = (u[2]*v[0] - u[0]*v[2])/6;
+            gradients[i][2] = (u[0]*v[1] - u[1]*v[0])/6;
+
+            denominator += inv_mass[i]*(square(gradients[i][0]) + square(gradients[i][1]) + square(gradients[i][2]));
+        }
+
+        // NOTE(gh) volume = dot(gradient(x0), x0 - x1)
+        real volume = gradients[0][0]*(x[0][0] - x[1][0]) + 
+                      gradients[0][1]*(x[0][1] - x[1][1]) + 
+                      gradients[0][2]*(x[0][2] - x[1][2]);
+        real C = volume - (real)c->rest_volume;
 
-            // NOTE(gh) delta(xi) = lagrange_multiplier*inv_mass*gradient(xi);
-            solution->offset = lagrange_multiplier*c->particle->inv_mass*(c->n);
+        if(denominator != 0)
+        {
+            real lagrange_multiplier = -C / denominator;
+            for(u32 i = 0;
+                    i < 4;
+                    ++i)
+            {
+                particles->px[indices[i]] += lagrange_multiplier*inv_mass[i]*gradients[i][0];
+                particles->py[indices[i]] += lagrange_multiplier*inv_mass[i]*gradients[i][1];
+                particles->pz[indices[i]] += lagrange_multiplier*inv_mass[i]*gradients[i][2];
+            }
         }
     }
 }
 
-// This returns A, which has rotational & scaling matrix based on polar decomposition
+// NOTE(gh) Advance the positions of the particles in [first, first + count)
+template<typename real>
+internal void
+integrate_particles(PBDSolverParticles<real> *particles, u32 first, u32 count, f64 sub_dt)
+{
+    real dt = (real)sub_dt;
+    real gravity = (real)(square(sub_dt)*-9.8);
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        if(particles->inv_mass[particle_index] > 0)
+        {
+            // TODO(gh) For damping, use the formula from XPBD which involves modified lagrange multiplier
+            particles->prev_px[particle_index] = particles->px[particle_index];
+            particles->prev_py[particle_index] = particles->py[particle_index];
+            particles->prev_pz[particle_index] = particles->pz[particle_index];
+
+            // NOTE(gh) We no longer modify the velocity with external forces,
+            // but directly modify the position with second order
+            particles->px[particle_index] += dt*particles->vx[particle_index];
+            particles->py[particle_index] += dt*particles->vy[particle_index];
+            particles->pz[particle_index] += dt*particles->vz[particle_index] + gravity;
+        }
+    }
+}
+
+template<typename real>
+internal void
+update_velocities(PBDSolverParticles<real> *particles, u32 first, u32 count, f64 sub_dt)
+{
+    real dt = (real)sub_dt;
+    real sleep_epsilon = (real)0.00000001;
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        if(particles->inv_mass[particle_index] != 0)
+        {
+            real delta_x = particles->px[particle_index] - particles->prev_px[particle_index];
+            real delta_y = particles->py[particle_index] - particles->prev_py[particle_index];
+            real delta_z = particles->pz[particle_index] - particles->prev_pz[particle_index];
+
+            if(sqrt(delta_x*delta_x + delta_y*delta_y + delta_z*delta_z) > sleep_epsilon)
+            {
+                particles->vx[particle_index] = delta_x/dt;
+                particles->vy[particle_index] = delta_y/dt;
+                particles->vz[particle_index] = delta_z/dt;
+            }
+            else
+            {
+                // Particle sleeping
+                particles->px[particle_index] = particles->prev_px[particle_index];
+                particles->py[particle_index] = particles->prev_py[particle_index];
+                particles->pz[particle_index] = particles->prev_pz[particle_index];
+            }
+        }
+    }
+}
+
+// TODO(gh) Is there any way to get the COM without any division,
+// maybe cleverly using the inverse mass?
+template<typename real>
+internal v3d
+get_com_of_particles(PBDSolverParticles<real> *particles, u32 first, u32 count)
+{
+    real x = 0;
+    real y = 0;
+    real z = 0;
+    real total_mass = 0;
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        real mass = particles->mass[particle_index];
+        assert(mass != 0);
+
+        total_mass += mass;
+        x += mass*particles->px[particle_index];
+        y += mass*particles->py[particle_index];
+        z += mass*particles->pz[particle_index];
+    }
+
+    v3d result = V3d(x, y, z)/(f64)total_mass;
+
+    return result;
+}
+
+// This returns Apq = sum(mi * (xi - com) * transpose(ri)), 
+// which has rotational & scaling matrix based on polar decomposition
 // A = R * S
+template<typename real>
 internal m3x3d
-get_shape_matching_rigid_body_deformation_matrix(PBDParticleGroup *group)
+get_shape_matching_Apq(PBDSolverParticles<real> *particles, u32 first, u32 count, v3d com)
 {
-    m3x3d result = M3x3d();
+    real com_x = (real)com.x;
+    real com_y = (real)com.y;
+    real com_z = (real)com.z;
 
-    // TODO(gh) Pass COM as a parameter?
-    v3d com = get_com_of_particle_group(group);
+    real e[3][3] = {};
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        real mass = particles->mass[particle_index];
+        real offset[3] = 
+        {
+            particles->px[particle_index] - com_x,
+            particles->py[particle_index] - com_y,
+            particles->pz[particle_index] - com_z,
+        };
+        real q[3] = 
+        {
+            particles->offset_x[particle_index],
+            particles->offset_y[particle_index],
+            particles->offset_z[particle_index],
+        };
 
-    for(u32 particle_index = 0;
-            particle_index < group->count;
+        for(u32 row = 0;
+                row < 3;
+                ++row)
+        {
+            real m_offset = mass*offset[row];
+            e[row][0] += m_offset*q[0];
+            e[row][1] += m_offset*q[1];
+            e[row][2] += m_offset*q[2];
+        }
+    }
+
+    m3x3d result = M3x3d(e[0][0], e[0][1], e[0][2],
+                         e[1][0], e[1][1], e[1][2],
+                         e[2][0], e[2][1], e[2][2]);
+
+    return result;
+}
+
+// NOTE(gh) Same as above, but q is the quadratic q(see get_quadratic_deformation_q),
+// which results in 3x9 matrix. The first three columns are identical to the linear Apq.
+template<typename real>
+internal m3x9d
+get_shape_matching_quadratic_Apq(PBDSolverParticles<real> *particles, u32 first, u32 count, v3d com)
+{
+    real com_x = (real)com.x;
+    real com_y = (real)com.y;
+    real com_z = (real)com.z;
+
+    real e[3][9] = {};
+    for(u32 particle_index = first;
+            particle_index < first + count;
             ++particle_index)
     {
-        PBDParticle *particle = group->particles + particle_index;
-        v3d offset = particle->p - com;
+        real mass = particles->mass[particle_index];
+        real offset[3] = 
+        {
+            particles->px[particle_index] - com_x,
+            particles->py[particle_index] - com_y,
+            particles->pz[particle_index] - com_z,
+        };
 
-        f64 particle_mass = 1.0/particle->inv_mass;
+        real q[9] = 
+        {
+            particles->offset_x[particle_index], particles->offset_y[particle_index], particles->offset_z[particle_index],
+            particles->q_xx[particle_index], particles->q_yy[particle_index], particles->q_zz[particle_index],
+            particles->q_xy[particle_index], particles->q_yz[particle_index], particles->q_zx[particle_index],
+        };
 
-        result.rows[0] += particle_mass * offset.x * particle->initial_offset_from_com;
-        result.rows[1] += particle_mass * offset.y * particle->initial_offset_from_com;
-        result.rows[2] += particle_mass * offset.z * particle->initial_offset_from_com;
+        for(u32 row = 0;
+                row < 3;
+                ++row)
+        {
+            real m_offset = mass*offset[row];
+            for(u32 column = 0;
+                    column < 9;
+                    ++column)
+            {
+                e[row][column] += m_offset*q[column];
+            }
+        }
+    }
+
+    m3x9d result = {};
+    for(u32 row = 0;
+            row < 3;
+            ++row)
+    {
+        for(u32 column = 0;
+                column < 9;
+                ++column)
+        {
+            result.e[row][column] = e[row][column];
+        }
     }
 
     return result;
 }
 
+// NOTE(gh) p = m*initial_offset_from_com + com, used by the rigid bodies
+template<typename real>
+internal void
+set_shape_matching_goal_positions(PBDSolverParticles<real> *particles, u32 first, u32 count, 
+                                  m3x3d m, v3d com)
+{
+    real m00 = (real)m.e[0][0]; real m01 = (real)m.e[0][1]; real m02 = (real)m.e[0][2];
+    real m10 = (real)m.e[1][0]; real m11 = (real)m.e[1][1]; real m12 = (real)m.e[1][2];
+    real m20 = (real)m.e[2][0]; real m21 = (real)m.e[2][1]; real m22 = (real)m.e[2][2];
+    real com_x = (real)com.x;
+    real com_y = (real)com.y;
+    real com_z = (real)com.z;
+
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        real qx = particles->offset_x[particle_index];
+        real qy = particles->offset_y[particle_index];
+        real qz = particles->offset_z[particle_index];
+
+        particles->px[particle_index] = (m00*qx + m01*qy + m02*qz) + com_x;
+        particles->py[particle_index] = (m10*qx + m11*qy + m12*qz) + com_y;
+        particles->pz[particle_index] = (m20*qx + m21*qy + m22*qz) + com_z;
+    }
+}
+
+#define shape_matching_polar_decomposition_max_iter_count 64
+
+// NOTE(gh) Extracts the rotations of all the shape matching groups at once,
+// each one warm started with the rotation that it had in the last substep.
+// The f32 path extracts HB_LANE_WIDTH of them at the same time(see batch_extract_rotations_from_polar_decomposition).
+template<typename real>
+internal void
+extract_shape_matching_rotations(PBDSolverParticles<real> *particles, m3x3d *As, quatd *rotations, u32 count)
+{
+    for(u32 i = 0;
+            i < count;
+            ++i)
+    {
+        rotations[i] = extract_rotation_from_polar_decomposition(As + i, rotations + i, 
+                                                                 shape_matching_polar_decomposition_max_iter_count);
+    }
+}
+
+// NOTE(gh) p += alpha*(goal - p), where alpha = stiffness*inv_mass.
+// This is also from the shape-matching paper
+template<typename real>
+internal void
+pull_to_shape_matching_goal_positions(PBDSolverParticles<real> *particles, u32 first, u32 count, 
+                                      m3x3d m, v3d com, f64 stiffness)
+{
+    real m00 = (real)m.e[0][0]; real m01 = (real)m.e[0][1]; real m02 = (real)m.e[0][2];
+    real m10 = (real)m.e[1][0]; real m11 = (real)m.e[1][1]; real m12 = (real)m.e[1][2];
+    real m20 = (real)m.e[2][0]; real m21 = (real)m.e[2][1]; real m22 = (real)m.e[2][2];
+    real com_x = (real)com.x;
+    real com_y = (real)com.y;
+    real com_z = (real)com.z;
+    real k = (real)stiffness;
+
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        real qx = particles->offset_x[particle_index];
+        real qy = particles->offset_y[particle_index];
+        real qz = particles->offset_z[particle_index];
+
+        real alpha = k*particles->inv_mass[particle_index];
+        particles->px[particle_index] += alpha*((m00*qx + m01*qy + m02*qz) + com_x - particles->px[particle_index]);
+        particles->py[particle_index] += alpha*((m10*qx + m11*qy + m12*qz) + com_y - particles->py[particle_index]);
+        particles->pz[particle_index] += alpha*((m20*qx + m21*qy + m22*qz) + com_z - particles->pz[particle_index]);
+    }
+}
+
+// NOTE(gh) p = m*q + com, where q is the quadratic q
+template<typename real>
+internal void
+set_quadratic_shape_matching_goal_positions(PBDSolverParticles<real> *particles, u32 first, u32 count, 
+                                            m3x9d *m, v3d com)
+{
+    real e[3][9];
+    for(u32 row = 0;
+            row < 3;
+            ++row)
+    {
+        for(u32 column = 0;
+                column < 9;
+                ++column)
+        {
+            e[row][column] = (real)m->e[row][column];
+        }
+    }
+    real com_p[3] = {(real)com.x, (real)com.y, (real)com.z};
+    real *p[3] = {particles->px, particles->py, particles->pz};
+
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        real q[9] = 
+        {
+            particles->offset_x[particle_index], particles->offset_y[particle_index], particles->offset_z[particle_index],
+            particles->q_xx[particle_index], particles->q_yy[particle_index], particles->q_zz[particle_index],
+            particles->q_xy[particle_index], particles->q_yz[particle_index], particles->q_zx[particle_index],
+        };
+
+        for(u32 row = 0;
+                row < 3;
+                ++row)
+        {
+            real value = 0;
+            for(u32 column = 0;
+                    column < 9;
+                    ++column)
+            {
+                value += e[row][column]*q[column];
+            }
+            p[row][particle_index] = value + com_p[row];
+        }
+    }
+}
+
+/*
+   NOTE(gh) f32 simd overloads of the kernels above.
+   Particles of a group are not aligned to the lane width, 
+   so the group functions mask out the lanes that are outside of [first, first + count).
+   This is safe because the solver arrays are padded(see start_solver_particles).
+*/
+force_inline simd_u32
+get_lane_mask(u32 index, u32 one_past_last_index)
+{
+    simd_u32 result = compare_less(simd_u32_(index, index + 1, index + 2, index + 3), 
+                                   simd_u32_(one_past_last_index));
+
+    return result;
+}
+
+internal void
+solve_environment_constraints(PBDSolverParticles<f32> *particles, u32 first, u32 count, b32 pre_stabilize)
+{
+    simd_f32 epsilon = Simd_f32((f32)collision_epsilon);
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 one = Simd_f32(1.0f);
+    simd_f32 static_friction = Simd_f32((f32)pbd_static_friction);
+    simd_f32 kinetic_friction = Simd_f32((f32)pbd_kinetic_friction);
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            particle_index += HB_LANE_WIDTH)
+    {
+        simd_u32 lane_mask = get_lane_mask(particle_index, first + count);
+        simd_u32 environment_mask = lane_mask & simd_u32_load(particles->environment_mask + particle_index);
+        if(!all_lanes_zero(environment_mask))
+        {
+            simd_f32 inv_mass = Simd_f32(particles->inv_mass + particle_index);
+            simd_f32 nx = Simd_f32(particles->environment_nx + particle_index);
+            simd_f32 ny = Simd_f32(particles->environment_ny + particle_index);
+            simd_f32 nz = Simd_f32(particles->environment_nz + particle_index);
+
+            simd_f32 px = Simd_f32(particles->px + particle_index);
+            simd_f32 py = Simd_f32(particles->py + particle_index);
+            simd_f32 pz = Simd_f32(particles->pz + particle_index);
+            simd_f32 prev_px = Simd_f32(particles->prev_px + particle_index);
+            simd_f32 prev_py = Simd_f32(particles->prev_py + particle_index);
+            simd_f32 prev_pz = Simd_f32(particles->prev_pz + particle_index);
+
+            simd_f32 d = pre_stabilize ? (nx*prev_px + ny*prev_py + nz*prev_pz) : (nx*px + ny*py + nz*pz);
+            simd_f32 C = d - Simd_f32(particles->environment_d + particle_index) - Simd_f32(particles->r + particle_index);
+            simd_u32 hit_mask = environment_mask & compare_less(C, epsilon);
+
+            // NOTE(gh) Lanes without the constraint have inv_mass == 0, 
+            // but they are masked out anyway
+            simd_f32 lagrange_multiplier_inv_mass = (-C / inv_mass) * inv_mass;
+            simd_f32 offset_x = lagrange_multiplier_inv_mass*nx;
+            simd_f32 offset_y = lagrange_multiplier_inv_mass*ny;
+            simd_f32 offset_z = lagrange_multiplier_inv_mass*nz;
+
+            if(pre_stabilize)
+            {
+                simd_f32_store(particles->px + particle_index, overwrite(px, hit_mask, px + offset_x));
+                simd_f32_store(particles->py + particle_index, overwrite(py, hit_mask, py + offset_y));
+                simd_f32_store(particles->pz + particle_index, overwrite(pz, hit_mask, pz + offset_z));
+                simd_f32_store(particles->prev_px + particle_index, overwrite(prev_px, hit_mask, prev_px + offset_x));
+                simd_f32_store(particles->prev_py + particle_index, overwrite(prev_py, hit_mask, prev_py + offset_y));
+                simd_f32_store(particles->prev_pz + particle_index, overwrite(prev_pz, hit_mask, prev_pz + offset_z));
+            }
+            else
+            {
+                simd_f32 new_px = px + offset_x;
+                simd_f32 new_py = py + offset_y;
+                simd_f32 new_pz = pz + offset_z;
+
+                // NOTE(gh) Friction against the environment, same as the scalar version
+                simd_f32 d_x = new_px - prev_px;
+                simd_f32 d_y = new_py - prev_py;
+                simd_f32 d_z = new_pz - prev_pz;
+                simd_f32 d_normal = d_x*nx + d_y*ny + d_z*nz;
+                simd_f32 tangent_x = d_x - d_normal*nx;
+                simd_f32 tangent_y = d_y - d_normal*ny;
+                simd_f32 tangent_z = d_z - d_normal*nz;
+                simd_f32 tangent_length = sqrt(tangent_x*tangent_x + tangent_y*tangent_y + tangent_z*tangent_z);
+
+                simd_f32 penetration = -C;
+                simd_u32 kinetic_mask = compare_greater_equal(tangent_length, static_friction*penetration);
+                simd_f32 scale = overwrite(one, kinetic_mask, min(kinetic_friction*penetration/tangent_length, one));
+                // NOTE(gh) Lanes without the tangential movement can be NaN
+                scale = overwrite(zero, compare_greater(tangent_length, zero), scale);
+
+                simd_f32_store(particles->px + particle_index, overwrite(px, hit_mask, new_px - scale*tangent_x));
+                simd_f32_store(particles->py + particle_index, overwrite(py, hit_mask, new_py - scale*tangent_y));
+                simd_f32_store(particles->pz + particle_index, overwrite(pz, hit_mask, new_pz - scale*tangent_z));
+            }
+        }
+    }
+}
+
+internal void
+integrate_particles(PBDSolverParticles<f32> *particles, u32 first, u32 count, f64 sub_dt)
+{
+    simd_f32 dt = Simd_f32((f32)sub_dt);
+    simd_f32 gravity = Simd_f32((f32)(square(sub_dt)*-9.8));
+    simd_f32 zero = Simd_f32(0.0f);
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            particle_index += HB_LANE_WIDTH)
+    {
+        simd_u32 lane_mask = get_lane_mask(particle_index, first + count);
+        simd_u32 movable_mask = lane_mask & compare_greater(Simd_f32(particles->inv_mass + particle_index), zero);
+
+        simd_f32 px = Simd_f32(particles->px + particle_index);
+        simd_f32 py = Simd_f32(particles->py + particle_index);
+        simd_f32 pz = Simd_f32(particles->pz + particle_index);
+
+        simd_f32_store(particles->prev_px + particle_index, 
+                       overwrite(Simd_f32(particles->prev_px + particle_index), movable_mask, px));
+        simd_f32_store(particles->prev_py + particle_index, 
+                       overwrite(Simd_f32(particles->prev_py + particle_index), movable_mask, py));
+        simd_f32_store(particles->prev_pz + particle_index, 
+                       overwrite(Simd_f32(particles->prev_pz + particle_index), movable_mask, pz));
+
+        px = overwrite(px, movable_mask, px + dt*Simd_f32(particles->vx + particle_index));
+        py = overwrite(py, movable_mask, py + dt*Simd_f32(particles->vy + particle_index));
+        pz = overwrite(pz, movable_mask, pz + (dt*Simd_f32(particles->vz + particle_index) + gravity));
+        simd_f32_store(particles->px + particle_index, px);
+        simd_f32_store(particles->py + particle_index, py);
+        simd_f32_store(particles->pz + particle_index, pz);
+    }
+}
+
+internal void
+update_velocities(PBDSolverParticles<f32> *particles, u32 first, u32 count, f64 sub_dt)
+{
+    simd_f32 inv_dt = Simd_f32((f32)(1.0/sub_dt));
+    simd_f32 sleep_epsilon_square = Simd_f32(0.00000001f*0.00000001f);
+    simd_f32 zero = Simd_f32(0.0f);
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            particle_index += HB_LANE_WIDTH)
+    {
+        simd_u32 lane_mask = get_lane_mask(particle_index, first + count);
+        simd_u32 movable_mask = lane_mask & compare_not_equal(Simd_f32(particles->inv_mass + particle_index), zero);
+
+        simd_f32 px = Simd_f32(particles->px + particle_index);
+        simd_f32 py = Simd_f32(particles->py + particle_index);
+        simd_f32 pz = Simd_f32(particles->pz + particle_index);
+        simd_f32 prev_px = Simd_f32(particles->prev_px + particle_index);
+        simd_f32 prev_py = Simd_f32(particles->prev_py + particle_index);
+        simd_f32 prev_pz = Simd_f32(particles->prev_pz + particle_index);
+
+        simd_f32 delta_x = px - prev_px;
+        simd_f32 delta_y = py - prev_py;
+        simd_f32 delta_z = pz - prev_pz;
+        simd_u32 moving_mask = 
+            compare_greater(delta_x*delta_x + delta_y*delta_y + delta_z*delta_z, sleep_epsilon_square);
+
+        simd_u32 velocity_mask = movable_mask & moving_mask;
+        simd_f32_store(particles->vx + particle_index, 
+                       overwrite(Simd_f32(particles->vx + particle_index), velocity_mask, delta_x*inv_dt));
+        simd_f32_store(particles->vy + particle_index, 
+                       overwrite(Simd_f32(particles->vy + particle_index), velocity_mask, delta_y*inv_dt));
+        simd_f32_store(particles->vz + particle_index, 
+                       overwrite(Simd_f32(particles->vz + particle_index), velocity_mask, delta_z*inv_dt));
+
+        // Particle sleeping
+        simd_u32 sleep_mask = movable_mask & (~moving_mask);
+        simd_f32_store(particles->px + particle_index, overwrite(px, sleep_mask, prev_px));
+        simd_f32_store(particles->py + particle_index, overwrite(py, sleep_mask, prev_py));
+        simd_f32_store(particles->pz + particle_index, overwrite(pz, sleep_mask, prev_pz));
+    }
+}
+
+internal v3d
+get_com_of_particles(PBDSolverParticles<f32> *particles, u32 first, u32 count)
+{
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 x = zero;
+    simd_f32 y = zero;
+    simd_f32 z = zero;
+    simd_f32 total_mass = zero;
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            particle_index += HB_LANE_WIDTH)
+    {
+        simd_u32 lane_mask = get_lane_mask(particle_index, first + count);
+        simd_f32 mass = overwrite(zero, lane_mask, Simd_f32(particles->mass + particle_index));
+
+        total_mass += mass;
+        x += mass*Simd_f32(particles->px + particle_index);
+        y += mass*Simd_f32(particles->py + particle_index);
+        z += mass*Simd_f32(particles->pz + particle_index);
+    }
+
+    v3d result = V3d(add_all_lanes(x), add_all_lanes(y), add_all_lanes(z))/(f64)add_all_lanes(total_mass);
+
+    return result;
+}
+
 internal m3x3d
-get_shape_matching_linear_deformation_rotation_matrix(PBDParticleGroup *group)
+get_shape_matching_Apq(PBDSolverParticles<f32> *particles, u32 first, u32 count, v3d com)
 {
-    m3x3d linear_Apq = get_shape_matching_rigid_body_deformation_matrix(group); 
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 com_x = Simd_f32((f32)com.x);
+    simd_f32 com_y = Simd_f32((f32)com.y);
+    simd_f32 com_z = Simd_f32((f32)com.z);
 
-    m3x3d linear_A = linear_Apq * group->linear_inv_Aqq;
-    // Volume preservation
-    linear_A = (1.0/cbrt(get_determinant(linear_A))) * linear_A;
+    simd_f32 e00 = zero; simd_f32 e01 = zero; simd_f32 e02 = zero;
+    simd_f32 e10 = zero; simd_f32 e11 = zero; simd_f32 e12 = zero;
+    simd_f32 e20 = zero; simd_f32 e21 = zero; simd_f32 e22 = zero;
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            particle_index += HB_LANE_WIDTH)
+    {
+        simd_u32 lane_mask = get_lane_mask(particle_index, first + count);
+        simd_f32 mass = overwrite(zero, lane_mask, Simd_f32(particles->mass + particle_index));
 
-    // NOTE(gh) Note that R should be retrieved from Apq, not from full A.
-    group->shape_match_quat = 
-        extract_rotation_from_polar_decomposition(&linear_Apq, &group->shape_match_quat, 64);
-    // R is the matrix that we were using for the rigid body deformation,
-    // which means that it will try to recover in a 'rigid body' way.
-    m3x3d rigid_body_R = 
-        orientation_quatd_to_m3x3d(group->shape_match_quat);
+        simd_f32 offset_x = mass*(Simd_f32(particles->px + particle_index) - com_x);
+        simd_f32 offset_y = mass*(Simd_f32(particles->py + particle_index) - com_y);
+        simd_f32 offset_z = mass*(Simd_f32(particles->pz + particle_index) - com_z);
 
-    f64 c = 1 - group->linear_deformation_c;
-    m3x3d result = group->linear_deformation_c*linear_A + c*rigid_body_R;
+        simd_f32 qx = Simd_f32(particles->offset_x + particle_index);
+        simd_f32 qy = Simd_f32(particles->offset_y + particle_index);
+        simd_f32 qz = Simd_f32(particles->offset_z + particle_index);
+
+        e00 += offset_x*qx; e01 += offset_x*qy; e02 += offset_x*qz;
+        e10 += offset_y*qx; e11 += offset_y*qy; e12 += offset_y*qz;
+        e20 += offset_z*qx; e21 += offset_z*qy; e22 += offset_z*qz;
+    }
+
+    m3x3d result = M3x3d(add_all_lanes(e00), add_all_lanes(e01), add_all_lanes(e02),
+                         add_all_lanes(e10), add_all_lanes(e11), add_all_lanes(e12),
+                         add_all_lanes(e20), add_all_lanes(e21), add_all_lanes(e22));
+
+    return result;
+}
+
+// NOTE(gh) When stiffness is negative, particles are directly set to the goal positions
+internal void
+move_to_shape_matching_goal_positions(PBDSolverParticles<f32> *particles, u32 first, u32 count, 
+                                      m3x3d m, v3d com, f64 stiffness)
+{
+    simd_f32 m00 = Simd_f32((f32)m.e[0][0]); simd_f32 m01 = Simd_f32((f32)m.e[0][1]); simd_f32 m02 = Simd_f32((f32)m.e[0][2]);
+    simd_f32 m10 = Simd_f32((f32)m.e[1][0]); simd_f32 m11 = Simd_f32((f32)m.e[1][1]); simd_f32 m12 = Simd_f32((f32)m.e[1][2]);
+    simd_f32 m20 = Simd_f32((f32)m.e[2][0]); simd_f32 m21 = Simd_f32((f32)m.e[2][1]); simd_f32 m22 = Simd_f32((f32)m.e[2][2]);
+    simd_f32 com_x = Simd_f32((f32)com.x);
+    simd_f32 com_y = Simd_f32((f32)com.y);
+    simd_f32 com_z = Simd_f32((f32)com.z);
+    simd_f32 k = Simd_f32((f32)stiffness);
+    b32 set_directly = (stiffness < 0.0);
+
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            particle_index += HB_LANE_WIDTH)
+    {
+        simd_u32 lane_mask = get_lane_mask(particle_index, first + count);
+
+        simd_f32 qx = Simd_f32(particles->offset_x + particle_index);
+        simd_f32 qy = Simd_f32(particles->offset_y + particle_index);
+        simd_f32 qz = Simd_f32(particles->offset_z + particle_index);
+
+        simd_f32 px = Simd_f32(particles->px + particle_index);
+        simd_f32 py = Simd_f32(particles->py + particle_index);
+        simd_f32 pz = Simd_f32(particles->pz + particle_index);
+
+        simd_f32 goal_x = (m00*qx + m01*qy + m02*qz) + com_x;
+        simd_f32 goal_y = (m10*qx + m11*qy + m12*qz) + com_y;
+        simd_f32 goal_z = (m20*qx + m21*qy + m22*qz) + com_z;
+        if(!set_directly)
+        {
+            simd_f32 alpha = k*Simd_f32(particles->inv_mass + particle_index);
+            goal_x = px + alpha*(goal_x - px);
+            goal_y = py + alpha*(goal_y - py);
+            goal_z = pz + alpha*(goal_z - pz);
+        }
+
+        simd_f32_store(particles->px + particle_index, overwrite(px, lane_mask, goal_x));
+        simd_f32_store(particles->py + particle_index, overwrite(py, lane_mask, goal_y));
+        simd_f32_store(particles->pz + particle_index, overwrite(pz, lane_mask, goal_z));
+    }
+}
+
+internal void
+set_shape_matching_goal_positions(PBDSolverParticles<f32> *particles, u32 first, u32 count, 
+                                  m3x3d m, v3d com)
+{
+    move_to_shape_matching_goal_positions(particles, first, count, m, com, -1.0);
+}
+
+internal void
+pull_to_shape_matching_goal_positions(PBDSolverParticles<f32> *particles, u32 first, u32 count, 
+                                      m3x3d m, v3d com, f64 stiffness)
+{
+    move_to_shape_matching_goal_positions(particles, first, count, m, com, stiffness);
+}
+
+// NOTE(gh) Rotation only needs to be good enough for the f32 positions
+#define polar_decomposition_f32_epsilon 1.0e-6f
+
+/*
+   NOTE(gh) Same iteration as extract_rotation_from_polar_decomposition, but for HB_LANE_WIDTH matrices at once.
+   Each lane stops updating once its correction gets smaller than the epsilon, 
+   and the loop exits as soon as all lanes have converged, which only takes a few iterations with the warm start.
+   The correction is applied as q = normalize((1, w/2)*q) instead of using the axis angle, 
+   which doesn't need sin & cos and is exact enough for the small w that we get.
+*/
+internal void
+batch_extract_rotations_from_polar_decomposition(m3x3d *As, quatd *rotations, u32 count, u32 max_iter_count)
+{
+    simd_f32 one = Simd_f32(1.0f);
+    simd_f32 two = Simd_f32(2.0f);
+    simd_f32 half = Simd_f32(0.5f);
+    simd_f32 epsilon_square = Simd_f32(square(polar_decomposition_f32_epsilon));
+    simd_f32 denominator_epsilon = Simd_f32(1.0e-9f);
+    for(u32 first = 0;
+            first < count;
+            first += HB_LANE_WIDTH)
+    {
+        // NOTE(gh) Lanes past the count get the identity, which converges right away
+        f32 a[9][HB_LANE_WIDTH];
+        f32 q[4][HB_LANE_WIDTH];
+        for(u32 lane = 0;
+                lane < HB_LANE_WIDTH;
+                ++lane)
+        {
+            u32 index = first + lane;
+            m3x3d A = (index < count) ? As[index] : identity_m3x3d();
+            quatd rotation = (index < count) ? rotations[index] : Quatd(1, 0, 0, 0);
+            for(u32 row = 0;
+                    row < 3;
+                    ++row)
+            {
+                for(u32 column = 0;
+                        column < 3;
+                        ++column)
+                {
+                    a[3*row + column][lane] = (f32)A.e[row][column];
+                }
+            }
+            q[0][lane] = (f32)rotation.s;
+            q[1][lane] = (f32)rotation.x;
+            q[2][lane] = (f32)rotation.y;
+            q[3][lane] = (f32)rotation.z;
+        }
+
+        simd_f32 a00 = Simd_f32(a[0]); simd_f32 a01 = Simd_f32(a[1]); simd_f32 a02 = Simd_f32(a[2]);
+        simd_f32 a10 = Simd_f32(a[3]); simd_f32 a11 = Simd_f32(a[4]); simd_f32 a12 = Simd_f32(a[5]);
+        simd_f32 a20 = Simd_f32(a[6]); simd_f32 a21 = Simd_f32(a[7]); simd_f32 a22 = Simd_f32(a[8]);
+        simd_f32 qs = Simd_f32(q[0]);
+        simd_f32 qx = Simd_f32(q[1]);
+        simd_f32 qy = Simd_f32(q[2]);
+        simd_f32 qz = Simd_f32(q[3]);
+        for(u32 iter = 0;
+                iter < max_iter_count;
+                ++iter)
+        {
+            // NOTE(gh) Same as orientation_quatd_to_m3x3d
+            simd_f32 r00 = one - two*(qy*qy + qz*qz);
+            simd_f32 r01 = two*(qx*qy - qs*qz);
+            simd_f32 r02 = two*(qx*qz + qs*qy);
+            simd_f32 r10 = two*(qx*qy + qs*qz);
+            simd_f32 r11 = one - two*(qx*qx + qz*qz);
+            simd_f32 r12 = two*(qy*qz - qs*qx);
+            simd_f32 r20 = two*(qx*qz - qs*qy);
+            simd_f32 r21 = two*(qy*qz + qs*qx);
+            simd_f32 r22 = one - two*(qx*qx + qy*qy);
+
+            // w = sum(cross(R column i, A column i)) / (|sum(dot(R column i, A column i))| + epsilon)
+            simd_f32 wx = (r10*a20 - r20*a10) + (r11*a21 - r21*a11) + (r12*a22 - r22*a12);
+            simd_f32 wy = (r20*a00 - r00*a20) + (r21*a01 - r01*a21) + (r22*a02 - r02*a22);
+            simd_f32 wz = (r00*a10 - r10*a00) + (r01*a11 - r11*a01) + (r02*a12 - r12*a02);
+            simd_f32 d = (r00*a00 + r10*a10 + r20*a20) + 
+                         (r01*a01 + r11*a11 + r21*a21) + 
+                         (r02*a02 + r12*a12 + r22*a22);
+            simd_f32 inv_d = one/(max(d, -d) + denominator_epsilon);
+            wx = inv_d*wx;
+            wy = inv_d*wy;
+            wz = inv_d*wz;
+
+            simd_u32 active_mask = compare_greater(wx*wx + wy*wy + wz*wz, epsilon_square);
+            if(all_lanes_zero(active_mask))
+            {
+                break;
+            }
+
+            simd_f32 hx = half*wx;
+            simd_f32 hy = half*wy;
+            simd_f32 hz = half*wz;
+            simd_f32 new_qs = qs - (hx*qx + hy*qy + hz*qz);
+            simd_f32 new_qx = qx + hx*qs + (hy*qz - hz*qy);
+            simd_f32 new_qy = qy + hy*qs + (hz*qx - hx*qz);
+            simd_f32 new_qz = qz + hz*qs + (hx*qy - hy*qx);
+            simd_f32 inv_length = one/sqrt(new_qs*new_qs + new_qx*new_qx + new_qy*new_qy + new_qz*new_qz);
+
+            qs = overwrite(qs, active_mask, inv_length*new_qs);
+            qx = overwrite(qx, active_mask, inv_length*new_qx);
+            qy = overwrite(qy, active_mask, inv_length*new_qy);
+            qz = overwrite(qz, active_mask, inv_length*new_qz);
+        }
+
+        simd_f32_store(q[0], qs);
+        simd_f32_store(q[1], qx);
+        simd_f32_store(q[2], qy);
+        simd_f32_store(q[3], qz);
+        for(u32 lane = 0;
+                lane < HB_LANE_WIDTH && first + lane < count;
+                ++lane)
+        {
+            rotations[first + lane] = normalize(Quatd(q[0][lane], q[1][lane], q[2][lane], q[3][lane]));
+        }
+    }
+}
+
+internal void
+extract_shape_matching_rotations(PBDSolverParticles<f32> *particles, m3x3d *As, quatd *rotations, u32 count)
+{
+    batch_extract_rotations_from_polar_decomposition(As, rotations, count, 
+                                                     shape_matching_polar_decomposition_max_iter_count);
+}
+
+/*
+   NOTE(gh) The particles of the constraints are scattered around, so they need to be gathered into the lanes.
+   Lanes past the last constraint of the color point to the padding particle(particles->count) 
+   that has inv_mass of 0, and they are never scattered back.
+*/
+force_inline simd_f32
+gather_lanes(f32 *array, u32 *indices)
+{
+    f32 values[HB_LANE_WIDTH];
+    for(u32 lane = 0;
+            lane < HB_LANE_WIDTH;
+            ++lane)
+    {
+        values[lane] = array[indices[lane]];
+    }
+
+    simd_f32 result = Simd_f32(values);
 
     return result;
 }
 
+// NOTE(gh) Safe because the constraints with the same color never share a particle
+force_inline void
+scatter_add_lanes(f32 *array, u32 *indices, simd_f32 value, u32 lane_count)
+{
+    f32 values[HB_LANE_WIDTH];
+    simd_f32_store(values, value);
+    for(u32 lane = 0;
+            lane < lane_count;
+            ++lane)
+    {
+        array[indices[lane]] += values[lane];
+    }
+}
 
+internal void
+solve_distance_constraints(PBDSolverParticles<f32> *particles, u32 first, PBDParticleGroup *group, f64 sub_dt)
+{
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 alpha = Simd_f32((f32)(group->inv_distance_stiffness/square(sub_dt)));
 
+    u32 color_first = 0;
+    for(u32 color_index = 0;
+            color_index < group->distance_color_count;
+            ++color_index)
+    {
+        u32 color_end = group->distance_color_ends[color_index];
+        for(u32 constraint_index = color_first;
+                constraint_index < color_end;
+                constraint_index += HB_LANE_WIDTH)
+        {
+            u32 lane_count = minimum(HB_LANE_WIDTH, color_end - constraint_index);
 
+            u32 i0[HB_LANE_WIDTH];
+            u32 i1[HB_LANE_WIDTH];
+            f32 rest_lengths[HB_LANE_WIDTH];
+            for(u32 lane = 0;
+                    lane < HB_LANE_WIDTH;
+                    ++lane)
+            {
+                i0[lane] = i1[lane] = particles->count;
+                rest_lengths[lane] = 0.0f;
+                if(lane < lane_count)
+                {
+                    DistanceConstraint *c = group->distance_constraints + constraint_index + lane;
+                    i0[lane] = first + c->index0;
+                    i1[lane] = first + c->index1;
+                    rest_lengths[lane] = c->rest_length;
+                }
+            }
 
+            simd_f32 inv_mass0 = gather_lanes(particles->inv_mass, i0);
+            simd_f32 inv_mass1 = gather_lanes(particles->inv_mass, i1);
 
+            simd_f32 delta_x = gather_lanes(particles->px, i0) - gather_lanes(particles->px, i1);
+            simd_f32 delta_y = gather_lanes(particles->py, i0) - gather_lanes(particles->py, i1);
+            simd_f32 delta_z = gather_lanes(particles->pz, i0) - gather_lanes(particles->pz, i1);
+            simd_f32 delta_length = sqrt(delta_x*delta_x + delta_y*delta_y + delta_z*delta_z);
 
+            simd_f32 C = delta_length - Simd_f32(rest_lengths);
+            simd_u32 solve_mask = compare_not_equal(inv_mass0 + inv_mass1, zero) & 
+                                  compare_not_equal(delta_length, zero);
 
+            // NOTE(gh) Masked out lanes can be NaN, so overwrite them before multiplying with the gradient
+            simd_f32 lagrange_multiplier_over_length = 
+                overwrite(zero, solve_mask, (-C / (inv_mass0 + inv_mass1 + alpha)) / delta_length);
+            simd_f32 offset0 = lagrange_multiplier_over_length*inv_mass0;
+            simd_f32 offset1 = -lagrange_multiplier_over_length*inv_mass1;
 
+            scatter_add_lanes(particles->px, i0, offset0*delta_x, lane_count);
+            scatter_add_lanes(particles->py, i0, offset0*delta_y, lane_count);
+            scatter_add_lanes(particles->pz, i0, offset0*delta_z, lane_count);
+            scatter_add_lanes(particles->px, i1, offset1*delta_x, lane_count);
+            scatter_add_lanes(particles->py, i1, offset1*delta_y, lane_count);
+            scatter_add_lanes(particles->pz, i1, offset1*delta_z, lane_count);
+        }
 
+        color_first = color_end;
+    }
+}
+
+internal void
+solve_volume_constraints(PBDSolverParticles<f32> *particles, u32 first, PBDParticleGroup *group, f64 sub_dt)
+{
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 one_over_six = Simd_f32(1.0f/6.0f);
+    simd_f32 alpha = Simd_f32((f32)(group->inv_volume_stiffness/square(sub_dt)));
+    u32 abc[4][3] = {{2, 1, 3}, {0, 2, 3}, {3, 1, 0}, {1, 2, 0}};
+
+    u32 color_first = 0;
+    for(u32 color_index = 0;
+            color_index < group->volume_color_count;
+            ++color_index)
+    {
+        u32 color_end = group->volume_color_ends[color_index];
+        for(u32 constraint_index = color_first;
+                constraint_index < color_end;
+                constraint_index += HB_LANE_WIDTH)
+        {
+            u32 lane_count = minimum(HB_LANE_WIDTH, color_end - constraint_index);
 
+            u32 indices[4][HB_LANE_WIDTH];
+            f32 rest_volumes[HB_LANE_WIDTH];
+            for(u32 lane = 0;
+                    lane < HB_LANE_WIDTH;
+                    ++lane)
+            {
+                indices[0][lane] = indices[1][lane] = indices[2][lane] = indices[3][lane] = particles->count;
+                rest_volumes[lane] = 0.0f;
+                if(lane < lane_count)
+                {
+                    VolumeConstraint *c = group->volume_constraints + constraint_index + lane;
+                    indices[0][lane] = first + c->index0;
+                    indices[1][lane] = first + c->index1;
+                    indices[2][lane] = first + c->index2;
+                    indices[3][lane] = first + c->index3;
+                    rest_volumes[lane] = c->rest_volume;
+                }
+            }
 
+            simd_f32 x[4];
+            simd_f32 y[4];
+            simd_f32 z[4];
+            simd_f32 inv_mass[4];
+            for(u32 i = 0;
+                    i < 4;
+                    ++i)
+            {
+                x[i] = gather_lanes(particles->px, indices[i]);
+                y[i] = gather_lanes(particles->py, indices[i]);
+                z[i] = gather_lanes(particles->pz, indices[i]);
+                inv_mass[i] = gather_lanes(particles->inv_mass, indices[i]);
+            }
 
+            simd_f32 gradient_x[4];
+            simd_f32 gradient_y[4];
+            simd_f32 gradient_z[4];
+            simd_f32 denominator = alpha;
+            for(u32 i = 0;
+                    i < 4;
+                    ++i)
+            {
+                u32 a = abc[i][0];
+                u32 b = abc[i][1];
+                u32 c = abc[i][2];
+                simd_f32 ux = x[a] - x[b];
+                simd_f32 uy = y[a] - y[b];
+                simd_f32 uz = z[a] - z[b];
+                simd_f32 vx = x[c] - x[b];
+                simd_f32 vy = y[c] - y[b];
+                simd_f32 vz = z[c] - z[b];
+                gradient_x[i] = one_over_six*(uy*vz - uz*vy);
+                gradient_y[i] = one_over_six*(uz*vx - ux*vz);
+                gradient_z[i] = one_over_six*(ux*vy - uy*vx);
+
+                denominator += inv_mass[i]*(gradient_x[i]*gradient_x[i] + 
+                                            gradient_y[i]*gradient_y[i] + 
+                                            gradient_z[i]*gradient_z[i]);
+            }
+
+            simd_f32 volume = gradient_x[0]*(x[0] - x[1]) + 
+                              gradient_y[0]*(y[0] - y[1]) + 
+                              gradient_z[0]*(z[0] - z[1]);
+            simd_f32 C = volume - Simd_f32(rest_volumes);
+            simd_f32 lagrange_multiplier = 
+                overwrite(zero, compare_not_equal(denominator, zero), -C / denominator);
+
+            for(u32 i = 0;
+                    i < 4;
+                    ++i)
+            {
+                simd_f32 offset = lagrange_multiplier*inv_mass[i];
+                scatter_add_lanes(particles->px, indices[i], offset*gradient_x[i], lane_count);
+                scatter_add_lanes(particles->py, indices[i], offset*gradient_y[i], lane_count);
+                scatter_add_lanes(particles->pz, indices[i], offset*gradient_z[i], lane_count);
+            }
+        }
+
+        color_first = color_end;
+    }
+}
 
+// NOTE(gh) rigid_body_R should be retrieved from Apq, not from full A(see extract_shape_matching_rotations)
+internal m3x3d
+get_shape_matching_linear_deformation_matrix(PBDParticleGroup *group, m3x3d linear_Apq, m3x3d rigid_body_R)
+{
+    m3x3d linear_A = linear_Apq * group->linear_inv_Aqq;
+    // Volume preservation
+    linear_A = (1.0/cbrt(get_determinant(linear_A))) * linear_A;
+
+    // R is the matrix that we were using for the rigid body deformation,
+    // which means that it will try to recover in a 'rigid body' way.
+
+    f64 c = 1 - group->linear_deformation_c;
+    m3x3d result = group->linear_deformation_c*linear_A + c*rigid_body_R;
+
+    return result;
+}
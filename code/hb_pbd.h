@@ -21,6 +21,11 @@ struct PBDParticle
     // preventing them from colliding each other
     i32 phase; 
 
+    // NOTE(gh) Signed distance to the surface of the body(negative inside) and the outward normal 
+    // of that surface in the rest pose, both are 0 if the body doesn't have the sdf(see compute_vox_sdf)
+    f32 sdf;
+    v3 sdf_normal;
+
     /*
         NOTE(gh) Temporary varaibles, should be cleared to 0 each frame
     */
@@ -35,7 +40,9 @@ struct PBDParticlePool
     // TODO(gh) Probably not a good idea, 
     // but works well with the time machine, since the game state is the 
     // one who are holding the particle pool
-    PBDParticle particles[1024];
+    // NOTE(gh) Sized for a fluid block of a few thousand particles(see add_pbd_fluid_block_entity).
+    // Unused particles don't cost anything to the time machine, since it only stores what has changed.
+    PBDParticle particles[8192];
     u32 count;
 };
 
@@ -52,8 +59,9 @@ struct FixedPositionConstraint
 */
 struct CollisionConstraint
 {
-    PBDParticle *particle0;
-    PBDParticle *particle1;
+    // NOTE(gh) Indices to the particle pool
+    u32 index0;
+    u32 index1;
 };
 
 /*
@@ -63,13 +71,13 @@ struct CollisionConstraint
     which means that the displacement should not occur in a direction of contact normal.
 
     Then, the offset for particle 0 should be
-    if(length(tanD) < static friction coefficient)
+    if(length(tanD) < static friction coefficient*penetration distance)
     {
-        offset = (w1/(w1+w2)) * tanD
+        offset = -(w1/(w1+w2)) * tanD
     }
     else
     {
-        offset = (w1/(w1+w2)) * tanD * 
+        offset = -(w1/(w1+w2)) * tanD * 
                   min(kinetic friction coefficient*penetration distance/length(tanD), 1);
     }
 
@@ -84,20 +92,6 @@ struct FrictionConstraint
     f64 penetration_depth;
 };
 
-/*
-    NOTE(gh) Environment collision constraint between one particle and the environment
-    C(x) = dot(plane_normal, particle_position) − plane_d - radius ≥ 0
-*/
-struct EnvironmentConstraint
-{
-    PBDParticle *particle;
-
-    // environment info
-    v3d n; // should be normalized
-    // Should also include the radius of the particle, too
-    f32 d;
-};
-
 /*
     NOTE(gh) Distance constraint between two particles
     C = distance_between(x0, x1) - rest_length;
@@ -108,6 +102,8 @@ struct EnvironmentConstraint
     lagrange_multiplier = -C / (w0 + w1 + alpha/dt^2),
     where w0 and w1 are the inverse mass of the particles,
     and alpha = 1/stiffness
+
+    Indices are relative to the particles of the group.
 */
 struct DistanceConstraint
 {
@@ -125,6 +121,9 @@ struct DistanceConstraint
     gradient(x1) = (x0-x2) x (x3 - x2);
     gradient(x2) = (x3-x1) x (x0 - x1);
     gradient(x3) = (x1-x2) x (x0 - x2);
+    (all divided by 6)
+
+    Indices are relative to the particles of the group.
 */
 struct VolumeConstraint
 {
@@ -136,6 +135,9 @@ struct VolumeConstraint
     f32 rest_volume;
 };
 
+// NOTE(gh) Constraints with the same color never share a particle
+#define max_pbd_constraint_color_count 32
+
 struct PBDParticleGroup
 {
     // particles should be laid out sequentially
@@ -145,14 +147,19 @@ struct PBDParticleGroup
     // Used as an initial value of shape match rotation matrix extraction quaternion
     quatd shape_match_quat;
 
-#if 1
+    // NOTE(gh) Constraints are sorted by their colors(see color_constraints),
+    // and color_ends holds one past the last constraint of each color.
     DistanceConstraint *distance_constraints;
     u32 distance_constraint_count;
+    u32 distance_color_ends[max_pbd_constraint_color_count];
+    u32 distance_color_count;
     f32 inv_distance_stiffness;
 
     VolumeConstraint *volume_constraints;
     u32 volume_constraint_count;
-#endif
+    u32 volume_color_ends[max_pbd_constraint_color_count];
+    u32 volume_color_count;
+    f32 inv_volume_stiffness;
 
     // Used for linear deformation
     m3x3d linear_inv_Aqq;
@@ -161,6 +168,284 @@ struct PBDParticleGroup
     // NOTE(gh) Used for quadratic deformation
     m9x9d quadratic_inv_Aqq;
     // f32 quadratic_shape_matching_coefficient; // should range from 0 to 1
+
+    // NOTE(gh) Sleeping groups are skipped by the solver entirely, 
+    // and are woken up when the island that they belong to starts moving(see update_sleeping_islands)
+    b32 is_sleeping;
+    f32 rest_time; // How long the group has been resting, in seconds
+
+    // NOTE(gh) Whether any of the particles had an environment or a collision constraint in the last frame,
+    // used to pick the substep count(see get_pbd_substep_count)
+    b32 has_contacts;
+
+    /*
+       NOTE(gh) 6-DOF state of the EntityFlag_RigidBody groups(see initialize_rigid_body).
+       Orientation is the shape_match_quat, and the inv mass is 0 if the group can't use the fast path.
+       While is_free_rigid_body is set, only these are simulated and the particles are left behind,
+       so anyone who reads the particles should call materialize_rigid_body_particles first.
+    */
+    v3d rigid_body_p; // com
+    v3d rigid_body_v;
+    v3d rigid_body_w;
+    f64 rigid_body_inv_mass;
+    m3x3d rigid_body_inertia; // body space
+    m3x3d rigid_body_inv_inertia; // body space
+    f64 rigid_body_radius; // including the particle radius
+    b32 is_free_rigid_body;
+    b32 are_particles_stale;
+};
+
+// NOTE(gh) Same as the particle pool, groups own a contiguous range of these
+struct PBDConstraintPool
+{
+    DistanceConstraint distance_constraints[4096];
+    u32 distance_constraint_count;
+
+    VolumeConstraint volume_constraints[4096];
+    u32 volume_constraint_count;
+};
+
+// NOTE(gh) Contiguous range of particles inside the particle pool
+struct PBDParticleRange
+{
+    u32 first;
+    u32 count;
+};
+
+// NOTE(gh) World space AABB of the particles of one entity, 
+// expanded by the radius and the speculative margin of each particle
+struct PBDEntityBounds
+{
+    v3d min;
+    v3d max;
+};
+
+// NOTE(gh) Static triangle that the particles can collide against, in world space.
+// Normal follows the counter clockwise winding, and only the front side pushes the particles out.
+struct PBDEnvironmentTriangle
+{
+    v3d p0;
+    v3d p1;
+    v3d p2;
+    v3d normal;
+
+    v3d min;
+    v3d max;
+};
+
+/*
+    NOTE(gh) Static triangle mesh(floors, heightfields, imported meshes...) that the particles collide against.
+    Triangles are bucketed into a uniform xy grid, so that the query only has to look at the cells that 
+    overlap with the bounds of the entity, regardless of the total triangle count.
+    Triangles that overlap with multiple cells are stored in every one of them.
+*/
+struct PBDEnvironmentCollider
+{
+    PBDEnvironmentTriangle *triangles;
+    u32 triangle_count;
+
+    f64 grid_min_x;
+    f64 grid_min_y;
+    f64 cell_dim;
+    u32 cell_count_x;
+    u32 cell_count_y;
+
+    // NOTE(gh) Triangles of cell i are cell_triangle_indices[cell_first_triangle[i]...cell_first_triangle[i+1]]
+    u32 *cell_first_triangle; 
+    u32 *cell_triangle_indices;
+};
+
+// NOTE(gh) Colliders never change after they were added, 
+// so the time machine only needs to copy the pointers.
+struct PBDEnvironment
+{
+    PBDEnvironmentCollider colliders[16];
+    u32 collider_count;
+};
+
+enum PBDPrecisionMode
+{
+    // NOTE(gh) Reference path, see the 'Precision' note in hb.cpp
+    PBDPrecisionMode_f64,
+    // NOTE(gh) HB_LANE_WIDTH wide simd path, which is only stable when the sub step is small enough
+    PBDPrecisionMode_f32,
+};
+
+/*
+    NOTE(gh) SOA copy of the particle pool that the substep solver works on.
+    This gets filled from the particle pool at the start of the frame and written back at the end, 
+    so the game state(and therefore the time machine) stays in f64 regardless of the precision mode.
+
+    All arrays are padded to the lane width with zeros, so the padded lanes have inv_mass == 0.
+*/
+template<typename real>
+struct PBDSolverParticles
+{
+    u32 count;
+    u32 lane_count;
+
+    real *px;
+    real *py;
+    real *pz;
+
+    real *prev_px;
+    real *prev_py;
+    real *prev_pz;
+
+    real *vx;
+    real *vy;
+    real *vz;
+
+    // initial_offset_from_com
+    real *offset_x;
+    real *offset_y;
+    real *offset_z;
+
+    // NOTE(gh) Second order terms of the quadratic q(see get_quadratic_deformation_q),
+    // the first order terms are the offsets above. Only filled for the quadratic groups.
+    real *q_xx;
+    real *q_yy;
+    real *q_zz;
+    real *q_xy;
+    real *q_yz;
+    real *q_zx;
+
+    // NOTE(gh) sdf of the particle and the sdf normal rotated by the current orientation of the group
+    real *sdf;
+    real *sdf_nx;
+    real *sdf_ny;
+    real *sdf_nz;
+
+    real *inv_mass; // 0 for the particles that belong to the sleeping groups
+    real *mass; // 0 for the particles with infinite mass
+    real *r;
+
+    u32 *entity_indices; // Entity that this particle belongs to
+
+    // NOTE(gh) Upper bound of how far the particle can travel in this frame,
+    // used to generate the collision candidates once per frame instead of every substep
+    real *speculative_margin;
+
+    /*
+        NOTE(gh) Environment collision constraint between one particle and the environment,
+        at most one per particle, generated once per frame using the speculative margin.
+        C(x) = dot(plane_normal, particle_position) − plane_d - radius ≥ 0
+    */
+    u32 *environment_mask; // 0xffffffff if the constraint is active
+    real *environment_nx; // should be normalized
+    real *environment_ny;
+    real *environment_nz;
+    real *environment_d;
+};
+
+// NOTE(gh) Inputs & outputs of the shape matching groups for one substep, 
+// gathered so that the rotations can be extracted in batches(see solve_shape_matching_constraints)
+struct PBDShapeMatchingBatch
+{
+    u32 count;
+    u32 *entity_indices;
+    v3d *coms;
+    m3x3d *Apqs; // linear part of Apq for the quadratic groups
+    m3x9d *quadratic_Apqs; // only filled for the quadratic groups
+    quatd *rotations; // warm started with shape_match_quat
+};
+
+// NOTE(gh) Range of the shape matching batch that one thread works on(see prepare_shape_matching_jobs)
+template<typename real>
+struct ThreadShapeMatchingData
+{
+    PBDSolverParticles<real> *particles;
+    struct GameState *game_state;
+    PBDShapeMatchingBatch *batch;
+
+    u32 first;
+    u32 one_past_last;
+
+    // NOTE(gh) false : gather com & Apq, true : move the particles to the goal positions
+    b32 should_apply_goal_positions;
+    f64 sub_dt;
+};
+
+// NOTE(gh) Neighbors past this are ignored. At the rest spacing, 
+// a fluid particle has 32 neighbors inside the kernel radius(see get_fluid_rest_density)
+#define pbd_fluid_max_neighbor_count 64
+
+/*
+    NOTE(gh) Position based fluids(Macklin & Muller), one density constraint per fluid particle.
+    rho_i = sum_j W_poly6(p_i - p_j, h)
+    C_i = rho_i/rest_density - 1 (clamped to 0, so the fluid can only push)
+    lambda_i = -C_i / (sum_k |gradient_pk(C_i)|^2 + relaxation)
+    delta_p_i = (1/rest_density) * sum_j (lambda_i + lambda_j + s_corr) * gradient_W_spiky(p_i - p_j, h)
+    where s_corr is the artificial pressure that keeps the particles from clumping together.
+
+    Neighbors are found with the uniform hash grid with the cell dim of h, rebuilt every substep.
+    Fluid particles are sorted by their cells, so that the neighbor lists of the consecutive particles 
+    touch the same particles.
+*/
+template<typename real>
+struct PBDFluidParticles
+{
+    u32 count;
+    real kernel_radius; // h
+    real rest_density;
+
+    // NOTE(gh) Solver particle indices of the awake fluid particles
+    u32 *unsorted_indices;
+    u32 *indices; // sorted by the cells
+    u32 *particle_cells; // cell of unsorted_indices[i]
+
+    // NOTE(gh) Particles of cell i are indices[cell_first[i]...cell_first[i+1]]
+    u32 cell_count; // power of 2
+    u32 *cell_first;
+    u32 *cell_cursor;
+
+    // NOTE(gh) pbd_fluid_max_neighbor_count per fluid particle, in the sorted order.
+    // Padded to the lane width with the padding particle(particles->count).
+    u32 *neighbor_counts;
+    u32 *neighbors;
+
+    real *lambdas; // indexed by the solver particle index
+    real *delta_x; // in the sorted order
+    real *delta_y;
+    real *delta_z;
+};
+
+// NOTE(gh) What the adaptive substepping picked for the last couple of frames(see get_pbd_substep_count)
+struct PBDSubstepStats
+{
+    u32 last_substep_count;
+    f64 last_residual_error; // relative to the radius
+    f64 last_max_travel; // relative to the radius
+
+    u32 substep_counts[128];
+    f32 residual_errors[128];
+    u32 write_cursor;
+    u32 recorded_count;
+};
+
+struct PBDPrecisionComparison
+{
+    u32 frame_count;
+
+    // NOTE(gh) Distance between the f32 particle and the f64 reference particle
+    f64 max_drift; // over the whole trajectory
+    f64 final_average_drift;
+
+    u64 f64_cycle_count;
+    u64 f32_cycle_count;
+};
+
+// NOTE(gh) See debug_benchmark_polar_decomposition
+struct PBDPolarDecompositionBenchmark
+{
+    u32 group_count;
+
+    u64 scalar_cycle_count;
+    u64 batch_cycle_count;
+
+    // NOTE(gh) Angle between the extracted and the actual rotation, in radian
+    f64 scalar_max_error;
+    f64 batch_max_error;
 };
 
 
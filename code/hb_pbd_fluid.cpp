@@ -0,0 +1,669 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+/*
+   NOTE(gh) Position based fluids, see the note on PBDFluidParticles.
+   Same as the rest of the solver, the kernels are templated on the scalar type
+   and the f32 path overloads them with the simd versions that evaluate HB_LANE_WIDTH neighbors at once.
+*/
+
+// NOTE(gh) Kernel radius(h) relative to the particle radius, which is two times the rest spacing
+#define pbd_fluid_kernel_radius_over_particle_radius 4.0
+// NOTE(gh) Added to the denominator of the lambda, softens the constraint when the particle has only a few neighbors
+#define pbd_fluid_relaxation 0.5
+// NOTE(gh) s_corr = -k*(W(r)/W(dq*h))^4
+#define pbd_fluid_artificial_pressure_k 0.001
+#define pbd_fluid_artificial_pressure_dq 0.2
+// NOTE(gh) How far the density constraint can move a particle in one substep, relative to the radius
+#define pbd_fluid_max_delta_over_radius 0.25
+// NOTE(gh) XSPH viscosity, how much the velocity gets pulled towards the neighbors each substep
+#define pbd_fluid_viscosity 0.02
+
+// NOTE(gh) W_poly6(r, h) = 315/(64*pi*h^9) * (h^2 - r^2)^3
+internal f64
+get_poly6_coefficient(f64 h)
+{
+    f64 h_cube = h*h*h;
+    f64 result = 315.0/(64.0*pi_32*h_cube*h_cube*h_cube);
+
+    return result;
+}
+
+// NOTE(gh) gradient_W_spiky(r, h) = -45/(pi*h^6) * (h - r)^2 * r/|r|
+internal f64
+get_spiky_gradient_coefficient(f64 h)
+{
+    f64 h_cube = h*h*h;
+    f64 result = -45.0/(pi_32*h_cube*h_cube);
+
+    return result;
+}
+
+// NOTE(gh) Density of the particle inside the cubic lattice with the given spacing,
+// so that the fluid block is at rest when it gets added(see add_pbd_fluid_block_entity)
+internal f64
+get_fluid_rest_density(f64 h, f64 spacing)
+{
+    f64 poly6 = get_poly6_coefficient(h);
+    i32 extent = (i32)(h/spacing);
+
+    f64 result = 0;
+    for(i32 z = -extent;
+            z <= extent;
+            ++z)
+    {
+        for(i32 y = -extent;
+                y <= extent;
+                ++y)
+        {
+            for(i32 x = -extent;
+                    x <= extent;
+                    ++x)
+            {
+                f64 r_square = square(spacing)*(x*x + y*y + z*z);
+                if(r_square < square(h))
+                {
+                    f64 w = square(h) - r_square;
+                    result += poly6*w*w*w;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+// NOTE(gh) Primes from 'Optimized Spatial Hashing for Collision Detection of Deformable Objects'
+internal u32
+get_fluid_cell_hash(i32 x, i32 y, i32 z, u32 cell_count)
+{
+    u32 result = (((u32)x*73856093) ^ ((u32)y*19349663) ^ ((u32)z*83492791)) & (cell_count - 1);
+
+    return result;
+}
+
+/*
+   NOTE(gh) Gathers the particles of the awake fluid groups, which doesn't change between the substeps.
+   All fluid particles are assumed to have the same radius & mass,
+   and the fluid groups see each other as the same fluid.
+*/
+template<typename real>
+internal TempMemory
+start_fluid_particles(PBDFluidParticles<real> *fluid, PBDSolverParticles<real> *particles,
+                      MemoryArena *arena, GameState *game_state)
+{
+    PBDParticlePool *pool = &game_state->particle_pool;
+
+    u32 count = 0;
+    f64 r = 0;
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        Entity *entity = game_state->entities + entity_index;
+        PBDParticleGroup *group = &entity->particle_group;
+        if(group->count && !group->is_sleeping && is_entity_flag_set(entity, EntityFlag_Fluid))
+        {
+            count += group->count;
+            r = group->particles[0].r;
+        }
+    }
+
+    fluid->count = count;
+    fluid->kernel_radius = (real)(pbd_fluid_kernel_radius_over_particle_radius*r);
+    fluid->rest_density = (real)get_fluid_rest_density(fluid->kernel_radius, 2.0*r);
+    fluid->cell_count = 1;
+    while(fluid->cell_count < 2*count)
+    {
+        fluid->cell_count *= 2;
+    }
+
+    TempMemory result =
+        start_temp_memory(arena,
+                          (particles->lane_count + 3*count)*sizeof(real) +
+                          (count*(4 + pbd_fluid_max_neighbor_count) + 2*fluid->cell_count + 1)*sizeof(u32),
+                          false);
+
+    // NOTE(gh) The padding neighbors read the lambda of the padding particle
+    fluid->lambdas = push_array(&result, real, particles->lane_count);
+    for(u32 particle_index = 0;
+            particle_index < particles->lane_count;
+            ++particle_index)
+    {
+        fluid->lambdas[particle_index] = 0;
+    }
+
+    if(count)
+    {
+        fluid->delta_x = push_array(&result, real, count);
+        fluid->delta_y = push_array(&result, real, count);
+        fluid->delta_z = push_array(&result, real, count);
+        fluid->unsorted_indices = push_array(&result, u32, count);
+        fluid->indices = push_array(&result, u32, count);
+        fluid->particle_cells = push_array(&result, u32, count);
+        fluid->neighbor_counts = push_array(&result, u32, count);
+        fluid->neighbors = push_array(&result, u32, count*pbd_fluid_max_neighbor_count);
+        fluid->cell_first = push_array(&result, u32, (fluid->cell_count + 1));
+        fluid->cell_cursor = push_array(&result, u32, fluid->cell_count);
+
+        u32 fluid_index = 0;
+        for(u32 entity_index = 0;
+                entity_index < game_state->entity_count;
+                ++entity_index)
+        {
+            Entity *entity = game_state->entities + entity_index;
+            PBDParticleGroup *group = &entity->particle_group;
+            if(group->count && !group->is_sleeping && is_entity_flag_set(entity, EntityFlag_Fluid))
+            {
+                u32 first = get_first_particle_index(pool, group);
+                for(u32 particle_index = first;
+                        particle_index < first + group->count;
+                        ++particle_index)
+                {
+                    fluid->unsorted_indices[fluid_index++] = particle_index;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+/*
+   NOTE(gh) Counting sort of the fluid particles by their cells, followed by the neighbor search
+   that looks at the 27 cells around each particle. Called once per substep after the particles were integrated.
+   Different cells can end up with the same hash,
+   so the hashes are deduplicated and the far away particles are rejected by the distance.
+*/
+template<typename real>
+internal void
+build_fluid_neighbors(PBDSolverParticles<real> *particles, PBDFluidParticles<real> *fluid)
+{
+    f64 inv_h = 1.0/fluid->kernel_radius;
+    real h_square = fluid->kernel_radius*fluid->kernel_radius;
+
+    for(u32 cell_index = 0;
+            cell_index <= fluid->cell_count;
+            ++cell_index)
+    {
+        fluid->cell_first[cell_index] = 0;
+    }
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 particle_index = fluid->unsorted_indices[fluid_index];
+        u32 cell = get_fluid_cell_hash((i32)floor(particles->px[particle_index]*inv_h),
+                                       (i32)floor(particles->py[particle_index]*inv_h),
+                                       (i32)floor(particles->pz[particle_index]*inv_h), fluid->cell_count);
+        fluid->particle_cells[fluid_index] = cell;
+        fluid->cell_first[cell + 1]++;
+    }
+
+    for(u32 cell_index = 0;
+            cell_index < fluid->cell_count;
+            ++cell_index)
+    {
+        fluid->cell_first[cell_index + 1] += fluid->cell_first[cell_index];
+        fluid->cell_cursor[cell_index] = fluid->cell_first[cell_index];
+    }
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 cell = fluid->particle_cells[fluid_index];
+        fluid->indices[fluid->cell_cursor[cell]++] = fluid->unsorted_indices[fluid_index];
+    }
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        i32 cell_x = (i32)floor(particles->px[i]*inv_h);
+        i32 cell_y = (i32)floor(particles->py[i]*inv_h);
+        i32 cell_z = (i32)floor(particles->pz[i]*inv_h);
+
+        u32 *neighbors = fluid->neighbors + fluid_index*pbd_fluid_max_neighbor_count;
+        u32 neighbor_count = 0;
+
+        u32 visited_cells[27];
+        u32 visited_cell_count = 0;
+        for(i32 z = cell_z - 1;
+                z <= cell_z + 1;
+                ++z)
+        {
+            for(i32 y = cell_y - 1;
+                    y <= cell_y + 1;
+                    ++y)
+            {
+                for(i32 x = cell_x - 1;
+                        x <= cell_x + 1;
+                        ++x)
+                {
+                    u32 cell = get_fluid_cell_hash(x, y, z, fluid->cell_count);
+
+                    b32 is_visited = false;
+                    for(u32 visited_index = 0;
+                            visited_index < visited_cell_count;
+                            ++visited_index)
+                    {
+                        if(visited_cells[visited_index] == cell)
+                        {
+                            is_visited = true;
+                            break;
+                        }
+                    }
+
+                    if(!is_visited)
+                    {
+                        visited_cells[visited_cell_count++] = cell;
+                        for(u32 sorted_index = fluid->cell_first[cell];
+                                sorted_index < fluid->cell_first[cell + 1] && neighbor_count < pbd_fluid_max_neighbor_count;
+                                ++sorted_index)
+                        {
+                            u32 j = fluid->indices[sorted_index];
+                            real dx = particles->px[i] - particles->px[j];
+                            real dy = particles->py[i] - particles->py[j];
+                            real dz = particles->pz[i] - particles->pz[j];
+                            if(j != i && dx*dx + dy*dy + dz*dz < h_square)
+                            {
+                                neighbors[neighbor_count++] = j;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        fluid->neighbor_counts[fluid_index] = neighbor_count;
+        for(u32 padding_index = neighbor_count;
+                (padding_index % HB_LANE_WIDTH) != 0;
+                ++padding_index)
+        {
+            neighbors[padding_index] = particles->count;
+        }
+    }
+}
+
+/*
+   NOTE(gh) Jacobi style, the offsets are applied after every particle has seen the same positions.
+   The offsets are clamped, because a particle that got squeezed between the other bodies 
+   can get a huge lambda and jump through them in one substep.
+*/
+template<typename real>
+internal void
+apply_fluid_position_deltas(PBDSolverParticles<real> *particles, PBDFluidParticles<real> *fluid)
+{
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        real delta_x = fluid->delta_x[fluid_index];
+        real delta_y = fluid->delta_y[fluid_index];
+        real delta_z = fluid->delta_z[fluid_index];
+
+        real max_delta = (real)pbd_fluid_max_delta_over_radius*particles->r[i];
+        real delta_length_square = delta_x*delta_x + delta_y*delta_y + delta_z*delta_z;
+        if(delta_length_square > max_delta*max_delta)
+        {
+            real scale = max_delta/sqrt(delta_length_square);
+            delta_x *= scale;
+            delta_y *= scale;
+            delta_z *= scale;
+        }
+
+        particles->px[i] += delta_x;
+        particles->py[i] += delta_y;
+        particles->pz[i] += delta_z;
+    }
+}
+
+template<typename real>
+internal void
+solve_fluid_density_constraints(PBDSolverParticles<real> *particles, PBDFluidParticles<real> *fluid)
+{
+    real h = fluid->kernel_radius;
+    real h_square = h*h;
+    real poly6 = (real)get_poly6_coefficient(h);
+    real spiky = (real)get_spiky_gradient_coefficient(h);
+    real inv_rest_density = 1/fluid->rest_density;
+    real relaxation = (real)pbd_fluid_relaxation;
+    real self_density = poly6*h_square*h_square*h_square;
+
+    real dq_w = h_square - (real)square(pbd_fluid_artificial_pressure_dq)*h_square;
+    real inv_artificial_pressure_w = 1/(dq_w*dq_w*dq_w);
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        u32 *neighbors = fluid->neighbors + fluid_index*pbd_fluid_max_neighbor_count;
+
+        real density = self_density;
+        real gradient_x = 0;
+        real gradient_y = 0;
+        real gradient_z = 0;
+        real gradient_square_sum = 0;
+        for(u32 neighbor_index = 0;
+                neighbor_index < fluid->neighbor_counts[fluid_index];
+                ++neighbor_index)
+        {
+            u32 j = neighbors[neighbor_index];
+            real dx = particles->px[i] - particles->px[j];
+            real dy = particles->py[i] - particles->py[j];
+            real dz = particles->pz[i] - particles->pz[j];
+            real r_square = dx*dx + dy*dy + dz*dz;
+            if(r_square < h_square)
+            {
+                real w = h_square - r_square;
+                density += poly6*w*w*w;
+
+                real r = sqrt(r_square);
+                if(r > 0)
+                {
+                    // NOTE(gh) Gradient of C_i with respect to p_i is g*d, and -g*d for p_j
+                    real g = spiky*(h - r)*(h - r)/r*inv_rest_density;
+                    gradient_x += g*dx;
+                    gradient_y += g*dy;
+                    gradient_z += g*dz;
+                    gradient_square_sum += g*g*r_square;
+                }
+            }
+        }
+
+        real C = density*inv_rest_density - 1;
+        if(C < 0)
+        {
+            C = 0;
+        }
+
+        gradient_square_sum += gradient_x*gradient_x + gradient_y*gradient_y + gradient_z*gradient_z;
+        fluid->lambdas[i] = -C/(gradient_square_sum + relaxation);
+    }
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        u32 *neighbors = fluid->neighbors + fluid_index*pbd_fluid_max_neighbor_count;
+
+        real delta_x = 0;
+        real delta_y = 0;
+        real delta_z = 0;
+        for(u32 neighbor_index = 0;
+                neighbor_index < fluid->neighbor_counts[fluid_index];
+                ++neighbor_index)
+        {
+            u32 j = neighbors[neighbor_index];
+            real dx = particles->px[i] - particles->px[j];
+            real dy = particles->py[i] - particles->py[j];
+            real dz = particles->pz[i] - particles->pz[j];
+            real r_square = dx*dx + dy*dy + dz*dz;
+            real r = sqrt(r_square);
+            if(r_square < h_square && r > 0)
+            {
+                real w = h_square - r_square;
+                real ratio = w*w*w*inv_artificial_pressure_w;
+                real s_corr = -(real)pbd_fluid_artificial_pressure_k*ratio*ratio*ratio*ratio;
+
+                real g = spiky*(h - r)*(h - r)/r;
+                real scale = (fluid->lambdas[i] + fluid->lambdas[j] + s_corr)*g;
+                delta_x += scale*dx;
+                delta_y += scale*dy;
+                delta_z += scale*dz;
+            }
+        }
+
+        fluid->delta_x[fluid_index] = delta_x*inv_rest_density;
+        fluid->delta_y[fluid_index] = delta_y*inv_rest_density;
+        fluid->delta_z[fluid_index] = delta_z*inv_rest_density;
+    }
+
+    apply_fluid_position_deltas(particles, fluid);
+}
+
+// NOTE(gh) XSPH viscosity, v_i += c * sum_j (v_j - v_i) * W_poly6(p_i - p_j, h) / rest_density
+template<typename real>
+internal void
+apply_fluid_viscosity(PBDSolverParticles<real> *particles, PBDFluidParticles<real> *fluid)
+{
+    real h_square = fluid->kernel_radius*fluid->kernel_radius;
+    real c = (real)(pbd_fluid_viscosity*get_poly6_coefficient(fluid->kernel_radius))/fluid->rest_density;
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        u32 *neighbors = fluid->neighbors + fluid_index*pbd_fluid_max_neighbor_count;
+
+        real dv_x = 0;
+        real dv_y = 0;
+        real dv_z = 0;
+        for(u32 neighbor_index = 0;
+                neighbor_index < fluid->neighbor_counts[fluid_index];
+                ++neighbor_index)
+        {
+            u32 j = neighbors[neighbor_index];
+            real dx = particles->px[i] - particles->px[j];
+            real dy = particles->py[i] - particles->py[j];
+            real dz = particles->pz[i] - particles->pz[j];
+            real r_square = dx*dx + dy*dy + dz*dz;
+            if(r_square < h_square)
+            {
+                real w = h_square - r_square;
+                real W = w*w*w;
+                dv_x += (particles->vx[j] - particles->vx[i])*W;
+                dv_y += (particles->vy[j] - particles->vy[i])*W;
+                dv_z += (particles->vz[j] - particles->vz[i])*W;
+            }
+        }
+
+        fluid->delta_x[fluid_index] = c*dv_x;
+        fluid->delta_y[fluid_index] = c*dv_y;
+        fluid->delta_z[fluid_index] = c*dv_z;
+    }
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        particles->vx[i] += fluid->delta_x[fluid_index];
+        particles->vy[i] += fluid->delta_y[fluid_index];
+        particles->vz[i] += fluid->delta_z[fluid_index];
+    }
+}
+
+/*
+   NOTE(gh) f32 simd overloads of the kernels above.
+   Each particle evaluates HB_LANE_WIDTH of its neighbors at once,
+   the lanes past the neighbor count point to the padding particle and are masked out.
+*/
+internal void
+solve_fluid_density_constraints(PBDSolverParticles<f32> *particles, PBDFluidParticles<f32> *fluid)
+{
+    f32 h = fluid->kernel_radius;
+    f32 inv_rest_density = 1.0f/fluid->rest_density;
+    f32 self_density = (f32)get_poly6_coefficient(h)*h*h*h*h*h*h;
+
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 h_simd = Simd_f32(h);
+    simd_f32 h_square = Simd_f32(h*h);
+    simd_f32 poly6 = Simd_f32((f32)get_poly6_coefficient(h));
+    simd_f32 spiky = Simd_f32((f32)get_spiky_gradient_coefficient(h));
+    simd_f32 spiky_over_rest_density = spiky*Simd_f32(inv_rest_density);
+
+    f32 dq_w = h*h - (f32)square(pbd_fluid_artificial_pressure_dq)*h*h;
+    simd_f32 inv_artificial_pressure_w = Simd_f32(1.0f/(dq_w*dq_w*dq_w));
+    simd_f32 artificial_pressure_k = Simd_f32((f32)pbd_fluid_artificial_pressure_k);
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        u32 *neighbors = fluid->neighbors + fluid_index*pbd_fluid_max_neighbor_count;
+        u32 neighbor_count = fluid->neighbor_counts[fluid_index];
+        simd_f32 px = Simd_f32(particles->px[i]);
+        simd_f32 py = Simd_f32(particles->py[i]);
+        simd_f32 pz = Simd_f32(particles->pz[i]);
+
+        simd_f32 density = zero;
+        simd_f32 gradient_x = zero;
+        simd_f32 gradient_y = zero;
+        simd_f32 gradient_z = zero;
+        simd_f32 gradient_square_sum = zero;
+        for(u32 neighbor_index = 0;
+                neighbor_index < neighbor_count;
+                neighbor_index += HB_LANE_WIDTH)
+        {
+            u32 *j = neighbors + neighbor_index;
+            simd_f32 dx = px - gather_lanes(particles->px, j);
+            simd_f32 dy = py - gather_lanes(particles->py, j);
+            simd_f32 dz = pz - gather_lanes(particles->pz, j);
+            simd_f32 r_square = dx*dx + dy*dy + dz*dz;
+            simd_f32 r = sqrt(r_square);
+
+            simd_u32 kernel_mask = get_lane_mask(neighbor_index, neighbor_count) & compare_less(r_square, h_square);
+            simd_u32 gradient_mask = kernel_mask & compare_greater(r, zero);
+
+            simd_f32 w = h_square - r_square;
+            density += overwrite(zero, kernel_mask, poly6*w*w*w);
+
+            simd_f32 g = overwrite(zero, gradient_mask, spiky_over_rest_density*(h_simd - r)*(h_simd - r)/r);
+            gradient_x += g*dx;
+            gradient_y += g*dy;
+            gradient_z += g*dz;
+            gradient_square_sum += g*g*r_square;
+        }
+
+        f32 C = (self_density + add_all_lanes(density))*inv_rest_density - 1.0f;
+        if(C < 0.0f)
+        {
+            C = 0.0f;
+        }
+
+        f32 sum_x = add_all_lanes(gradient_x);
+        f32 sum_y = add_all_lanes(gradient_y);
+        f32 sum_z = add_all_lanes(gradient_z);
+        f32 denominator = add_all_lanes(gradient_square_sum) + sum_x*sum_x + sum_y*sum_y + sum_z*sum_z +
+                          (f32)pbd_fluid_relaxation;
+        fluid->lambdas[i] = -C/denominator;
+    }
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        u32 *neighbors = fluid->neighbors + fluid_index*pbd_fluid_max_neighbor_count;
+        u32 neighbor_count = fluid->neighbor_counts[fluid_index];
+        simd_f32 px = Simd_f32(particles->px[i]);
+        simd_f32 py = Simd_f32(particles->py[i]);
+        simd_f32 pz = Simd_f32(particles->pz[i]);
+        simd_f32 lambda_i = Simd_f32(fluid->lambdas[i]);
+
+        simd_f32 delta_x = zero;
+        simd_f32 delta_y = zero;
+        simd_f32 delta_z = zero;
+        for(u32 neighbor_index = 0;
+                neighbor_index < neighbor_count;
+                neighbor_index += HB_LANE_WIDTH)
+        {
+            u32 *j = neighbors + neighbor_index;
+            simd_f32 dx = px - gather_lanes(particles->px, j);
+            simd_f32 dy = py - gather_lanes(particles->py, j);
+            simd_f32 dz = pz - gather_lanes(particles->pz, j);
+            simd_f32 r_square = dx*dx + dy*dy + dz*dz;
+            simd_f32 r = sqrt(r_square);
+
+            simd_u32 gradient_mask = get_lane_mask(neighbor_index, neighbor_count) &
+                                     compare_less(r_square, h_square) & compare_greater(r, zero);
+
+            simd_f32 w = h_square - r_square;
+            simd_f32 ratio = w*w*w*inv_artificial_pressure_w;
+            simd_f32 ratio_square = ratio*ratio;
+            simd_f32 s_corr = -artificial_pressure_k*ratio_square*ratio_square;
+
+            simd_f32 g = spiky*(h_simd - r)*(h_simd - r)/r;
+            simd_f32 scale = overwrite(zero, gradient_mask, (lambda_i + gather_lanes(fluid->lambdas, j) + s_corr)*g);
+            delta_x += scale*dx;
+            delta_y += scale*dy;
+            delta_z += scale*dz;
+        }
+
+        fluid->delta_x[fluid_index] = add_all_lanes(delta_x)*inv_rest_density;
+        fluid->delta_y[fluid_index] = add_all_lanes(delta_y)*inv_rest_density;
+        fluid->delta_z[fluid_index] = add_all_lanes(delta_z)*inv_rest_density;
+    }
+
+    apply_fluid_position_deltas(particles, fluid);
+}
+
+internal void
+apply_fluid_viscosity(PBDSolverParticles<f32> *particles, PBDFluidParticles<f32> *fluid)
+{
+    f32 h = fluid->kernel_radius;
+    f32 c = (f32)(pbd_fluid_viscosity*get_poly6_coefficient(h))/fluid->rest_density;
+
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 h_square = Simd_f32(h*h);
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        u32 *neighbors = fluid->neighbors + fluid_index*pbd_fluid_max_neighbor_count;
+        u32 neighbor_count = fluid->neighbor_counts[fluid_index];
+        simd_f32 px = Simd_f32(particles->px[i]);
+        simd_f32 py = Simd_f32(particles->py[i]);
+        simd_f32 pz = Simd_f32(particles->pz[i]);
+        simd_f32 vx = Simd_f32(particles->vx[i]);
+        simd_f32 vy = Simd_f32(particles->vy[i]);
+        simd_f32 vz = Simd_f32(particles->vz[i]);
+
+        simd_f32 dv_x = zero;
+        simd_f32 dv_y = zero;
+        simd_f32 dv_z = zero;
+        for(u32 neighbor_index = 0;
+                neighbor_index < neighbor_count;
+                neighbor_index += HB_LANE_WIDTH)
+        {
+            u32 *j = neighbors + neighbor_index;
+            simd_f32 dx = px - gather_lanes(particles->px, j);
+            simd_f32 dy = py - gather_lanes(particles->py, j);
+            simd_f32 dz = pz - gather_lanes(particles->pz, j);
+            simd_f32 r_square = dx*dx + dy*dy + dz*dz;
+
+            simd_u32 kernel_mask = get_lane_mask(neighbor_index, neighbor_count) & compare_less(r_square, h_square);
+            simd_f32 w = h_square - r_square;
+            simd_f32 W = overwrite(zero, kernel_mask, w*w*w);
+            dv_x += (gather_lanes(particles->vx, j) - vx)*W;
+            dv_y += (gather_lanes(particles->vy, j) - vy)*W;
+            dv_z += (gather_lanes(particles->vz, j) - vz)*W;
+        }
+
+        fluid->delta_x[fluid_index] = c*add_all_lanes(dv_x);
+        fluid->delta_y[fluid_index] = c*add_all_lanes(dv_y);
+        fluid->delta_z[fluid_index] = c*add_all_lanes(dv_z);
+    }
+
+    for(u32 fluid_index = 0;
+            fluid_index < fluid->count;
+            ++fluid_index)
+    {
+        u32 i = fluid->indices[fluid_index];
+        particles->vx[i] += fluid->delta_x[fluid_index];
+        particles->vy[i] += fluid->delta_y[fluid_index];
+        particles->vz[i] += fluid->delta_z[fluid_index];
+    }
+}
@@ -0,0 +1,1689 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+/*
+   NOTE(gh) PBD substep solver.
+   The solver is templated on the scalar type, so that the same code runs as 
+   the f64 reference path and the f32 path. The f32 path overloads the hot kernels 
+   with the simd versions(see hb_pbd.cpp), which halves the bandwidth and doubles the lane count.
+
+   Whether the f32 path is good enough or not depends on the sub step count(see the 'Precision' note in hb.cpp),
+   so use debug_compare_pbd_precision to see how far it drifts away from the reference.
+*/
+
+template<typename real>
+internal TempMemory
+start_solver_particles(PBDSolverParticles<real> *particles, MemoryArena *arena, GameState *game_state)
+{
+    PBDParticlePool *pool = &game_state->particle_pool;
+    particles->count = pool->count;
+    // NOTE(gh) Pad at least one full lane at the end, 
+    // so that the group loops that start at the unaligned index can safely read past the last particle.
+    particles->lane_count = HB_LANE_WIDTH*(pool->count/HB_LANE_WIDTH + 2);
+
+    u32 lane_count = particles->lane_count;
+    u32 real_array_count = 30;
+    u32 u32_array_count = 2;
+    TempMemory result = 
+        start_temp_memory(arena, lane_count*(real_array_count*sizeof(real) + u32_array_count*sizeof(u32)));
+
+    particles->px = push_array(&result, real, lane_count);
+    particles->py = push_array(&result, real, lane_count);
+    particles->pz = push_array(&result, real, lane_count);
+    particles->prev_px = push_array(&result, real, lane_count);
+    particles->prev_py = push_array(&result, real, lane_count);
+    particles->prev_pz = push_array(&result, real, lane_count);
+    particles->vx = push_array(&result, real, lane_count);
+    particles->vy = push_array(&result, real, lane_count);
+    particles->vz = push_array(&result, real, lane_count);
+    particles->offset_x = push_array(&result, real, lane_count);
+    particles->offset_y = push_array(&result, real, lane_count);
+    particles->offset_z = push_array(&result, real, lane_count);
+    particles->q_xx = push_array(&result, real, lane_count);
+    particles->q_yy = push_array(&result, real, lane_count);
+    particles->q_zz = push_array(&result, real, lane_count);
+    particles->q_xy = push_array(&result, real, lane_count);
+    particles->q_yz = push_array(&result, real, lane_count);
+    particles->q_zx = push_array(&result, real, lane_count);
+    particles->sdf = push_array(&result, real, lane_count);
+    particles->sdf_nx = push_array(&result, real, lane_count);
+    particles->sdf_ny = push_array(&result, real, lane_count);
+    particles->sdf_nz = push_array(&result, real, lane_count);
+    particles->inv_mass = push_array(&result, real, lane_count);
+    particles->mass = push_array(&result, real, lane_count);
+    particles->r = push_array(&result, real, lane_count);
+    particles->environment_nx = push_array(&result, real, lane_count);
+    particles->environment_ny = push_array(&result, real, lane_count);
+    particles->environment_nz = push_array(&result, real, lane_count);
+    particles->environment_d = push_array(&result, real, lane_count);
+    particles->speculative_margin = push_array(&result, real, lane_count);
+    particles->environment_mask = push_array(&result, u32, lane_count);
+    particles->entity_indices = push_array(&result, u32, lane_count);
+
+    for(u32 particle_index = 0;
+            particle_index < pool->count;
+            ++particle_index)
+    {
+        PBDParticle *particle = pool->particles + particle_index;
+
+        particles->px[particle_index] = (real)particle->p.x;
+        particles->py[particle_index] = (real)particle->p.y;
+        particles->pz[particle_index] = (real)particle->p.z;
+        particles->prev_px[particle_index] = (real)particle->prev_p.x;
+        particles->prev_py[particle_index] = (real)particle->prev_p.y;
+        particles->prev_pz[particle_index] = (real)particle->prev_p.z;
+        particles->vx[particle_index] = (real)particle->v.x;
+        particles->vy[particle_index] = (real)particle->v.y;
+        particles->vz[particle_index] = (real)particle->v.z;
+        particles->offset_x[particle_index] = (real)particle->initial_offset_from_com.x;
+        particles->offset_y[particle_index] = (real)particle->initial_offset_from_com.y;
+        particles->offset_z[particle_index] = (real)particle->initial_offset_from_com.z;
+        particles->inv_mass[particle_index] = (real)particle->inv_mass;
+        if(particle->inv_mass != 0.0)
+        {
+            particles->mass[particle_index] = (real)(1.0/particle->inv_mass);
+        }
+        particles->r[particle_index] = (real)particle->r;
+        particles->sdf[particle_index] = (real)particle->sdf;
+    }
+
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        Entity *entity = game_state->entities + entity_index;
+        PBDParticleGroup *group = &entity->particle_group;
+        b32 is_quadratic = is_entity_flag_set(entity, EntityFlag_Quadratic);
+        u32 first = get_first_particle_index(pool, group);
+        for(u32 particle_index = first;
+                particle_index < first + group->count;
+                ++particle_index)
+        {
+            particles->entity_indices[particle_index] = entity_index;
+
+            // NOTE(gh) Computed once here instead of every substep
+            if(is_quadratic)
+            {
+                v9d q = get_quadratic_deformation_q(pool->particles[particle_index].initial_offset_from_com);
+                particles->q_xx[particle_index] = (real)q.e[3];
+                particles->q_yy[particle_index] = (real)q.e[4];
+                particles->q_zz[particle_index] = (real)q.e[5];
+                particles->q_xy[particle_index] = (real)q.e[6];
+                particles->q_yz[particle_index] = (real)q.e[7];
+                particles->q_zx[particle_index] = (real)q.e[8];
+            }
+
+            // NOTE(gh) Sleeping particles act as static particles for the awake ones, 
+            // the island will be woken up at the end of the frame if it was hit hard enough.
+            // Free rigid bodies are not touching anything, so they are left out the same way.
+            if(group->is_sleeping || group->is_free_rigid_body)
+            {
+                particles->inv_mass[particle_index] = 0;
+            }
+        }
+
+        update_sdf_normals(particles, pool, group);
+    }
+
+    return result;
+}
+
+// NOTE(gh) Writes the result back to the particle pool
+template<typename real>
+internal void
+end_solver_particles(PBDSolverParticles<real> *particles, PBDParticlePool *pool, TempMemory *memory)
+{
+    for(u32 particle_index = 0;
+            particle_index < particles->count;
+            ++particle_index)
+    {
+        PBDParticle *particle = pool->particles + particle_index;
+
+        particle->p = V3d(particles->px[particle_index], particles->py[particle_index], particles->pz[particle_index]);
+        particle->prev_p = V3d(particles->prev_px[particle_index], particles->prev_py[particle_index], particles->prev_pz[particle_index]);
+        particle->v = V3d(particles->vx[particle_index], particles->vy[particle_index], particles->vz[particle_index]);
+    }
+
+    end_temp_memory(memory);
+}
+
+// NOTE(gh) Rotates the sdf normals of the group by the current orientation of the group,
+// which is the rotation that the shape matching extracted.
+template<typename real>
+internal void
+update_sdf_normals(PBDSolverParticles<real> *particles, PBDParticlePool *pool, PBDParticleGroup *group)
+{
+    m3x3d rotation = orientation_quatd_to_m3x3d(group->shape_match_quat);
+    u32 first = get_first_particle_index(pool, group);
+    for(u32 particle_index = first;
+            particle_index < first + group->count;
+            ++particle_index)
+    {
+        v3d normal = rotation*V3d(pool->particles[particle_index].sdf_normal);
+        particles->sdf_nx[particle_index] = (real)normal.x;
+        particles->sdf_ny[particle_index] = (real)normal.y;
+        particles->sdf_nz[particle_index] = (real)normal.z;
+    }
+}
+
+// NOTE(gh) Gathers the particles of the awake groups into contiguous ranges,
+// so that the per particle kernels never touch the sleeping particles(or the free rigid bodies).
+internal u32
+get_awake_particle_ranges(PBDParticleRange *ranges, u32 max_range_count, GameState *game_state)
+{
+    u32 range_count = 0;
+    PBDParticlePool *pool = &game_state->particle_pool;
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(group->count && !group->is_sleeping && !group->is_free_rigid_body)
+        {
+            u32 first = get_first_particle_index(pool, group);
+
+            PBDParticleRange *last_range = range_count ? ranges + range_count - 1 : 0;
+            if(last_range && last_range->first + last_range->count == first)
+            {
+                last_range->count += group->count;
+            }
+            else
+            {
+                assert(range_count < max_range_count);
+                PBDParticleRange *range = ranges + range_count++;
+                range->first = first;
+                range->count = group->count;
+            }
+        }
+    }
+
+    return range_count;
+}
+
+/*
+   NOTE(gh) Dividing the time step means that we would need to do the collision detection 
+   for every sub step(see 'Problem 1' in hb.cpp). Instead, we generate the collision candidates 
+   once at the start of the frame, and each substep only re-evaluates C for the cached candidates.
+
+   To not miss the contacts that happen in the middle of the frame, the particles are expanded by 
+   how far they can travel in this frame, assuming only the velocity and the gravity.
+   margin = |v|*dt + 0.5*g*dt^2
+*/
+template<typename real>
+internal void
+compute_speculative_margins(PBDSolverParticles<real> *particles, u32 first, u32 count, f64 dt)
+{
+    real gravity_margin = (real)(0.5*9.8*square(dt));
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        real speed = sqrt(square(particles->vx[particle_index]) + 
+                          square(particles->vy[particle_index]) + 
+                          square(particles->vz[particle_index]));
+        particles->speculative_margin[particle_index] = speed*(real)dt + gravity_margin;
+    }
+}
+
+// NOTE(gh) Closest point on the triangle abc to p, from Real-Time Collision Detection by Christer Ericson.
+// Checks the voronoi regions of the vertices and the edges first, and falls back to the face.
+internal v3d
+get_closest_point_on_triangle(v3d p, v3d a, v3d b, v3d c, b32 *is_on_face)
+{
+    *is_on_face = false;
+
+    v3d ab = b - a;
+    v3d ac = c - a;
+    v3d ap = p - a;
+    f64 d1 = dot(ab, ap);
+    f64 d2 = dot(ac, ap);
+    if(d1 <= 0 && d2 <= 0)
+    {
+        return a;
+    }
+
+    v3d bp = p - b;
+    f64 d3 = dot(ab, bp);
+    f64 d4 = dot(ac, bp);
+    if(d3 >= 0 && d4 <= d3)
+    {
+        return b;
+    }
+
+    f64 vc = d1*d4 - d3*d2;
+    if(vc <= 0 && d1 >= 0 && d3 <= 0)
+    {
+        return a + (d1/(d1 - d3))*ab;
+    }
+
+    v3d cp = p - c;
+    f64 d5 = dot(ab, cp);
+    f64 d6 = dot(ac, cp);
+    if(d6 >= 0 && d5 <= d6)
+    {
+        return c;
+    }
+
+    f64 vb = d5*d2 - d1*d6;
+    if(vb <= 0 && d2 >= 0 && d6 <= 0)
+    {
+        return a + (d2/(d2 - d6))*ac;
+    }
+
+    f64 va = d3*d6 - d5*d4;
+    if(va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    {
+        return b + ((d4 - d3)/((d4 - d3) + (d5 - d6)))*(c - b);
+    }
+
+    *is_on_face = true;
+    f64 denom = 1/(va + vb + vc);
+    return a + (vb*denom)*ab + (vc*denom)*ac;
+}
+
+/*
+   NOTE(gh) Generates one environment constraint(plane) per particle against the static colliders.
+   The candidate triangles are gathered once per entity using the bounds of the entity, 
+   so the grid lookup is shared by all particles of the entity and the cost only depends on 
+   the number of triangles near the entity.
+   Out of all candidates, the one with the smallest signed distance becomes the plane of the particle.
+*/
+template<typename real>
+internal void
+generate_environment_constraints(PBDSolverParticles<real> *particles, u32 first, u32 count, 
+                                 PBDEnvironment *environment, MemoryArena *arena)
+{
+    PBDEntityBounds bounds = {};
+    bounds.min = V3d(flt_max, flt_max, flt_max);
+    bounds.max = V3d(-flt_max, -flt_max, -flt_max);
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        f64 extent = (f64)(particles->r[particle_index] + particles->speculative_margin[particle_index]);
+        v3d p = V3d(particles->px[particle_index], particles->py[particle_index], particles->pz[particle_index]);
+
+        bounds.min.x = minimum(bounds.min.x, p.x - extent);
+        bounds.min.y = minimum(bounds.min.y, p.y - extent);
+        bounds.min.z = minimum(bounds.min.z, p.z - extent);
+        bounds.max.x = maximum(bounds.max.x, p.x + extent);
+        bounds.max.y = maximum(bounds.max.y, p.y + extent);
+        bounds.max.z = maximum(bounds.max.z, p.z + extent);
+    }
+
+    u32 max_candidate_count = 4096;
+    TempMemory candidate_memory = start_temp_memory(arena, sizeof(PBDEnvironmentTriangle *)*max_candidate_count, false);
+    PBDEnvironmentTriangle **candidates = push_array(&candidate_memory, PBDEnvironmentTriangle *, max_candidate_count);
+    u32 candidate_count = 0;
+
+    for(u32 collider_index = 0;
+            collider_index < environment->collider_count;
+            ++collider_index)
+    {
+        PBDEnvironmentCollider *collider = environment->colliders + collider_index;
+        u32 min_x = get_environment_cell(bounds.min.x, collider->grid_min_x, collider->cell_dim, collider->cell_count_x);
+        u32 min_y = get_environment_cell(bounds.min.y, collider->grid_min_y, collider->cell_dim, collider->cell_count_y);
+        u32 max_x = get_environment_cell(bounds.max.x, collider->grid_min_x, collider->cell_dim, collider->cell_count_x);
+        u32 max_y = get_environment_cell(bounds.max.y, collider->grid_min_y, collider->cell_dim, collider->cell_count_y);
+        for(u32 y = min_y;
+                y <= max_y;
+                ++y)
+        {
+            for(u32 x = min_x;
+                    x <= max_x;
+                    ++x)
+            {
+                u32 cell_index = y*collider->cell_count_x + x;
+                for(u32 i = collider->cell_first_triangle[cell_index];
+                        i < collider->cell_first_triangle[cell_index+1];
+                        ++i)
+                {
+                    PBDEnvironmentTriangle *triangle = collider->triangles + collider->cell_triangle_indices[i];
+
+                    // NOTE(gh) Triangles that span multiple cells are only added from the first cell 
+                    // that overlaps with both the triangle and the query
+                    u32 first_x = maximum(get_environment_cell(triangle->min.x, collider->grid_min_x, collider->cell_dim, collider->cell_count_x), min_x);
+                    u32 first_y = maximum(get_environment_cell(triangle->min.y, collider->grid_min_y, collider->cell_dim, collider->cell_count_y), min_y);
+                    if(x == first_x && y == first_y &&
+                       triangle->min.x <= bounds.max.x && bounds.min.x <= triangle->max.x &&
+                       triangle->min.y <= bounds.max.y && bounds.min.y <= triangle->max.y &&
+                       triangle->min.z <= bounds.max.z && bounds.min.z <= triangle->max.z)
+                    {
+                        assert(candidate_count < max_candidate_count);
+                        candidates[candidate_count++] = triangle;
+                    }
+                }
+            }
+        }
+    }
+
+    for(u32 particle_index = first;
+            particle_index < first + count;
+            ++particle_index)
+    {
+        u32 environment_mask = 0;
+        if(particles->inv_mass[particle_index] > 0)
+        {
+            f64 r = (f64)particles->r[particle_index];
+            f64 extent = r + (f64)particles->speculative_margin[particle_index];
+            v3d p = V3d(particles->px[particle_index], particles->py[particle_index], particles->pz[particle_index]);
+
+            f64 best_distance = flt_max;
+            v3d best_normal = V3d();
+            f64 best_d = 0;
+            for(u32 candidate_index = 0;
+                    candidate_index < candidate_count;
+                    ++candidate_index)
+            {
+                PBDEnvironmentTriangle *triangle = candidates[candidate_index];
+                f64 face_distance = dot(p - triangle->p0, triangle->normal);
+                if(p.x + extent >= triangle->min.x && p.x - extent <= triangle->max.x &&
+                   p.y + extent >= triangle->min.y && p.y - extent <= triangle->max.y &&
+                   p.z + extent >= triangle->min.z && p.z - extent <= triangle->max.z &&
+                   face_distance > -extent)
+                {
+                    b32 is_on_face;
+                    v3d closest = get_closest_point_on_triangle(p, triangle->p0, triangle->p1, triangle->p2, &is_on_face);
+                    v3d delta = p - closest;
+                    f64 distance = length(delta);
+                    if(face_distance > 0 && !is_on_face && distance > 0)
+                    {
+                        // NOTE(gh) In front of the edge or the vertex, push out along the direction to the closest point
+                        if(distance < best_distance)
+                        {
+                            best_distance = distance;
+                            best_normal = delta/distance;
+                            best_d = dot(best_normal, closest);
+                        }
+                    }
+                    else
+                    {
+                        // NOTE(gh) In front of or behind the face, push out along the face normal.
+                        // Using the face normal as it is(instead of p - closest) keeps the resting contacts 
+                        // on the flat surfaces from picking up the tiny tangential components 
+                        f64 signed_distance = (face_distance > 0) ? distance : -distance;
+                        if(signed_distance < best_distance)
+                        {
+                            best_distance = signed_distance;
+                            best_normal = triangle->normal;
+                            best_d = dot(triangle->normal, triangle->p0);
+                        }
+                    }
+                }
+            }
+
+            if(best_distance - r < (f64)particles->speculative_margin[particle_index])
+            {
+                environment_mask = 0xffffffff;
+                particles->environment_nx[particle_index] = (real)best_normal.x;
+                particles->environment_ny[particle_index] = (real)best_normal.y;
+                particles->environment_nz[particle_index] = (real)best_normal.z;
+                particles->environment_d[particle_index] = (real)best_d;
+            }
+        }
+        particles->environment_mask[particle_index] = environment_mask;
+    }
+
+    end_temp_memory(&candidate_memory);
+}
+
+template<typename real>
+internal void
+get_entity_bounds(PBDEntityBounds *bounds, GameState *game_state, PBDSolverParticles<real> *particles)
+{
+    PBDParticlePool *pool = &game_state->particle_pool;
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        PBDEntityBounds *b = bounds + entity_index;
+        b->min = V3d(flt_max, flt_max, flt_max);
+        b->max = V3d(-flt_max, -flt_max, -flt_max);
+
+        // NOTE(gh) Free rigid bodies keep the empty bounds, they were already tested in update_free_rigid_bodies
+        u32 first = get_first_particle_index(pool, group);
+        u32 count = group->is_free_rigid_body ? 0 : group->count;
+        for(u32 particle_index = first;
+                particle_index < first + count;
+                ++particle_index)
+        {
+            f64 extent = (f64)(particles->r[particle_index] + particles->speculative_margin[particle_index]);
+            f64 x = (f64)particles->px[particle_index];
+            f64 y = (f64)particles->py[particle_index];
+            f64 z = (f64)particles->pz[particle_index];
+
+            b->min.x = minimum(b->min.x, x - extent);
+            b->min.y = minimum(b->min.y, y - extent);
+            b->min.z = minimum(b->min.z, z - extent);
+            b->max.x = maximum(b->max.x, x + extent);
+            b->max.y = maximum(b->max.y, y + extent);
+            b->max.z = maximum(b->max.z, z + extent);
+        }
+    }
+}
+
+internal b32
+test_entity_bounds(PBDEntityBounds *a, PBDEntityBounds *b)
+{
+    b32 result = (a->min.x <= b->max.x && b->min.x <= a->max.x &&
+                  a->min.y <= b->max.y && b->min.y <= a->max.y &&
+                  a->min.z <= b->max.z && b->min.z <= a->max.z);
+
+    return result;
+}
+
+/*
+   NOTE(gh) Sort and sweep over the entity bounds along x.
+   The order is kept inside the game state, and because the entities don't move much 
+   between the frames, the insertion sort is almost linear.
+*/
+internal void
+sort_broadphase_order(GameState *game_state, PBDEntityBounds *bounds)
+{
+    u32 *order = game_state->broadphase_order;
+    assert(game_state->entity_count <= array_count(game_state->broadphase_order));
+    for(u32 entity_index = game_state->broadphase_order_count;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        order[entity_index] = entity_index;
+    }
+    game_state->broadphase_order_count = game_state->entity_count;
+
+    for(u32 i = 1;
+            i < game_state->broadphase_order_count;
+            ++i)
+    {
+        u32 entity_index = order[i];
+        f64 min_x = bounds[entity_index].min.x;
+
+        u32 j = i;
+        while(j > 0 && bounds[order[j-1]].min.x > min_x)
+        {
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = entity_index;
+    }
+}
+
+template<typename real>
+internal void
+generate_particle_collision_constraints(CollisionConstraint *constraints, u32 *constraint_count, u32 max_constraint_count,
+                                        PBDSolverParticles<real> *particles, 
+                                        u32 first, u32 count, u32 test_first, u32 test_count)
+{
+    for(u32 i0 = first;
+            i0 < first + count;
+            ++i0)
+    {
+        for(u32 i1 = test_first;
+                i1 < test_first + test_count;
+                ++i1)
+        {
+            // NOTE(gh) Two particles below the surface of their sdf bodies can only meet 
+            // when the surface particles are already penetrating, which will be resolved by the sdf normal
+            if(particles->inv_mass[i0] + particles->inv_mass[i1] != 0 &&
+               !(is_interior_particle(particles, i0) && is_interior_particle(particles, i1)))
+            {
+                real delta_x = particles->px[i0] - particles->px[i1];
+                real delta_y = particles->py[i0] - particles->py[i1];
+                real delta_z = particles->pz[i0] - particles->pz[i1];
+                real distance_between = sqrt(delta_x*delta_x + delta_y*delta_y + delta_z*delta_z);
+                if(distance_between < particles->r[i0] + particles->r[i1] + 
+                                      particles->speculative_margin[i0] + particles->speculative_margin[i1])
+                {
+                    assert(*constraint_count < max_constraint_count);
+                    CollisionConstraint *c = constraints + (*constraint_count)++;
+                    c->index0 = i0;
+                    c->index1 = i1;
+                }
+            }
+        }
+    }
+}
+
+template<typename real>
+internal u32
+generate_collision_constraints(CollisionConstraint *constraints, u32 max_constraint_count,
+                               GameState *game_state, MemoryArena *arena, PBDSolverParticles<real> *particles)
+{
+    TIMED_BLOCK();
+
+    u32 constraint_count = 0;
+    PBDParticlePool *pool = &game_state->particle_pool;
+
+    u32 entity_count = game_state->entity_count;
+    TempMemory bounds_memory = start_temp_memory(arena, sizeof(PBDEntityBounds)*entity_count);
+    PBDEntityBounds *bounds = push_array(&bounds_memory, PBDEntityBounds, entity_count);
+    get_entity_bounds(bounds, game_state, particles);
+    sort_broadphase_order(game_state, bounds);
+
+    u32 *order = game_state->broadphase_order;
+    for(u32 i = 0;
+            i < entity_count;
+            ++i)
+    {
+        PBDEntityBounds *b = bounds + order[i];
+        if(game_state->entities[order[i]].particle_group.count)
+        {
+            for(u32 j = i + 1;
+                    j < entity_count;
+                    ++j)
+            {
+                PBDEntityBounds *test_b = bounds + order[j];
+                if(test_b->min.x > b->max.x)
+                {
+                    // NOTE(gh) Sorted by min x, so none of the remaining entities can overlap
+                    break;
+                }
+
+                // NOTE(gh) Keep the same pair order as the brute force loop,
+                // where the entity with the higher index should be collidable & movable
+                u32 entity_index = minimum(order[i], order[j]);
+                u32 test_entity_index = maximum(order[i], order[j]);
+                Entity *entity = game_state->entities + entity_index;
+                Entity *test_entity = game_state->entities + test_entity_index;
+                PBDParticleGroup *group = &entity->particle_group;
+                PBDParticleGroup *test_group = &test_entity->particle_group;
+
+                // NOTE(gh) Two sleeping groups never need to be tested against each other
+                if(is_entity_flag_set(test_entity, EntityFlag_Collides) &&
+                   is_entity_flag_set(test_entity, EntityFlag_Movable) && 
+                   group->count && test_group->count && 
+                   !(group->is_sleeping && test_group->is_sleeping) &&
+                   test_entity_bounds(b, test_b))
+                {
+                    generate_particle_collision_constraints(constraints, &constraint_count, max_constraint_count, particles,
+                                                            get_first_particle_index(pool, group), group->count,
+                                                            get_first_particle_index(pool, test_group), test_group->count);
+                }
+            }
+        }
+    }
+
+    end_temp_memory(&bounds_memory);
+
+    return constraint_count;
+}
+
+internal b32
+is_touching_environment(PBDEnvironment *environment, v3d center, f64 radius)
+{
+    b32 result = false;
+    for(u32 collider_index = 0;
+            collider_index < environment->collider_count && !result;
+            ++collider_index)
+    {
+        PBDEnvironmentCollider *collider = environment->colliders + collider_index;
+        u32 min_x = get_environment_cell(center.x - radius, collider->grid_min_x, collider->cell_dim, collider->cell_count_x);
+        u32 min_y = get_environment_cell(center.y - radius, collider->grid_min_y, collider->cell_dim, collider->cell_count_y);
+        u32 max_x = get_environment_cell(center.x + radius, collider->grid_min_x, collider->cell_dim, collider->cell_count_x);
+        u32 max_y = get_environment_cell(center.y + radius, collider->grid_min_y, collider->cell_dim, collider->cell_count_y);
+        for(u32 y = min_y;
+                y <= max_y && !result;
+                ++y)
+        {
+            for(u32 x = min_x;
+                    x <= max_x && !result;
+                    ++x)
+            {
+                u32 cell_index = y*collider->cell_count_x + x;
+                for(u32 i = collider->cell_first_triangle[cell_index];
+                        i < collider->cell_first_triangle[cell_index+1];
+                        ++i)
+                {
+                    PBDEnvironmentTriangle *triangle = collider->triangles + collider->cell_triangle_indices[i];
+                    if(triangle->min.x <= center.x + radius && center.x - radius <= triangle->max.x &&
+                       triangle->min.y <= center.y + radius && center.y - radius <= triangle->max.y &&
+                       triangle->min.z <= center.z + radius && center.z - radius <= triangle->max.z)
+                    {
+                        b32 is_on_face;
+                        v3d closest = get_closest_point_on_triangle(center, triangle->p0, triangle->p1, triangle->p2, &is_on_face);
+                        if(length_square(center - closest) <= square(radius))
+                        {
+                            result = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+/*
+   NOTE(gh) Decides which rigid bodies can skip the particles for this frame(see initialize_rigid_body).
+   Same idea as the speculative margin, the bounding sphere of the body is expanded by 
+   how far any of its particles can travel in this frame, 
+   and the body is free if that doesn't reach the environment or any other entity.
+   The bodies that stopped being free bring their particles up to date, so that the solver can pick them up.
+*/
+internal void
+update_free_rigid_bodies(GameState *game_state, MemoryArena *arena, f64 dt)
+{
+    u32 entity_count = game_state->entity_count;
+    f64 gravity_margin = 0.5*9.8*square(dt);
+
+    TempMemory bounds_memory = start_temp_memory(arena, sizeof(PBDEntityBounds)*entity_count);
+    PBDEntityBounds *bounds = push_array(&bounds_memory, PBDEntityBounds, entity_count);
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        PBDEntityBounds *b = bounds + entity_index;
+        b->min = V3d(flt_max, flt_max, flt_max);
+        b->max = V3d(-flt_max, -flt_max, -flt_max);
+
+        if(has_rigid_body(group) && !group->is_sleeping)
+        {
+            f64 extent = group->rigid_body_radius + gravity_margin + 
+                         (length(group->rigid_body_v) + length(group->rigid_body_w)*group->rigid_body_radius)*dt;
+            b->min = group->rigid_body_p - V3d(extent, extent, extent);
+            b->max = group->rigid_body_p + V3d(extent, extent, extent);
+        }
+        else
+        {
+            for(u32 particle_index = 0;
+                    particle_index < group->count;
+                    ++particle_index)
+            {
+                PBDParticle *particle = group->particles + particle_index;
+                f64 extent = particle->r + length(particle->v)*dt + gravity_margin;
+
+                b->min.x = minimum(b->min.x, particle->p.x - extent);
+                b->min.y = minimum(b->min.y, particle->p.y - extent);
+                b->min.z = minimum(b->min.z, particle->p.z - extent);
+                b->max.x = maximum(b->max.x, particle->p.x + extent);
+                b->max.y = maximum(b->max.y, particle->p.y + extent);
+                b->max.z = maximum(b->max.z, particle->p.z + extent);
+            }
+        }
+    }
+
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        b32 is_free = false;
+        if(has_rigid_body(group) && !group->is_sleeping)
+        {
+            PBDEntityBounds *b = bounds + entity_index;
+            f64 extent = b->max.x - group->rigid_body_p.x;
+
+            is_free = !is_touching_environment(&game_state->environment, group->rigid_body_p, extent);
+            for(u32 test_entity_index = 0;
+                    test_entity_index < entity_count && is_free;
+                    ++test_entity_index)
+            {
+                if(test_entity_index != entity_index && 
+                   test_entity_bounds(b, bounds + test_entity_index))
+                {
+                    is_free = false;
+                }
+            }
+
+            if(is_free)
+            {
+                group->has_contacts = false;
+            }
+            else
+            {
+                materialize_rigid_body_particles(group);
+            }
+        }
+
+        group->is_free_rigid_body = is_free;
+    }
+
+    end_temp_memory(&bounds_memory);
+}
+
+/*
+   NOTE(gh) Solve shape matching constraints.
+   http://www.beosil.com/download/MeshlessDeformations_SIG05.pdf
+
+   The basic idea behind this is about finding a 'rotation matrix' that 
+   when applied each of the initial offset from the COM, produces the 'goal position'
+   that would match the shape.
+
+   This _must_ be the last step, especially for the rigid bodies.
+
+   1. Rigid bodies
+   m3x3d A = sum((xi - com) * transpose(ri)),
+   where xi is the position, and ri is the offset from the COM when resting.
+   The rotational part, R, can be retrieved using the polar decomposition,
+   which is explained in 
+   https://matthias-research.github.io/pages/publications/stablePolarDecomp.pdf
+
+   2. Linear deformation
+   Similar to rigid bodies, but support stretching.
+
+   3. Quadratic deformation
+
+   All groups gather their Apq first, and then the rotations are extracted together,
+   which lets the f32 path extract HB_LANE_WIDTH of them at once.
+*/
+template<typename real>
+internal void
+gather_shape_matching_Apq(PBDSolverParticles<real> *particles, GameState *game_state, 
+                          PBDShapeMatchingBatch *batch, u32 batch_index)
+{
+    Entity *entity = game_state->entities + batch->entity_indices[batch_index];
+    PBDParticleGroup *group = &entity->particle_group;
+    u32 first = get_first_particle_index(&game_state->particle_pool, group);
+    v3d com = get_com_of_particles(particles, first, group->count);
+
+    batch->coms[batch_index] = com;
+    batch->rotations[batch_index] = group->shape_match_quat;
+    if(is_entity_flag_set(entity, EntityFlag_RigidBody) || 
+       is_entity_flag_set(entity, EntityFlag_Linear))
+    {
+        batch->Apqs[batch_index] = get_shape_matching_Apq(particles, first, group->count, com);
+    }
+    else
+    {
+        m3x9d quadratic_Apq = get_shape_matching_quadratic_Apq(particles, first, group->count, com);
+        batch->quadratic_Apqs[batch_index] = quadratic_Apq;
+
+        // NOTE(gh) Quadratic deformation is done on top of 
+        // linea deformation, so we need to caculate linear deformation first.
+        batch->Apqs[batch_index] = 
+            M3x3d(quadratic_Apq.e[0][0], quadratic_Apq.e[0][1], quadratic_Apq.e[0][2],
+                  quadratic_Apq.e[1][0], quadratic_Apq.e[1][1], quadratic_Apq.e[1][2],
+                  quadratic_Apq.e[2][0], quadratic_Apq.e[2][1], quadratic_Apq.e[2][2]);
+    }
+}
+
+template<typename real>
+internal void
+apply_shape_matching_goal_positions(PBDSolverParticles<real> *particles, GameState *game_state, 
+                                    PBDShapeMatchingBatch *batch, u32 batch_index, f64 sub_dt)
+{
+    PBDParticlePool *pool = &game_state->particle_pool;
+    Entity *entity = game_state->entities + batch->entity_indices[batch_index];
+    PBDParticleGroup *group = &entity->particle_group;
+    u32 first = get_first_particle_index(pool, group);
+    u32 count = group->count;
+    v3d com = batch->coms[batch_index];
+
+    group->shape_match_quat = batch->rotations[batch_index];
+    m3x3d rigid_body_R = orientation_quatd_to_m3x3d(group->shape_match_quat);
+
+    if(is_entity_flag_set(entity, EntityFlag_RigidBody))
+    {
+        // Apply the shape matching rotation
+        set_shape_matching_goal_positions(particles, first, count, rigid_body_R, com);
+    }
+    else if(is_entity_flag_set(entity, EntityFlag_Linear))
+    {
+        m3x3d shape_matching_matrix = 
+            get_shape_matching_linear_deformation_matrix(group, batch->Apqs[batch_index], rigid_body_R);
+
+        pull_to_shape_matching_goal_positions(particles, first, count, shape_matching_matrix, com, 
+                                              square(sub_dt)*group->linear_deformation_c);
+    }
+    else
+    {
+        m3x9d quadratic_A = batch->quadratic_Apqs[batch_index]*group->quadratic_inv_Aqq;
+
+        // quadratric_R = [R 0 0], which results in 3x9 matrix
+        m3x3d R = get_shape_matching_linear_deformation_matrix(group, batch->Apqs[batch_index], rigid_body_R);
+        m3x9d quadratric_R = {};
+        quadratric_R.rows[0] = V9d(R.e[0][0], R.e[0][1], R.e[0][2],
+                                    0, 0, 0, 0, 0, 0);
+        quadratric_R.rows[1] = V9d(R.e[1][0], R.e[1][1], R.e[1][2],
+                                    0, 0, 0, 0, 0, 0);
+        quadratric_R.rows[2] = V9d(R.e[2][0], R.e[2][1], R.e[2][2],
+                                    0, 0, 0, 0, 0, 0);
+
+        f64 quadratic_coefficient = 0.5;
+        m3x9d shape_match_rotation_matrix = quadratic_coefficient*quadratic_A + 
+                                            (1-quadratic_coefficient)*quadratric_R;
+
+        set_quadratic_shape_matching_goal_positions(particles, first, count, &shape_match_rotation_matrix, com);
+    }
+
+    // NOTE(gh) sdf normals follow the orientation that we just got from the shape matching
+    update_sdf_normals(particles, pool, group);
+}
+
+template<typename real>
+internal
+THREAD_WORK_CALLBACK(thread_shape_matching_callback)
+{
+    ThreadShapeMatchingData<real> *d = (ThreadShapeMatchingData<real> *)data;
+    for(u32 batch_index = d->first;
+            batch_index < d->one_past_last;
+            ++batch_index)
+    {
+        if(d->should_apply_goal_positions)
+        {
+            apply_shape_matching_goal_positions(d->particles, d->game_state, d->batch, batch_index, d->sub_dt);
+        }
+        else
+        {
+            gather_shape_matching_Apq(d->particles, d->game_state, d->batch, batch_index);
+        }
+    }
+}
+
+// NOTE(gh) Minimum number of particles in one shape matching job, 
+// below this the cost of waking up the threads is bigger than the work itself
+#define pbd_shape_matching_job_min_particle_count 512
+#define pbd_shape_matching_max_job_count 64
+
+/*
+   NOTE(gh) Gathers the groups that need the shape matching for this frame(which doesn't change between the substeps),
+   and divides them into the jobs. Each group only touches its own particles, 
+   so the jobs can run in parallel without any synchronization.
+   Returns the job count.
+*/
+template<typename real>
+internal u32
+prepare_shape_matching_jobs(ThreadShapeMatchingData<real> *jobs, PBDSolverParticles<real> *particles, 
+                            GameState *game_state, PBDShapeMatchingBatch *batch)
+{
+    u32 total_particle_count = 0;
+    batch->count = 0;
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        Entity *entity = game_state->entities + entity_index;
+        PBDParticleGroup *group = &entity->particle_group;
+        if(group->count && !group->is_sleeping && !group->is_free_rigid_body &&
+           (is_entity_flag_set(entity, EntityFlag_RigidBody) || 
+            is_entity_flag_set(entity, EntityFlag_Linear) ||
+            is_entity_flag_set(entity, EntityFlag_Quadratic)))
+        {
+            batch->entity_indices[batch->count++] = entity_index;
+            total_particle_count += group->count;
+        }
+    }
+
+    u32 job_particle_count = maximum(pbd_shape_matching_job_min_particle_count, 
+                                     total_particle_count/pbd_shape_matching_max_job_count + 1);
+    u32 job_count = 0;
+    u32 particle_count = 0;
+    for(u32 batch_index = 0;
+            batch_index < batch->count;
+            ++batch_index)
+    {
+        if(particle_count == 0)
+        {
+            assert(job_count < pbd_shape_matching_max_job_count);
+            ThreadShapeMatchingData<real> *job = jobs + job_count++;
+            job->particles = particles;
+            job->game_state = game_state;
+            job->batch = batch;
+            job->first = batch_index;
+        }
+
+        particle_count += game_state->entities[batch->entity_indices[batch_index]].particle_group.count;
+        jobs[job_count-1].one_past_last = batch_index + 1;
+        if(particle_count >= job_particle_count)
+        {
+            particle_count = 0;
+        }
+    }
+
+    return job_count;
+}
+
+template<typename real>
+internal void
+run_shape_matching_jobs(ThreadWorkQueue *thread_work_queue, ThreadShapeMatchingData<real> *jobs, u32 job_count, 
+                        b32 should_apply_goal_positions, f64 sub_dt)
+{
+    for(u32 job_index = 0;
+            job_index < job_count;
+            ++job_index)
+    {
+        jobs[job_index].should_apply_goal_positions = should_apply_goal_positions;
+        jobs[job_index].sub_dt = sub_dt;
+    }
+
+    if(job_count == 1)
+    {
+        thread_shape_matching_callback<real>(jobs);
+    }
+    else if(job_count > 1)
+    {
+        for(u32 job_index = 0;
+                job_index < job_count;
+                ++job_index)
+        {
+            thread_work_queue->add_thread_work_queue_item(thread_work_queue, thread_shape_matching_callback<real>, 0, 
+                                                          (void *)(jobs + job_index));
+        }
+        thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
+    }
+}
+
+// TODO/IMPORTANT(gh) Make sure the polar decomposition math checks out!
+template<typename real>
+internal void
+solve_shape_matching_constraints(PBDSolverParticles<real> *particles, ThreadWorkQueue *thread_work_queue, 
+                                 PBDShapeMatchingBatch *batch, ThreadShapeMatchingData<real> *jobs, u32 job_count, 
+                                 f64 sub_dt)
+{
+    run_shape_matching_jobs(thread_work_queue, jobs, job_count, false, sub_dt);
+
+    // NOTE(gh) Rotations are extracted together on this thread, see extract_shape_matching_rotations
+    extract_shape_matching_rotations(particles, batch->Apqs, batch->rotations, batch->count);
+
+    run_shape_matching_jobs(thread_work_queue, jobs, job_count, true, sub_dt);
+}
+
+/*
+   NOTE(gh) Contact islands, which are the groups that are connected by the collision constraints.
+   The islands are rebuilt every frame using union-find on the entity indices, 
+   and the whole island goes to sleep(or wakes up) together.
+*/
+internal u32
+find_island_root(u32 *island_parents, u32 entity_index)
+{
+    u32 result = entity_index;
+    while(island_parents[result] != result)
+    {
+        // NOTE(gh) Path halving
+        island_parents[result] = island_parents[island_parents[result]];
+        result = island_parents[result];
+    }
+
+    return result;
+}
+
+internal void
+merge_islands(u32 *island_parents, u32 entity_index0, u32 entity_index1)
+{
+    u32 root0 = find_island_root(island_parents, entity_index0);
+    u32 root1 = find_island_root(island_parents, entity_index1);
+    if(root0 != root1)
+    {
+        island_parents[maximum(root0, root1)] = minimum(root0, root1);
+    }
+}
+
+// NOTE(gh) Kinetic energy per unit mass(0.5*v^2) of the island, 
+// below which the island is considered to be resting
+#define sleep_kinetic_energy_threshold 0.002
+// NOTE(gh) How long the island should be resting before it goes to sleep, in seconds
+#define sleep_rest_time_threshold 0.5f
+
+template<typename real>
+internal void
+update_sleeping_islands(GameState *game_state, MemoryArena *arena, 
+                        PBDSolverParticles<real> *particles, u32 *island_parents, f32 dt)
+{
+    PBDParticlePool *pool = &game_state->particle_pool;
+    u32 entity_count = game_state->entity_count;
+
+    TempMemory island_memory = 
+        start_temp_memory(arena, entity_count*(2*sizeof(f64) + sizeof(f32)));
+    f64 *island_energies = push_array(&island_memory, f64, entity_count);
+    f64 *island_masses = push_array(&island_memory, f64, entity_count);
+    f32 *island_rest_times = push_array(&island_memory, f32, entity_count);
+
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        island_rest_times[entity_index] = sleep_rest_time_threshold;
+    }
+
+    // NOTE(gh) Sleeping groups contribute nothing to the energy
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(group->is_free_rigid_body)
+        {
+            // NOTE(gh) Particles of the free rigid bodies are stale, use the body instead
+            u32 root = find_island_root(island_parents, entity_index);
+            island_energies[root] += get_rigid_body_kinetic_energy(group);
+            island_masses[root] += 1.0/group->rigid_body_inv_mass;
+        }
+        else if(group->count && !group->is_sleeping)
+        {
+            u32 root = find_island_root(island_parents, entity_index);
+            u32 first = get_first_particle_index(pool, group);
+            for(u32 particle_index = first;
+                    particle_index < first + group->count;
+                    ++particle_index)
+            {
+                f64 mass = particles->mass[particle_index];
+                f64 v_square = square((f64)particles->vx[particle_index]) + 
+                               square((f64)particles->vy[particle_index]) + 
+                               square((f64)particles->vz[particle_index]);
+                island_energies[root] += 0.5*mass*v_square;
+                island_masses[root] += mass;
+            }
+        }
+    }
+
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(group->count)
+        {
+            u32 root = find_island_root(island_parents, entity_index);
+            b32 is_island_resting = (island_energies[root] <= sleep_kinetic_energy_threshold*island_masses[root]);
+            if(is_island_resting)
+            {
+                if(!group->is_sleeping)
+                {
+                    group->rest_time += dt;
+                    island_rest_times[root] = minimum(island_rest_times[root], group->rest_time);
+                }
+            }
+            else
+            {
+                group->is_sleeping = false;
+                group->rest_time = 0.0f;
+                // NOTE(gh) Mark the island as not ready to sleep
+                island_rest_times[root] = 0.0f;
+            }
+        }
+    }
+
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        // NOTE(gh) Free rigid bodies are not touching anything, so there's nothing for them to rest on
+        if(group->count && !group->is_sleeping && !group->is_free_rigid_body)
+        {
+            u32 root = find_island_root(island_parents, entity_index);
+            if(island_rest_times[root] >= sleep_rest_time_threshold)
+            {
+                group->is_sleeping = true;
+
+                u32 first = get_first_particle_index(pool, group);
+                for(u32 particle_index = first;
+                        particle_index < first + group->count;
+                        ++particle_index)
+                {
+                    particles->vx[particle_index] = 0;
+                    particles->vy[particle_index] = 0;
+                    particles->vz[particle_index] = 0;
+                }
+            }
+        }
+    }
+
+    end_temp_memory(&island_memory);
+}
+
+/*
+   NOTE(gh) Largest contact violation that is left after the last substep, relative to the radius.
+   Shape matching runs after the contacts in each substep, 
+   so this is how much the substep count was not enough to settle the contacts.
+   Distance & volume constraints are left out, because they are allowed to stretch by their compliance.
+*/
+template<typename real>
+internal f64
+get_pbd_residual_error(PBDSolverParticles<real> *particles, PBDParticleRange *awake_ranges, u32 awake_range_count,
+                       CollisionConstraint *collision_constraints, u32 collision_constraint_count)
+{
+    f64 result = 0;
+    for(u32 range_index = 0;
+            range_index < awake_range_count;
+            ++range_index)
+    {
+        PBDParticleRange *range = awake_ranges + range_index;
+        for(u32 particle_index = range->first;
+                particle_index < range->first + range->count;
+                ++particle_index)
+        {
+            if(particles->environment_mask[particle_index])
+            {
+                f64 d = (f64)(particles->environment_nx[particle_index]*particles->px[particle_index] + 
+                              particles->environment_ny[particle_index]*particles->py[particle_index] + 
+                              particles->environment_nz[particle_index]*particles->pz[particle_index]);
+                f64 r = (f64)particles->r[particle_index];
+                f64 C = d - (f64)particles->environment_d[particle_index] - r;
+                result = maximum(result, -C/r);
+            }
+        }
+    }
+
+    for(u32 constraint_index = 0;
+            constraint_index < collision_constraint_count;
+            ++constraint_index)
+    {
+        CollisionConstraint *c = collision_constraints + constraint_index;
+        f64 delta_x = (f64)(particles->px[c->index0] - particles->px[c->index1]);
+        f64 delta_y = (f64)(particles->py[c->index0] - particles->py[c->index1]);
+        f64 delta_z = (f64)(particles->pz[c->index0] - particles->pz[c->index1]);
+        f64 rest_length = (f64)(particles->r[c->index0] + particles->r[c->index1]);
+        f64 C = sqrt(delta_x*delta_x + delta_y*delta_y + delta_z*delta_z) - rest_length;
+
+        // NOTE(gh) rest_length is r0 + r1, so multiply by 2 to get the error relative to the radius
+        result = maximum(result, -2*C/rest_length);
+    }
+
+    return result;
+}
+
+// NOTE(gh) Returns the residual error of the contacts(see get_pbd_residual_error)
+template<typename real>
+internal f64
+simulate_pbd_substeps(GameState *game_state, MemoryArena *arena, ThreadWorkQueue *thread_work_queue, 
+                      f64 sub_dt, u32 substep_count)
+{
+    PBDParticlePool *pool = &game_state->particle_pool;
+
+    // NOTE(gh) This has to happen before we copy the particles, 
+    // because the rigid bodies that stopped being free write their particles back to the pool
+    update_free_rigid_bodies(game_state, arena, substep_count*sub_dt);
+
+    PBDSolverParticles<real> particles = {};
+    TempMemory particle_memory = start_solver_particles(&particles, arena, game_state);
+
+    u32 entity_count = game_state->entity_count;
+    TempMemory island_memory = 
+        start_temp_memory(arena, entity_count*(sizeof(u32) + sizeof(PBDParticleRange)));
+    u32 *island_parents = push_array(&island_memory, u32, entity_count);
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        island_parents[entity_index] = entity_index;
+    }
+
+    PBDParticleRange *awake_ranges = push_array(&island_memory, PBDParticleRange, entity_count);
+    u32 awake_range_count = get_awake_particle_ranges(awake_ranges, entity_count, game_state);
+
+    // NOTE(gh) Collision candidates are generated once per frame, 
+    // and stay valid for all substeps thanks to the speculative margin
+    for(u32 range_index = 0;
+            range_index < awake_range_count;
+            ++range_index)
+    {
+        PBDParticleRange *range = awake_ranges + range_index;
+        compute_speculative_margins(&particles, range->first, range->count, substep_count*sub_dt);
+    }
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        // NOTE(gh) Per entity rather than per range, because the neighbouring entities 
+        // that got merged into the same range can be far away from each other
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(group->count && !group->is_sleeping && !group->is_free_rigid_body)
+        {
+            u32 first = get_first_particle_index(pool, group);
+            generate_environment_constraints(&particles, first, group->count, &game_state->environment, arena);
+
+            group->has_contacts = false;
+            for(u32 particle_index = first;
+                    particle_index < first + group->count;
+                    ++particle_index)
+            {
+                if(particles.environment_mask[particle_index])
+                {
+                    group->has_contacts = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    u32 max_collision_constraint_count = 16384;
+    TempMemory collision_constraint_memory = 
+        start_temp_memory(arena, sizeof(CollisionConstraint)*max_collision_constraint_count);
+    CollisionConstraint *collision_constraints = 
+        push_array(&collision_constraint_memory, CollisionConstraint, max_collision_constraint_count);
+    u32 collision_constraint_count = 
+        generate_collision_constraints(collision_constraints, max_collision_constraint_count, game_state, arena, &particles);
+    for(u32 constraint_index = 0;
+            constraint_index < collision_constraint_count;
+            ++constraint_index)
+    {
+        CollisionConstraint *c = collision_constraints + constraint_index;
+        u32 entity_index0 = particles.entity_indices[c->index0];
+        u32 entity_index1 = particles.entity_indices[c->index1];
+        merge_islands(island_parents, entity_index0, entity_index1);
+
+        game_state->entities[entity_index0].particle_group.has_contacts = true;
+        game_state->entities[entity_index1].particle_group.has_contacts = true;
+    }
+
+    PBDShapeMatchingBatch shape_matching_batch = {};
+    TempMemory shape_matching_memory = 
+        start_temp_memory(arena, 
+                          entity_count*(sizeof(u32) + sizeof(v3d) + sizeof(m3x3d) + sizeof(m3x9d) + sizeof(quatd)) + 
+                          pbd_shape_matching_max_job_count*sizeof(ThreadShapeMatchingData<real>), false);
+    ThreadShapeMatchingData<real> *shape_matching_jobs = 
+        push_array(&shape_matching_memory, ThreadShapeMatchingData<real>, pbd_shape_matching_max_job_count);
+    shape_matching_batch.coms = push_array(&shape_matching_memory, v3d, entity_count);
+    shape_matching_batch.Apqs = push_array(&shape_matching_memory, m3x3d, entity_count);
+    shape_matching_batch.quadratic_Apqs = push_array(&shape_matching_memory, m3x9d, entity_count);
+    shape_matching_batch.rotations = push_array(&shape_matching_memory, quatd, entity_count);
+    shape_matching_batch.entity_indices = push_array(&shape_matching_memory, u32, entity_count);
+    u32 shape_matching_job_count = 
+        prepare_shape_matching_jobs(shape_matching_jobs, &particles, game_state, &shape_matching_batch);
+
+    PBDFluidParticles<real> fluid = {};
+    TempMemory fluid_memory = start_fluid_particles(&fluid, &particles, arena, game_state);
+
+    for(u32 substep_index = 0;
+            substep_index < substep_count;
+            ++substep_index)
+    {
+        for(u32 range_index = 0;
+                range_index < awake_range_count;
+                ++range_index)
+        {
+            PBDParticleRange *range = awake_ranges + range_index;
+            integrate_particles(&particles, range->first, range->count, sub_dt);
+        }
+
+        for(u32 entity_index = 0;
+                entity_index < entity_count;
+                ++entity_index)
+        {
+            PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+            if(group->is_free_rigid_body)
+            {
+                integrate_rigid_body(group, sub_dt);
+            }
+        }
+
+        // NOTE(gh) The neighbors are found using the predicted positions
+        if(fluid.count)
+        {
+            build_fluid_neighbors(&particles, &fluid);
+        }
+
+        u32 pre_stabilization_iter_count = 2;
+        for(u32 iter = 0;
+                iter < pre_stabilization_iter_count;
+                ++iter)
+        {
+            for(u32 range_index = 0;
+                    range_index < awake_range_count;
+                    ++range_index)
+            {
+                PBDParticleRange *range = awake_ranges + range_index;
+                solve_environment_constraints(&particles, range->first, range->count, true);
+            }
+            solve_collision_constraints(&particles, collision_constraints, collision_constraint_count, true);
+        }
+
+        /*
+           TODO(gh) Find out in what precise order we should solve the constraints,
+           especially with the environment and collision
+           Solve every constraints, in specific order.
+           fluid density -> environment -> collision -> distance -> shape matching
+           */
+        if(fluid.count)
+        {
+            solve_fluid_density_constraints(&particles, &fluid);
+        }
+
+        for(u32 range_index = 0;
+                range_index < awake_range_count;
+                ++range_index)
+        {
+            PBDParticleRange *range = awake_ranges + range_index;
+            solve_environment_constraints(&particles, range->first, range->count, false);
+        }
+
+        // NOTE(gh) Friction is applied inside the collision solve, using the sdf normals
+        solve_collision_constraints(&particles, collision_constraints, collision_constraint_count, false);
+
+        // NOTE(gh) Distance & volume constraints, used for cloth, chains and tetrahedral soft bodies
+        for(u32 entity_index = 0;
+                entity_index < game_state->entity_count;
+                ++entity_index)
+        {
+            PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+            if(!group->is_sleeping && !group->is_free_rigid_body &&
+               (group->distance_constraint_count || group->volume_constraint_count))
+            {
+                u32 first = get_first_particle_index(pool, group);
+                solve_distance_constraints(&particles, first, group, sub_dt);
+                solve_volume_constraints(&particles, first, group, sub_dt);
+            }
+        }
+
+        solve_shape_matching_constraints(&particles, thread_work_queue, &shape_matching_batch, 
+                                         shape_matching_jobs, shape_matching_job_count, sub_dt);
+
+        // Post solve
+        for(u32 range_index = 0;
+                range_index < awake_range_count;
+                ++range_index)
+        {
+            PBDParticleRange *range = awake_ranges + range_index;
+            update_velocities(&particles, range->first, range->count, sub_dt);
+        }
+
+        if(fluid.count)
+        {
+            apply_fluid_viscosity(&particles, &fluid);
+        }
+    }
+
+    end_temp_memory(&fluid_memory);
+    end_temp_memory(&shape_matching_memory);
+
+    f64 residual_error = get_pbd_residual_error(&particles, awake_ranges, awake_range_count, 
+                                                collision_constraints, collision_constraint_count);
+
+    end_temp_memory(&collision_constraint_memory);
+
+    update_sleeping_islands(game_state, arena, &particles, island_parents, (f32)(substep_count*sub_dt));
+
+    end_temp_memory(&island_memory);
+    end_solver_particles(&particles, pool, &particle_memory);
+
+    for(u32 entity_index = 0;
+            entity_index < entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        // NOTE(gh) Sleeping groups don't move, and the woken ones get here with is_sleeping already cleared
+        if(has_rigid_body(group) && !group->is_free_rigid_body && !group->is_sleeping)
+        {
+            update_rigid_body_from_particles(group);
+        }
+    }
+
+    return residual_error;
+}
+
+// NOTE(gh) How far the particles in contact are allowed to move in one substep, relative to their radius
+#define pbd_max_contact_travel_per_substep 0.25
+// NOTE(gh) How much contact violation we allow to be left after a frame, relative to the radius
+#define pbd_residual_error_tolerance 0.02
+
+/*
+   NOTE(gh) Thanks to the speculative contacts, free flying particles can't tunnel through anything 
+   regardless of their speed, so the substep count is driven by 
+   1. the particles that are touching something. Those still need small steps, because the contact normals 
+      and the friction are only valid while the particles move a fraction of their radius per substep.
+   2. the residual error of the last frame. Following the small steps paper, the error goes down with 
+      the square of the substep, so we scale the last substep count by sqrt(error/tolerance).
+      This is also what lets the calm scenes drop to the min substep count.
+*/
+internal u32
+get_pbd_substep_count(GameState *game_state, f64 dt, u32 min_substep_count, u32 max_substep_count, 
+                      PBDSubstepStats *stats)
+{
+    f64 max_travel = 0; // relative to the radius
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(!group->is_sleeping && group->has_contacts)
+        {
+            for(u32 particle_index = 0;
+                    particle_index < group->count;
+                    ++particle_index)
+            {
+                PBDParticle *particle = group->particles + particle_index;
+                if(particle->inv_mass != 0)
+                {
+                    max_travel = maximum(max_travel, length(particle->v)*dt/particle->r);
+                }
+            }
+        }
+    }
+
+    u32 travel_substep_count = (u32)ceil(max_travel/pbd_max_contact_travel_per_substep);
+    u32 error_substep_count = 
+        (u32)ceil(stats->last_substep_count*sqrt(stats->last_residual_error/pbd_residual_error_tolerance));
+
+    u32 result = maximum(travel_substep_count, error_substep_count);
+
+    // NOTE(gh) Going down one substep per frame at most, 
+    // otherwise a single bad frame makes the count bounce between min and max
+    if(stats->last_substep_count > 1)
+    {
+        result = maximum(result, stats->last_substep_count - 1);
+    }
+    result = clamp(min_substep_count, result, max_substep_count);
+
+#if HB_DETERMINISTIC
+    // NOTE(gh) The stats are not part of the game state, so the frame that was picked up from the middle
+    // (i.e by hb_replay) would end up with a different substep count
+    result = max_substep_count;
+#endif
+
+    stats->last_max_travel = max_travel;
+
+    return result;
+}
+
+internal void
+record_pbd_substep_stats(PBDSubstepStats *stats, u32 substep_count, f64 residual_error)
+{
+    stats->last_substep_count = substep_count;
+    stats->last_residual_error = residual_error;
+
+    stats->substep_counts[stats->write_cursor] = substep_count;
+    stats->residual_errors[stats->write_cursor] = (f32)residual_error;
+    stats->write_cursor = (stats->write_cursor + 1) % array_count(stats->substep_counts);
+    if(stats->recorded_count < array_count(stats->substep_counts))
+    {
+        stats->recorded_count++;
+    }
+}
+
+// NOTE(gh) Returns the residual error of the contacts(see get_pbd_residual_error)
+internal f64
+simulate_pbd(GameState *game_state, MemoryArena *arena, ThreadWorkQueue *thread_work_queue, 
+             PBDPrecisionMode precision_mode, f64 sub_dt, u32 substep_count)
+{
+    f64 result = 0;
+    if(substep_count && game_state->entity_count)
+    {
+        switch(precision_mode)
+        {
+            case PBDPrecisionMode_f64:
+            {
+                TIMED_BLOCK();
+                result = simulate_pbd_substeps<f64>(game_state, arena, thread_work_queue, sub_dt, substep_count);
+            }break;
+
+            case PBDPrecisionMode_f32:
+            {
+                TIMED_BLOCK();
+                result = simulate_pbd_substeps<f32>(game_state, arena, thread_work_queue, sub_dt, substep_count);
+            }break;
+        }
+    }
+
+    return result;
+}
+
+#if HB_DEBUG
+// NOTE(gh) Copies the game state, and fixes up the particle pointers 
+// so that they point to the particle pool of the copied game state.
+internal void
+debug_copy_game_state(GameState *dest, GameState *source)
+{
+    *dest = *source;
+    for(u32 entity_index = 0;
+            entity_index < dest->entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &dest->entities[entity_index].particle_group;
+        if(group->particles)
+        {
+            group->particles = dest->particle_pool.particles + 
+                               get_first_particle_index(&source->particle_pool, group);
+        }
+
+        if(group->distance_constraints)
+        {
+            group->distance_constraints = dest->constraint_pool.distance_constraints + 
+                (group->distance_constraints - source->constraint_pool.distance_constraints);
+        }
+
+        if(group->volume_constraints)
+        {
+            group->volume_constraints = dest->constraint_pool.volume_constraints + 
+                (group->volume_constraints - source->constraint_pool.volume_constraints);
+        }
+    }
+}
+
+/*
+   NOTE(gh) Runs the same game state with both precision modes for frame_count frames,
+   and records how far the f32 trajectory drifted away from the f64 reference.
+*/
+internal void
+debug_compare_pbd_precision(PBDPrecisionComparison *comparison, GameState *source, 
+                            MemoryArena *arena, ThreadWorkQueue *thread_work_queue,
+                            f64 dt_per_frame, u32 substep_count, u32 frame_count)
+{
+    TempMemory game_state_memory = start_temp_memory(arena, 2*sizeof(GameState), false);
+    GameState *reference = push_struct(&game_state_memory, GameState);
+    GameState *test = push_struct(&game_state_memory, GameState);
+    debug_copy_game_state(reference, source);
+    debug_copy_game_state(test, source);
+
+    *comparison = {};
+    comparison->frame_count = frame_count;
+
+    f64 sub_dt = dt_per_frame/substep_count;
+    for(u32 frame_index = 0;
+            frame_index < frame_count;
+            ++frame_index)
+    {
+        u64 start_cycle_count = rdtsc();
+        simulate_pbd_substeps<f64>(reference, arena, thread_work_queue, sub_dt, substep_count);
+        u64 middle_cycle_count = rdtsc();
+        simulate_pbd_substeps<f32>(test, arena, thread_work_queue, sub_dt, substep_count);
+        u64 end_cycle_count = rdtsc();
+
+        comparison->f64_cycle_count += middle_cycle_count - start_cycle_count;
+        comparison->f32_cycle_count += end_cycle_count - middle_cycle_count;
+
+        for(u32 entity_index = 0;
+                entity_index < reference->entity_count;
+                ++entity_index)
+        {
+            materialize_rigid_body_particles(&reference->entities[entity_index].particle_group);
+            materialize_rigid_body_particles(&test->entities[entity_index].particle_group);
+        }
+
+        f64 drift_sum = 0.0;
+        for(u32 particle_index = 0;
+                particle_index < reference->particle_pool.count;
+                ++particle_index)
+        {
+            f64 drift = length(reference->particle_pool.particles[particle_index].p - 
+                               test->particle_pool.particles[particle_index].p);
+            drift_sum += drift;
+            comparison->max_drift = maximum(comparison->max_drift, drift);
+        }
+
+        if(reference->particle_pool.count)
+        {
+            comparison->final_average_drift = drift_sum/reference->particle_pool.count;
+        }
+    }
+
+    end_temp_memory(&game_state_memory);
+}
+
+// NOTE(gh) Angle of the rotation that takes a to b, both should be normalized.
+// Uses 2*sin(angle/2) instead of acos, which doesn't have enough precision near 1.
+internal f64
+get_angle_between_rotations(quatd a, quatd b)
+{
+    f64 result = 2.0*length((conjugate(a)*b).v);
+
+    return result;
+}
+
+/*
+   NOTE(gh) Extracts the rotations of group_count random shape matching matrices(A = R*S, where S is a random stretch)
+   with both extract_rotation_from_polar_decomposition and the batched version.
+   Like the substeps, the extraction is warm started with a rotation that is slightly off from R.
+*/
+internal void
+debug_benchmark_polar_decomposition(PBDPolarDecompositionBenchmark *benchmark, MemoryArena *arena, u32 group_count)
+{
+    TempMemory memory = start_temp_memory(arena, group_count*(sizeof(m3x3d) + 3*sizeof(quatd)), false);
+    m3x3d *As = push_array(&memory, m3x3d, group_count);
+    quatd *actual_rotations = push_array(&memory, quatd, group_count);
+    quatd *scalar_rotations = push_array(&memory, quatd, group_count);
+    quatd *batch_rotations = push_array(&memory, quatd, group_count);
+
+    RandomSeries series = start_random_series(1234);
+    for(u32 group_index = 0;
+            group_index < group_count;
+            ++group_index)
+    {
+        v3d axis = normalize(V3d(random_between_minus_1_1(&series), 
+                                 random_between_minus_1_1(&series), 
+                                 random_between_minus_1_1(&series)));
+        quatd rotation = get_quatd_with_axis_angle(axis, random_between(&series, 0, pi_32));
+
+        // NOTE(gh) Apq also carries the mass of the group
+        f64 mass = random_between(&series, 1, 100);
+        m3x3d stretch = M3x3d(random_between(&series, 0.8f, 1.2f), 0, 0,
+                              0, random_between(&series, 0.8f, 1.2f), 0,
+                              0, 0, random_between(&series, 0.8f, 1.2f));
+        As[group_index] = mass*(orientation_quatd_to_m3x3d(rotation)*stretch);
+        actual_rotations[group_index] = rotation;
+
+        v3d offset_axis = normalize(V3d(random_between_minus_1_1(&series), 
+                                        random_between_minus_1_1(&series), 
+                                        random_between_minus_1_1(&series)));
+        quatd warm_start = normalize(get_quatd_with_axis_angle(offset_axis, 0.02)*rotation);
+        scalar_rotations[group_index] = warm_start;
+        batch_rotations[group_index] = warm_start;
+    }
+
+    u64 start_cycle_count = rdtsc();
+    for(u32 group_index = 0;
+            group_index < group_count;
+            ++group_index)
+    {
+        scalar_rotations[group_index] = 
+            extract_rotation_from_polar_decomposition(As + group_index, scalar_rotations + group_index, 
+                                                      shape_matching_polar_decomposition_max_iter_count);
+    }
+    u64 middle_cycle_count = rdtsc();
+    batch_extract_rotations_from_polar_decomposition(As, batch_rotations, group_count, 
+                                                     shape_matching_polar_decomposition_max_iter_count);
+    u64 end_cycle_count = rdtsc();
+
+    *benchmark = {};
+    benchmark->group_count = group_count;
+    benchmark->scalar_cycle_count = middle_cycle_count - start_cycle_count;
+    benchmark->batch_cycle_count = end_cycle_count - middle_cycle_count;
+    for(u32 group_index = 0;
+            group_index < group_count;
+            ++group_index)
+    {
+        benchmark->scalar_max_error = 
+            maximum(benchmark->scalar_max_error, 
+                    get_angle_between_rotations(scalar_rotations[group_index], actual_rotations[group_index]));
+        benchmark->batch_max_error = 
+            maximum(benchmark->batch_max_error, 
+                    get_angle_between_rotations(batch_rotations[group_index], actual_rotations[group_index]));
+    }
+
+    end_temp_memory(&memory);
+}
+#endif
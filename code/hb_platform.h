@@ -32,12 +32,42 @@ typedef PLATFORM_WRITE_ENTIRE_FILE(platform_write_entire_file);
 #define PLATFORM_FREE_FILE_MEMORY(name) void (name)(void *memory)
 typedef PLATFORM_FREE_FILE_MEMORY(platform_free_file_memory);
 
+// NOTE(gh) File that is mapped to the memory with read & write access, 
+// so that whatever we write to the memory ends up in the file without any explicit write.
+struct PlatformMappedFile
+{
+    u8 *memory;
+    u64 size;
+
+    u64 platform_handle;
+};
+
+// NOTE(gh) Creates(or truncates) the file with the given size and maps it to the memory
+#define PLATFORM_OPEN_MAPPED_FILE(name) PlatformMappedFile (name)(const char *file_name, u64 size)
+typedef PLATFORM_OPEN_MAPPED_FILE(platform_open_mapped_file);
+
+// NOTE(gh) Unmaps the file, and cuts the file down to size_to_keep
+#define PLATFORM_CLOSE_MAPPED_FILE(name) void (name)(PlatformMappedFile *file, u64 size_to_keep)
+typedef PLATFORM_CLOSE_MAPPED_FILE(platform_close_mapped_file);
+
+// NOTE(gh) Writes the used part of the permanent & transient memory to the file(see PlatformMemory), 
+// which will be mapped back in the next time the platform starts up
+#define PLATFORM_WRITE_MEMORY_SNAPSHOT(name) b32 (name)(struct PlatformMemory *platform_memory)
+typedef PLATFORM_WRITE_MEMORY_SNAPSHOT(platform_write_memory_snapshot);
+
 struct PlatformAPI
 {
     platform_read_file *read_file;
     platform_write_entire_file *write_entire_file;
     platform_free_file_memory *free_file_memory;
 
+    // NOTE(gh) Can be null if the platform doesn't support the mapped files
+    platform_open_mapped_file *open_mapped_file;
+    platform_close_mapped_file *close_mapped_file;
+
+    // NOTE(gh) Can be null if the platform can't put the memory back at the same address
+    platform_write_memory_snapshot *write_memory_snapshot;
+
     // platform_atomic_compare_and_exchange32() *atomic_compare_and_exchange32;
     // platform_atomic_compare_and_exchange64() *atomic_compare_and_exchange64;
 };
@@ -69,6 +99,8 @@ enum PlatformKeyID
     PlatformKeyID_FallbackSubstep,
     PlatformKeyID_AdvanceFrame,
     PlatformKeyID_FallbackFrame,
+
+    PlatformKeyID_SaveMemorySnapshot,
 };
 
 struct PlatformInput
@@ -138,6 +170,16 @@ struct PlatformMemory
 
     void *transient_memory;
     u64 transient_memory_size;
+
+    // NOTE(gh) Filled by the game, only this much of each memory goes into the memory snapshot
+    u64 permanent_memory_used;
+    u64 transient_memory_used;
+
+    // NOTE(gh) Set by the platform when the memory was mapped from the memory snapshot.
+    // Pointers inside the memory are still valid because the memory is at the same address, 
+    // but whatever lives outside of the memory(GPU resources, files...) should be created again by the game,
+    // which should clear this afterwards.
+    b32 is_restored_from_memory_snapshot;
 };
 
 // TODO(gh) sub_arena!
@@ -412,6 +454,10 @@ struct PlatformRenderPushBuffer
 #define GAME_UPDATE_AND_RENDER(name) void (name)(PlatformAPI *platform_api, PlatformInput *platform_input, PlatformMemory *platform_memory, PlatformRenderPushBuffer *platform_render_push_buffer, PlatformRenderPushBuffer *debug_platform_render_push_buffer, ThreadWorkQueue *thread_work_queue, ThreadWorkQueue *gpu_work_queue)
 typedef GAME_UPDATE_AND_RENDER(UpdateAndRender);
 
+// NOTE(gh) Called once right before the platform quits, so that the game can close the files that it was writing to
+#define GAME_SHUTDOWN(name) void (name)(PlatformMemory *platform_memory)
+typedef GAME_SHUTDOWN(ShutdownGame);
+
 #ifdef __cplusplus
 }
 #endif
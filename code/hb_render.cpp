@@ -612,6 +612,7 @@ render_all_entities(PlatformRenderPushBuffer *render_push_buffer,
             case EntityType_PBD:
             {
                 PBDParticleGroup *group = &entity->particle_group;
+                materialize_rigid_body_particles(group);
 
                 if(draw_particles)
                 {
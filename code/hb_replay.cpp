@@ -0,0 +1,219 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+/*
+   NOTE(gh) Headless tool that opens the time machine stream(see TimeMachineStream),
+   rebuilds the frame that we want, and optionally keeps simulating from there.
+   This is for replaying & profiling whatever happened in the session that wrote the stream,
+   without running the game itself.
+
+   The game only writes the stream when it's built with HB_STREAM_TIME_MACHINE(off by default, see makefile).
+
+   usage : hb_replay <stream file> <frame index> [frame count to simulate]
+
+   The hashes of the frames(see StateHash) are printed in the same format as state_hash_log_file_name,
+   so when both the game and this are built with HB_DETERMINISTIC, 
+   the lines should match the log of the game until the frame where the user did something(i.e shooting).
+*/
+#include "hb.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// NOTE(gh) Everything runs in the main thread, which also keeps the profile simple
+internal
+PLATFORM_ADD_THREAD_WORK_QUEUE_ITEM(replay_add_thread_work_queue_item)
+{
+    if(thread_work_callback)
+    {
+        thread_work_callback(data);
+    }
+}
+
+internal
+PLATFORM_COMPLETE_ALL_THREAD_WORK_QUEUE_ITEMS(replay_complete_all_thread_work_queue_items)
+{
+}
+
+/*
+   NOTE(gh) Particles and constraints are pointing inside the game state of the process that wrote the stream,
+   so they only need to be moved by the same amount as the game state.
+   Environment lives outside of the game state, so it points to the copy inside the stream.
+*/
+internal void
+relocate_replay_game_state(GameState *game_state, u8 *file_memory)
+{
+    TimeMachineStreamHeader *header = (TimeMachineStreamHeader *)file_memory;
+    u64 delta = (u64)game_state - header->state_address;
+
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(group->particles)
+        {
+            group->particles = (PBDParticle *)((u64)group->particles + delta);
+        }
+        if(group->distance_constraints)
+        {
+            group->distance_constraints = (DistanceConstraint *)((u64)group->distance_constraints + delta);
+        }
+        if(group->volume_constraints)
+        {
+            group->volume_constraints = (VolumeConstraint *)((u64)group->volume_constraints + delta);
+        }
+    }
+
+    load_time_machine_stream_environment(file_memory, &game_state->environment);
+}
+
+internal void
+print_replay_game_state(GameState *game_state)
+{
+    printf("entity count : %u, particle count : %u\n", game_state->entity_count, game_state->particle_pool.count);
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(group->count)
+        {
+            v3d com = V3d();
+            f64 max_speed = 0;
+            for(u32 particle_index = 0;
+                    particle_index < group->count;
+                    ++particle_index)
+            {
+                PBDParticle *particle = group->particles + particle_index;
+                com += particle->p;
+                max_speed = maximum(max_speed, length(particle->v));
+            }
+            com /= (f64)group->count;
+
+            printf("    entity %u : particle count %u, com (%f, %f, %f), max speed %f\n",
+                    entity_index, group->count, com.x, com.y, com.z, max_speed);
+        }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        printf("usage : hb_replay <stream file> <frame index> [frame count to simulate]\n");
+        return 1;
+    }
+
+    int file = open(argv[1], O_RDONLY);
+    if(file < 0)
+    {
+        printf("Failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    struct stat file_stat;
+    fstat(file, &file_stat);
+    if((u64)file_stat.st_size < sizeof(TimeMachineStreamHeader))
+    {
+        printf("%s is too small to be a time machine stream\n", argv[1]);
+        return 1;
+    }
+
+    u8 *file_memory = (u8 *)mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(file_memory == MAP_FAILED)
+    {
+        printf("Failed to map %s\n", argv[1]);
+        return 1;
+    }
+
+    TimeMachineStreamHeader *header = (TimeMachineStreamHeader *)file_memory;
+    if(header->magic != time_machine_stream_magic ||
+       header->version != time_machine_stream_version)
+    {
+        printf("%s is not a time machine stream, or was written by a different version\n", argv[1]);
+        return 1;
+    }
+
+    if(header->state_size != sizeof(GameState))
+    {
+        printf("GameState has changed since the stream was written(%u bytes, but now %u bytes)\n",
+                header->state_size, (u32)sizeof(GameState));
+        return 1;
+    }
+
+    printf("%u frames, %.2f seconds, %.2f MB of frames\n",
+            header->frame_count, header->frame_count*header->dt_per_frame,
+            (f32)(sizeof(u64)*header->payload_word_count)/(f32)(megabytes(1)));
+
+    u32 frame_index = (u32)atoi(argv[2]);
+    if(frame_index >= header->frame_count)
+    {
+        printf("frame index should be less than %u\n", header->frame_count);
+        return 1;
+    }
+
+    GameState *game_state = (GameState *)malloc(sizeof(GameState));
+    load_time_machine_stream_frame(file_memory, frame_index, game_state);
+    relocate_replay_game_state(game_state, file_memory);
+    printf("frame %u\n", frame_index);
+    print_replay_game_state(game_state);
+    // NOTE(gh) The stream only has the game state, so there's no grid fluid to hash
+    printf("%010u %016llx\n", frame_index, (unsigned long long)hash_game_state(game_state, 0));
+
+    u32 frame_count_to_simulate = (argc > 3) ? (u32)atoi(argv[3]) : 0;
+    if(frame_count_to_simulate)
+    {
+        size_t arena_size = gigabytes(1);
+        MemoryArena arena = start_memory_arena(malloc(arena_size), arena_size);
+
+        ThreadWorkQueue thread_work_queue = {};
+        thread_work_queue.add_thread_work_queue_item = replay_add_thread_work_queue_item;
+        thread_work_queue.complete_all_thread_work_queue_items = replay_complete_all_thread_work_queue_items;
+
+        // NOTE(gh) Same as what the game uses in realtime
+        u32 min_pbd_substep_count = 2;
+        u32 max_pbd_substep_count = 16;
+        PBDSubstepStats substep_stats = {};
+
+        // NOTE(gh) Hashing is left out of the timing, and the hashes are printed at the end
+        u64 *hashes = (u64 *)malloc(sizeof(u64)*frame_count_to_simulate);
+
+        clock_t simulation_clock = 0;
+        for(u32 frame = 0;
+                frame < frame_count_to_simulate;
+                ++frame)
+        {
+            clock_t begin = clock();
+            u32 substep_count = get_pbd_substep_count(game_state, (f64)header->dt_per_frame,
+                                                      min_pbd_substep_count, max_pbd_substep_count,
+                                                      &substep_stats);
+            f64 residual_error = simulate_pbd(game_state, &arena, &thread_work_queue, PBDPrecisionMode_f64,
+                                              (f64)header->dt_per_frame/(f64)substep_count, substep_count);
+            record_pbd_substep_stats(&substep_stats, substep_count, residual_error);
+            simulation_clock += clock() - begin;
+
+            hashes[frame] = hash_game_state(game_state, 0);
+        }
+
+        f64 ms = 1000.0*(f64)simulation_clock/(f64)CLOCKS_PER_SEC;
+        printf("simulated %u frames in %.3f ms(%.3f ms per frame)\n",
+                frame_count_to_simulate, ms, ms/frame_count_to_simulate);
+        print_replay_game_state(game_state);
+
+        for(u32 frame = 0;
+                frame < frame_count_to_simulate;
+                ++frame)
+        {
+            printf("%010u %016llx\n", frame_index + frame + 1, (unsigned long long)hashes[frame]);
+        }
+    }
+
+    return 0;
+}
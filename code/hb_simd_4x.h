@@ -107,6 +107,12 @@ simd_u32_load(u32 *ptr)
     return result;
 }
 
+force_inline void
+simd_u32_store(u32 *ptr, simd_u32 value)
+{
+    vst1q_u32(ptr, value.v);
+}
+
 force_inline u32
 get_lane(simd_u32 a, u32 lane)
 {
@@ -361,6 +367,12 @@ Simd_f32(f32 *ptr)
     return result;
 }
 
+force_inline void
+simd_f32_store(f32 *ptr, simd_f32 value)
+{
+    vst1q_f32(ptr, value.v);
+}
+
 force_inline f32
 get_lane(simd_f32 a, u32 lane)
 {
@@ -648,6 +660,122 @@ all_lanes_zero(simd_f32 a)
     return result;
 }
 
+//////////////////// simd_i32 ////////////////////
+
+force_inline simd_i32
+Simd_i32(i32 dup)
+{
+    simd_i32 result = {};
+    result.v = vdupq_n_s32(dup);
+
+    return result;
+}
+
+force_inline simd_i32
+Simd_i32(i32 value0, i32 value1, i32 value2, i32 value3)
+{
+    simd_i32 result = {};
+    result.v = {value0, value1, value2, value3};
+
+    return result;
+}
+
+force_inline i32
+get_lane(simd_i32 a, u32 lane)
+{
+    return (((i32 *)&a)[lane]);
+}
+
+force_inline simd_i32
+operator+(simd_i32 a, simd_i32 b)
+{
+    simd_i32 result = {};
+    result.v = vaddq_s32(a.v, b.v);
+
+    return result;
+}
+
+force_inline simd_i32
+operator-(simd_i32 a, simd_i32 b)
+{
+    simd_i32 result = {};
+    result.v = vsubq_s32(a.v, b.v);
+
+    return result;
+}
+
+force_inline simd_i32
+operator*(simd_i32 a, simd_i32 b)
+{
+    simd_i32 result = {};
+    result.v = vmulq_s32(a.v, b.v);
+
+    return result;
+}
+
+force_inline simd_i32
+min(simd_i32 a, simd_i32 b)
+{
+    simd_i32 result = {};
+    result.v = vminq_s32(a.v, b.v);
+
+    return result;
+}
+
+// NOTE(gh) Rounds toward zero, same as the c style cast
+force_inline simd_i32
+convert_i32_from_f32(simd_f32 value)
+{
+    simd_i32 result = {};
+    result.v = vcvtq_s32_f32(value.v);
+
+    return result;
+}
+
+force_inline simd_f32
+convert_f32_from_i32(simd_i32 value)
+{
+    simd_f32 result = {};
+    result.v = vcvtq_f32_s32(value.v);
+
+    return result;
+}
+
+// NOTE(gh) NEON doesn't have a gather instruction, so each lane is loaded separately.
+// This is still better than going back to the scalar path, as everything around the load stays in the vector registers.
+force_inline simd_f32
+gather(f32 *base, simd_i32 indices)
+{
+    simd_f32 result = {};
+    result.v = vld1q_lane_f32(base + vgetq_lane_s32(indices.v, 0), result.v, 0);
+    result.v = vld1q_lane_f32(base + vgetq_lane_s32(indices.v, 1), result.v, 1);
+    result.v = vld1q_lane_f32(base + vgetq_lane_s32(indices.v, 2), result.v, 2);
+    result.v = vld1q_lane_f32(base + vgetq_lane_s32(indices.v, 3), result.v, 3);
+
+    return result;
+}
+
+// NOTE(gh) Gathers base[index] to first & base[index+1] to second, 
+// with one 64bit load per lane instead of two 32bit ones.
+force_inline void
+gather_pairs(f32 *base, simd_i32 indices, simd_f32 *first, simd_f32 *second)
+{
+    float32x4_t pairs01 = vcombine_f32(vld1_f32(base + vgetq_lane_s32(indices.v, 0)), vld1_f32(base + vgetq_lane_s32(indices.v, 1)));
+    float32x4_t pairs23 = vcombine_f32(vld1_f32(base + vgetq_lane_s32(indices.v, 2)), vld1_f32(base + vgetq_lane_s32(indices.v, 3)));
+
+    first->v = vuzp1q_f32(pairs01, pairs23);
+    second->v = vuzp2q_f32(pairs01, pairs23);
+}
+
+force_inline void
+scatter(f32 *base, simd_i32 indices, simd_f32 values)
+{
+    vst1q_lane_f32(base + vgetq_lane_s32(indices.v, 0), values.v, 0);
+    vst1q_lane_f32(base + vgetq_lane_s32(indices.v, 1), values.v, 1);
+    vst1q_lane_f32(base + vgetq_lane_s32(indices.v, 2), values.v, 2);
+    vst1q_lane_f32(base + vgetq_lane_s32(indices.v, 3), values.v, 3);
+}
+
 //////////////////// simd_v3 ////////////////////
 
 // TODO(joon): we can also make this from operator=
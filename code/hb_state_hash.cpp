@@ -0,0 +1,258 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+#define xxhash64_prime0 11400714785074694791ULL
+#define xxhash64_prime1 14029467366897019727ULL
+#define xxhash64_prime2 1609587929392839161ULL
+#define xxhash64_prime3 9650029242287828579ULL
+#define xxhash64_prime4 2870177450012600261ULL
+
+inline u64
+rotate_left_u64(u64 value, u32 shift)
+{
+    u64 result = (value << shift) | (value >> (64 - shift));
+    return result;
+}
+
+inline u64
+xxhash64_round(u64 acc, u64 input)
+{
+    acc += input*xxhash64_prime1;
+    acc = rotate_left_u64(acc, 31);
+    acc *= xxhash64_prime0;
+
+    return acc;
+}
+
+inline u64
+xxhash64_merge_round(u64 acc, u64 value)
+{
+    acc ^= xxhash64_round(0, value);
+    acc = acc*xxhash64_prime0 + xxhash64_prime3;
+
+    return acc;
+}
+
+inline u64
+read_u64(u8 *memory)
+{
+    u64 result;
+    memcpy(&result, memory, sizeof(result));
+    return result;
+}
+
+inline u32
+read_u32(u8 *memory)
+{
+    u32 result;
+    memcpy(&result, memory, sizeof(result));
+    return result;
+}
+
+internal StateHash
+start_state_hash(u64 seed = 0)
+{
+    StateHash result = {};
+    result.seed = seed;
+    result.accs[0] = seed + xxhash64_prime0 + xxhash64_prime1;
+    result.accs[1] = seed + xxhash64_prime1;
+    result.accs[2] = seed;
+    result.accs[3] = seed - xxhash64_prime0;
+
+    return result;
+}
+
+internal void
+consume_state_hash_stripe(StateHash *hash, u8 *stripe)
+{
+    hash->accs[0] = xxhash64_round(hash->accs[0], read_u64(stripe + 0));
+    hash->accs[1] = xxhash64_round(hash->accs[1], read_u64(stripe + 8));
+    hash->accs[2] = xxhash64_round(hash->accs[2], read_u64(stripe + 16));
+    hash->accs[3] = xxhash64_round(hash->accs[3], read_u64(stripe + 24));
+}
+
+internal void
+update_state_hash(StateHash *hash, void *memory, u64 size)
+{
+    u8 *current = (u8 *)memory;
+    u8 *end = current + size;
+    hash->total_size += size;
+
+    // NOTE(gh) Fill up the stripe that was left from the last update first
+    if(hash->buffer_size)
+    {
+        u32 size_to_fill = (u32)minimum((u64)(sizeof(hash->buffer) - hash->buffer_size), size);
+        memcpy(hash->buffer + hash->buffer_size, current, size_to_fill);
+        hash->buffer_size += size_to_fill;
+        current += size_to_fill;
+
+        if(hash->buffer_size == sizeof(hash->buffer))
+        {
+            consume_state_hash_stripe(hash, hash->buffer);
+            hash->buffer_size = 0;
+        }
+    }
+
+    while(end - current >= (i64)sizeof(hash->buffer))
+    {
+        consume_state_hash_stripe(hash, current);
+        current += sizeof(hash->buffer);
+    }
+
+    if(current != end)
+    {
+        hash->buffer_size = (u32)(end - current);
+        memcpy(hash->buffer, current, hash->buffer_size);
+    }
+}
+
+internal u64
+get_state_hash_digest(StateHash *hash)
+{
+    u64 result;
+    if(hash->total_size >= sizeof(hash->buffer))
+    {
+        result = rotate_left_u64(hash->accs[0], 1) + rotate_left_u64(hash->accs[1], 7) +
+                 rotate_left_u64(hash->accs[2], 12) + rotate_left_u64(hash->accs[3], 18);
+        result = xxhash64_merge_round(result, hash->accs[0]);
+        result = xxhash64_merge_round(result, hash->accs[1]);
+        result = xxhash64_merge_round(result, hash->accs[2]);
+        result = xxhash64_merge_round(result, hash->accs[3]);
+    }
+    else
+    {
+        result = hash->seed + xxhash64_prime4;
+    }
+    result += hash->total_size;
+
+    u8 *current = hash->buffer;
+    u8 *end = hash->buffer + hash->buffer_size;
+    while(end - current >= 8)
+    {
+        result ^= xxhash64_round(0, read_u64(current));
+        result = rotate_left_u64(result, 27)*xxhash64_prime0 + xxhash64_prime3;
+        current += 8;
+    }
+    if(end - current >= 4)
+    {
+        result ^= (u64)read_u32(current)*xxhash64_prime0;
+        result = rotate_left_u64(result, 23)*xxhash64_prime1 + xxhash64_prime2;
+        current += 4;
+    }
+    while(current != end)
+    {
+        result ^= (*current)*xxhash64_prime4;
+        result = rotate_left_u64(result, 11)*xxhash64_prime0;
+        current++;
+    }
+
+    // NOTE(gh) Avalanche
+    result ^= result >> 33;
+    result *= xxhash64_prime1;
+    result ^= result >> 29;
+    result *= xxhash64_prime2;
+    result ^= result >> 32;
+
+    return result;
+}
+
+/*
+   NOTE(gh) Only the part of the game state that the simulation changes goes into the hash.
+   The rest of the particle(i.e prev_p, d_p_sum) is either constant or cleared every frame,
+   and has the paddings that nobody cares about.
+
+   The particles of the free rigid bodies are left behind, and only brought up to date when somebody 
+   needs them(i.e rendering, which hb_replay never does). So for those, we hash the bodies instead of the particles.
+
+   The grid fluid is not inside the game state, so it's passed separately and can be null.
+   update_fluid_cube_mac leaves the result of the frame in the dest buffers, and the source ones are only the scratch input.
+*/
+internal u64
+hash_game_state(GameState *game_state, FluidCubeMAC *fluid_cube)
+{
+    StateHash hash = start_state_hash();
+
+    update_state_hash(&hash, &game_state->entity_count, sizeof(game_state->entity_count));
+    update_state_hash(&hash, &game_state->particle_pool.count, sizeof(game_state->particle_pool.count));
+
+    for(u32 entity_index = 0;
+            entity_index < game_state->entity_count;
+            ++entity_index)
+    {
+        PBDParticleGroup *group = &game_state->entities[entity_index].particle_group;
+        if(!group->is_free_rigid_body)
+        {
+            for(u32 particle_index = 0;
+                    particle_index < group->count;
+                    ++particle_index)
+            {
+                PBDParticle *particle = group->particles + particle_index;
+                update_state_hash(&hash, &particle->p, sizeof(particle->p));
+                update_state_hash(&hash, &particle->v, sizeof(particle->v));
+            }
+        }
+
+        if(has_rigid_body(group))
+        {
+            update_state_hash(&hash, &group->rigid_body_p, sizeof(group->rigid_body_p));
+            update_state_hash(&hash, &group->rigid_body_v, sizeof(group->rigid_body_v));
+            update_state_hash(&hash, &group->rigid_body_w, sizeof(group->rigid_body_w));
+            update_state_hash(&hash, &group->shape_match_quat, sizeof(group->shape_match_quat));
+        }
+        update_state_hash(&hash, &group->is_free_rigid_body, sizeof(group->is_free_rigid_body));
+        update_state_hash(&hash, &group->is_sleeping, sizeof(group->is_sleeping));
+    }
+
+    if(fluid_cube && fluid_cube->total_center_count)
+    {
+        update_state_hash(&hash, fluid_cube->v_x_dest, sizeof(f32)*fluid_cube->total_x_count);
+        update_state_hash(&hash, fluid_cube->v_y_dest, sizeof(f32)*fluid_cube->total_y_count);
+        update_state_hash(&hash, fluid_cube->v_z_dest, sizeof(f32)*fluid_cube->total_z_count);
+        update_state_hash(&hash, fluid_cube->density_dest, sizeof(f32)*fluid_cube->total_center_count);
+    }
+
+    u64 result = get_state_hash_digest(&hash);
+    return result;
+}
+
+internal void
+start_state_hash_log(StateHashLog *log, PlatformAPI *platform_api, u32 max_line_count)
+{
+    zero_memory(log, sizeof(*log));
+    if(platform_api->open_mapped_file && platform_api->close_mapped_file)
+    {
+        log->file = platform_api->open_mapped_file(state_hash_log_file_name,
+                                                   (u64)state_hash_log_line_size*max_line_count);
+        if(log->file.memory)
+        {
+            log->close_mapped_file = platform_api->close_mapped_file;
+            log->max_line_count = max_line_count;
+        }
+    }
+}
+
+internal void
+end_state_hash_log(StateHashLog *log)
+{
+    if(log->file.memory)
+    {
+        u32 line_count = minimum(log->frame_index, log->max_line_count);
+        log->close_mapped_file(&log->file, (u64)state_hash_log_line_size*line_count);
+    }
+}
+
+internal void
+log_state_hash(StateHashLog *log, u64 hash)
+{
+    if(log->file.memory && log->frame_index < log->max_line_count)
+    {
+        // NOTE(gh) One more for the null terminator from snprintf, which doesn't go into the file
+        char line[state_hash_log_line_size + 1];
+        snprintf(line, array_count(line), "%010u %016llx\n", log->frame_index, (unsigned long long)hash);
+        memcpy(log->file.memory + (u64)state_hash_log_line_size*log->frame_index, line, state_hash_log_line_size);
+    }
+
+    log->frame_index++;
+    log->last_hash = hash;
+}
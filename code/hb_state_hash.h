@@ -0,0 +1,53 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+#ifndef HB_STATE_HASH_H
+#define HB_STATE_HASH_H
+
+/*
+   NOTE(gh) Deterministic mode(HB_DETERMINISTIC) hashes the simulated state every frame, 
+   so that any parallel or SIMD version of the solver can be checked bit by bit against the serial one.
+   Write down the hashes from both versions(the game writes them to state_hash_log_file_name, 
+   and hb_replay prints them), and the first frame that doesn't match is where they diverged.
+
+   To keep the result identical no matter how the work gets divided,
+   - a*b + c is never contracted to fma, see the top of hb.cpp
+   - the jobs never accumulate into the shared values. If the job needs to reduce something(i.e sum, max),
+     it writes its own partial result, and the main thread combines them in the job order.
+   - constraints that touch the same particles are solved in the same order, 
+     so the Gauss-Seidel updates are applied in the same order
+   - the substep count doesn't depend on what happened before the frame(see get_pbd_substep_count)
+*/
+
+// NOTE(gh) Streaming xxHash64, feed any number of arrays and then get the digest
+struct StateHash
+{
+    u64 accs[4];
+
+    // NOTE(gh) Bytes that didn't fill the whole stripe yet
+    u8 buffer[32];
+    u32 buffer_size;
+
+    u64 total_size;
+    u64 seed;
+};
+
+#define state_hash_log_file_name "hb_state_hashes.txt"
+// NOTE(gh) Every line is '<frame index(10 digits)> <hash(16 hex digits)>\n'
+#define state_hash_log_line_size 28
+
+struct StateHashLog
+{
+    // NOTE(gh) Mapped with max_line_count lines up front, and cut down to the lines that we wrote by end_state_hash_log
+    PlatformMappedFile file;
+    platform_close_mapped_file *close_mapped_file;
+    u32 max_line_count;
+
+    // NOTE(gh) Same as the index of the time machine stream frame, 
+    // because both are written when the frame is recorded
+    u32 frame_index;
+    u64 last_hash;
+};
+
+#endif
@@ -0,0 +1,609 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+internal void
+init_time_machine(TimeMachine *time_machine, MemoryArena *arena,
+                  size_t state_size, u32 max_frame_count, size_t max_encoded_size)
+{
+    // NOTE(gh) GameState has f64s inside, so the size should be always aligned to 8 bytes
+    assert(state_size % sizeof(u64) == 0);
+
+    time_machine->state_word_count = (u32)(state_size/sizeof(u64));
+    time_machine->cursor_state = push_array(arena, u64, time_machine->state_word_count);
+
+    time_machine->max_frame_count = max_frame_count;
+    time_machine->frames = push_array(arena, TimeMachineFrame, max_frame_count);
+
+    time_machine->max_word_count = (u32)(max_encoded_size/sizeof(u64));
+    time_machine->words = push_array(arena, u64, time_machine->max_word_count);
+
+    time_machine->chunk_count = (time_machine->state_word_count + time_machine_chunk_word_count - 1)/time_machine_chunk_word_count;
+    time_machine->encode_data = push_array(arena, ThreadTimeMachineEncodeData, time_machine->chunk_count);
+    for(u32 chunk_index = 0;
+            chunk_index < time_machine->chunk_count;
+            ++chunk_index)
+    {
+        ThreadTimeMachineEncodeData *d = time_machine->encode_data + chunk_index;
+        d->first_word = chunk_index*time_machine_chunk_word_count;
+        d->one_past_last_word = minimum(d->first_word + time_machine_chunk_word_count, time_machine->state_word_count);
+        d->output = push_array(arena, u64, (2*(d->one_past_last_word - d->first_word)));
+    }
+
+    time_machine->first_frame = 0;
+    time_machine->frame_count = 0;
+    time_machine->frames_since_keyframe = 0;
+    time_machine->write_word = 0;
+    time_machine->is_cursor_valid = false;
+    time_machine->read_cursor = 0;
+}
+
+// NOTE(gh) Throws away all the recorded frames, the next frame will be a keyframe
+internal void
+reset_time_machine(TimeMachine *time_machine)
+{
+    time_machine->first_frame = 0;
+    time_machine->frame_count = 0;
+    time_machine->frames_since_keyframe = 0;
+    time_machine->write_word = 0;
+    time_machine->is_cursor_valid = false;
+    time_machine->read_cursor = 0;
+}
+
+internal TimeMachineFrame *
+get_time_machine_frame(TimeMachine *time_machine, u32 frame_index)
+{
+    assert(frame_index < time_machine->frame_count);
+    TimeMachineFrame *result = time_machine->frames +
+                               (time_machine->first_frame + frame_index) % time_machine->max_frame_count;
+
+    return result;
+}
+
+/*
+   NOTE(gh) Encodes the runs of the words that changed against the reference,
+   and updates the reference so that it becomes the current state.
+   Unchanged chunk produces no words at all.
+*/
+internal
+THREAD_WORK_CALLBACK(thread_time_machine_encode_callback)
+{
+    ThreadTimeMachineEncodeData *d = (ThreadTimeMachineEncodeData *)data;
+
+    u64 *current = d->current;
+    u64 *reference = d->reference;
+    u64 *output = d->output;
+    u32 output_word_count = 0;
+
+    u32 word_index = d->first_word;
+    while(word_index < d->one_past_last_word)
+    {
+        // NOTE(gh) Keyframe is encoded against the zero state
+        u64 delta = d->is_keyframe ? current[word_index] : (current[word_index] ^ reference[word_index]);
+        if(delta == 0)
+        {
+            if(d->is_keyframe)
+            {
+                reference[word_index] = current[word_index];
+            }
+
+            word_index++;
+            continue;
+        }
+
+        u32 header_index = output_word_count++;
+        u32 run_start = word_index;
+        while(word_index < d->one_past_last_word)
+        {
+            delta = d->is_keyframe ? current[word_index] : (current[word_index] ^ reference[word_index]);
+            if(delta == 0)
+            {
+                break;
+            }
+
+            output[output_word_count++] = delta;
+            reference[word_index] = current[word_index];
+            word_index++;
+        }
+
+        output[header_index] = ((u64)run_start << 32) | (u64)(word_index - run_start);
+    }
+
+    d->output_word_count = output_word_count;
+}
+
+// NOTE(gh) XORs the encoded runs to the state
+internal void
+xor_time_machine_words(u64 *state, u32 state_word_count, u64 *words, u64 word_count)
+{
+    u64 *word = words;
+    u64 *one_past_last_word = words + word_count;
+    while(word < one_past_last_word)
+    {
+        u64 header = *word++;
+        u32 run_start = (u32)(header >> 32);
+        u32 run_word_count = (u32)(header & 0xffffffff);
+        assert(run_start + run_word_count <= state_word_count);
+
+        u64 *run_state = state + run_start;
+        for(u32 i = 0;
+                i < run_word_count;
+                ++i)
+        {
+            run_state[i] ^= word[i];
+        }
+        word += run_word_count;
+    }
+}
+
+internal void
+apply_time_machine_frame(TimeMachine *time_machine, TimeMachineFrame *frame)
+{
+    xor_time_machine_words(time_machine->cursor_state, time_machine->state_word_count,
+                           time_machine->words + frame->offset, frame->word_count);
+}
+
+// NOTE(gh) Throws away the oldest keyframe and the deltas that depend on it
+internal void
+evict_oldest_time_machine_frames(TimeMachine *time_machine)
+{
+    do
+    {
+        time_machine->first_frame = (time_machine->first_frame + 1) % time_machine->max_frame_count;
+        time_machine->frame_count--;
+
+        // NOTE(gh) The frames are relative to the oldest frame
+        if(time_machine->cursor_frame > 0)
+        {
+            time_machine->cursor_frame--;
+        }
+        else
+        {
+            time_machine->is_cursor_valid = false;
+        }
+    }
+    while(time_machine->frame_count > 0 &&
+          !get_time_machine_frame(time_machine, 0)->is_keyframe);
+
+    if(time_machine->frame_count == 0)
+    {
+        time_machine->is_cursor_valid = false;
+    }
+}
+
+/*
+   NOTE(gh) Starts writing every recorded frame to the file, until the file fills up.
+   The file is mapped with the full size up front, and the OS takes care of writing the pages back.
+*/
+internal void
+start_time_machine_stream(TimeMachine *time_machine, PlatformAPI *platform_api, const char *file_name,
+                          u32 max_frame_count, u64 max_payload_size, f32 dt_per_frame)
+{
+    if(!platform_api->open_mapped_file || !platform_api->close_mapped_file)
+    {
+        return;
+    }
+
+    TimeMachineStream *stream = &time_machine->stream;
+    u64 payload_offset = sizeof(TimeMachineStreamHeader) + sizeof(TimeMachineStreamFrame)*max_frame_count;
+    stream->file = platform_api->open_mapped_file(file_name, payload_offset + max_payload_size);
+    if(stream->file.memory)
+    {
+        stream->close_mapped_file = platform_api->close_mapped_file;
+
+        stream->header = (TimeMachineStreamHeader *)stream->file.memory;
+        stream->frames = (TimeMachineStreamFrame *)(stream->header + 1);
+        stream->payload = (u64 *)(stream->file.memory + payload_offset);
+
+        TimeMachineStreamHeader *header = stream->header;
+        header->magic = time_machine_stream_magic;
+        header->version = time_machine_stream_version;
+        header->state_size = sizeof(u64)*time_machine->state_word_count;
+        header->dt_per_frame = dt_per_frame;
+        header->max_frame_count = max_frame_count;
+        header->frame_count = 0;
+        header->payload_offset = payload_offset;
+        header->payload_word_count = 0;
+        header->max_payload_word_count = max_payload_size/sizeof(u64);
+        header->state_address = 0;
+        header->environment_offset = 0;
+        header->environment_word_count = 0;
+
+        stream->last_keyframe_index = 0;
+
+        // NOTE(gh) The first frame of the stream should be a keyframe
+        time_machine->is_cursor_valid = false;
+        time_machine->is_streaming = true;
+    }
+}
+
+internal void
+end_time_machine_stream(TimeMachine *time_machine)
+{
+    if(time_machine->is_streaming)
+    {
+        TimeMachineStream *stream = &time_machine->stream;
+        u64 used_size = stream->header->payload_offset + sizeof(u64)*stream->header->payload_word_count;
+        stream->close_mapped_file(&stream->file, used_size);
+
+        time_machine->is_streaming = false;
+    }
+}
+
+internal void
+append_time_machine_stream_frame(TimeMachine *time_machine, TimeMachineFrame *frame, void *state)
+{
+    TimeMachineStream *stream = &time_machine->stream;
+    TimeMachineStreamHeader *header = stream->header;
+    if(header->frame_count == header->max_frame_count ||
+       header->payload_word_count + frame->word_count > header->max_payload_word_count)
+    {
+        // NOTE(gh) Keep what we have so far
+        end_time_machine_stream(time_machine);
+        return;
+    }
+
+    u32 frame_index = header->frame_count;
+    if(frame_index == 0)
+    {
+        header->state_address = (u64)state;
+    }
+
+    if(frame->is_keyframe)
+    {
+        stream->last_keyframe_index = frame_index;
+    }
+
+    TimeMachineStreamFrame *stream_frame = stream->frames + frame_index;
+    stream_frame->offset = header->payload_word_count;
+    stream_frame->word_count = frame->word_count;
+    stream_frame->keyframe_index = stream->last_keyframe_index;
+    memcpy(stream->payload + stream_frame->offset, time_machine->words + frame->offset, sizeof(u64)*frame->word_count);
+
+    header->payload_word_count += frame->word_count;
+    header->frame_count++;
+}
+
+internal u64 *
+push_time_machine_stream_words(TimeMachineStream *stream, void *source, u64 size)
+{
+    u64 *result = 0;
+
+    u64 word_count = (size + sizeof(u64) - 1)/sizeof(u64);
+    TimeMachineStreamHeader *header = stream->header;
+    if(header->payload_word_count + word_count <= header->max_payload_word_count)
+    {
+        result = stream->payload + header->payload_word_count;
+        memcpy(result, source, size);
+        header->payload_word_count += word_count;
+    }
+
+    return result;
+}
+
+/*
+   NOTE(gh) Colliders never change after they were added, so they only need to be written once.
+   Each collider is written as the collider itself followed by its arrays, each padded to u64.
+*/
+internal void
+write_time_machine_stream_environment(TimeMachine *time_machine, PBDEnvironment *environment)
+{
+    if(!time_machine->is_streaming)
+    {
+        return;
+    }
+
+    TimeMachineStream *stream = &time_machine->stream;
+    u64 environment_offset = stream->header->payload_word_count;
+
+    u64 collider_count = environment->collider_count;
+    b32 is_written = (push_time_machine_stream_words(stream, &collider_count, sizeof(collider_count)) != 0);
+    for(u32 collider_index = 0;
+            collider_index < environment->collider_count && is_written;
+            ++collider_index)
+    {
+        PBDEnvironmentCollider *collider = environment->colliders + collider_index;
+        u32 cell_count = collider->cell_count_x*collider->cell_count_y;
+        u32 cell_triangle_index_count = collider->cell_first_triangle[cell_count];
+
+        is_written = (push_time_machine_stream_words(stream, collider, sizeof(*collider)) &&
+                      push_time_machine_stream_words(stream, collider->triangles, sizeof(PBDEnvironmentTriangle)*collider->triangle_count) &&
+                      push_time_machine_stream_words(stream, collider->cell_first_triangle, sizeof(u32)*(cell_count + 1)) &&
+                      (cell_triangle_index_count == 0 || 
+                       push_time_machine_stream_words(stream, collider->cell_triangle_indices, sizeof(u32)*cell_triangle_index_count)));
+    }
+
+    if(is_written)
+    {
+        stream->header->environment_offset = environment_offset;
+        stream->header->environment_word_count = stream->header->payload_word_count - environment_offset;
+    }
+}
+
+/*
+   NOTE(gh) Points the colliders of the environment to the arrays inside the stream file.
+   The file should stay mapped while the environment is being used.
+*/
+internal void
+load_time_machine_stream_environment(u8 *file_memory, PBDEnvironment *environment)
+{
+    TimeMachineStreamHeader *header = (TimeMachineStreamHeader *)file_memory;
+    u64 *payload = (u64 *)(file_memory + header->payload_offset);
+
+    environment->collider_count = 0;
+    if(header->environment_word_count)
+    {
+        u64 *word = payload + header->environment_offset;
+        u64 collider_count = *word++;
+        assert(collider_count <= array_count(environment->colliders));
+        for(u32 collider_index = 0;
+                collider_index < collider_count;
+                ++collider_index)
+        {
+            PBDEnvironmentCollider *collider = environment->colliders + environment->collider_count++;
+            *collider = *(PBDEnvironmentCollider *)word;
+            word += (sizeof(PBDEnvironmentCollider) + sizeof(u64) - 1)/sizeof(u64);
+
+            u32 cell_count = collider->cell_count_x*collider->cell_count_y;
+
+            collider->triangles = (PBDEnvironmentTriangle *)word;
+            word += (sizeof(PBDEnvironmentTriangle)*collider->triangle_count + sizeof(u64) - 1)/sizeof(u64);
+
+            collider->cell_first_triangle = (u32 *)word;
+            word += (sizeof(u32)*(cell_count + 1) + sizeof(u64) - 1)/sizeof(u64);
+
+            u32 cell_triangle_index_count = collider->cell_first_triangle[cell_count];
+            collider->cell_triangle_indices = (u32 *)word;
+            word += (sizeof(u32)*cell_triangle_index_count + sizeof(u64) - 1)/sizeof(u64);
+        }
+    }
+}
+
+/*
+   NOTE(gh) Rebuilds the frame from the stream file that was written by the time machine,
+   starting from the keyframe of the frame.
+*/
+internal void
+load_time_machine_stream_frame(u8 *file_memory, u32 frame_index, void *state_to_populate)
+{
+    TimeMachineStreamHeader *header = (TimeMachineStreamHeader *)file_memory;
+    TimeMachineStreamFrame *frames = (TimeMachineStreamFrame *)(header + 1);
+    u64 *payload = (u64 *)(file_memory + header->payload_offset);
+    assert(frame_index < header->frame_count);
+
+    u64 *state = (u64 *)state_to_populate;
+    u32 state_word_count = header->state_size/sizeof(u64);
+    zero_memory(state, header->state_size);
+    for(u32 i = frames[frame_index].keyframe_index;
+            i <= frame_index;
+            ++i)
+    {
+        xor_time_machine_words(state, state_word_count, payload + frames[i].offset, frames[i].word_count);
+    }
+}
+
+// NOTE(gh) Whether any of the recorded frames has a word inside [first_word, one_past_last_word)
+internal b32
+is_time_machine_word_range_in_use(TimeMachine *time_machine, u32 first_word, u32 one_past_last_word)
+{
+    b32 result = false;
+    for(u32 frame_index = 0;
+            frame_index < time_machine->frame_count;
+            ++frame_index)
+    {
+        TimeMachineFrame *frame = get_time_machine_frame(time_machine, frame_index);
+        if(frame->word_count > 0 && 
+           frame->offset < one_past_last_word && 
+           first_word < frame->offset + frame->word_count)
+        {
+            result = true;
+            break;
+        }
+    }
+
+    return result;
+}
+
+/*
+   NOTE(gh) Each chunk of the game state is encoded by the thread work queue into encode_data.
+   All the encoding should be done before the simulation starts touching the game state again,
+   so this waits for the queue.
+*/
+internal u32
+encode_time_machine_frame(TimeMachine *time_machine, void *state, ThreadWorkQueue *thread_work_queue, b32 is_keyframe)
+{
+    for(u32 chunk_index = 0;
+            chunk_index < time_machine->chunk_count;
+            ++chunk_index)
+    {
+        ThreadTimeMachineEncodeData *d = time_machine->encode_data + chunk_index;
+        d->current = (u64 *)state;
+        d->reference = time_machine->cursor_state;
+        d->is_keyframe = is_keyframe;
+
+        thread_work_queue->add_thread_work_queue_item(thread_work_queue, thread_time_machine_encode_callback, 0, (void *)d);
+    }
+    thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
+
+    u32 result = 0;
+    for(u32 chunk_index = 0;
+            chunk_index < time_machine->chunk_count;
+            ++chunk_index)
+    {
+        result += time_machine->encode_data[chunk_index].output_word_count;
+    }
+    assert(result <= time_machine->max_word_count);
+
+    return result;
+}
+
+// NOTE(gh) Evicts the oldest frames until the new frame fits, both in the frame ring and in the word ring
+internal void
+make_room_for_time_machine_frame(TimeMachine *time_machine, u32 word_count)
+{
+    if(time_machine->write_word + word_count > time_machine->max_word_count)
+    {
+        // NOTE(gh) Frames that start after the write position are left over from the last lap,
+        // and are older than every frame in [0, write_word). Only checking the oldest frame against the new range
+        // would let the new frame run over the live frames behind a leftover that happens not to overlap it.
+        while(time_machine->frame_count > 0 &&
+              get_time_machine_frame(time_machine, 0)->offset >= time_machine->write_word)
+        {
+            evict_oldest_time_machine_frames(time_machine);
+        }
+
+        time_machine->write_word = 0;
+    }
+    u32 one_past_last_word = time_machine->write_word + word_count;
+
+    while(time_machine->frame_count > 0)
+    {
+        TimeMachineFrame *oldest = get_time_machine_frame(time_machine, 0);
+        b32 overlaps = (oldest->word_count > 0 && word_count > 0 &&
+                        oldest->offset < one_past_last_word &&
+                        time_machine->write_word < oldest->offset + oldest->word_count);
+        if(time_machine->frame_count < time_machine->max_frame_count && !overlaps)
+        {
+            break;
+        }
+
+        evict_oldest_time_machine_frames(time_machine);
+    }
+#if HB_SLOW
+    assert(!is_time_machine_word_range_in_use(time_machine, time_machine->write_word, one_past_last_word));
+#endif
+}
+
+internal void
+record_time_machine_frame(TimeMachine *time_machine, void *state, ThreadWorkQueue *thread_work_queue)
+{
+    // NOTE(gh) Reference needs to be the previous frame, which might not be true if the user has been looking at other frames
+    b32 is_keyframe = (time_machine->frame_count == 0 ||
+                       time_machine->frames_since_keyframe + 1 >= time_machine_keyframe_interval ||
+                       !time_machine->is_cursor_valid ||
+                       time_machine->cursor_frame != time_machine->frame_count - 1);
+
+    u32 word_count = encode_time_machine_frame(time_machine, state, thread_work_queue, is_keyframe);
+    make_room_for_time_machine_frame(time_machine, word_count);
+    if(!is_keyframe && 
+       (time_machine->frame_count == 0 || !time_machine->is_cursor_valid))
+    {
+        // NOTE(gh) Making room evicted the frame that the delta was against(i.e the ring only had one keyframe group),
+        // so this frame has to be a keyframe after all. Keyframe doesn't look at the reference, so encoding again is fine.
+        is_keyframe = true;
+        word_count = encode_time_machine_frame(time_machine, state, thread_work_queue, is_keyframe);
+        make_room_for_time_machine_frame(time_machine, word_count);
+    }
+    u32 one_past_last_word = time_machine->write_word + word_count;
+
+    if(is_keyframe)
+    {
+        time_machine->frames_since_keyframe = 0;
+    }
+    else
+    {
+        time_machine->frames_since_keyframe++;
+    }
+
+    time_machine->frame_count++;
+    TimeMachineFrame *frame = get_time_machine_frame(time_machine, time_machine->frame_count - 1);
+    frame->offset = time_machine->write_word;
+    frame->word_count = word_count;
+    frame->is_keyframe = is_keyframe;
+
+    u64 *dest = time_machine->words + time_machine->write_word;
+    for(u32 chunk_index = 0;
+            chunk_index < time_machine->chunk_count;
+            ++chunk_index)
+    {
+        ThreadTimeMachineEncodeData *d = time_machine->encode_data + chunk_index;
+        memcpy(dest, d->output, sizeof(u64)*d->output_word_count);
+        dest += d->output_word_count;
+    }
+    time_machine->write_word = one_past_last_word;
+
+    // NOTE(gh) Encoding has turned the reference into this frame
+    time_machine->cursor_frame = time_machine->frame_count - 1;
+    time_machine->is_cursor_valid = true;
+#if HB_SLOW
+    assert(get_time_machine_frame(time_machine, 0)->is_keyframe);
+#endif
+
+    if(time_machine->is_streaming)
+    {
+        append_time_machine_stream_frame(time_machine, frame, state);
+    }
+}
+
+/*
+   NOTE(gh) Moves the cursor state to the frame, by XORing the deltas in between
+   if we can walk there without crossing a keyframe, or by starting from the closest keyframe.
+*/
+internal void
+seek_time_machine(TimeMachine *time_machine, u32 frame_index)
+{
+    assert(frame_index < time_machine->frame_count);
+
+    u32 keyframe_index = frame_index;
+    while(!get_time_machine_frame(time_machine, keyframe_index)->is_keyframe)
+    {
+        // NOTE(gh) The oldest frame is always a keyframe, so this can't go below 0
+        keyframe_index--;
+    }
+
+    if(time_machine->is_cursor_valid &&
+       time_machine->cursor_frame >= keyframe_index &&
+       time_machine->cursor_frame <= frame_index)
+    {
+        // NOTE(gh) Walk forward, nothing to do if we are already there
+    }
+    else
+    {
+        b32 can_walk_backward = false;
+        if(time_machine->is_cursor_valid &&
+           time_machine->cursor_frame > frame_index)
+        {
+            // NOTE(gh) XORing a keyframe doesn't bring back the previous frame
+            can_walk_backward = true;
+            for(u32 i = frame_index + 1;
+                    i <= time_machine->cursor_frame;
+                    ++i)
+            {
+                if(get_time_machine_frame(time_machine, i)->is_keyframe)
+                {
+                    can_walk_backward = false;
+                    break;
+                }
+            }
+        }
+
+        if(can_walk_backward)
+        {
+            while(time_machine->cursor_frame > frame_index)
+            {
+                apply_time_machine_frame(time_machine, get_time_machine_frame(time_machine, time_machine->cursor_frame));
+                time_machine->cursor_frame--;
+            }
+        }
+        else
+        {
+            zero_memory(time_machine->cursor_state, sizeof(u64)*time_machine->state_word_count);
+            apply_time_machine_frame(time_machine, get_time_machine_frame(time_machine, keyframe_index));
+            time_machine->cursor_frame = keyframe_index;
+            time_machine->is_cursor_valid = true;
+        }
+    }
+
+    while(time_machine->cursor_frame < frame_index)
+    {
+        time_machine->cursor_frame++;
+        apply_time_machine_frame(time_machine, get_time_machine_frame(time_machine, time_machine->cursor_frame));
+    }
+}
+
+internal void
+load_time_machine_frame(TimeMachine *time_machine, u32 frame_index, void *state_to_populate)
+{
+    seek_time_machine(time_machine, frame_index);
+    memcpy(state_to_populate, time_machine->cursor_state, sizeof(u64)*time_machine->state_word_count);
+}
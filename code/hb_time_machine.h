@@ -0,0 +1,142 @@
+/*
+ * Written by Gyuhyun Lee
+ */
+
+#ifndef HB_TIME_MACHINE_H
+#define HB_TIME_MACHINE_H
+
+// NOTE(gh) Every this much frames, the frame is stored as a whole instead of the delta,
+// so that we can jump to any frame without replaying the whole history.
+#define time_machine_keyframe_interval 60
+// NOTE(gh) Game state is divided into the chunks of this many words, and each chunk is encoded by a thread
+#define time_machine_chunk_word_count 8192
+
+struct TimeMachineFrame
+{
+    // NOTE(gh) In u64 words, inside the encoded word buffer
+    u32 offset;
+    u32 word_count;
+
+    // NOTE(gh) Keyframe is encoded against the zero state, and others against the previous frame
+    b32 is_keyframe;
+};
+
+struct ThreadTimeMachineEncodeData
+{
+    u64 *current;
+    u64 *reference;
+    u32 first_word;
+    u32 one_past_last_word;
+    b32 is_keyframe;
+
+    // NOTE(gh) Worst case is one header per two words, so this should have room for 2*word count
+    u64 *output;
+    u32 output_word_count;
+};
+
+/*
+   NOTE(gh) The time machine can also stream the frames to a file(see start_time_machine_stream), 
+   so that we can replay what happened after the game is gone(see hb_replay.cpp).
+   The file is laid out as
+   -------------------------------------------------------------------------------
+    TimeMachineStreamHeader
+    TimeMachineStreamFrame x max_frame_count
+    encoded frames(same encoding as the time machine), and the environment 
+   -------------------------------------------------------------------------------
+   Every frame knows where its keyframe is, so any frame can be found in O(1) and 
+   rebuilt with at most time_machine_keyframe_interval frames of XOR.
+
+   The game state has pointers inside, which are only valid in the process that wrote the stream.
+   The reader should relocate them using state_address, and point the environment colliders 
+   (which live outside of the game state and never change) to the copy inside the stream.
+*/
+#define time_machine_stream_magic 0x4d544248 // 'HBTM'
+#define time_machine_stream_version 1
+
+struct TimeMachineStreamHeader
+{
+    u32 magic;
+    u32 version;
+
+    u32 state_size; // Should match with sizeof(GameState) of whoever is reading this
+    f32 dt_per_frame;
+
+    u32 max_frame_count;
+    // NOTE(gh) Updated after the frame has been written, so the frames below this are always complete
+    u32 frame_count;
+
+    u64 payload_offset; // In bytes, from the start of the file
+    u64 payload_word_count;
+    u64 max_payload_word_count;
+
+    u64 state_address; // Where the game state was in the process that wrote the stream
+    // NOTE(gh) In u64 words, from the payload. Word count is 0 if the environment was never written
+    u64 environment_offset;
+    u64 environment_word_count;
+};
+
+struct TimeMachineStreamFrame
+{
+    u64 offset; // In u64 words, from the payload
+    u32 word_count;
+
+    u32 keyframe_index; // Same as the frame index if this frame is a keyframe
+};
+
+struct TimeMachineStream
+{
+    PlatformMappedFile file;
+    platform_close_mapped_file *close_mapped_file;
+
+    TimeMachineStreamHeader *header;
+    TimeMachineStreamFrame *frames;
+    u64 *payload;
+
+    u32 last_keyframe_index;
+};
+
+/*
+   NOTE(gh) Instead of copying the whole game state every frame,
+   the time machine stores the XOR of the game state against the previous frame.
+   Most of the game state(empty entities, unused particles, resting bodies...) doesn't change between the frames,
+   so the delta is mostly zero and can be stored as the runs of the non-zero words.
+   Each run is a header word(start word index << 32 | run word count) followed by the XORed words.
+
+   Because XOR is its own inverse, applying the delta of frame n to frame n moves us back to frame n - 1,
+   and applying the delta of frame n + 1 moves us to frame n + 1, so stepping through the frames never needs a copy of the whole state.
+*/
+struct TimeMachine
+{
+    u32 state_word_count;
+
+    // NOTE(gh) Game state at the cursor frame.
+    // While recording, this is the last recorded frame, which is the reference of the next delta.
+    u64 *cursor_state;
+    u32 cursor_frame;
+    b32 is_cursor_valid;
+
+    // NOTE(gh) Ring buffer of the frames, index 0 being the oldest one that we still have.
+    // The oldest frame is always a keyframe.
+    TimeMachineFrame *frames;
+    u32 max_frame_count;
+    u32 first_frame;
+    u32 frame_count;
+    u32 frames_since_keyframe;
+
+    // NOTE(gh) Ring buffer of the encoded frames.
+    // Frame never wraps, we just start from the beginning if the frame doesn't fit at the end.
+    u64 *words;
+    u32 max_word_count;
+    u32 write_word;
+
+    ThreadTimeMachineEncodeData *encode_data;
+    u32 chunk_count;
+
+    // NOTE(gh) Where the user is looking at while the simulation is paused
+    u32 read_cursor;
+
+    b32 is_streaming;
+    TimeMachineStream stream;
+};
+
+#endif
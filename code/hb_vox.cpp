@@ -14,7 +14,7 @@
     -------------------------------------------------------------------------------
 */
 internal LoadedVOXResult
-load_vox(u8 *file, u32 file_size)
+load_vox(u8 *file, u32 file_size, MemoryArena *arena)
 {
     LoadedVOXResult result = {};
 
@@ -47,9 +47,9 @@ load_vox(u8 *file, u32 file_size)
             assert(children_chunk_content_size == 0);
 
             result.voxel_count = *(internal_current++);
-            result.xs = (u8 *)malloc(result.voxel_count);
-            result.ys = (u8 *)malloc(result.voxel_count);
-            result.zs = (u8 *)malloc(result.voxel_count);
+            result.xs = push_array(arena, u8, result.voxel_count);
+            result.ys = push_array(arena, u8, result.voxel_count);
+            result.zs = push_array(arena, u8, result.voxel_count);
             for(u32 voxel_index = 0;
                     voxel_index < result.voxel_count;
                     ++voxel_index)
@@ -73,3 +73,662 @@ load_vox(u8 *file, u32 file_size)
     return result;
 }
 
+/*
+   NOTE(gh) 1D squared euclidean distance transform of the samples f, 
+   which is the lower envelope of the parabolas rooted at each sample.
+   http://cs.brown.edu/people/pfelzens/papers/dt-final.pdf
+*/
+internal void
+distance_transform_1d(f32 *f, i32 count, i32 stride)
+{
+    f32 source[258];
+    i32 v[258];
+    f32 z[259];
+    assert(count <= array_count(source));
+
+    for(i32 i = 0;
+            i < count;
+            ++i)
+    {
+        source[i] = f[i*stride];
+    }
+
+    i32 k = 0;
+    v[0] = 0;
+    z[0] = -flt_max;
+    z[1] = flt_max;
+    for(i32 q = 1;
+            q < count;
+            ++q)
+    {
+        f32 s = ((source[q] + q*q) - (source[v[k]] + v[k]*v[k])) / (2.0f*(q - v[k]));
+        while(s <= z[k])
+        {
+            // NOTE(gh) The new parabola hides the last one, z[0] is -flt_max so this never goes below 0
+            k--;
+            s = ((source[q] + q*q) - (source[v[k]] + v[k]*v[k])) / (2.0f*(q - v[k]));
+        }
+
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = flt_max;
+    }
+
+    k = 0;
+    for(i32 q = 0;
+            q < count;
+            ++q)
+    {
+        while(z[k+1] < q)
+        {
+            k++;
+        }
+        f[q*stride] = square((f32)(q - v[k])) + source[v[k]];
+    }
+}
+
+internal
+THREAD_WORK_CALLBACK(thread_vox_distance_transform_callback)
+{
+    ThreadVOXDistanceTransformData *d = (ThreadVOXDistanceTransformData *)data;
+
+    i32 strides[3] = {1, d->dim[0], d->dim[0]*d->dim[1]};
+    // NOTE(gh) The remaining axis that is neither the transform axis nor the slice axis
+    u32 row_axis = 3 - d->axis - d->slice_axis;
+    for(i32 row = 0;
+            row < d->dim[row_axis];
+            ++row)
+    {
+        f32 *line = d->grid + d->slice*strides[d->slice_axis] + row*strides[row_axis];
+        distance_transform_1d(line, d->dim[d->axis], strides[d->axis]);
+    }
+}
+
+/*
+   NOTE(gh) Computes the signed distance of each voxel to the surface of the vox,
+   using the separable euclidean distance transform on a grid padded by one empty cell
+   so that the outside of the vox counts as empty.
+   Each pass runs the 1D transform along one axis, and every line of a pass is independent, 
+   so the pass is divided into the slices and thrown into the thread work queue.
+
+   The surface lies halfway between the filled voxel and the empty voxel, 
+   so sdf = -(distance to the closest empty voxel - 0.5)
+*/
+internal void
+compute_vox_sdf(LoadedVOXResult *loaded_vox, MemoryArena *arena, ThreadWorkQueue *thread_work_queue)
+{
+    i32 dim[3] = {loaded_vox->x_count + 2, loaded_vox->y_count + 2, loaded_vox->z_count + 2};
+    i32 total_cell_count = dim[0]*dim[1]*dim[2];
+
+    // NOTE(gh) The results are pushed before the grid, which only lives inside this function
+    loaded_vox->sdf_values = push_array(arena, f32, loaded_vox->voxel_count);
+    loaded_vox->sdf_normals = push_array(arena, v3, loaded_vox->voxel_count);
+
+    // NOTE(gh) Slices are taken along z for the x and y pass, and along y for the z pass
+    u32 slice_axes[3] = {2, 2, 1};
+    i32 max_slice_count = maximum(dim[1], dim[2]);
+    TempMemory grid_memory = start_temp_memory(arena, 
+                                               sizeof(f32)*total_cell_count + 
+                                               sizeof(ThreadVOXDistanceTransformData)*max_slice_count, 
+                                               false);
+    f32 *grid = push_array(&grid_memory, f32, total_cell_count);
+    ThreadVOXDistanceTransformData *work_data = push_array(&grid_memory, ThreadVOXDistanceTransformData, max_slice_count);
+    for(i32 cell_index = 0;
+            cell_index < total_cell_count;
+            ++cell_index)
+    {
+        grid[cell_index] = 0.0f;
+    }
+
+    // NOTE(gh) Big enough to be treated as infinity, but small enough to not overflow while adding q^2
+    f32 infinity = 1.0e20f;
+    for(u32 voxel_index = 0;
+            voxel_index < loaded_vox->voxel_count;
+            ++voxel_index)
+    {
+        i32 x = loaded_vox->xs[voxel_index] + 1;
+        i32 y = loaded_vox->ys[voxel_index] + 1;
+        i32 z = loaded_vox->zs[voxel_index] + 1;
+        grid[z*dim[0]*dim[1] + y*dim[0] + x] = infinity;
+    }
+
+    for(u32 axis = 0;
+            axis < 3;
+            ++axis)
+    {
+        u32 slice_axis = slice_axes[axis];
+        for(i32 slice = 0;
+                slice < dim[slice_axis];
+                ++slice)
+        {
+            ThreadVOXDistanceTransformData *d = work_data + slice;
+            d->grid = grid;
+            d->dim[0] = dim[0];
+            d->dim[1] = dim[1];
+            d->dim[2] = dim[2];
+            d->axis = axis;
+            d->slice_axis = slice_axis;
+            d->slice = slice;
+
+            thread_work_queue->add_thread_work_queue_item(thread_work_queue, thread_vox_distance_transform_callback, 0, (void *)d);
+        }
+
+        // NOTE(gh) Next pass depends on the whole result of this pass
+        thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
+    }
+
+    for(i32 cell_index = 0;
+            cell_index < total_cell_count;
+            ++cell_index)
+    {
+        grid[cell_index] = sqrt(grid[cell_index]);
+    }
+
+    v3 center = 0.5f*V3((f32)(loaded_vox->x_count - 1), (f32)(loaded_vox->y_count - 1), (f32)(loaded_vox->z_count - 1));
+    for(u32 voxel_index = 0;
+            voxel_index < loaded_vox->voxel_count;
+            ++voxel_index)
+    {
+        i32 x = loaded_vox->xs[voxel_index] + 1;
+        i32 y = loaded_vox->ys[voxel_index] + 1;
+        i32 z = loaded_vox->zs[voxel_index] + 1;
+        i32 cell_index = z*dim[0]*dim[1] + y*dim[0] + x;
+
+        loaded_vox->sdf_values[voxel_index] = -(grid[cell_index] - 0.5f);
+
+        // NOTE(gh) The distance increases towards the inside, so the outward normal is the negative gradient
+        v3 gradient = 0.5f*V3(grid[cell_index + 1] - grid[cell_index - 1],
+                              grid[cell_index + dim[0]] - grid[cell_index - dim[0]],
+                              grid[cell_index + dim[0]*dim[1]] - grid[cell_index - dim[0]*dim[1]]);
+        v3 normal = -gradient;
+        if(length_square(normal) < 0.0001f)
+        {
+            // NOTE(gh) The gradient vanishes at the medial axis(i.e center of the cube), 
+            // so just point away from the center of the vox.
+            normal = V3((f32)(x - 1), (f32)(y - 1), (f32)(z - 1)) - center;
+            if(length_square(normal) < 0.0001f)
+            {
+                normal = V3(0, 0, 1);
+            }
+        }
+        loaded_vox->sdf_normals[voxel_index] = normalize(normal);
+    }
+
+    end_temp_memory(&grid_memory);
+}
+
+// NOTE(gh) Keeps the columns off the edges and the vertices that are aligned to the voxel grid, 
+// which would be hit by every triangle that shares them and flip the parity.
+#define voxelizer_column_offset_u 0.000137f
+#define voxelizer_column_offset_v 0.000291f
+#define voxelizer_max_crossing_count 256
+
+internal
+THREAD_WORK_CALLBACK(thread_vox_voxelize_callback)
+{
+    ThreadVOXVoxelizeData *d = (ThreadVOXVoxelizeData *)data;
+    VoxelizerTriangles *triangles = d->triangles;
+
+    u32 u_axis = (d->axis + 1)%3;
+    u32 v_axis = (d->axis + 2)%3;
+    i32 strides[3] = {1, d->dim[0], d->dim[0]*d->dim[1]};
+    i32 w_count = d->dim[d->axis];
+
+    simd_f32 zero = Simd_f32(0.0f);
+    simd_f32 one = Simd_f32(1.0f);
+    simd_f32 v = Simd_f32(d->row + 0.5f + voxelizer_column_offset_v);
+
+    f32 crossings[voxelizer_max_crossing_count];
+    for(i32 column = 0;
+            column < d->dim[u_axis];
+            ++column)
+    {
+        simd_f32 u = Simd_f32(column + 0.5f + voxelizer_column_offset_u);
+
+        u32 crossing_count = 0;
+        for(u32 triangle_index = d->first_triangle;
+                triangle_index < d->one_past_last_triangle;
+                triangle_index += HB_LANE_WIDTH)
+        {
+            simd_u32 hit_mask = compare_less_equal(Simd_f32(triangles->min_u + triangle_index), u) & 
+                                compare_less_equal(u, Simd_f32(triangles->max_u + triangle_index));
+            if(all_lanes_zero(hit_mask))
+            {
+                continue;
+            }
+
+            simd_f32 b0 = Simd_f32(triangles->b0_u + triangle_index)*u + 
+                          Simd_f32(triangles->b0_v + triangle_index)*v + 
+                          Simd_f32(triangles->b0_c + triangle_index);
+            simd_f32 b1 = Simd_f32(triangles->b1_u + triangle_index)*u + 
+                          Simd_f32(triangles->b1_v + triangle_index)*v + 
+                          Simd_f32(triangles->b1_c + triangle_index);
+            simd_f32 b2 = one - b0 - b1;
+            hit_mask = hit_mask & 
+                       compare_greater_equal(b0, zero) & 
+                       compare_greater_equal(b1, zero) & 
+                       compare_greater_equal(b2, zero);
+            if(all_lanes_zero(hit_mask))
+            {
+                continue;
+            }
+
+            simd_f32 w = b0*Simd_f32(triangles->w0 + triangle_index) + 
+                         b1*Simd_f32(triangles->w1 + triangle_index) + 
+                         b2*Simd_f32(triangles->w2 + triangle_index);
+
+            u32 lane_hits[HB_LANE_WIDTH];
+            f32 lane_ws[HB_LANE_WIDTH];
+            simd_u32_store(lane_hits, hit_mask);
+            simd_f32_store(lane_ws, w);
+            for(u32 lane = 0;
+                    lane < HB_LANE_WIDTH;
+                    ++lane)
+            {
+                if(lane_hits[lane])
+                {
+                    // NOTE(gh) Dropping a crossing would flip the parity of the rest of the column
+                    assert(crossing_count < voxelizer_max_crossing_count);
+                    crossings[crossing_count++] = lane_ws[lane];
+                }
+            }
+        }
+
+        // NOTE(gh) Odd number of crossings means the column went through a hole of the mesh,
+        // and there's no way to tell where the inside is. Leave it to the other axes.
+        if(crossing_count & 1)
+        {
+            continue;
+        }
+
+        // NOTE(gh) There are only a handful of crossings per column
+        for(u32 i = 1;
+                i < crossing_count;
+                ++i)
+        {
+            f32 crossing = crossings[i];
+            u32 j = i;
+            while(j > 0 && crossings[j - 1] > crossing)
+            {
+                crossings[j] = crossings[j - 1];
+                j--;
+            }
+            crossings[j] = crossing;
+        }
+
+        u8 *column_votes = d->votes + column*strides[u_axis] + d->row*strides[v_axis];
+        for(u32 crossing_index = 0;
+                crossing_index < crossing_count;
+                crossing_index += 2)
+        {
+            // NOTE(gh) Fill the cells whose center lies between the entering and the exiting crossing
+            i32 first = maximum(0, (i32)ceilf(crossings[crossing_index] - 0.5f));
+            i32 last = minimum(w_count - 1, (i32)floor_f32(crossings[crossing_index + 1] - 0.5f));
+            for(i32 w_index = first;
+                    w_index <= last;
+                    ++w_index)
+            {
+                column_votes[w_index*strides[d->axis]]++;
+            }
+        }
+    }
+}
+
+/*
+   NOTE(gh) Turns a triangle mesh into the voxels, so that we can spawn PBD entities from the meshes
+   the same way we do from the vox files(see add_pbd_vox_entity). 
+   resolution is the voxel count along the longest side of the mesh, and can't go over 256
+   because the voxel coordinates are stored in u8.
+
+   The voxel is inside when the column through the center of the voxel crosses the surface odd number of times before reaching it.
+   The columns are tested along all three axes and the voxel is filled when at least two of them agree,
+   so that a small hole in the scanned mesh(i.e stanford bunny) doesn't carve out the whole column.
+
+   For each axis, the triangles are set up HB_LANE_WIDTH at a time, binned to the rows they overlap,
+   and each row of columns is thrown into the thread work queue. 
+   The rows never touch the same voxel, so they don't need any synchronization.
+*/
+internal LoadedVOXResult
+voxelize_mesh(v3 *positions, u32 position_count, u32 *indices, u32 index_count, u32 resolution, 
+              MemoryArena *arena, ThreadWorkQueue *thread_work_queue)
+{
+    assert(position_count > 0 && index_count >= 3);
+    assert(resolution > 0 && resolution <= 256);
+
+    LoadedVOXResult result = {};
+
+    v3 min_p = positions[0];
+    v3 max_p = positions[0];
+    for(u32 position_index = 1;
+            position_index < position_count;
+            ++position_index)
+    {
+        v3 p = positions[position_index];
+        min_p = V3(minimum(min_p.x, p.x), minimum(min_p.y, p.y), minimum(min_p.z, p.z));
+        max_p = V3(maximum(max_p.x, p.x), maximum(max_p.y, p.y), maximum(max_p.z, p.z));
+    }
+    v3 extent = max_p - min_p;
+    f32 max_extent = maximum(maximum(extent.x, extent.y), extent.z);
+    assert(max_extent > 0.0f);
+    f32 scale = resolution/max_extent;
+
+    i32 dim[3];
+    for(u32 axis = 0;
+            axis < 3;
+            ++axis)
+    {
+        dim[axis] = clamp(1, (i32)ceilf(extent.e[axis]*scale), (i32)resolution);
+    }
+    i32 total_cell_count = dim[0]*dim[1]*dim[2];
+
+    // NOTE(gh) The votes are pushed before the scratch memory, 
+    // because they outlive it and become the xs of the result(see below).
+    u8 *votes = push_array(arena, u8, total_cell_count);
+    for(i32 cell_index = 0;
+            cell_index < total_cell_count;
+            ++cell_index)
+    {
+        votes[cell_index] = 0;
+    }
+
+    u32 triangle_count = index_count/3;
+    u32 padded_triangle_count = HB_LANE_WIDTH*((triangle_count + HB_LANE_WIDTH - 1)/HB_LANE_WIDTH);
+
+    TempMemory scratch_memory = start_temp_memory(arena, 
+                                                  sizeof(v3)*position_count + 
+                                                  sizeof(f32)*13*padded_triangle_count + 
+                                                  sizeof(ThreadVOXVoxelizeData)*resolution + 
+                                                  sizeof(u32)*(2*resolution + 1), 
+                                                  false);
+
+    v3 *voxel_positions = push_array(&scratch_memory, v3, position_count);
+    for(u32 position_index = 0;
+            position_index < position_count;
+            ++position_index)
+    {
+        voxel_positions[position_index] = scale*(positions[position_index] - min_p);
+    }
+
+    // NOTE(gh) Set up triangles in the mesh order, before binning them to the rows
+    VoxelizerTriangles setup = {};
+    setup.count = padded_triangle_count;
+    f32 *setup_memory = push_array(&scratch_memory, f32, 13*padded_triangle_count);
+    f32 **setup_arrays[] = {&setup.b0_u, &setup.b0_v, &setup.b0_c, &setup.b1_u, &setup.b1_v, &setup.b1_c,
+                            &setup.w0, &setup.w1, &setup.w2, &setup.min_u, &setup.max_u};
+    for(u32 array_index = 0;
+            array_index < array_count(setup_arrays);
+            ++array_index)
+    {
+        *setup_arrays[array_index] = setup_memory + array_index*padded_triangle_count;
+    }
+    f32 *setup_min_v = setup_memory + 11*padded_triangle_count;
+    f32 *setup_max_v = setup_memory + 12*padded_triangle_count;
+
+    ThreadVOXVoxelizeData *work_data = push_array(&scratch_memory, ThreadVOXVoxelizeData, resolution);
+    u32 *row_first_triangles = push_array(&scratch_memory, u32, (resolution + 1));
+    u32 *row_cursors = push_array(&scratch_memory, u32, resolution);
+
+    simd_f32 one = Simd_f32(1.0f);
+    simd_f32 degenerate_area_square = Simd_f32(1.0e-12f);
+    simd_f32 never_min = Simd_f32(1.0f);
+    simd_f32 never_max = Simd_f32(-1.0f);
+    for(u32 axis = 0;
+            axis < 3;
+            ++axis)
+    {
+        u32 u_axis = (axis + 1)%3;
+        u32 v_axis = (axis + 2)%3;
+        i32 row_count = dim[v_axis];
+
+        for(u32 triangle_index = 0;
+                triangle_index < padded_triangle_count;
+                triangle_index += HB_LANE_WIDTH)
+        {
+            // NOTE(gh) Padding triangles collapse to a point, and get culled as degenerate ones
+            f32 lane_p[3][3][HB_LANE_WIDTH] = {};
+            for(u32 lane = 0;
+                    lane < HB_LANE_WIDTH;
+                    ++lane)
+            {
+                if(triangle_index + lane < triangle_count)
+                {
+                    for(u32 vertex = 0;
+                            vertex < 3;
+                            ++vertex)
+                    {
+                        v3 p = voxel_positions[indices[3*(triangle_index + lane) + vertex]];
+                        lane_p[vertex][0][lane] = p.e[u_axis];
+                        lane_p[vertex][1][lane] = p.e[v_axis];
+                        lane_p[vertex][2][lane] = p.e[axis];
+                    }
+                }
+            }
+
+            simd_f32 p0u = Simd_f32(lane_p[0][0]);
+            simd_f32 p0v = Simd_f32(lane_p[0][1]);
+            simd_f32 p1u = Simd_f32(lane_p[1][0]);
+            simd_f32 p1v = Simd_f32(lane_p[1][1]);
+            simd_f32 p2u = Simd_f32(lane_p[2][0]);
+            simd_f32 p2v = Simd_f32(lane_p[2][1]);
+
+            // NOTE(gh) Twice the signed area of the projected triangle. 
+            // The barycentric coordinates are normalized by it, so the winding doesn't matter.
+            simd_f32 area = (p1u - p0u)*(p2v - p0v) - (p2u - p0u)*(p1v - p0v);
+            simd_u32 degenerate_mask = compare_less(area*area, degenerate_area_square);
+            simd_f32 inv_area = one/overwrite(area, degenerate_mask, one);
+
+            simd_f32_store(setup.b0_u + triangle_index, (p1v - p2v)*inv_area);
+            simd_f32_store(setup.b0_v + triangle_index, (p2u - p1u)*inv_area);
+            simd_f32_store(setup.b0_c + triangle_index, (p1u*p2v - p2u*p1v)*inv_area);
+            simd_f32_store(setup.b1_u + triangle_index, (p2v - p0v)*inv_area);
+            simd_f32_store(setup.b1_v + triangle_index, (p0u - p2u)*inv_area);
+            simd_f32_store(setup.b1_c + triangle_index, (p2u*p0v - p0u*p2v)*inv_area);
+            simd_f32_store(setup.w0 + triangle_index, Simd_f32(lane_p[0][2]));
+            simd_f32_store(setup.w1 + triangle_index, Simd_f32(lane_p[1][2]));
+            simd_f32_store(setup.w2 + triangle_index, Simd_f32(lane_p[2][2]));
+
+            simd_f32_store(setup.min_u + triangle_index, overwrite(min(min(p0u, p1u), p2u), degenerate_mask, never_min));
+            simd_f32_store(setup.max_u + triangle_index, overwrite(max(max(p0u, p1u), p2u), degenerate_mask, never_max));
+            simd_f32_store(setup_min_v + triangle_index, overwrite(min(min(p0v, p1v), p2v), degenerate_mask, never_min));
+            simd_f32_store(setup_max_v + triangle_index, overwrite(max(max(p0v, p1v), p2v), degenerate_mask, never_max));
+        }
+
+        // NOTE(gh) Count the triangles per row, padding each row to the lane width
+        for(i32 row = 0;
+                row < row_count;
+                ++row)
+        {
+            row_cursors[row] = 0;
+        }
+        for(u32 triangle_index = 0;
+                triangle_index < triangle_count;
+                ++triangle_index)
+        {
+            i32 first_row = maximum(0, (i32)ceilf(setup_min_v[triangle_index] - 0.5f - voxelizer_column_offset_v));
+            i32 last_row = minimum(row_count - 1, (i32)floor_f32(setup_max_v[triangle_index] - 0.5f - voxelizer_column_offset_v));
+            for(i32 row = first_row;
+                    row <= last_row;
+                    ++row)
+            {
+                row_cursors[row]++;
+            }
+        }
+        u32 binned_triangle_count = 0;
+        for(i32 row = 0;
+                row < row_count;
+                ++row)
+        {
+            row_first_triangles[row] = binned_triangle_count;
+            binned_triangle_count += HB_LANE_WIDTH*((row_cursors[row] + HB_LANE_WIDTH - 1)/HB_LANE_WIDTH);
+            row_cursors[row] = row_first_triangles[row];
+        }
+        row_first_triangles[row_count] = binned_triangle_count;
+
+        VoxelizerTriangles binned = {};
+        binned.count = binned_triangle_count;
+        u32 binned_memory_count = 11*maximum(binned_triangle_count, 1);
+        TempMemory binned_temp_memory = start_temp_memory(arena, sizeof(f32)*binned_memory_count, false);
+        f32 *binned_memory = push_array(&binned_temp_memory, f32, binned_memory_count);
+        f32 **binned_arrays[] = {&binned.b0_u, &binned.b0_v, &binned.b0_c, &binned.b1_u, &binned.b1_v, &binned.b1_c,
+                                 &binned.w0, &binned.w1, &binned.w2, &binned.min_u, &binned.max_u};
+        for(u32 array_index = 0;
+                array_index < array_count(binned_arrays);
+                ++array_index)
+        {
+            *binned_arrays[array_index] = binned_memory + array_index*binned_triangle_count;
+        }
+        for(u32 triangle_index = 0;
+                triangle_index < binned_triangle_count;
+                ++triangle_index)
+        {
+            binned.min_u[triangle_index] = 1.0f;
+            binned.max_u[triangle_index] = -1.0f;
+        }
+
+        for(u32 triangle_index = 0;
+                triangle_index < triangle_count;
+                ++triangle_index)
+        {
+            i32 first_row = maximum(0, (i32)ceilf(setup_min_v[triangle_index] - 0.5f - voxelizer_column_offset_v));
+            i32 last_row = minimum(row_count - 1, (i32)floor_f32(setup_max_v[triangle_index] - 0.5f - voxelizer_column_offset_v));
+            for(i32 row = first_row;
+                    row <= last_row;
+                    ++row)
+            {
+                u32 binned_index = row_cursors[row]++;
+                for(u32 array_index = 0;
+                        array_index < array_count(binned_arrays);
+                        ++array_index)
+                {
+                    (*binned_arrays[array_index])[binned_index] = (*setup_arrays[array_index])[triangle_index];
+                }
+            }
+        }
+
+        for(i32 row = 0;
+                row < row_count;
+                ++row)
+        {
+            if(row_first_triangles[row] != row_first_triangles[row + 1])
+            {
+                ThreadVOXVoxelizeData *d = work_data + row;
+                d->triangles = &binned;
+                d->first_triangle = row_first_triangles[row];
+                d->one_past_last_triangle = row_first_triangles[row + 1];
+                d->votes = votes;
+                d->dim[0] = dim[0];
+                d->dim[1] = dim[1];
+                d->dim[2] = dim[2];
+                d->axis = axis;
+                d->row = row;
+
+                thread_work_queue->add_thread_work_queue_item(thread_work_queue, thread_vox_voxelize_callback, 0, (void *)d);
+            }
+        }
+
+        // NOTE(gh) The binned triangles are only valid for this axis
+        thread_work_queue->complete_all_thread_work_queue_items(thread_work_queue, true);
+        end_temp_memory(&binned_temp_memory);
+    }
+
+    end_temp_memory(&scratch_memory);
+
+    result.x_count = dim[0];
+    result.y_count = dim[1];
+    result.z_count = dim[2];
+    for(i32 cell_index = 0;
+            cell_index < total_cell_count;
+            ++cell_index)
+    {
+        if(votes[cell_index] >= 2)
+        {
+            result.voxel_count++;
+        }
+    }
+
+    if(result.voxel_count == 0)
+    {
+        // NOTE(gh) The mesh is too thin for this resolution, 
+        // so fill the voxel at the center of the mesh to have a particle to spawn.
+        votes[(dim[2]/2)*dim[0]*dim[1] + (dim[1]/2)*dim[0] + dim[0]/2] = 2;
+        result.voxel_count = 1;
+    }
+
+    /*
+       NOTE(gh) The votes are compacted into the xs in place, 
+       which is fine because the voxel index never gets ahead of the cell index that we are reading.
+    */
+    result.xs = votes;
+    result.ys = push_array(arena, u8, result.voxel_count);
+    result.zs = push_array(arena, u8, result.voxel_count);
+
+    u32 voxel_index = 0;
+    for(i32 z = 0;
+            z < dim[2];
+            ++z)
+    {
+        for(i32 y = 0;
+                y < dim[1];
+                ++y)
+        {
+            for(i32 x = 0;
+                    x < dim[0];
+                    ++x)
+            {
+                if(votes[z*dim[0]*dim[1] + y*dim[0] + x] >= 2)
+                {
+                    result.xs[voxel_index] = (u8)x;
+                    result.ys[voxel_index] = (u8)y;
+                    result.zs[voxel_index] = (u8)z;
+                    voxel_index++;
+                }
+            }
+        }
+    }
+    assert(voxel_index == result.voxel_count);
+
+    return result;
+}
+
+/*
+   NOTE(gh) Voxelizes the obj file(see voxelize_mesh). 
+   The obj files we have are y-up, so they are rotated to be z-up like the rest of the game.
+*/
+internal LoadedVOXResult
+load_obj_vox(u8 *file, u32 file_size, u32 resolution, MemoryArena *arena, ThreadWorkQueue *thread_work_queue)
+{
+    PreParseObjResult pre_parse = pre_parse_obj(file, file_size);
+
+    // NOTE(gh) Not a temp memory of the arena, because voxelize_mesh pushes the result to it
+    v3 *positions = (v3 *)malloc(sizeof(v3)*pre_parse.position_count);
+    v3 *normals = (v3 *)malloc(sizeof(v3)*maximum(pre_parse.normal_count, 1));
+    u32 *indices = (u32 *)malloc(sizeof(u32)*pre_parse.index_count);
+    parse_obj(&pre_parse, file, file_size, positions, normals, 0, indices);
+
+    for(u32 position_index = 0;
+            position_index < pre_parse.position_count;
+            ++position_index)
+    {
+        v3 p = positions[position_index];
+        positions[position_index] = V3(p.x, -p.z, p.y);
+    }
+
+    // NOTE(gh) obj indices start from 1
+    for(u32 index = 0;
+            index < pre_parse.index_count;
+            ++index)
+    {
+        indices[index]--;
+    }
+
+    LoadedVOXResult result = voxelize_mesh(positions, pre_parse.position_count, 
+                                           indices, pre_parse.index_count, 
+                                           resolution, arena, thread_work_queue);
+
+    free(indices);
+    free(normals);
+    free(positions);
+
+    return result;
+}
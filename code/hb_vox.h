@@ -11,6 +11,75 @@ struct LoadedVOXResult
     u8 *xs;
     u8 *ys;
     u8 *zs;
+
+    // NOTE(gh) Signed distance field sampled at each voxel, in voxel unit(negative inside),
+    // and the outward normal of the surface that is closest to the voxel. See compute_vox_sdf.
+    f32 *sdf_values;
+    v3 *sdf_normals;
+
+    // NOTE(gh) Shape matching info shared by all PBD entities that were spawned from this vox.
+    // Offsets are populated when the vox is loaded(see populate_vox_offsets_from_com), 
+    // and inv_Aqq by the first add_pbd_vox_entity that needs it(see populate_vox_shape_matching_cache).
+    // Every voxel becomes a particle with the same mass, so the offsets don't depend on where we spawn the entity,
+    // and inv_Aqq only needs to be scaled by the inv mass of the particle.
+    v3d *offsets_from_com;
+    b32 is_linear_inv_Aqq_valid;
+    m3x3d unit_mass_linear_inv_Aqq;
+    b32 is_quadratic_inv_Aqq_valid;
+    m9x9d unit_mass_quadratic_inv_Aqq;
+};
+
+struct ThreadVOXDistanceTransformData
+{
+    f32 *grid; // squared distance to the closest empty cell
+    i32 dim[3];
+
+    u32 axis; // 1D transform runs along this axis
+    u32 slice_axis;
+    i32 slice;
+};
+
+/*
+   NOTE(gh) Triangles of the mesh that is being voxelized(see voxelize_mesh), in voxel space, 
+   set up for the parity test of the columns that run along one axis.
+   u and v are the remaining two axes, and the column at (u, v) hits the triangle when all of
+   b0 = b0_u*u + b0_v*v + b0_c
+   b1 = b1_u*u + b1_v*v + b1_c
+   b2 = 1 - b0 - b1
+   are non-negative, at w = b0*w0 + b1*w1 + b2*w2.
+   The triangles are binned to the rows(same v) they overlap, so a triangle can appear more than once.
+   Each row is padded to the lane width with triangles that never contain any column.
+*/
+struct VoxelizerTriangles
+{
+    u32 count;
+
+    f32 *b0_u;
+    f32 *b0_v;
+    f32 *b0_c;
+    f32 *b1_u;
+    f32 *b1_v;
+    f32 *b1_c;
+
+    f32 *w0;
+    f32 *w1;
+    f32 *w2;
+
+    f32 *min_u;
+    f32 *max_u;
+};
+
+struct ThreadVOXVoxelizeData
+{
+    VoxelizerTriangles *triangles;
+    u32 first_triangle; 
+    u32 one_past_last_triangle;
+
+    u8 *votes; // number of the axes that found the cell inside the mesh
+    i32 dim[3];
+
+    u32 axis; // columns run along this axis
+    i32 row; // v coordinate of the columns
 };
 
 #endif
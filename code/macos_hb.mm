@@ -8,6 +8,7 @@
 #import <mach/mach_time.h> // mach_absolute_time
 #import <stdio.h> // printf for debugging purpose
 #import <sys/stat.h>
+#import <sys/mman.h> // mmap
 #import <libkern/OSAtomic.h>
 #import <pthread.h>
 #import <semaphore.h>
@@ -39,6 +40,8 @@ global v2 last_mouse_p;
 global v2 mouse_diff;
 
 global b32 is_game_running;
+// NOTE(gh) Whenever we load the game code, so that we can tell whether the memory snapshot was written by this game code
+global time_t global_game_code_last_modified_time;
 
 // TODO(gh) temporary thing to remove render_group.cpp from the platform layer
 internal m4x4 
@@ -134,6 +137,238 @@ PLATFORM_FREE_FILE_MEMORY(debug_macos_free_file_memory)
     free(memory);
 }
 
+PLATFORM_OPEN_MAPPED_FILE(macos_open_mapped_file)
+{
+    PlatformMappedFile result = {};
+
+    int file = open(file_name, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU);
+    if(file >= 0)
+    {
+        // NOTE(gh) The file is sparse, so the pages that we never touch don't take any disk space
+        if(ftruncate(file, size) == 0)
+        {
+            void *memory = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, file, 0);
+            if(memory != MAP_FAILED)
+            {
+                result.memory = (u8 *)memory;
+                result.size = size;
+                result.platform_handle = (u64)file;
+            }
+        }
+
+        if(!result.memory)
+        {
+            // TODO(gh) : log
+            close(file);
+        }
+    }
+    else
+    {
+        // TODO(gh) :log
+        printf("Failed to create file\n");
+    }
+
+    return result;
+}
+
+PLATFORM_CLOSE_MAPPED_FILE(macos_close_mapped_file)
+{
+    if(file->memory)
+    {
+        int handle = (int)file->platform_handle;
+
+        msync(file->memory, size_to_keep, MS_SYNC);
+        munmap(file->memory, file->size);
+        ftruncate(handle, size_to_keep);
+        close(handle);
+
+        *file = {};
+    }
+}
+
+/*
+   NOTE(gh) Memory snapshot file is laid out as
+   -------------------------------------------------------------------------------
+    MacOSMemorySnapshotHeader
+    used part of the permanent memory
+    used part of the transient memory
+   -------------------------------------------------------------------------------
+   Every section starts at the multiple of macos_memory_snapshot_alignment, 
+   so that it can be mapped straight into the platform memory.
+*/
+#define macos_memory_snapshot_file_name "hb_memory.hbms"
+#define macos_memory_snapshot_magic 0x534d4248 // 'HBMS'
+#define macos_memory_snapshot_version 1
+// NOTE(gh) Should be a multiple of the page size(16KB on the apple silicon)
+#define macos_memory_snapshot_alignment kilobytes(64)
+
+struct MacOSMemorySnapshotHeader
+{
+    u32 magic;
+    u32 version;
+
+    // NOTE(gh) The memory should be at the same address with the same size, 
+    // and the game code should be the one that wrote the snapshot, 
+    // or the pointers & structs inside the snapshot don't mean anything.
+    u64 permanent_memory_address;
+    u64 permanent_memory_size;
+    u64 transient_memory_size;
+    time_t game_code_last_modified_time;
+
+    u64 permanent_memory_used;
+    u64 transient_memory_used;
+};
+
+internal u64
+macos_align_memory_snapshot_size(u64 size)
+{
+    u64 result = (size + macos_memory_snapshot_alignment - 1) & ~((u64)macos_memory_snapshot_alignment - 1);
+    return result;
+}
+
+/*
+   NOTE(gh) Most of the used memory is still zero(i.e the time machine that hasn't recorded much), 
+   so we skip the blocks that are all zero and leave the holes in the file, which are zero anyway.
+*/
+internal b32
+macos_write_memory_snapshot_section(int file, void *source, u64 size, u64 offset)
+{
+    b32 result = true;
+
+    u64 block_size = macos_memory_snapshot_alignment;
+    for(u64 block_offset = 0;
+            block_offset < size && result;
+            block_offset += block_size)
+    {
+        u8 *block = (u8 *)source + block_offset;
+        u64 size_to_write = minimum(block_size, size - block_offset);
+
+        b32 is_zero = true;
+        u64 *words = (u64 *)block;
+        for(u64 word_index = 0;
+                word_index < size_to_write/sizeof(u64);
+                ++word_index)
+        {
+            if(words[word_index])
+            {
+                is_zero = false;
+                break;
+            }
+        }
+        // NOTE(gh) Don't bother checking the tail
+        is_zero &= ((size_to_write % sizeof(u64)) == 0);
+
+        if(!is_zero)
+        {
+            result = (pwrite(file, block, size_to_write, offset + block_offset) == (ssize_t)size_to_write);
+        }
+    }
+
+    return result;
+}
+
+PLATFORM_WRITE_MEMORY_SNAPSHOT(macos_write_memory_snapshot)
+{
+    b32 result = false;
+
+    // NOTE(gh) The previous snapshot might still be mapped to the memory, 
+    // and the pages that we haven't written to are coming straight from the file.
+    // So we write to another file and replace the old one, which stays alive until we unmap it.
+    char temp_file_name[256];
+    snprintf(temp_file_name, array_count(temp_file_name), "%s.tmp", macos_memory_snapshot_file_name);
+
+    int file = open(temp_file_name, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU);
+    if(file >= 0)
+    {
+        MacOSMemorySnapshotHeader header = {};
+        header.magic = macos_memory_snapshot_magic;
+        header.version = macos_memory_snapshot_version;
+        header.permanent_memory_address = (u64)platform_memory->permanent_memory;
+        header.permanent_memory_size = platform_memory->permanent_memory_size;
+        header.transient_memory_size = platform_memory->transient_memory_size;
+        header.game_code_last_modified_time = global_game_code_last_modified_time;
+        header.permanent_memory_used = platform_memory->permanent_memory_used;
+        header.transient_memory_used = platform_memory->transient_memory_used;
+
+        u64 permanent_offset = macos_align_memory_snapshot_size(sizeof(header));
+        u64 transient_offset = permanent_offset + macos_align_memory_snapshot_size(header.permanent_memory_used);
+        u64 file_size = transient_offset + macos_align_memory_snapshot_size(header.transient_memory_used);
+
+        // NOTE(gh) ftruncate fills the file with zero, which is what the memory would look like anyway
+        if(ftruncate(file, file_size) == 0 &&
+           pwrite(file, &header, sizeof(header), 0) == sizeof(header) &&
+           macos_write_memory_snapshot_section(file, platform_memory->permanent_memory, header.permanent_memory_used, permanent_offset) &&
+           macos_write_memory_snapshot_section(file, platform_memory->transient_memory, header.transient_memory_used, transient_offset))
+        {
+            result = (rename(temp_file_name, macos_memory_snapshot_file_name) == 0);
+        }
+        close(file);
+
+        if(!result)
+        {
+            // TODO(gh) : log
+            unlink(temp_file_name);
+        }
+    }
+
+    return result;
+}
+
+/*
+   NOTE(gh) Maps the memory snapshot(if there is one that we can use) over the platform memory.
+   The pages are only read from the file when we touch them, 
+   and the pages that we write to become our own copy without touching the file.
+*/
+internal b32
+macos_map_memory_snapshot(PlatformMemory *platform_memory)
+{
+    b32 result = false;
+
+    int file = open(macos_memory_snapshot_file_name, O_RDONLY);
+    if(file >= 0)
+    {
+        MacOSMemorySnapshotHeader header = {};
+        if(pread(file, &header, sizeof(header), 0) == sizeof(header) &&
+           header.magic == macos_memory_snapshot_magic &&
+           header.version == macos_memory_snapshot_version &&
+           header.permanent_memory_address == (u64)platform_memory->permanent_memory &&
+           header.permanent_memory_size == platform_memory->permanent_memory_size &&
+           header.transient_memory_size == platform_memory->transient_memory_size &&
+           header.game_code_last_modified_time == global_game_code_last_modified_time)
+        {
+            u64 permanent_offset = macos_align_memory_snapshot_size(sizeof(header));
+            u64 permanent_size = macos_align_memory_snapshot_size(header.permanent_memory_used);
+            u64 transient_offset = permanent_offset + permanent_size;
+            u64 transient_size = macos_align_memory_snapshot_size(header.transient_memory_used);
+
+            void *permanent_memory = mmap(platform_memory->permanent_memory, permanent_size, 
+                                          PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, file, permanent_offset);
+            void *transient_memory = mmap(platform_memory->transient_memory, transient_size, 
+                                          PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, file, transient_offset);
+            if(permanent_memory == platform_memory->permanent_memory &&
+               transient_memory == platform_memory->transient_memory)
+            {
+                platform_memory->permanent_memory_used = header.permanent_memory_used;
+                platform_memory->transient_memory_used = header.transient_memory_used;
+                result = true;
+            }
+            else
+            {
+                // NOTE(gh) Put the fresh memory back, so that the game can start from the scratch
+                mmap(platform_memory->permanent_memory, permanent_size, 
+                     PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0);
+                mmap(platform_memory->transient_memory, transient_size, 
+                     PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0);
+            }
+        }
+
+        // NOTE(gh) Mapping stays valid after closing the file
+        close(file);
+    }
+
+    return result;
+}
+
 @interface 
 app_delegate : NSObject<NSApplicationDelegate>
 @end
@@ -158,6 +393,13 @@ app_delegate : NSObject<NSApplicationDelegate>
     [NSApp postEvent: event atStart: YES];
     [pool drain];
 }
+
+// NOTE(gh) terminate: exits right away, so let the main loop end instead to give the game a chance to shut down
+- (NSApplicationTerminateReply)applicationShouldTerminate:(NSApplication *)sender
+{
+    is_game_running = false;
+    return NSTerminateCancel;
+}
 @end
 
 internal CVReturn 
@@ -318,6 +560,10 @@ macos_handle_event(NSApplication *app, NSWindow *window, PlatformInput *platform
                         {
                             register_platform_key_input(platform_input, PlatformKeyID_Shoot, is_down);
                         }
+                        else if(key_code == kVK_F5)
+                        {
+                            register_platform_key_input(platform_input, PlatformKeyID_SaveMemorySnapshot, is_down);
+                        }
 
                         else if(key_code == kVK_Return)
                         {
@@ -1327,6 +1573,7 @@ struct MacOSGameCode
     void *library;
     time_t last_modified_time; // u32 bit integer
     UpdateAndRender *update_and_render;
+    ShutdownGame *shutdown_game;
 };
 
 internal void
@@ -1340,6 +1587,7 @@ macos_load_game_code(MacOSGameCode *game_code, char *file_name)
     {
         int error = dlclose(game_code->library);
         game_code->update_and_render = 0;
+        game_code->shutdown_game = 0;
         game_code->last_modified_time = 0;
         game_code->library = 0;
     }
@@ -1350,6 +1598,9 @@ macos_load_game_code(MacOSGameCode *game_code, char *file_name)
         game_code->library = library;
         game_code->last_modified_time = macos_get_last_modified_time(file_name);
         game_code->update_and_render = (UpdateAndRender *)dlsym(library, "update_and_render");
+        game_code->shutdown_game = (ShutdownGame *)dlsym(library, "shutdown_game");
+
+        global_game_code_last_modified_time = game_code->last_modified_time;
     }
 }
 
@@ -1378,18 +1629,40 @@ int main(void)
     platform_api.read_file = debug_macos_read_file;
     platform_api.write_entire_file = debug_macos_write_entire_file;
     platform_api.free_file_memory = debug_macos_free_file_memory;
+    platform_api.open_mapped_file = macos_open_mapped_file;
+    platform_api.close_mapped_file = macos_close_mapped_file;
 
     PlatformMemory platform_memory = {};
 
     platform_memory.permanent_memory_size = gigabytes(1);
     platform_memory.transient_memory_size = gigabytes(3);
     u64 total_size = platform_memory.permanent_memory_size + platform_memory.transient_memory_size;
-    vm_allocate(mach_task_self(), 
-                (vm_address_t *)&platform_memory.permanent_memory,
-                total_size, 
-                VM_FLAGS_ANYWHERE);
+
+    // NOTE(gh) Always try to put the memory at the same address, 
+    // so that the pointers inside the memory snapshot are still valid in the next launch.
+    platform_memory.permanent_memory = (void *)(terabytes(2));
+    if(vm_allocate(mach_task_self(), 
+                   (vm_address_t *)&platform_memory.permanent_memory,
+                   total_size, 
+                   VM_FLAGS_FIXED) == KERN_SUCCESS)
+    {
+        platform_api.write_memory_snapshot = macos_write_memory_snapshot;
+    }
+    else
+    {
+        platform_memory.permanent_memory = 0;
+        vm_allocate(mach_task_self(), 
+                    (vm_address_t *)&platform_memory.permanent_memory,
+                    total_size, 
+                    VM_FLAGS_ANYWHERE);
+    }
     platform_memory.transient_memory = (u8 *)platform_memory.permanent_memory + platform_memory.permanent_memory_size;
 
+    if(platform_api.write_memory_snapshot)
+    {
+        platform_memory.is_restored_from_memory_snapshot = macos_map_memory_snapshot(&platform_memory);
+    }
+
     // TODO(gh) get monitor width and height and use that 
 #if 1
     // 2.5k -ish
@@ -2046,6 +2319,12 @@ int main(void)
         }
     }
 
+    macos_complete_all_thread_work_queue_items(&thread_work_queue, true);
+    if(macos_game_code.shutdown_game)
+    {
+        macos_game_code.shutdown_game(&platform_memory);
+    }
+
     return 0;
 }
 